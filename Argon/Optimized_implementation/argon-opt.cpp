@@ -0,0 +1,712 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+//Optimized Argon: same output as Reference_implementation/argon-ref.cpp.
+//AES_reduced uses AES-NI when available (__AES__, or any MSVC build), otherwise a
+//table-free constant-time fallback. Define ARGON_NO_AESNI to force the fallback.
+
+#define MAX_THREADS 32
+#define MAX_OUTLEN 32
+#define MIN_MEMORY 1
+#define MAX_MEMORY (1<<26)
+#define MIN_TIME 1
+#define LENGTH_SIZE 4
+#define MIN_PASSWORD 0
+#define MAX_PASSWORD 256
+#define MAX_SALT  32
+#define MAX_SECRET 16
+#define INPUT_SIZE (INPUT_BLOCKS*12)
+#define INPUT_BLOCKS 32
+#define GROUP_SIZE 32
+#define SLICES 32
+#define CACHE_LINE_BLOCKS 4 //int128 blocks per 64-byte cache line
+#define MIN_PARALLEL_MEMORY 1024 //KBytes; smaller m_cost is not worth waking threads for
+#define SLICE_MAJOR_MEMORY 16384 //KBytes; PHS uses the slice-major Layout from here up, see Benchmark()
+
+#define AES_ROUNDS 5
+
+#define u32 unsigned int
+#define u64 unsigned long long int
+
+#if (defined(__AES__) || defined(_MSC_VER)) && !defined(ARGON_NO_AESNI)
+#define ARGON_AESNI
+#endif
+
+#define KAT
+#define _MEASURE
+//#define KATINT
+
+u64 subkeys64[11][2]=
+	{{0x0706050403020100, 0x0f0e0d0c0b0a0908},
+{0xfa72afd2fd74aad6, 0xfe76abd6f178a6da},
+{0xf1bd3d640bcf92b6, 0xfeb3306800c59bbe},
+{0xbfc9c2d24e74ffb6, 0x41bf6904bf0c596c},
+{0x033e3595bcf7f747, 0xfd8d05fdbc326cf9},
+{0xeb9d9fa9e8a3aa3c, 0xaa22f6ad57aff350},
+{0x9692a6f77d0f395e, 0x6b1fa30ac13d55a7},
+{0x8ce25fe31a70f914, 0x26c0a94e4ddf0a44},
+{0xb9651ca435874347, 0xd27abfaef4ba16e0},
+{0x685785f0d1329954, 0x4e972cbe9ced9310},
+{0x174a94e37f1d1113, 0xc5302b4d8ba707f3}};
+
+typedef __m128i int128;
+
+#define LOAD_SUBKEY(r) _mm_set_epi64x((long long)subkeys64[r][1],(long long)subkeys64[r][0])
+
+#ifdef ARGON_AESNI
+
+//The first AddRoundKey plus AES_ROUNDS full AES rounds, which is exactly AESENC.
+//Blocks are processed 8 at a time so that the AESENC latency is hidden.
+void AES_reduced_n(int128* x, unsigned n)
+{
+	const int128 k0 = LOAD_SUBKEY(0), k1 = LOAD_SUBKEY(1), k2 = LOAD_SUBKEY(2),
+		k3 = LOAD_SUBKEY(3), k4 = LOAD_SUBKEY(4), k5 = LOAD_SUBKEY(5);
+	unsigned i=0;
+	for(; i+8<=n; i+=8)
+	{
+		int128 y0 = _mm_xor_si128(x[i+0],k0), y1 = _mm_xor_si128(x[i+1],k0);
+		int128 y2 = _mm_xor_si128(x[i+2],k0), y3 = _mm_xor_si128(x[i+3],k0);
+		int128 y4 = _mm_xor_si128(x[i+4],k0), y5 = _mm_xor_si128(x[i+5],k0);
+		int128 y6 = _mm_xor_si128(x[i+6],k0), y7 = _mm_xor_si128(x[i+7],k0);
+#define ROUND8(k) \
+		y0 = _mm_aesenc_si128(y0,k); y1 = _mm_aesenc_si128(y1,k); \
+		y2 = _mm_aesenc_si128(y2,k); y3 = _mm_aesenc_si128(y3,k); \
+		y4 = _mm_aesenc_si128(y4,k); y5 = _mm_aesenc_si128(y5,k); \
+		y6 = _mm_aesenc_si128(y6,k); y7 = _mm_aesenc_si128(y7,k);
+		ROUND8(k1) ROUND8(k2) ROUND8(k3) ROUND8(k4) ROUND8(k5)
+#undef ROUND8
+		x[i+0] = y0; x[i+1] = y1; x[i+2] = y2; x[i+3] = y3;
+		x[i+4] = y4; x[i+5] = y5; x[i+6] = y6; x[i+7] = y7;
+	}
+	for(; i<n; ++i)
+	{
+		int128 y = _mm_xor_si128(x[i],k0);
+		y = _mm_aesenc_si128(y,k1);
+		y = _mm_aesenc_si128(y,k2);
+		y = _mm_aesenc_si128(y,k3);
+		y = _mm_aesenc_si128(y,k4);
+		x[i] = _mm_aesenc_si128(y,k5);
+	}
+}
+
+#else
+
+//Table-free constant-time AES. Each u64 holds 8 state bytes (two AES columns), and
+//all byte operations are done on the 8 bytes at once with shifts and masks, so no
+//memory access or branch depends on the data.
+
+#define BYTES(b) (0x0101010101010101ULL*(b))
+
+static inline u64 xtime8(u64 x)
+{
+	return ((x & BYTES(0x7f))<<1) ^ (((x>>7) & BYTES(0x01))*0x1b);
+}
+
+static inline u64 gmul8(u64 a, u64 b)
+{
+	u64 p = 0;
+	for(unsigned i=0; i<8; ++i)
+	{
+		p ^= a & (((b>>i) & BYTES(0x01))*0xff);
+		a = xtime8(a);
+	}
+	return p;
+}
+
+static inline u64 rotl8(u64 x, unsigned k)
+{
+	return ((x<<k) & BYTES((0xff<<k)&0xff)) | ((x>>(8-k)) & BYTES(0xff>>(8-k)));
+}
+
+static inline u64 SubBytes8(u64 x)
+{
+	//Inversion in GF(256) as x^254, then the AES affine map
+	u64 x2 = gmul8(x,x);
+	u64 x3 = gmul8(x2,x);
+	u64 x12 = gmul8(x3,x3);
+	x12 = gmul8(x12,x12);
+	u64 x15 = gmul8(x12,x3);
+	u64 x240 = x15;
+	for(unsigned i=0; i<4; ++i)
+		x240 = gmul8(x240,x240);
+	u64 inv = gmul8(gmul8(x240,x12),x2);
+	return inv ^ rotl8(inv,1) ^ rotl8(inv,2) ^ rotl8(inv,3) ^ rotl8(inv,4) ^ BYTES(0x63);
+}
+
+//Rotate each 32-bit column down by 8*k bits, so that row r receives row r+k.
+static inline u64 rotcol(u64 x, unsigned k)
+{
+	u64 lo = 0x00000000ffffffffULL >> (8*k);
+	lo |= lo<<32;
+	return ((x>>(8*k)) & lo) | ((x<<(32-8*k)) & ~lo);
+}
+
+static inline u64 MixColumns8(u64 x)
+{
+	u64 r1 = rotcol(x,1);
+	return xtime8(x ^ r1) ^ r1 ^ rotcol(x,2) ^ rotcol(x,3);
+}
+
+static inline void AES_Round(u64 &w0, u64 &w1, unsigned r) //SubBytes-ShiftRows-MixColumns-AddRoundKey
+{
+	unsigned char b[16], s[16];
+	w0 = SubBytes8(w0);
+	w1 = SubBytes8(w1);
+	memcpy(b,&w0,8);
+	memcpy(b+8,&w1,8);
+	for(unsigned c=0; c<4; ++c)
+		for(unsigned row=0; row<4; ++row)
+			s[4*c+row] = b[4*((c+row)&3)+row];
+	memcpy(&w0,s,8);
+	memcpy(&w1,s+8,8);
+	w0 = MixColumns8(w0) ^ subkeys64[r][0];
+	w1 = MixColumns8(w1) ^ subkeys64[r][1];
+}
+
+void AES_reduced_n(int128* x, unsigned n)
+{
+	for(unsigned i=0; i<n; ++i)
+	{
+		u64 w[2];
+		_mm_storeu_si128((int128*)w,x[i]);
+		w[0] ^= subkeys64[0][0];
+		w[1] ^= subkeys64[0][1];
+		for(unsigned r=1; r<=AES_ROUNDS; ++r)
+			AES_Round(w[0],w[1],r);
+		x[i] = _mm_loadu_si128((int128*)w);
+	}
+}
+
+#endif
+
+void AES_reduced(int128 &input)
+{
+	AES_reduced_n(&input,1);
+}
+
+#define XOR8(a,b,c,d,e,f,g,h) _mm_xor_si128(_mm_xor_si128(_mm_xor_si128(s[a],s[b]),_mm_xor_si128(s[c],s[d])), \
+	_mm_xor_si128(_mm_xor_si128(s[e],s[f]),_mm_xor_si128(s[g],s[h])))
+
+//Persistent worker threads. Run() splits [0,count) into chunks of chunk items and
+//returns once f has been called on all of them; the calling thread works too.
+class ThreadPool
+{
+public:
+	ThreadPool(unsigned threads): job(NULL), count(0), chunk(1), next(0), generation(0), busy(0), quit(false)
+	{
+		for(unsigned t=1; t<threads; ++t)
+			workers.push_back(thread(&ThreadPool::Worker,this));
+	}
+	~ThreadPool()
+	{
+		{
+			unique_lock<mutex> lock(m);
+			quit = true;
+		}
+		start.notify_all();
+		for(size_t t=0; t<workers.size(); ++t)
+			workers[t].join();
+	}
+	unsigned Threads() const {return (unsigned)workers.size()+1;}
+	void Run(unsigned n, unsigned c, const function<void(unsigned,unsigned)>& f)
+	{
+		lock_guard<mutex> one_job(run); //Concurrent hashes take turns
+		unique_lock<mutex> lock(m);
+		//A worker may still hold the previous job until it sees there is nothing left
+		done.wait(lock,[this]{return busy==0;});
+		job = &f;
+		count = n;
+		chunk = c;
+		next.store(0);
+		++generation;
+		lock.unlock();
+		start.notify_all();
+		Work(f);
+		lock.lock();
+		done.wait(lock,[this]{return busy==0;});
+		job = NULL;
+	}
+private:
+	void Work(const function<void(unsigned,unsigned)>& f)
+	{
+		for(unsigned i; (i = next.fetch_add(chunk)) < count; )
+			f(i,min(i+chunk,count));
+	}
+	void Worker()
+	{
+		unsigned long seen = 0;
+		unique_lock<mutex> lock(m);
+		for(;;)
+		{
+			start.wait(lock,[&]{return quit || generation!=seen;});
+			if(quit)
+				return;
+			//A worker waking after Run() has returned finds the job gone: skip that generation
+			seen = generation;
+			const function<void(unsigned,unsigned)>* f = job;
+			if(f==NULL)
+				continue;
+			++busy;
+			lock.unlock();
+			Work(*f);
+			lock.lock();
+			if(--busy==0)
+				done.notify_all();
+		}
+	}
+	vector<thread> workers;
+	mutex run, m;
+	condition_variable start, done;
+	const function<void(unsigned,unsigned)>* job;
+	unsigned count, chunk;
+	atomic<unsigned> next;
+	unsigned long generation;
+	unsigned busy;
+	bool quit;
+};
+
+//One pool per thread count, created on first use and kept for the life of the process.
+static ThreadPool* GetPool(unsigned threads)
+{
+	static mutex pools_mutex;
+	static ThreadPool* pools[MAX_THREADS+1];
+	lock_guard<mutex> lock(pools_mutex);
+	if(pools[threads]==NULL)
+		pools[threads] = new ThreadPool(threads);
+	return pools[threads];
+}
+
+//Runs f over [0,n) on the pool, or directly when single-threaded.
+static void ParallelFor(ThreadPool* pool, unsigned n, unsigned chunk, const function<void(unsigned,unsigned)>& f)
+{
+	if(pool==NULL)
+		f(0,n);
+	else
+		pool->Run(n,chunk,f);
+}
+
+//Where block i*32+s of the reference (row i, slice s) is kept. The flat layout is the
+//reference one. The slice-major layout stores each slice contiguously, so ShuffleSlices
+//walks memory sequentially instead of with a 512-byte stride, and SubGroups gathers a
+//row from 32 sequential streams instead.
+struct Layout
+{
+	bool slice_major;
+	size_t rows; //state_size/SLICES
+
+	size_t RowStart(size_t i) const {return slice_major? i : i*SLICES;}
+	size_t RowStride() const {return slice_major? rows : 1;}
+	size_t SliceStart(size_t s) const {return slice_major? s*rows : s;}
+	size_t SliceStride() const {return slice_major? 1 : SLICES;}
+	size_t Index(size_t l) const {return RowStart(l/SLICES) + (l%SLICES)*RowStride();}
+	size_t Logical(size_t p) const {return slice_major? (p%rows)*SLICES + p/rows : p;}
+};
+
+//Groups first to last-1 of 32 blocks each
+void SubGroupsRange(int128* state, const Layout& layout, unsigned first, unsigned last)
+{
+	size_t stride = layout.RowStride();
+	int128 row[GROUP_SIZE];
+	for(unsigned i=first; i<last; ++i)
+	{
+		int128* s = state+layout.RowStart(i);
+		if(stride!=1)
+		{
+			for(unsigned k=0; k<GROUP_SIZE; ++k)
+				row[k] = s[k*stride];
+			s = row;
+		}
+		//Computing X_i:
+		int128 X[16];
+		X[ 0] = XOR8( 3, 7,11,15,19,23,27,31);
+		X[ 1] = XOR8( 1, 3, 9,11,17,19,25,27);
+		X[ 2] = XOR8( 0, 2, 4, 6,16,18,20,22);
+		X[ 3] = XOR8( 1, 3, 5, 7, 9,11,13,15);
+		X[ 4] = XOR8( 6, 7,14,15,22,23,30,31);
+		X[ 5] = XOR8(10,11,14,15,26,27,30,31);
+		X[ 6] = XOR8(16,17,20,21,24,25,28,29);
+		X[ 7] = XOR8(12,13,14,15,28,29,30,31);
+		X[ 8] = XOR8( 4, 5, 6, 7,12,13,14,15);
+		X[ 9] = XOR8(16,17,18,19,20,21,22,23);
+		X[10] = XOR8( 1, 5, 9,13,17,21,25,29);
+		X[11] = XOR8( 2, 6,10,14,18,22,26,30);
+		X[12] = XOR8( 4, 5, 6, 7,20,21,22,23);
+		X[13] = XOR8( 8, 9,10,11,24,25,26,27);
+		X[14] = XOR8( 0, 1, 2, 3, 8, 9,10,11);
+		X[15] = XOR8( 0, 4, 8,12,16,20,24,28);
+
+		//The 16 F computations are independent, so they run side by side
+		AES_reduced_n(X,16);
+		for(unsigned j=0; j<16;++j)
+		{
+			s[2*j] = _mm_xor_si128(s[2*j],X[j]); //XORs
+			s[2*j+1] = _mm_xor_si128(s[2*j+1],X[j]);
+		}
+		AES_reduced_n(s,GROUP_SIZE);
+		if(stride!=1)
+		{
+			for(unsigned k=0; k<GROUP_SIZE; ++k)
+				state[layout.RowStart(i)+k*stride] = row[k];
+		}
+	}
+}
+
+#undef XOR8
+
+void SubGroups(int128* state, const Layout& layout, ThreadPool* pool)
+{
+	unsigned groups = (unsigned)layout.rows;
+	unsigned chunk = pool? max(1u,groups/(8*pool->Threads())) : groups;
+	ParallelFor(pool,groups,chunk,[state,&layout](unsigned first, unsigned last){SubGroupsRange(state,layout,first,last);});
+}
+
+//Slices first to last-1. Each slice is shuffled independently of the others.
+void ShuffleSlicesRange(int128* state, const Layout& layout, unsigned first, unsigned last)
+{
+	size_t rows = layout.rows, stride = layout.SliceStride();
+	for(unsigned s=first; s<last; ++s) //Loop on slices
+	{
+		int128* slice = state+layout.SliceStart(s);
+		size_t j=0;
+		for(size_t i=0; i<rows; ++i)
+		{
+			//j <- j+ S[i]
+			//Swap(S[i],S[j])
+			int128 v1 = slice[i*stride];
+			j = (j+ (u32)_mm_cvtsi128_si32(v1))%rows;
+			slice[i*stride] = slice[j*stride];
+			slice[j*stride] = v1;
+		}
+	}
+}
+
+void ShuffleSlices(int128* state, const Layout& layout, ThreadPool* pool)
+{
+	//In the flat layout neighbouring slices share cache lines, so each thread takes whole lines of them
+	ParallelFor(pool,SLICES,CACHE_LINE_BLOCKS,[state,&layout](unsigned first, unsigned last){ShuffleSlicesRange(state,layout,first,last);});
+}
+
+static void StoreBytes(unsigned char* out, int128 x, unsigned len)
+{
+	unsigned char tmp[16];
+	_mm_storeu_si128((int128*)tmp,x);
+	memcpy(out,tmp,len);
+}
+
+#ifdef KATINT
+//Blocks are printed in the order of the reference, whatever the layout
+static void PrintBlocks(FILE* fp, int128* state, const Layout& layout, unsigned state_size)
+{
+	if(fp==NULL)
+		return;
+	for(unsigned i=0; i<state_size; ++i)
+	{
+		u64 w[2];
+		_mm_storeu_si128((int128*)w,state[layout.Index(i)]);
+		fprintf(fp,"Block %3.3d: H: %.16llx L: %.16llx",i,w[1],w[0]);
+		fprintf(fp,"\n");
+	}
+	fprintf(fp,"\n");
+}
+#endif
+
+#ifdef KAT
+static bool kat_log = true; //Benchmark() turns this off
+#endif
+
+//threads: 0 picks one per core for m_cost of at least MIN_PARALLEL_MEMORY, 1 runs single-threaded.
+//slice_major selects the internal Layout; the output is the same either way.
+int ArgonOpt(void *out, size_t outlen, const void *in, size_t inlen, const void *salt, size_t saltlen, const void *secret, size_t secretlen, unsigned int t_cost, unsigned int m_cost, unsigned int threads, bool slice_major)
+{
+	int128* state;  //Array A of blocks
+
+	//0. Restricting parameters
+	//maximum outlen=32
+	if(outlen>MAX_OUTLEN)
+		outlen=MAX_OUTLEN;
+
+	//minumum m_cost =1
+	if(m_cost<MIN_MEMORY)
+		m_cost = MIN_MEMORY;
+	if(m_cost>MAX_MEMORY)
+		m_cost = MAX_MEMORY;
+
+	//minimum t_cost =3
+	if(t_cost<MIN_TIME)
+		t_cost = MIN_TIME;
+
+	if(inlen> MAX_PASSWORD)
+		inlen = MAX_PASSWORD;
+	if(saltlen> MAX_SALT)
+		saltlen = MAX_SALT;
+#ifdef KAT
+	FILE* fp = kat_log? fopen("kat.log","a+") : NULL;
+	if(fp)
+	{
+		fprintf(fp,"=======================================\n");
+		fprintf(fp,"Iterations: %d, Memory: %d KBytes, Tag length: %d bytes\n", t_cost, m_cost,(int)outlen);
+		fprintf(fp,"Password: ");
+		for(unsigned i=0; i<inlen; ++i)
+			fprintf(fp,"%2.2x ",((unsigned char*)in)[i]);
+		fprintf(fp,"\n");
+		fprintf(fp,"Salt: ");
+		for(unsigned i=0; i<saltlen; ++i)
+			fprintf(fp,"%2.2x ",((unsigned char*)salt)[i]);
+		fprintf(fp,"\n");
+	}
+#endif
+
+	//1. Preparing input string I: lengths, t_cost, m_cost and outlen, then password, salt and secret
+	unsigned char Input[INPUT_SIZE];
+	memset(Input,0,INPUT_SIZE);
+	unsigned params[6] = {(unsigned)inlen, (unsigned)saltlen, (unsigned)secretlen, t_cost, m_cost, (unsigned)outlen};
+	for(unsigned p=0; p<6; ++p)
+		for(unsigned i=0; i<LENGTH_SIZE; ++i)
+			Input[i+p*LENGTH_SIZE] = (params[p]>>(8*i))&0xff;  //Little endian encoding
+	memcpy(Input+6*LENGTH_SIZE,in,inlen);
+	memcpy(Input+6*LENGTH_SIZE+inlen,salt,saltlen);
+	//The reference places secret byte i at offset i+6*LENGTH_SIZE+inlen+saltlen+i
+	for(unsigned i=0; i<secretlen; ++i)
+		Input[i+6*LENGTH_SIZE+inlen+saltlen+i] =((unsigned char*)secret)[i];
+#ifdef KATINT
+	if(fp)
+	{
+		fprintf(fp,"Input string:\n");
+		for(unsigned i=0; i<INPUT_SIZE; ++i)
+		{
+			fprintf(fp,"%2.2x ",Input[i]);
+			if(i%30==29)
+				fprintf(fp,"\n");
+		}
+		fprintf(fp,"\n");
+	}
+#endif
+
+	if(threads==0)
+		threads = m_cost>=MIN_PARALLEL_MEMORY? thread::hardware_concurrency() : 1;
+	if(threads>MAX_THREADS)
+		threads = MAX_THREADS;
+	ThreadPool* pool = threads>1? GetPool(threads) : NULL;
+
+	//2. Filling blocks
+	unsigned state_size = m_cost*64;
+	state = (int128*)_mm_malloc(state_size*sizeof(int128),64);
+	if(state==NULL)
+		return 1;
+	Layout layout;
+	layout.slice_major = slice_major;
+	layout.rows = state_size/SLICES;
+
+	for(unsigned p=0; p<state_size; ++p) //In memory order
+	{
+		unsigned i = (unsigned)layout.Logical(p);
+		//Input part
+		unsigned input_block_index = 12*(i%INPUT_BLOCKS); //Position where we take the input block
+		u64 i0=0, i1=0;
+		memcpy(&i0,Input+input_block_index,8);
+		memcpy(&i1,Input+input_block_index+8,4);
+		//Counter
+		i1 ^= ((u64)i)<<(32);
+		state[p] = _mm_set_epi64x((long long)i1,(long long)i0);
+	}
+	memset(Input,0,INPUT_SIZE);
+#ifdef KATINT
+	fprintf(fp,"Blocks:\n");
+	PrintBlocks(fp,state,layout,state_size);
+#endif
+
+	//3. Initial transformation
+	ParallelFor(pool,state_size/GROUP_SIZE,max(1u,state_size/GROUP_SIZE/(8*threads)),[state](unsigned first, unsigned last){
+		AES_reduced_n(state+first*GROUP_SIZE,(last-first)*GROUP_SIZE);});
+#ifdef KATINT
+	fprintf(fp,"Initial transformation:\nBlocks:\n");
+	PrintBlocks(fp,state,layout,state_size);
+#endif
+
+	//4. Rounds:
+	for(unsigned l=0; l <t_cost; ++l)
+	{
+		SubGroups(state,layout,pool);
+#ifdef KATINT
+		fprintf(fp,"Round %d SubGroups:\nBlocks:\n",l+1);
+		PrintBlocks(fp,state,layout,state_size);
+#endif
+		ShuffleSlices(state,layout,pool);
+#ifdef KATINT
+		fprintf(fp,"ShuffleSlices:\nBlocks:\n");
+		PrintBlocks(fp,state,layout,state_size);
+#endif
+	}
+
+	//5.Finalization
+	SubGroups(state,layout,pool);
+#ifdef KATINT
+	fprintf(fp,"Last round: SubGroups:\nBlocks:\n");
+	PrintBlocks(fp,state,layout,state_size);
+#endif
+
+	//a1 is the XOR of the first half of the blocks in reference order, a2 of the second
+	int128 a1 = _mm_setzero_si128();
+	int128 a2 = _mm_setzero_si128();
+	for(unsigned p=0; p<state_size; ++p)
+	{
+		if(layout.Logical(p) < state_size/2)
+			a1 = _mm_xor_si128(a1,state[p]);
+		else
+			a2 = _mm_xor_si128(a2,state[p]);
+	}
+	memset(state,0,state_size*sizeof(int128));
+	if(outlen<=16)
+	{
+		int128 tag = _mm_xor_si128(a1,a2);
+		for(unsigned r=0; r<4; ++r)
+			AES_reduced(tag);
+		tag = _mm_xor_si128(tag,_mm_xor_si128(a1,a2));
+		StoreBytes((unsigned char*)out,tag,outlen);
+	}
+	else
+	{
+		int128 tags[2] = {a1,a2};
+		for(unsigned r=0; r<4; ++r)
+			AES_reduced_n(tags,2);
+		StoreBytes((unsigned char*)out,_mm_xor_si128(tags[0],a1),16);
+		StoreBytes((unsigned char*)out+16,_mm_xor_si128(tags[1],a2),outlen-16);
+	}
+#ifdef KAT
+	if(fp)
+	{
+		fprintf(fp,"Tag: ");
+		for(unsigned i=0; i<outlen; ++i)
+			fprintf(fp,"%2.2x ",((unsigned char*)out)[i]);
+		fprintf(fp,"\n");
+		fclose(fp);
+	}
+#endif
+
+	_mm_free(state);
+	return 0;
+}
+
+int PHS(void *out, size_t outlen, const void *in, size_t inlen, const void *salt, size_t saltlen,
+	unsigned int t_cost, unsigned int m_cost)
+{
+	return ArgonOpt(out, outlen, in, inlen, salt, saltlen, NULL, 0, t_cost, m_cost, 0, m_cost>=SLICE_MAJOR_MEMORY);
+}
+
+//AES S-box, used as password input for the test vectors
+const static unsigned char sbox[256] =   {
+		0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+		0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+		0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+		0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+		0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+		0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+		0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+		0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+		0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+		0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+		0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+		0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+		0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+		0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+		0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+		0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 };
+
+void GenKat(unsigned outlen)
+{
+	unsigned char out[32];
+	unsigned t_cost = 3;
+	unsigned m_cost = 2;
+	unsigned char salt[32];
+	memcpy(salt,subkeys64[5],32);  //subkeys[5] and subkeys[6] of the reference
+#ifdef KAT
+	remove("kat.log");
+#endif
+	for(unsigned p_len=0; p_len<=256; p_len+=32)
+	{
+		for(unsigned s_len=8; s_len<=32; s_len+=8)
+		{
+#ifdef _MEASURE
+			u64 i2,i3,d2;
+			unsigned int ui2,ui3;
+#endif
+
+			outlen = s_len;
+#ifdef _MEASURE
+			clock_t start = clock();
+			i2 = __rdtscp(&ui2);
+#endif
+
+			PHS(out,outlen,sbox,p_len,salt,s_len,t_cost,m_cost);
+
+#ifdef _MEASURE
+			i3 = __rdtscp(&ui3);
+			clock_t finish = clock();
+
+			d2 = (i3-i2)/(m_cost);
+			float mcycles = (float)(i3-i2)/(1<<20);
+			printf("Argon Optimized:  %d iterations %2.2f cpb %2.2f Mcycles\n", t_cost, (float)d2/1000,mcycles);
+
+			float run_time = ((float)finish-start)/(CLOCKS_PER_SEC);
+			printf("%2.4f seconds\n", run_time);
+#endif
+		}
+	}
+}
+
+//Compares the two layouts for m_cost from 1 MiB up to max_m_cost KBytes, 4x per step.
+void Benchmark(unsigned max_m_cost, unsigned threads)
+{
+	unsigned char out[2][32];
+	unsigned t_cost = 3;
+#ifdef KAT
+	kat_log = false;
+#endif
+	printf("Argon Optimized, %u iterations, %u threads: MBytes/s (ms per hash)\n", t_cost, threads);
+	for(unsigned m_cost=1<<10; m_cost<=max_m_cost && m_cost<=MAX_MEMORY; m_cost<<=2)
+	{
+		double mbps[2], ms[2];
+		for(unsigned slice_major=0; slice_major<2; ++slice_major)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			if(ArgonOpt(out[slice_major],32,"password",8,"somesalt",8,NULL,0,t_cost,m_cost,threads,slice_major!=0))
+			{
+				printf("%u KBytes: out of memory\n", m_cost);
+				return;
+			}
+			ms[slice_major] = chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+			mbps[slice_major] = m_cost/1024.0/(ms[slice_major]/1000);
+		}
+		printf("%8u KBytes: flat %8.1f (%9.1f)  slice-major %8.1f (%9.1f)%s\n", m_cost,
+			mbps[0], ms[0], mbps[1], ms[1], memcmp(out[0],out[1],32)? "  TAG MISMATCH" : "");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	//argon-opt bench [max_m_cost [threads]]
+	if(argc>1 && !strcmp(argv[1],"bench"))
+		Benchmark(argc>2? atoi(argv[2]) : 1<<20, argc>3? atoi(argv[3]) : 1);
+	else
+		GenKat(32);
+}
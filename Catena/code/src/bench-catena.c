@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "catena.h"
+
+#define MIN_BENCH_GARLIC 14
+#define MAX_BENCH_GARLIC 24
+
+/* Each garlic is timed over about 2^REPS_GARLIC rows */
+#define REPS_GARLIC 20
+
+/* Client outputs per server relief run */
+#define SERVER_N (1 << 18)
+
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*******************************************************************/
+
+/* Catena_Server() one at a time against Catena_Server_many() */
+void bench_server(void)
+{
+  uint8_t *garlic = malloc(SERVER_N);
+  uint8_t *x = malloc((size_t) SERVER_N * H_LEN);
+  uint8_t *one = malloc((size_t) SERVER_N * H_LEN);
+  uint8_t *many = malloc((size_t) SERVER_N * H_LEN);
+  uint8_t *ok = malloc(SERVER_N);
+  uint32_t i, matches = 0;
+  double t_one, t_many, t_verify;
+
+  for (i = 0; i < SERVER_N; i++) garlic[i] = MIN_GARLIC + (i & 3);
+  for (i = 0; i < SERVER_N * H_LEN; i++) x[i] = i * 2654435761u >> 24;
+
+  t_one = now();
+  for (i = 0; i < SERVER_N; i++)
+    Catena_Server(garlic[i], x + (size_t) i * H_LEN, H_LEN,
+		  one + (size_t) i * H_LEN);
+  t_one = now() - t_one;
+
+  t_many = now();
+  Catena_Server_many(SERVER_N, garlic, x, H_LEN, many);
+  t_many = now() - t_many;
+
+  t_verify = now();
+  Catena_Server_Verify_many(SERVER_N, garlic, x, H_LEN, one, ok);
+  t_verify = now() - t_verify;
+  for (i = 0; i < SERVER_N; i++) matches += ok[i];
+
+  printf("Server relief, %u client outputs\n", SERVER_N);
+  printf("  Catena_Server:             %10.0f /s\n", SERVER_N / t_one);
+  printf("  Catena_Server_many:        %10.0f /s%s\n", SERVER_N / t_many,
+	 memcmp(one, many, (size_t) SERVER_N * H_LEN) ? "  MISMATCH" : "");
+  printf("  Catena_Server_Verify_many: %10.0f /s, %u of %u verified\n\n",
+	 SERVER_N / t_verify, matches, SERVER_N);
+
+  free(garlic); free(x); free(one); free(many); free(ok);
+}
+
+/*******************************************************************/
+
+int main(int argc, char **argv)
+{
+  const uint8_t salt[16] = {0};
+  const char *password = "Password";
+  const uint8_t max_garlic = (argc > 1) ? atoi(argv[1]) : MAX_BENCH_GARLIC;
+  catena_workspace ws;
+  uint8_t hash[H_LEN];
+  uint8_t garlic;
+  uint32_t reps, i;
+  double start, elapsed;
+
+  bench_server();
+
+  Catena_Init_Workspace(&ws, CATENA_HUGEPAGES_TRANSPARENT);
+  printf("Lambda: %u, one LBRH per garlic, warm workspace\n", LAMBDA);
+  printf("garlic  memory (KiB)  ms/hash  ns/row\n");
+
+  for (garlic = MIN_BENCH_GARLIC; garlic <= max_garlic; garlic++)
+    {
+      reps = (garlic < REPS_GARLIC) ? 1 << (REPS_GARLIC - garlic) : 1;
+
+      /* Fault the workspace in before timing */
+      if (Catena_With_Workspace(&ws, (uint8_t *) password, 8, salt, 16,
+				(uint8_t *) "", 0, LAMBDA, garlic, garlic,
+				H_LEN, hash) != 0)
+	{
+	  fprintf(stderr, "Not enough memory for garlic %u\n", garlic);
+	  break;
+	}
+
+      start = now();
+      for (i = 0; i < reps; i++)
+	Catena_With_Workspace(&ws, (uint8_t *) password, 8, salt, 16,
+			      (uint8_t *) "", 0, LAMBDA, garlic, garlic,
+			      H_LEN, hash);
+      elapsed = (now() - start) / reps;
+
+      printf("%6u  %12llu  %7.2f  %6.1f\n", garlic,
+	     (unsigned long long) ((UINT64_C(1) << garlic) * H_LEN / 1024),
+	     elapsed * 1e3,
+	     elapsed * 1e9 / ((double) (UINT64_C(1) << garlic) * (LAMBDA + 1)));
+    }
+
+  Catena_Free_Workspace(&ws);
+  return 0;
+}
@@ -61,7 +61,7 @@ extern "C" {
     uint8_t  personal[BLAKE2S_PERSONALBYTES];  // 32
   } blake2s_param;
 
-  ALIGN( 64 ) typedef struct __blake2s_state
+  typedef struct ALIGN( 64 ) __blake2s_state
   {
     uint32_t h[8];
     uint32_t t[2];
@@ -86,7 +86,7 @@ extern "C" {
     uint8_t  personal[BLAKE2B_PERSONALBYTES];  // 64
   } blake2b_param;
 
-  ALIGN( 64 ) typedef struct __blake2b_state
+  typedef struct ALIGN( 64 ) __blake2b_state
   {
     uint64_t h[8];
     uint64_t t[2];
@@ -96,7 +96,7 @@ extern "C" {
     uint8_t  last_node;
   } blake2b_state;
 
-  ALIGN( 64 ) typedef struct __blake2sp_state
+  typedef struct ALIGN( 64 ) __blake2sp_state
   {
     blake2s_state S[8][1];
     blake2s_state R[1];
@@ -104,7 +104,7 @@ extern "C" {
     size_t  buflen;
   } blake2sp_state;
 
-  ALIGN( 64 ) typedef struct __blake2bp_state
+  typedef struct ALIGN( 64 ) __blake2bp_state
   {
     blake2b_state S[4][1];
     blake2b_state R[1];
@@ -125,6 +125,8 @@ extern "C" {
   int blake2b_init_param( blake2b_state *S, const blake2b_param *P );
   int blake2b_update( blake2b_state *S, const uint8_t *in, uint64_t inlen );
   int blake2b_final( blake2b_state *S, uint8_t *out, uint8_t outlen );
+  int blake2b_final_block( const uint64_t h0[8], const uint8_t block[BLAKE2B_BLOCKBYTES], const uint8_t inlen, uint8_t *out, uint8_t outlen );
+  int blake2b_final_block_many( const uint64_t h0[8], const uint8_t *blocks, const uint8_t inlen, const size_t n, uint8_t *out, uint8_t outlen );
 
   int blake2sp_init( blake2sp_state *S, const uint8_t outlen );
   int blake2sp_init_key( blake2sp_state *S, const uint8_t outlen, const void *key, const uint8_t keylen );
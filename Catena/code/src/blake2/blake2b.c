@@ -366,6 +366,139 @@ int blake2b_final( blake2b_state *S, uint8_t *out, uint8_t outlen )
 }
 
 
+/* Hashes a message of inlen <= BLAKE2B_BLOCKBYTES bytes, given as one block that
+   is already zero padded, from the chaining value h0 of an initialized state.
+   Equivalent to update + final on a copy of that state, without the buffering. */
+int blake2b_final_block( const uint64_t h0[8], const uint8_t block[BLAKE2B_BLOCKBYTES], const uint8_t inlen, uint8_t *out, uint8_t outlen )
+{
+  blake2b_state S[1];
+
+  if( inlen > BLAKE2B_BLOCKBYTES || outlen > BLAKE2B_OUTBYTES ) return -1;
+
+  memcpy( S->h, h0, BLAKE2B_OUTBYTES );
+  S->t[0] = inlen;
+  S->t[1] = 0;
+  S->f[0] = ~0ULL;
+  S->f[1] = 0;
+  blake2b_compress( S, block );
+  memcpy( out, &S->h[0], outlen );
+  return 0;
+}
+
+
+/* Multi-buffer variant of blake2b_final_block: each 64-bit word of the state
+   holds the same word of BLAKE2B_LANES independent messages. */
+#if defined(__AVX512F__)
+#define BLAKE2B_LANES 8
+#elif defined(__AVX2__)
+#define BLAKE2B_LANES 4
+#else
+#define BLAKE2B_LANES 2
+#endif
+
+typedef uint64_t blake2b_lanes __attribute__ ( ( vector_size( 8 * BLAKE2B_LANES ) ) );
+
+#define ROTR64V(x, c) ( ( (x) >> (c) ) | ( (x) << ( 64 - (c) ) ) )
+
+#define GV(r,i,a,b,c,d) \
+  do { \
+    a = a + b + m[blake2b_sigma[r][2*i+0]]; \
+    d = ROTR64V(d ^ a, 32); \
+    c = c + d; \
+    b = ROTR64V(b ^ c, 24); \
+    a = a + b + m[blake2b_sigma[r][2*i+1]]; \
+    d = ROTR64V(d ^ a, 16); \
+    c = c + d; \
+    b = ROTR64V(b ^ c, 63); \
+  } while(0)
+
+#define ROUNDV(r)  \
+  do { \
+    GV(r,0,v[ 0],v[ 4],v[ 8],v[12]); \
+    GV(r,1,v[ 1],v[ 5],v[ 9],v[13]); \
+    GV(r,2,v[ 2],v[ 6],v[10],v[14]); \
+    GV(r,3,v[ 3],v[ 7],v[11],v[15]); \
+    GV(r,4,v[ 0],v[ 5],v[10],v[15]); \
+    GV(r,5,v[ 1],v[ 6],v[11],v[12]); \
+    GV(r,6,v[ 2],v[ 7],v[ 8],v[13]); \
+    GV(r,7,v[ 3],v[ 4],v[ 9],v[14]); \
+  } while(0)
+
+static inline void blake2b_compress_lanes( const uint64_t h0[8], const uint8_t *blocks, const uint8_t inlen, uint8_t out[BLAKE2B_LANES][BLAKE2B_OUTBYTES] )
+{
+  blake2b_lanes m[16];
+  blake2b_lanes v[16];
+  const blake2b_lanes zero = { 0 };
+  int i, l;
+
+  for( i = 0; i < 16; ++i )
+    for( l = 0; l < BLAKE2B_LANES; ++l )
+      m[i][l] = load64( blocks + l * BLAKE2B_BLOCKBYTES + i * 8 );
+
+  for( i = 0; i < 8; ++i )
+  {
+    v[i] = zero + h0[i];
+    v[i + 8] = zero + blake2b_IV[i];
+  }
+  v[12] ^= inlen;
+  v[14] ^= ~0ULL;
+
+  ROUNDV( 0 );
+  ROUNDV( 1 );
+  ROUNDV( 2 );
+  ROUNDV( 3 );
+  ROUNDV( 4 );
+  ROUNDV( 5 );
+  ROUNDV( 6 );
+  ROUNDV( 7 );
+  ROUNDV( 8 );
+  ROUNDV( 9 );
+  ROUNDV( 10 );
+  ROUNDV( 11 );
+
+  for( i = 0; i < 8; ++i )
+  {
+    v[i] ^= v[i + 8] ^ h0[i];
+    for( l = 0; l < BLAKE2B_LANES; ++l )
+      store64( out[l] + i * 8, v[i][l] );
+  }
+}
+
+#undef GV
+#undef ROUNDV
+#undef ROTR64V
+
+/* blake2b_final_block for n messages of the same length inlen, given as n
+   consecutive zero padded blocks; the digests are written consecutively to out.
+   Runs BLAKE2B_LANES messages at a time through the vector units. */
+int blake2b_final_block_many( const uint64_t h0[8], const uint8_t *blocks, const uint8_t inlen, const size_t n, uint8_t *out, uint8_t outlen )
+{
+  ALIGN( 64 ) uint8_t digests[BLAKE2B_LANES][BLAKE2B_OUTBYTES];
+  ALIGN( 64 ) uint8_t tail[BLAKE2B_LANES * BLAKE2B_BLOCKBYTES];
+  size_t j, k, l;
+
+  if( inlen > BLAKE2B_BLOCKBYTES || outlen > BLAKE2B_OUTBYTES ) return -1;
+
+  for( j = 0; j < n; j += k )
+  {
+    const uint8_t *in = blocks + j * BLAKE2B_BLOCKBYTES;
+    k = n - j < BLAKE2B_LANES ? n - j : BLAKE2B_LANES;
+
+    /* The unused lanes of the last group hash zero blocks */
+    if( k < BLAKE2B_LANES )
+    {
+      memset( tail, 0, sizeof( tail ) );
+      memcpy( tail, in, k * BLAKE2B_BLOCKBYTES );
+      in = tail;
+    }
+    blake2b_compress_lanes( h0, in, inlen, digests );
+    for( l = 0; l < k; ++l )
+      memcpy( out + ( j + l ) * outlen, digests[l], outlen );
+  }
+  return 0;
+}
+
+
 int blake2b( uint8_t *out, const void *in, const void *key, const uint8_t outlen, const uint64_t inlen, uint8_t keylen )
 {
   blake2b_state S[1];
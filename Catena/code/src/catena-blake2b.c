@@ -2,6 +2,18 @@
 #include "blake2.h"
 #include "hash.h"
 
+/* Chaining value left by blake2b_init(&ctx, H_LEN): the IV xored with the
+ * parameter block (digest length H_LEN, no key, fanout 1, depth 1).
+ */
+static const uint64_t blake2b_H_LEN_IV[8] =
+{
+  UINT64_C(0x6a09e667f3bcc908) ^ (UINT64_C(0x01010000) | H_LEN),
+  UINT64_C(0xbb67ae8584caa73b), UINT64_C(0x3c6ef372fe94f82b),
+  UINT64_C(0xa54ff53a5f1d36f1), UINT64_C(0x510e527fade682d1),
+  UINT64_C(0x9b05688c2b3e6c1f), UINT64_C(0x1f83d9abfb41bd6b),
+  UINT64_C(0x5be0cd19137e2179)
+};
+
 
 inline void __Hash1(const uint8_t *input, const uint32_t inputlen,
 		      uint8_t hash[H_LEN])
@@ -79,3 +91,56 @@ inline void __Hash5(const uint8_t *i1, const uint8_t i1len,
   blake2b_update(&ctx, i5, i5len);
   blake2b_final(&ctx, hash, H_LEN);
 }
+
+
+/***************************************************/
+
+inline void __HashFast1(const uint8_t x[H_LEN], uint8_t hash[H_LEN])
+{
+  ALIGN(16) uint8_t block[BLAKE2B_BLOCKBYTES];
+  memcpy(block, x, H_LEN);
+  memset(block + H_LEN, 0, BLAKE2B_BLOCKBYTES - H_LEN);
+  blake2b_final_block(blake2b_H_LEN_IV, block, H_LEN, hash, H_LEN);
+}
+
+
+/***************************************************/
+
+inline void __HashFast2(const uint8_t *i1, const uint8_t *i2,
+			uint8_t hash[H_LEN])
+{
+  ALIGN(16) uint8_t block[BLAKE2B_BLOCKBYTES];
+
+  /* Adjacent halves are already one block, no need to copy them */
+  if (i2 == i1 + H_LEN) {
+    blake2b_final_block(blake2b_H_LEN_IV, i1, 2*H_LEN, hash, H_LEN);
+    return;
+  }
+  memcpy(block, i1, H_LEN);
+  memcpy(block + H_LEN, i2, H_LEN);
+  blake2b_final_block(blake2b_H_LEN_IV, block, 2*H_LEN, hash, H_LEN);
+}
+
+
+/***************************************************/
+
+/* Messages padded per call to blake2b_final_block_many */
+#define MANY_BATCH 32
+
+void __Hash2_many(const uint8_t *c, const uint8_t *x, const uint32_t n,
+		  uint8_t *hash)
+{
+  ALIGN(64) uint8_t blocks[MANY_BATCH * BLAKE2B_BLOCKBYTES];
+  uint32_t i, j, k;
+
+  memset(blocks, 0, sizeof(blocks));
+  for (i = 0; i < n; i += k) {
+    k = (n - i < MANY_BATCH) ? n - i : MANY_BATCH;
+    for (j = 0; j < k; j++) {
+      blocks[j * BLAKE2B_BLOCKBYTES] = c[i + j];
+      memcpy(blocks + j * BLAKE2B_BLOCKBYTES + 1, x + (i + j) * H_LEN, H_LEN);
+    }
+    blake2b_final_block_many(blake2b_H_LEN_IV, blocks, 1 + H_LEN, k,
+			     hash + i * H_LEN, H_LEN);
+  }
+}
@@ -84,3 +84,36 @@ inline void __Hash5(const uint8_t *i1, const uint8_t i1len,
 
 
 /***************************************************/
+
+
+/***************************************************/
+
+inline void __HashFast1(const uint8_t x[H_LEN], uint8_t hash[H_LEN])
+{
+  SHA512(x, H_LEN, hash);
+}
+
+
+/***************************************************/
+
+inline void __HashFast2(const uint8_t *i1, const uint8_t *i2,
+			uint8_t hash[H_LEN])
+{
+  if (i2 == i1 + H_LEN) {
+    SHA512(i1, 2*H_LEN, hash);
+    return;
+  }
+  __Hash2(i1, H_LEN, i2, H_LEN, hash);
+}
+
+
+/***************************************************/
+
+void __Hash2_many(const uint8_t *c, const uint8_t *x, const uint32_t n,
+		  uint8_t *hash)
+{
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    __Hash2(c + i, 1, x + i * H_LEN, H_LEN, hash + i * H_LEN);
+}
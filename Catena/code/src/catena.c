@@ -1,8 +1,11 @@
+#define _DEFAULT_SOURCE
 #include <string.h>
 #include <stdio.h>
 #include <byteswap.h>
 #include <stdlib.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #define __STDC_CONSTANT_MACROS
 #include <stdint.h>
 
@@ -19,6 +22,34 @@
   #define TO_LITTLE_ENDIAN_32(n) (n)
 #endif
 
+#define HUGE_PAGE_SIZE (UINT64_C(2) << 20)
+
+/* Client outputs hashed per __Hash2_many() call of the server */
+#define SERVER_BATCH 64
+
+/* Rows of the bit-reversal layers are prefetched this many steps ahead,
+ * 0 disables it */
+#ifndef CATENA_PREFETCH_DISTANCE
+  #define CATENA_PREFETCH_DISTANCE 8
+#endif
+
+/* The bit-reversed indices are generated in tiles of 2^CATENA_BITREV_TILE,
+ * 0 computes reverse() for every index */
+#ifndef CATENA_BITREV_TILE
+  #define CATENA_BITREV_TILE 6
+#endif
+
+#if CATENA_BITREV_TILE > 0 && \
+  CATENA_PREFETCH_DISTANCE >= (1 << CATENA_BITREV_TILE)
+  #error "CATENA_PREFETCH_DISTANCE must be smaller than a tile"
+#endif
+
+#if CATENA_PREFETCH_DISTANCE > 0
+  #define PREFETCH(p) __builtin_prefetch((p), 1, 3)
+#else
+  #define PREFETCH(p)
+#endif
+
 uint64_t reverse(uint64_t x, const uint8_t n)
 {
   x = bswap_64(x);
@@ -32,46 +63,169 @@ uint64_t reverse(uint64_t x, const uint8_t n)
 }
 
 
-void LBRH(const uint8_t x[H_LEN], const uint8_t lambda,
-	  const uint8_t garlic,   uint8_t h[H_LEN])
+/***************************************************/
+
+void Catena_Init_Workspace(catena_workspace *ws, const uint8_t hugepages)
+{
+  ws->r = NULL;
+  ws->size = 0;
+  ws->hugepages = hugepages;
+  ws->mapped = 0;
+}
+
+/***************************************************/
+
+void Catena_Free_Workspace(catena_workspace *ws)
+{
+  if (ws->r != NULL) {
+    if (ws->mapped) munmap(ws->r, ws->size);
+    else free(ws->r);
+  }
+  ws->r = NULL;
+  ws->size = 0;
+  ws->mapped = 0;
+}
+
+/***************************************************/
+
+/* Returns memory for the graph of the given garlic, growing ws if needed,
+ * or NULL if there is not enough memory.
+ */
+static uint8_t *Reserve_Workspace(catena_workspace *ws, const uint8_t garlic)
+{
+  const size_t size = (UINT64_C(1) << garlic) * H_LEN;
+  void *p = MAP_FAILED;
+
+  if ((ws->r != NULL) && (ws->size >= size)) return ws->r;
+  Catena_Free_Workspace(ws);
+
+  if ((ws->hugepages != CATENA_HUGEPAGES_NONE) && (size >= HUGE_PAGE_SIZE)) {
+    const size_t mapsize = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+    if (ws->hugepages == CATENA_HUGEPAGES_EXPLICIT)
+      p = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) {
+      p = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (p != MAP_FAILED) madvise(p, mapsize, MADV_HUGEPAGE);
+#endif
+    }
+    if (p != MAP_FAILED) {
+      ws->r = p;
+      ws->size = mapsize;
+      ws->mapped = 1;
+      return ws->r;
+    }
+  }
+
+  if (posix_memalign(&p, 64, size) != 0) return NULL;
+  ws->r = p;
+  ws->size = size;
+  return ws->r;
+}
+
+/***************************************************/
+
+/* One bit-reversal layer: for i = 1..c-1, the row r[reverse(i)] becomes
+ * H(r[reverse(i-1)] || r[reverse(i)]). The order is password independent,
+ * so the rows are prefetched before the hash chain gets to them.
+ */
+static void Bitrev_Layer(uint8_t *r, const uint8_t garlic)
+{
+  const uint64_t c = UINT64_C(1) << garlic;
+  uint8_t *previousR = r, *p;
+  uint64_t i;
+
+#if CATENA_BITREV_TILE > 0
+  if (garlic > CATENA_BITREV_TILE) {
+    /* With i = hi * 2^t + lo, reverse(i, garlic) is
+     * reverse(lo, t) << (garlic - t) | reverse(hi, garlic - t), so a tile of
+     * 2^t consecutive i only needs one reverse() and a table lookup each.
+     */
+    const uint8_t  t = CATENA_BITREV_TILE;
+    const uint8_t  s = garlic - CATENA_BITREV_TILE;
+    const uint64_t tile = UINT64_C(1) << t;
+    const uint64_t tiles = c >> t;
+    uint64_t low[1 << CATENA_BITREV_TILE];
+    uint64_t hi, lo, base = 0, next;
+
+    for (lo = 0; lo < tile; lo++) low[lo] = reverse(lo, t) << s;
+
+    for (hi = 0; hi < tiles; hi++, base = next) {
+      next = (hi + 1 < tiles) ? reverse(hi + 1, s) : 0;
+      for (lo = (hi == 0); lo < tile; lo++) {
+#if CATENA_PREFETCH_DISTANCE > 0
+	if (lo + CATENA_PREFETCH_DISTANCE < tile)
+	  PREFETCH(r + (low[lo + CATENA_PREFETCH_DISTANCE] | base) * H_LEN);
+	else
+	  PREFETCH(r + (low[lo + CATENA_PREFETCH_DISTANCE - tile] | next) * H_LEN);
+#endif
+	p = r + (low[lo] | base) * H_LEN;
+	__HashFast2(previousR, p, p);
+	previousR = p;
+      }
+    }
+    return;
+  }
+#endif
+
+  for (i = 1; i < c; i++) {
+    PREFETCH(r + reverse((i + CATENA_PREFETCH_DISTANCE) & (c - 1), garlic) * H_LEN);
+    p = r + reverse(i, garlic) * H_LEN;
+    __HashFast2(previousR, p, p);
+    previousR = p;
+  }
+}
+
+/***************************************************/
+
+/* LBRH on the caller's memory r of at least 2^garlic * H_LEN bytes */
+static void __LBRH(const uint8_t x[H_LEN], const uint8_t lambda,
+		   const uint8_t garlic, uint8_t *r, uint8_t h[H_LEN])
 {
   const uint64_t c = UINT64_C(1) << garlic;
-  uint8_t *r = malloc(c*H_LEN);
   uint64_t i = 0;
   uint32_t k;
 
-  __Hash1(x, H_LEN, r);
+  __HashFast1(x, r);
 
   /* Top row */
   for (i = 1; i < c; i++) {
-    __Hash1(r + (i-1)*H_LEN, H_LEN, r + i*H_LEN);
+    __HashFast1(r + (i-1)*H_LEN, r + i*H_LEN);
   }
 
   /* Mid rows */
   for (k = 0; k < lambda; k++) {
-    __Hash2(r + (c-1)*H_LEN, H_LEN, r, H_LEN, r);
+    __HashFast2(r + (c-1)*H_LEN, r, r);
 
     /* Replace r[reverse(i, garlic)] with new value */
-    uint8_t *previousR = r, *p;
-    for (i = 1; i < c; i++) {
-      p = r + reverse(i, garlic) * H_LEN;
-      __Hash2(previousR, H_LEN, p, H_LEN, p);
-      previousR = p;
-    }
+    Bitrev_Layer(r, garlic);
     k++;
     if (k >= lambda) {
       break;
     }
     /* This is now sequential because (reverse(reverse(i, garlic), garlic) == i) */
-    __Hash2(r + (c-1)*H_LEN, H_LEN, r, H_LEN, r);
-    p = r + H_LEN;
+    __HashFast2(r + (c-1)*H_LEN, r, r);
+    uint8_t *p = r + H_LEN;
     for (i = 1; i < c; i++, p += H_LEN) {
-      __Hash1(p - H_LEN, 2 * H_LEN, p);
+      __HashFast2(p - H_LEN, p, p);
     }
   }
 
   /* reverse(c - 1, garlic) == c - 1 */
   memcpy(h, r + (c - 1) * H_LEN, H_LEN);
+}
+
+
+void LBRH(const uint8_t x[H_LEN], const uint8_t lambda,
+	  const uint8_t garlic,   uint8_t h[H_LEN])
+{
+  uint8_t *r = malloc((UINT64_C(1) << garlic) * H_LEN);
+
+  __LBRH(x, lambda, garlic, r, h);
   free(r);
 }
 
@@ -80,19 +234,31 @@ void LBRH(const uint8_t x[H_LEN], const uint8_t lambda,
 /***************************************************/
 
 
-int __Catena(const uint8_t *pwd,   const uint32_t pwdlen,
+int __Catena(catena_workspace *ws,
+	     const uint8_t *pwd,   const uint32_t pwdlen,
 	     const uint8_t *salt,  const uint8_t  saltlen,
 	     const uint8_t *data,  const uint32_t datalen,
 	     const uint8_t lambda, const uint8_t  min_garlic,
 	     const uint8_t garlic, const uint8_t  hashlen,
 	     const uint8_t client, const uint8_t  tweak_id, uint8_t *hash)
 {
+ catena_workspace local;
  uint8_t x[H_LEN];
  uint8_t t[5];
+ uint8_t *r;
  uint8_t c;
 
  if ((hashlen > H_LEN) || (garlic > 63) || (min_garlic > garlic)) return -1;
 
+  /* Without a workspace, one is kept for the duration of this call */
+  if (ws == NULL) {
+    Catena_Init_Workspace(&local, CATENA_HUGEPAGES_NONE);
+    ws = &local;
+  }
+  /* The largest level is reserved first, the others reuse its memory */
+  r = Reserve_Workspace(ws, garlic);
+  if (r == NULL) return -1;
+
   /* Compute Tweak */
   t[0] = 0xFF;
   t[1] = tweak_id;
@@ -110,17 +276,18 @@ int __Catena(const uint8_t *pwd,   const uint32_t pwdlen,
 
   for(c=min_garlic; c <= garlic; c++)
     {
-      LBRH(x, lambda, c, x);
+      __LBRH(x, lambda, c, r, x);
       if( (c==garlic) && (client == CLIENT))
 	{
 	  memcpy(hash, x, H_LEN);
-	  return 0;
+	  break;
 	}
       __Hash2(&c,1, x,H_LEN, x);
       memset(x+hashlen, 0, H_LEN-hashlen);
     }
-  memcpy(hash, x, hashlen);
+  if (client != CLIENT) memcpy(hash, x, hashlen);
 
+  if (ws == &local) Catena_Free_Workspace(&local);
   return 0;
 }
 
@@ -133,20 +300,36 @@ int Catena(const uint8_t *pwd,   const uint32_t pwdlen,
 	   const uint8_t lambda, const uint8_t  min_garlic,
 	   const uint8_t garlic, const uint8_t  hashlen,  uint8_t *hash)
 {
-  return __Catena(pwd, pwdlen, salt, saltlen, data, datalen,
+  return __Catena(NULL, pwd, pwdlen, salt, saltlen, data, datalen,
 		  lambda, min_garlic, garlic,
 		  hashlen,  REGULAR, PASSWORD_HASHING_MODE, hash);
 
 }
 
 
+/***************************************************/
+
+int Catena_With_Workspace(catena_workspace *ws,
+			  const uint8_t *pwd,   const uint32_t pwdlen,
+			  const uint8_t *salt,  const uint8_t  saltlen,
+			  const uint8_t *data,  const uint32_t datalen,
+			  const uint8_t lambda, const uint8_t  min_garlic,
+			  const uint8_t garlic, const uint8_t  hashlen,
+			  uint8_t *hash)
+{
+  return __Catena(ws, pwd, pwdlen, salt, saltlen, data, datalen,
+		  lambda, min_garlic, garlic,
+		  hashlen,  REGULAR, PASSWORD_HASHING_MODE, hash);
+}
+
+
 /***************************************************/
 
 
 int Naive_Catena(const char *pwd,  const char *salt, const char *data,
 		  uint8_t hash[H_LEN])
 {
-  return __Catena( (uint8_t  *) pwd, strlen(pwd),
+  return __Catena(NULL, (uint8_t  *) pwd, strlen(pwd),
 		   (uint8_t  *) salt, strlen(salt),
 		   (uint8_t  *) data, strlen(data),
 		   LAMBDA, MIN_GARLIC, GARLIC,
@@ -161,7 +344,7 @@ int Simple_Catena(const uint8_t *pwd,   const uint32_t pwdlen,
 		  const uint8_t *data,  const uint32_t datalen,
 		  uint8_t hash[H_LEN])
 {
-  return __Catena(pwd, pwdlen, salt, saltlen, data, datalen,
+  return __Catena(NULL, pwd, pwdlen, salt, saltlen, data, datalen,
 		  LAMBDA, MIN_GARLIC, GARLIC, H_LEN,
 		  REGULAR, PASSWORD_HASHING_MODE, hash);
 }
@@ -176,7 +359,22 @@ int Catena_Client(const uint8_t  *pwd,   const uint32_t pwdlen,
 		  const uint8_t  garlic, const uint8_t  hashlen,
 		  uint8_t x[H_LEN])
 {
-  return __Catena(pwd, pwdlen, (uint8_t *) salt, saltlen, data, datalen,
+  return __Catena(NULL, pwd, pwdlen, (uint8_t *) salt, saltlen, data, datalen,
+		  lambda, min_garlic, garlic, hashlen,
+		  CLIENT, PASSWORD_HASHING_MODE, x);
+}
+
+/***************************************************/
+
+int Catena_Client_With_Workspace(catena_workspace *ws,
+				 const uint8_t *pwd,   const uint32_t pwdlen,
+				 const uint8_t *salt,  const uint8_t  saltlen,
+				 const uint8_t *data,  const uint32_t datalen,
+				 const uint8_t lambda, const uint8_t  min_garlic,
+				 const uint8_t garlic, const uint8_t  hashlen,
+				 uint8_t x[H_LEN])
+{
+  return __Catena(ws, pwd, pwdlen, salt, saltlen, data, datalen,
 		  lambda, min_garlic, garlic, hashlen,
 		  CLIENT, PASSWORD_HASHING_MODE, x);
 }
@@ -197,25 +395,179 @@ int Catena_Server(const uint8_t garlic,  const uint8_t x[H_LEN],
 
 /***************************************************/
 
-void CI_Update(const uint8_t *old_hash,  const uint8_t lambda,
-	       const uint8_t old_garlic, const uint8_t new_garlic,
-	       const uint8_t hashlen, uint8_t *new_hash)
+int CI_Update_With_Workspace(catena_workspace *ws, const uint8_t *old_hash,
+			     const uint8_t lambda,  const uint8_t old_garlic,
+			     const uint8_t new_garlic, const uint8_t hashlen,
+			     uint8_t *new_hash)
 {
   uint8_t c;
   uint8_t x[H_LEN];
+  uint8_t *r = NULL;
+
+  if (hashlen > H_LEN) return -1;
+  if (new_garlic > old_garlic) {
+    if (new_garlic > 63) return -1;
+    r = Reserve_Workspace(ws, new_garlic);
+    if (r == NULL) return -1;
+  }
 
   memcpy(x, old_hash, hashlen);
   memset(x+hashlen, 0, H_LEN-hashlen);
 
   for(c=old_garlic+1; c <= new_garlic; c++)
     {
-      LBRH(x, lambda, c, x);
+      __LBRH(x, lambda, c, r, x);
       __Hash2(&c,1,x, H_LEN, x);
       memset(x+hashlen, 0, H_LEN-hashlen);
     }
   memcpy(new_hash,x,hashlen);
+  return 0;
+}
+
+/***************************************************/
+
+int Catena_Server_many(const uint32_t n, const uint8_t *garlic,
+		       const uint8_t *x, const uint8_t hashlen, uint8_t *hash)
+{
+  uint8_t z[SERVER_BATCH * H_LEN];
+  uint32_t i, j, k;
+
+  if (hashlen > H_LEN) return -1;
+  for (i = 0; i < n; i += k) {
+    k = MIN(n - i, SERVER_BATCH);
+    __Hash2_many(garlic + i, x + (uint64_t) i * H_LEN, k, z);
+    for (j = 0; j < k; j++)
+      memcpy(hash + (uint64_t) (i + j) * hashlen, z + j * H_LEN, hashlen);
+  }
+  return 0;
+}
+
+/***************************************************/
+
+int Catena_Server_Verify_many(const uint32_t n, const uint8_t *garlic,
+			      const uint8_t *x, const uint8_t hashlen,
+			      const uint8_t *stored, uint8_t *ok)
+{
+  uint8_t z[SERVER_BATCH * H_LEN];
+  const uint8_t *s;
+  uint32_t i, j, k, d;
+  uint8_t l;
+
+  if (hashlen > H_LEN) return -1;
+  for (i = 0; i < n; i += k) {
+    k = MIN(n - i, SERVER_BATCH);
+    __Hash2_many(garlic + i, x + (uint64_t) i * H_LEN, k, z);
+    for (j = 0; j < k; j++) {
+      s = stored + (uint64_t) (i + j) * hashlen;
+      d = 0;
+      for (l = 0; l < hashlen; l++) d |= z[j * H_LEN + l] ^ s[l];
+      /* 1 if d == 0, without branching on it */
+      ok[i + j] = 1 & ((d - 1) >> 8);
+    }
+  }
+  return 0;
+}
+
+/***************************************************/
+
+void CI_Update(const uint8_t *old_hash,  const uint8_t lambda,
+	       const uint8_t old_garlic, const uint8_t new_garlic,
+	       const uint8_t hashlen, uint8_t *new_hash)
+{
+  catena_workspace ws;
+
+  Catena_Init_Workspace(&ws, CATENA_HUGEPAGES_NONE);
+  CI_Update_With_Workspace(&ws, old_hash, lambda, old_garlic, new_garlic,
+			   hashlen, new_hash);
+  Catena_Free_Workspace(&ws);
+}
+
+
+/***************************************************/
+
+/* Shared by the threads of CI_Update_many(), which take the next hash from
+ * the counter since the cost of a hash depends on its old garlic.
+ */
+typedef struct {
+  const uint8_t *old_hash;
+  const uint8_t *old_garlic;
+  uint8_t *new_hash;
+  uint32_t n;
+  uint32_t next;
+  uint8_t lambda;
+  uint8_t new_garlic;
+  uint8_t hashlen;
+  int error;
+} ci_update_job;
+
+typedef struct {
+  ci_update_job *job;
+  catena_workspace *ws;
+} ci_update_thread;
+
+static void *CI_Update_Thread(void *arg)
+{
+  ci_update_thread *t = arg;
+  ci_update_job *job = t->job;
+  uint64_t j;
+
+  while ((j = __sync_fetch_and_add(&job->next, 1)) < job->n) {
+    if (CI_Update_With_Workspace(t->ws, job->old_hash + j * job->hashlen,
+				 job->lambda, job->old_garlic[j],
+				 job->new_garlic, job->hashlen,
+				 job->new_hash + j * job->hashlen) != 0)
+      job->error = 1;
+  }
+  return NULL;
 }
 
+int CI_Update_many(catena_workspace *ws,   const uint32_t threads,
+		   const uint32_t n,       const uint8_t *old_hash,
+		   const uint8_t *old_garlic, const uint8_t lambda,
+		   const uint8_t new_garlic,  const uint8_t hashlen,
+		   uint8_t *new_hash)
+{
+  ci_update_job job;
+  ci_update_thread *t;
+  pthread_t *tid;
+  uint32_t i, started;
+
+  if ((threads == 0) || (hashlen > H_LEN)) return -1;
+
+  job.old_hash = old_hash;
+  job.old_garlic = old_garlic;
+  job.new_hash = new_hash;
+  job.n = n;
+  job.next = 0;
+  job.lambda = lambda;
+  job.new_garlic = new_garlic;
+  job.hashlen = hashlen;
+  job.error = 0;
+
+  t = malloc(threads * sizeof(ci_update_thread));
+  tid = malloc(threads * sizeof(pthread_t));
+  if ((t == NULL) || (tid == NULL)) {
+    free(t);
+    free(tid);
+    return -1;
+  }
+
+  /* The calling thread takes the first workspace */
+  for (i = 0; i < threads; i++) {
+    t[i].job = &job;
+    t[i].ws = &ws[i];
+  }
+  for (started = 1; started < threads; started++)
+    if (pthread_create(&tid[started], NULL, CI_Update_Thread,
+		       &t[started]) != 0)
+      break;
+  CI_Update_Thread(&t[0]);
+  for (i = 1; i < started; i++) pthread_join(tid[i], NULL);
+
+  free(t);
+  free(tid);
+  return job.error ? -1 : 0;
+}
 
 /***************************************************/
 
@@ -233,7 +585,7 @@ void Catena_KG(const uint8_t *pwd,   const uint32_t pwdlen,
   uint64_t i;
   keylen = TO_LITTLE_ENDIAN_32(keylen);
 
-  __Catena(pwd, pwdlen, salt, saltlen, data, datalen,
+  __Catena(NULL, pwd, pwdlen, salt, saltlen, data, datalen,
 	   lambda, min_garlic, garlic, H_LEN, REGULAR, KEY_DERIVATION_MODE,
 	   hash);
 
@@ -267,7 +619,7 @@ void Catena_Keyed_Hashing(const uint8_t *pwd,   const uint32_t pwdlen,
   uint64_t tmp = TO_LITTLE_ENDIAN_64(uuid);
   int i;
 
-   __Catena(pwd, pwdlen, salt, saltlen, data, datalen,
+   __Catena(NULL, pwd, pwdlen, salt, saltlen, data, datalen,
 	    lambda, min_garlic, garlic, hashlen,
 	    REGULAR, PASSWORD_HASHING_MODE, chash);
 
@@ -282,7 +634,7 @@ int PHS(void *out, size_t outlen,  const void *in, size_t inlen,
 	const void *salt, size_t saltlen, unsigned int t_cost,
 	unsigned int m_cost) {
 
-  return __Catena((const uint8_t *) in, inlen, salt, saltlen, (const uint8_t *)
+  return __Catena(NULL, (const uint8_t *) in, inlen, salt, saltlen, (const uint8_t *)
 		  "", 0, t_cost, MIN_GARLIC, m_cost, outlen, REGULAR,
 		  PASSWORD_HASHING_MODE, out);
 }
@@ -19,6 +19,23 @@
 #define REGULAR 0
 #define CLIENT 1
 
+/* Page sizes for a workspace */
+#define CATENA_HUGEPAGES_NONE        0
+#define CATENA_HUGEPAGES_TRANSPARENT 1
+#define CATENA_HUGEPAGES_EXPLICIT    2
+
+
+/* Memory for the graph of LBRH. It is sized for the largest garlic seen so
+ * far and kept across garlic levels and calls, so that its pages stay
+ * faulted in. Set up with Catena_Init_Workspace().
+ */
+typedef struct {
+  uint8_t *r;
+  size_t   size;
+  uint8_t  hugepages;
+  uint8_t  mapped;
+} catena_workspace;
+
 
 
 /* Return the reverse bit order of x where x is interpreted as n-bit value */
@@ -30,6 +47,17 @@ void LBRH(const uint8_t x[H_LEN], const uint8_t lambda,
 	  const uint8_t garlic,   uint8_t h[H_LEN]);
 
 
+/* Initializes an empty workspace, no memory is reserved until it is used.
+ * hugepages is one of CATENA_HUGEPAGES_*; regions of at least 2 MiB are then
+ * mapped with huge pages, explicit ones falling back to transparent ones.
+ */
+void Catena_Init_Workspace(catena_workspace *ws, const uint8_t hugepages);
+
+
+/* Releases the memory of a workspace, which stays usable. */
+void Catena_Free_Workspace(catena_workspace *ws);
+
+
 /* Returns -1 if an an error occurred, otherwise 0. */
 int Catena(const uint8_t *pwd,   const uint32_t pwdlen,
 	   const uint8_t *salt,  const uint8_t  saltlen,
@@ -38,6 +66,18 @@ int Catena(const uint8_t *pwd,   const uint32_t pwdlen,
 	   const uint8_t garlic, const uint8_t hashlen,  uint8_t *hash);
 
 
+/* Same as Catena(), taking the memory from the workspace ws.
+ * Returns -1 if an an error occurred, otherwise 0.
+ */
+int Catena_With_Workspace(catena_workspace *ws,
+			  const uint8_t *pwd,   const uint32_t pwdlen,
+			  const uint8_t *salt,  const uint8_t  saltlen,
+			  const uint8_t *data,  const uint32_t datalen,
+			  const uint8_t lambda, const uint8_t  min_garlic,
+			  const uint8_t garlic, const uint8_t hashlen,
+			  uint8_t *hash);
+
+
 /* API that assumes that the three parameter pwd, salt, and header
  * are all null-terminated string.
  * Returns -1 if an an error occurred, otherwise 0.
@@ -63,6 +103,17 @@ int Catena_Client(const uint8_t *pwd,   const uint32_t pwdlen,
 		  const uint8_t garlic, const uint8_t  hashlen,
 		  uint8_t x[H_LEN]);
 
+/* Same as Catena_Client(), taking the memory from the workspace ws.
+ * Returns -1 if an an error occurred, otherwise 0.
+ */
+int Catena_Client_With_Workspace(catena_workspace *ws,
+				 const uint8_t *pwd,   const uint32_t pwdlen,
+				 const uint8_t *salt,  const uint8_t  saltlen,
+				 const uint8_t *data,  const uint32_t datalen,
+				 const uint8_t lambda, const uint8_t  min_garlic,
+				 const uint8_t garlic, const uint8_t  hashlen,
+				 uint8_t x[H_LEN]);
+
 /*  Computes the final step of the password hashing process. Requieres the
  *  output of Catena_Client(...) as input
  *  Returns -1 if an an error occurred, otherwise 0.
@@ -70,11 +121,47 @@ int Catena_Client(const uint8_t *pwd,   const uint32_t pwdlen,
 int Catena_Server(const uint8_t garlic, const uint8_t x[H_LEN],
 		  const uint8_t hashlen, uint8_t *hash);
 
+/* Catena_Server() for n client outputs x + j*H_LEN with garlic[j], writing
+ * hashlen bytes to hash + j*hashlen. Several are hashed at once.
+ * Returns -1 if an an error occurred, otherwise 0.
+ */
+int Catena_Server_many(const uint32_t n, const uint8_t *garlic,
+		       const uint8_t *x, const uint8_t hashlen, uint8_t *hash);
+
+/* Like Catena_Server_many(), but compares each result with the stored hash
+ * stored + j*hashlen instead, setting ok[j] to 1 if they are equal and to 0
+ * otherwise. The comparisons take the same time whatever the contents.
+ * Returns -1 if an an error occurred, otherwise 0.
+ */
+int Catena_Server_Verify_many(const uint32_t n, const uint8_t *garlic,
+			      const uint8_t *x, const uint8_t hashlen,
+			      const uint8_t *stored, uint8_t *ok);
+
 /* Client independent update form an old hash */
 void CI_Update(const uint8_t *old_hash,  const uint8_t lambda,
 	       const uint8_t old_garlic, const uint8_t new_garlic,
 	       const uint8_t hashlen, uint8_t *new_hash);
 
+/* Same as CI_Update(), taking the memory from the workspace ws.
+ * Returns -1 if an an error occurred, otherwise 0.
+ */
+int CI_Update_With_Workspace(catena_workspace *ws, const uint8_t *old_hash,
+			     const uint8_t lambda,  const uint8_t old_garlic,
+			     const uint8_t new_garlic, const uint8_t hashlen,
+			     uint8_t *new_hash);
+
+
+/* CI_Update() for n hashes old_hash + j*hashlen of garlic old_garlic[j],
+ * writing new_hash + j*hashlen. Runs one thread per workspace of ws, which
+ * the caller keeps across calls so that their memory is reused.
+ * Returns -1 if an an error occurred, otherwise 0.
+ */
+int CI_Update_many(catena_workspace *ws,   const uint32_t threads,
+		   const uint32_t n,       const uint8_t *old_hash,
+		   const uint8_t *old_garlic, const uint8_t lambda,
+		   const uint8_t new_garlic,  const uint8_t hashlen,
+		   uint8_t *new_hash);
+
 
 /* Mode of operation that derives a key from a password */
 void Catena_KG(const uint8_t *pwd,   const uint32_t pwdlen,
@@ -32,4 +32,22 @@ inline void __Hash5(const uint8_t *i1, const uint8_t i1len,
 		    const uint8_t *i4, const uint8_t i4len,
 		    const uint8_t *i5, const uint8_t i5len,
 		    uint8_t hash[H_LEN]);
+
+
+/* Fixed-size variants for the inner loop of LBRH: the hash of exactly H_LEN
+ * bytes, and of exactly 2*H_LEN bytes given as the two halves i1 || i2.
+ * The output may overlap the input.
+ */
+inline void __HashFast1(const uint8_t x[H_LEN], uint8_t hash[H_LEN]);
+
+
+inline void __HashFast2(const uint8_t *i1, const uint8_t *i2,
+			uint8_t hash[H_LEN]);
+
+
+/* hash + j*H_LEN = H(c[j] || x + j*H_LEN) for j < n, where each c[j] is one
+ * byte and each x is H_LEN bytes. Backends may hash several at once.
+ */
+void __Hash2_many(const uint8_t *c, const uint8_t *x, const uint32_t n,
+		  uint8_t *hash);
 #endif
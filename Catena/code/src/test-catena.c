@@ -36,6 +36,7 @@ int main()
   uint8_t hash3[H_LEN];
   uint8_t hash4[H_LEN];
   uint8_t x[H_LEN];
+  catena_workspace ws;
 
   uint8_t key1[H_LEN];
   uint8_t key2[H_LEN/4];
@@ -66,6 +67,14 @@ int main()
   CI_Update(x, lambda, garlic-1, garlic, hashlen, hash3);
   print_hex(hash3, hashlen);
 
+  Catena_Init_Workspace(&ws, CATENA_HUGEPAGES_TRANSPARENT);
+  Catena_With_Workspace(&ws, (uint8_t *) password, strlen(password), salt,
+			SALT_LEN, (uint8_t *) data, strlen(data), lambda,
+			min_garlic, garlic-1, hashlen, x);
+  CI_Update_With_Workspace(&ws, x, lambda, garlic-1, garlic, hashlen, hash3);
+  Catena_Free_Workspace(&ws);
+  print_hex(hash3, hashlen);
+
   Catena((uint8_t *) password, strlen(password) ,salt, SALT_LEN,
 	 (uint8_t *) "", 0, lambda, garlic, garlic, hashlen, hash1);
   print_hex(hash1, hashlen);
@@ -0,0 +1,228 @@
+#define _DEFAULT_SOURCE
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "catena.h"
+
+/* Records read, upgraded and written per round; the checkpoint is
+ * written after each round */
+#define CHUNK 1024
+
+#define MAX_LINE (2 * H_LEN + 16)
+
+
+void usage(const char *name)
+{
+  fprintf(stderr,
+	  "Usage: %s -g new_garlic [-l lambda] [-t threads] [-c checkpoint]"
+	  " input output\n\n"
+	  "Raises the garlic of stored Catena hashes with CI_Update().\n"
+	  "Each line of input is a hash in hex and its garlic, separated by a\n"
+	  "space; output gets the same lines with the new hashes and garlic.\n"
+	  "With -c, progress is saved to the checkpoint file after every %u\n"
+	  "records, and an interrupted run given the same files resumes from\n"
+	  "there.\n", name, CHUNK);
+  exit(EXIT_FAILURE);
+}
+
+/*******************************************************************/
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*******************************************************************/
+
+/* Parses "hex garlic" into hash and *garlic, returns the length of the hash
+ * or -1 if the line is malformed */
+int parse_record(const char *line, uint8_t hash[H_LEN], uint8_t *garlic)
+{
+  unsigned int byte, g;
+  char end;
+  int len = 0, fields;
+
+  while (isxdigit((unsigned char) line[2 * len]) &&
+	 isxdigit((unsigned char) line[2 * len + 1])) {
+    if (len == H_LEN) return -1;
+    sscanf(line + 2 * len, "%2x", &byte);
+    hash[len++] = byte;
+  }
+  if ((len == 0) || (line[2 * len] != ' ')) return -1;
+  /* The last line may lack its newline */
+  fields = sscanf(line + 2 * len, " %u%c", &g, &end);
+  if ((fields < 1) || ((fields == 2) && (end != '\n')) || (g > 63))
+    return -1;
+  *garlic = g;
+  return len;
+}
+
+/* Reads the next non-empty line */
+char *next_record(char line[MAX_LINE + 2], FILE *in, uint64_t *lineno)
+{
+  while (fgets(line, MAX_LINE + 2, in) != NULL) {
+    (*lineno)++;
+    if (line[0] != '\n') return line;
+  }
+  return NULL;
+}
+
+/*******************************************************************/
+
+/* Reads the number of records done and the matching size of the output,
+ * returns 0 if there is no checkpoint yet */
+int read_checkpoint(const char *path, uint64_t *done, long *offset)
+{
+  FILE *f = fopen(path, "r");
+  int found;
+
+  if (f == NULL) return 0;
+  found = (fscanf(f, "%" SCNu64 " %ld", done, offset) == 2);
+  fclose(f);
+  return found;
+}
+
+/* Replaces the checkpoint atomically, once the output it refers to is on
+ * disk */
+int write_checkpoint(const char *path, FILE *out, uint64_t done)
+{
+  char tmp[4096];
+  FILE *f;
+
+  if ((fflush(out) != 0) || (fsync(fileno(out)) != 0)) return -1;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  f = fopen(tmp, "w");
+  if (f == NULL) return -1;
+  fprintf(f, "%" PRIu64 " %ld\n", done, ftell(out));
+  if ((fflush(f) != 0) || (fsync(fileno(f)) != 0)) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  return rename(tmp, path);
+}
+
+/*******************************************************************/
+
+int main(int argc, char **argv)
+{
+  uint8_t old_hash[CHUNK * H_LEN], new_hash[CHUNK * H_LEN];
+  uint8_t old_garlic[CHUNK];
+  char line[MAX_LINE + 2];
+  const char *checkpoint = NULL;
+  catena_workspace *ws;
+  FILE *in, *out;
+  uint64_t done = 0, skip, upgraded = 0, lineno = 0;
+  long offset = 0;
+  double start, elapsed;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int nthreads = (cpus > 0) ? cpus : 1;
+  int new_garlic = -1, lambda = LAMBDA, hashlen = 0, len, opt;
+  uint32_t threads, n, i, j;
+
+  while ((opt = getopt(argc, argv, "g:l:t:c:")) != -1) {
+    switch (opt) {
+    case 'g': new_garlic = atoi(optarg); break;
+    case 'l': lambda = atoi(optarg); break;
+    case 't': nthreads = atoi(optarg); break;
+    case 'c': checkpoint = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if ((optind + 2 != argc) || (new_garlic < 0) || (new_garlic > 63) ||
+      (lambda < 1) || (lambda > 255) || (nthreads < 1))
+    usage(argv[0]);
+  threads = nthreads;
+
+  in = fopen(argv[optind], "r");
+  if (in == NULL) {
+    perror(argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  /* Resume: drop output written after the checkpoint, skip what it covers */
+  if ((checkpoint != NULL) && read_checkpoint(checkpoint, &done, &offset)) {
+    out = fopen(argv[optind + 1], "r+");
+    if ((out == NULL) || (ftruncate(fileno(out), offset) != 0) ||
+	(fseek(out, offset, SEEK_SET) != 0)) {
+      perror(argv[optind + 1]);
+      return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Resuming after %" PRIu64 " records\n", done);
+  }
+  else
+    out = fopen(argv[optind + 1], "w");
+  if (out == NULL) {
+    perror(argv[optind + 1]);
+    return EXIT_FAILURE;
+  }
+
+  ws = malloc(threads * sizeof(catena_workspace));
+  if (ws == NULL) return EXIT_FAILURE;
+  for (i = 0; i < threads; i++)
+    Catena_Init_Workspace(&ws[i], CATENA_HUGEPAGES_TRANSPARENT);
+
+  for (skip = done; skip > 0 && next_record(line, in, &lineno); skip--)
+    ;
+
+  start = now();
+  for (;;) {
+    /* Read a chunk */
+    for (n = 0; n < CHUNK && next_record(line, in, &lineno); n++) {
+      len = parse_record(line, old_hash + n * H_LEN, &old_garlic[n]);
+      if ((len < 0) || ((hashlen != 0) && (len != hashlen))) {
+	fprintf(stderr, "%s:%" PRIu64 ": malformed record\n", argv[optind], lineno);
+	return EXIT_FAILURE;
+      }
+      hashlen = len;
+      /* Packed to hashlen bytes per record, as CI_Update_many() takes them */
+      memmove(old_hash + n * hashlen, old_hash + n * H_LEN, hashlen);
+    }
+    if (n == 0) break;
+
+    if (CI_Update_many(ws, threads, n, old_hash, old_garlic, lambda,
+		       new_garlic, hashlen, new_hash) != 0) {
+      fprintf(stderr, "Not enough memory for garlic %d\n", new_garlic);
+      return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < (uint32_t) hashlen; j++)
+	fprintf(out, "%02x", new_hash[i * hashlen + j]);
+      fprintf(out, " %u\n", (old_garlic[i] < new_garlic) ?
+	      (unsigned) new_garlic : old_garlic[i]);
+    }
+    done += n;
+    upgraded += n;
+    if ((checkpoint != NULL) && (write_checkpoint(checkpoint, out, done) != 0)) {
+      perror(checkpoint);
+      return EXIT_FAILURE;
+    }
+
+    elapsed = now() - start;
+    fprintf(stderr, "\r%" PRIu64 " records, %.1f hashes/s", done,
+	    upgraded / elapsed);
+  }
+
+  elapsed = now() - start;
+  fprintf(stderr, "\nUpgraded %" PRIu64 " records to garlic %d in %.1f s with %u"
+	  " threads, %.1f hashes/s\n", upgraded, new_garlic, elapsed, threads,
+	  (elapsed > 0) ? upgraded / elapsed : 0);
+
+  for (i = 0; i < threads; i++) Catena_Free_Workspace(&ws[i]);
+  free(ws);
+  fclose(in);
+  if (fclose(out) != 0) {
+    perror(argv[optind + 1]);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
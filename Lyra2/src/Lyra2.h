@@ -20,6 +20,8 @@
 #ifndef LYRA2_H_
 #define LYRA2_H_
 
+#include <stddef.h>
+
 typedef unsigned char byte ;
 
 #define BLOCK_LEN_INT64 12                               //Block length: 768 bits (=96 bytes, =12 uint64_t)
@@ -33,8 +35,35 @@ typedef unsigned char byte ;
 #define ROW_LEN_BYTES (ROW_LEN_INT64 * 8)               //Number of bytes per row
 
 
+/*Huge page policies for the memory matrix*/
+#define LYRA2_HUGEPAGES_NONE 0                          //Plain aligned allocation
+#define LYRA2_HUGEPAGES_TRANSPARENT 1                   //Large matrices are mmap'ed and advised with MADV_HUGEPAGE
+#define LYRA2_HUGEPAGES_EXPLICIT 2                      //Large matrices use MAP_HUGETLB if possible, else as above
+
+/*Caller-owned context keeping the memory matrix between calls to LYRA2_ctx*/
+typedef struct {
+    void *matrix;                                       //The memory matrix, 64-byte aligned
+    size_t size;                                        //Number of bytes held in matrix
+    int hugePages;                                      //One of LYRA2_HUGEPAGES_*
+    int mapped;                                         //Whether matrix comes from mmap
+} LYRA2_CTX;
+
+void LYRA2_initCtx(LYRA2_CTX *ctx, int hugePages);
+
+void LYRA2_freeCtx(LYRA2_CTX *ctx);
+
+void *LYRA2_reserve(LYRA2_CTX *ctx, size_t size);
+
+int LYRA2_ctx(LYRA2_CTX *ctx, unsigned char *K, int kLen, const unsigned char *pwd, int pwdlen, const unsigned char *salt, int saltlen, int timeCost, int nRows, int nCols);
+
+int LYRA2_parallel(LYRA2_CTX *ctx, unsigned char *K, int kLen, const unsigned char *pwd, int pwdlen, const unsigned char *salt, int saltlen, int timeCost, int nRows, int nCols, int p);
+
 int LYRA2(unsigned char *K, int kLen, const unsigned char *pwd, int pwdlen, const unsigned char *salt, int saltlen, int timeCost, int nRows, int nCols);
 
+int LYRA2_multi(unsigned char * const *K, int kLen, const unsigned char * const *pwd, const int *pwdlen, const unsigned char * const *salt, const int *saltlen, int timeCost, int nRows, int nCols, int count);
+
+int LYRA2_multiLanes(void);
+
 int PHS(void *out, size_t outlen, const void *in, size_t inlen, const void *salt, size_t saltlen, unsigned int t_cost, unsigned int m_cost);
 
 #endif /* LYRA2_H_ */
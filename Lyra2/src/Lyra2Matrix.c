@@ -0,0 +1,114 @@
+/**
+ * Allocation of the Lyra2 memory matrix, kept in a caller-owned context so that
+ * back-to-back hashes can reuse it.
+ *
+ * This software is hereby placed in the public domain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include "Lyra2.h"
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+#define MATRIX_ALIGN 64                                 //Alignment of the matrix: one cache line
+#define HUGE_PAGE_SIZE (2UL << 20)                      //Huge page size assumed when rounding mmap'ed regions
+
+/**
+ * Initializes an empty context. No memory is reserved until the first hash.
+ *
+ * @param ctx           The context to be initialized
+ * @param hugePages     LYRA2_HUGEPAGES_NONE, LYRA2_HUGEPAGES_TRANSPARENT or LYRA2_HUGEPAGES_EXPLICIT
+ */
+void LYRA2_initCtx(LYRA2_CTX *ctx, int hugePages) {
+    ctx->matrix = NULL;
+    ctx->size = 0;
+    ctx->hugePages = hugePages;
+    ctx->mapped = 0;
+}
+
+/**
+ * Releases the memory held by a context, leaving it empty but usable.
+ *
+ * @param ctx           The context whose memory is released
+ */
+void LYRA2_freeCtx(LYRA2_CTX *ctx) {
+    if (ctx->matrix != NULL) {
+#if defined(MAP_ANONYMOUS)
+        if (ctx->mapped) {
+            munmap(ctx->matrix, ctx->size);
+        } else
+#endif
+        free(ctx->matrix);
+    }
+    ctx->matrix = NULL;
+    ctx->size = 0;
+    ctx->mapped = 0;
+}
+
+/**
+ * Makes sure the context holds at least "size" bytes, aligned to 64 bytes. The memory already
+ * held is reused whenever it is large enough, so its pages stay faulted in from one hash to the next.
+ * Regions of at least one huge page are mapped with MAP_HUGETLB if LYRA2_HUGEPAGES_EXPLICIT was
+ * requested, falling back to normal pages advised with MADV_HUGEPAGE, if the kernel has none to spare.
+ *
+ * @param ctx           The context
+ * @param size          Number of bytes needed
+ *
+ * @return A pointer to the matrix, or NULL if there is not enough memory
+ */
+void *LYRA2_reserve(LYRA2_CTX *ctx, size_t size) {
+    if (ctx->matrix != NULL && ctx->size >= size) {
+        return ctx->matrix;
+    }
+    LYRA2_freeCtx(ctx);
+
+#if defined(MAP_ANONYMOUS)
+    if (ctx->hugePages != LYRA2_HUGEPAGES_NONE && size >= HUGE_PAGE_SIZE) {
+        size_t mapSize = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void *p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+        if (ctx->hugePages == LYRA2_HUGEPAGES_EXPLICIT) {
+            p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+#endif
+        if (p == MAP_FAILED) {
+            p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if defined(MADV_HUGEPAGE)
+            if (p != MAP_FAILED) {
+                madvise(p, mapSize, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        if (p != MAP_FAILED) {
+            ctx->matrix = p;
+            ctx->size = mapSize;
+            ctx->mapped = 1;
+            return p;
+        }
+    }
+#endif
+
+    if (posix_memalign(&ctx->matrix, MATRIX_ALIGN, size) != 0) {
+        ctx->matrix = NULL;
+        return NULL;
+    }
+    ctx->size = size;
+    return ctx->matrix;
+}
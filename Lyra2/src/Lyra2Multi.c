@@ -0,0 +1,522 @@
+/**
+ * Multi-lane implementation of the Lyra2 Password Hashing Scheme (PHS): hashes
+ * several passwords at once, one per SIMD lane.
+ *
+ * This software is hereby placed in the public domain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS ''AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <immintrin.h>
+#include "Lyra2.h"
+
+//Each 64-bit word of the sponge state and of the memory matrix holds one word of
+//LYRA2_LANES independent Lyra2 instances: 8 with AVX-512, 4 with AVX2, 2 with SSE2.
+//The 8 AVX-512 lanes are only used when built with -DLYRA2_MULTI_AVX512, and an -mavx512f build
+//uses the AVX2 lanes otherwise: 8 lanes need twice the memory of 4, and on large matrices the
+//extra memory traffic costs more than the wider vectors gain, down to below LYRA2 itself. The 4
+//AVX2 lanes stayed ahead of LYRA2 at every size measured
+#if defined(__AVX512F__) && defined(LYRA2_MULTI_AVX512)
+#define LYRA2_LANES 8
+typedef __m512i lane_t;
+#define LANE_XOR(a, b) _mm512_xor_si512(a, b)
+#define LANE_AND(a, b) _mm512_and_si512(a, b)
+#define LANE_ANDNOT(a, b) _mm512_andnot_si512(a, b)
+#define LANE_ADD(a, b) _mm512_add_epi64(a, b)
+#define LANE_ROTR(a, c) _mm512_ror_epi64(a, c)
+#define LANE_SET1(x) _mm512_set1_epi64((long long) (x))
+#elif defined(__AVX2__)
+#define LYRA2_LANES 4
+typedef __m256i lane_t;
+#define LANE_XOR(a, b) _mm256_xor_si256(a, b)
+#define LANE_AND(a, b) _mm256_and_si256(a, b)
+#define LANE_ANDNOT(a, b) _mm256_andnot_si256(a, b)
+#define LANE_ADD(a, b) _mm256_add_epi64(a, b)
+#define LANE_ROTR(a, c) _mm256_or_si256(_mm256_srli_epi64(a, c), _mm256_slli_epi64(a, 64 - (c)))
+#define LANE_SET1(x) _mm256_set1_epi64x((long long) (x))
+#else
+#define LYRA2_LANES 2
+typedef __m128i lane_t;
+#define LANE_XOR(a, b) _mm_xor_si128(a, b)
+#define LANE_AND(a, b) _mm_and_si128(a, b)
+#define LANE_ANDNOT(a, b) _mm_andnot_si128(a, b)
+#define LANE_ADD(a, b) _mm_add_epi64(a, b)
+#define LANE_ROTR(a, c) _mm_or_si128(_mm_srli_epi64(a, c), _mm_slli_epi64(a, 64 - (c)))
+#define LANE_SET1(x) _mm_set1_epi64x((long long) (x))
+#endif
+
+//Access to the individual lanes of a word
+typedef union {
+    lane_t v;
+    uint64_t w[LYRA2_LANES];
+} lanes_t;
+
+//Each column of the memory matrix holds its BLOCK_LEN_INT64 words for every lane, in groups of
+//LANE_GROUP lanes: word j of lane l is at LANE_OFFSET(l) + j * LANE_GROUP. With AVX-512, a whole
+//lane_t fills a cache line, so each word of a lane's row* would sit in a line of its own; groups
+//of 2 lanes keep 4 words of a lane's row* per line, for a few more shuffles per load and store
+#if LYRA2_LANES == 8
+#define LANE_GROUP 2
+#else
+#define LANE_GROUP LYRA2_LANES
+#endif
+#define LANE_OFFSET(l) ((l) / LANE_GROUP * BLOCK_LEN_INT64 * LANE_GROUP + (l) % LANE_GROUP)
+#define COL_WORDS (BLOCK_LEN_INT64 * LYRA2_LANES)
+
+/*Address of row r of the matrix m, whose rows have c columns*/
+#define ROW_LANES(m, r, c) ((m) + (size_t) (r) * COL_WORDS * (c))
+
+/*Word j of all lanes, in the column starting at col*/
+static inline lane_t loadWord(const uint64_t *col, int j) {
+#if LANE_GROUP == LYRA2_LANES
+    return ((const lane_t *) col)[j];
+#else
+    const __m128i *g = (const __m128i *) col + j;
+    __m256i lo = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128(g)),
+            _mm_load_si128(g + BLOCK_LEN_INT64), 1);
+    __m256i hi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128(g + 2 * BLOCK_LEN_INT64)),
+            _mm_load_si128(g + 3 * BLOCK_LEN_INT64), 1);
+    return _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+#endif
+}
+
+/*Stores v as word j of all lanes, in the column starting at col*/
+static inline void storeWord(uint64_t *col, int j, lane_t v) {
+#if LANE_GROUP == LYRA2_LANES
+    ((lane_t *) col)[j] = v;
+#else
+    __m128i *g = (__m128i *) col + j;
+    _mm_store_si128(g, _mm512_castsi512_si128(v));
+    _mm_store_si128(g + BLOCK_LEN_INT64, _mm512_extracti32x4_epi32(v, 1));
+    _mm_store_si128(g + 2 * BLOCK_LEN_INT64, _mm512_extracti32x4_epi32(v, 2));
+    _mm_store_si128(g + 3 * BLOCK_LEN_INT64, _mm512_extracti32x4_epi32(v, 3));
+#endif
+}
+
+static const uint64_t blake2b_IV_multi[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+/*Blake2b's G function, on all lanes at once*/
+#define G_LANES(a,b,c,d) \
+  do { \
+    a = LANE_ADD(a, b); \
+    d = LANE_ROTR(LANE_XOR(d, a), 32); \
+    c = LANE_ADD(c, d); \
+    b = LANE_ROTR(LANE_XOR(b, c), 24); \
+    a = LANE_ADD(a, b); \
+    d = LANE_ROTR(LANE_XOR(d, a), 16); \
+    c = LANE_ADD(c, d); \
+    b = LANE_ROTR(LANE_XOR(b, c), 63); \
+  } while(0)
+
+/*One Round of the Blake2b's compression function, on all lanes at once*/
+#define ROUND_LYRA_LANES(v) \
+    G_LANES(v[ 0],v[ 4],v[ 8],v[12]); \
+    G_LANES(v[ 1],v[ 5],v[ 9],v[13]); \
+    G_LANES(v[ 2],v[ 6],v[10],v[14]); \
+    G_LANES(v[ 3],v[ 7],v[11],v[15]); \
+    G_LANES(v[ 0],v[ 5],v[10],v[15]); \
+    G_LANES(v[ 1],v[ 6],v[11],v[12]); \
+    G_LANES(v[ 2],v[ 7],v[ 8],v[13]); \
+    G_LANES(v[ 3],v[ 4],v[ 9],v[14]);
+
+static inline void blake2bLyraLanes(lane_t *v) {
+    int i;
+    for (i = 0; i < 12; i++) {
+        ROUND_LYRA_LANES(v);
+    }
+}
+
+static inline void reducedBlake2bLyraLanes(lane_t *v) {
+    ROUND_LYRA_LANES(v);
+}
+
+/**
+ * Absorbs one block per lane, but only changes the state of lanes whose mask is all ones.
+ * This lets lanes with passwords of different lengths absorb different numbers of blocks.
+ *
+ * @param state     The current state of the sponges
+ * @param in        The block to be absorbed (BLOCK_LEN_INT64 words)
+ * @param mask      All ones for lanes that absorb this block, zero for the others
+ */
+static void absorbBlockMasked(lane_t *state, const lane_t *in, lane_t mask) {
+    lane_t v[16];
+    int i;
+    for (i = 0; i < 16; i++) {
+        v[i] = i < BLOCK_LEN_INT64 ? LANE_XOR(state[i], in[i]) : state[i];
+    }
+    blake2bLyraLanes(v);
+    for (i = 0; i < 16; i++) {
+        state[i] = LANE_XOR(LANE_AND(mask, v[i]), LANE_ANDNOT(mask, state[i]));
+    }
+}
+
+/**
+ * Multi-lane version of reducedSqueezeRow.
+ */
+static void reducedSqueezeRowLanes(lane_t *state, uint64_t *row, int nCols) {
+    int i, j;
+    for (i = 0; i < nCols; i++) {
+        for (j = 0; j < BLOCK_LEN_INT64; j++) {
+            storeWord(row, j, state[j]);
+        }
+        row += COL_WORDS;
+        reducedBlake2bLyraLanes(state);
+    }
+}
+
+/**
+ * Multi-lane version of reducedDuplexRowSetup. All lanes use the same three rows.
+ */
+static void reducedDuplexRowSetupLanes(lane_t *state, const uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols) {
+    int i, j;
+    for (i = 0; i < nCols; i++) {
+        lane_t inOut[BLOCK_LEN_INT64];
+
+        //Absorbing "M[rowInOut] XOR M[rowIn]"
+        for (j = 0; j < BLOCK_LEN_INT64; j++) {
+            inOut[j] = loadWord(rowInOut, j);
+            state[j] = LANE_XOR(state[j], LANE_XOR(inOut[j], loadWord(rowIn, j)));
+        }
+
+        reducedBlake2bLyraLanes(state);
+
+        //M[rowOut][col] = rand; M[rowInOut][col] = M[rowInOut][col] XOR rotW(rand)
+        for (j = 0; j < BLOCK_LEN_INT64; j++) {
+            storeWord(rowOut, j, state[j]);
+            storeWord(rowInOut, j, LANE_XOR(inOut[j], state[(j + BLOCK_LEN_INT64 - 1) % BLOCK_LEN_INT64]));
+        }
+
+        rowInOut += COL_WORDS;
+        rowIn += COL_WORDS;
+        rowOut += COL_WORDS;
+    }
+}
+
+/**
+ * Loads word idx.w[l] of base into lane l, for every lane.
+ */
+static inline lane_t gatherLanes(const uint64_t *base, lanes_t idx) {
+#if LYRA2_LANES == 8
+    return _mm512_i64gather_epi64(idx.v, (const void *) base, 8);
+#elif LYRA2_LANES == 4
+    return _mm256_i64gather_epi64((const long long *) base, idx.v, 8);
+#else
+    lanes_t r;
+    int l;
+    for (l = 0; l < LYRA2_LANES; l++) {
+        r.w[l] = base[idx.w[l]];
+    }
+    return r.v;
+#endif
+}
+
+/**
+ * Stores lane l of v into word idx.w[l] of base, for every lane.
+ */
+static inline void scatterLanes(uint64_t *base, lanes_t idx, lane_t v) {
+#if LYRA2_LANES == 8
+    _mm512_i64scatter_epi64((void *) base, idx.v, v, 8);
+#else
+    lanes_t r;
+    int l;
+    r.v = v;
+    for (l = 0; l < LYRA2_LANES; l++) {
+        base[idx.w[l]] = r.w[l];
+    }
+#endif
+}
+
+/**
+ * Multi-lane version of reducedDuplexRow. rowIn and rowOut are the same for all lanes,
+ * but each lane picks its own row*, so row* is gathered from the matrix through per-lane
+ * word offsets. As in reducedDuplexRow, row* is re-read and updated after rowOut, so the
+ * result is the same when row* is the same row as rowOut.
+ *
+ * @param state     The current state of the sponges
+ * @param matrix    The memory matrix
+ * @param rowInOut  Offset, in 64-bit words, of the first word of lane l of row* in the matrix
+ * @param rowIn     Row to feed the sponges
+ * @param rowOut    Row receiving the output
+ * @param nCols     Number of columns of the memory matrix
+ */
+static void reducedDuplexRowLanes(lane_t *state, uint64_t *matrix, lanes_t rowInOut, const uint64_t *rowIn, uint64_t *rowOut, int nCols) {
+    int i, j;
+    lane_t step = LANE_SET1(LANE_GROUP);
+    lane_t colStep = LANE_SET1(COL_WORDS);
+    for (i = 0; i < nCols; i++) {
+        lanes_t idx = rowInOut;
+
+        //Absorbing "M[rowInOut] XOR M[rowIn]"
+        for (j = 0; j < BLOCK_LEN_INT64; j++) {
+            state[j] = LANE_XOR(state[j], LANE_XOR(gatherLanes(matrix, idx), loadWord(rowIn, j)));
+            idx.v = LANE_ADD(idx.v, step);
+        }
+
+        reducedBlake2bLyraLanes(state);
+
+        //M[rowOut][col] = M[rowOut][col] XOR rand
+        for (j = 0; j < BLOCK_LEN_INT64; j++) {
+            storeWord(rowOut, j, LANE_XOR(loadWord(rowOut, j), state[j]));
+        }
+
+        //M[rowInOut][col] = M[rowInOut][col] XOR rotW(rand)
+        idx = rowInOut;
+        for (j = 0; j < BLOCK_LEN_INT64; j++) {
+            lane_t rot = state[(j + BLOCK_LEN_INT64 - 1) % BLOCK_LEN_INT64];
+            scatterLanes(matrix, idx, LANE_XOR(gatherLanes(matrix, idx), rot));
+            idx.v = LANE_ADD(idx.v, step);
+        }
+
+        rowInOut.v = LANE_ADD(rowInOut.v, colStep);
+        rowIn += COL_WORDS;
+        rowOut += COL_WORDS;
+    }
+}
+
+/**
+ * Writes pad(pwd || salt || basil) into "input", exactly as LYRA2 lays it out in the memory matrix.
+ *
+ * @return The number of blocks of padded input
+ */
+static int padInput(uint64_t *input, int maxBlocks, int kLen, const unsigned char *pwd, int pwdlen,
+        const unsigned char *salt, int saltlen, int timeCost, int nRows, int nCols) {
+    int nBlocksInput = ((saltlen + pwdlen + 6 * sizeof (int)) / BLOCK_LEN_BYTES) + 1;
+    int basil[6];
+    byte *ptrByte = (byte*) input;
+
+    basil[0] = kLen;
+    basil[1] = pwdlen;
+    basil[2] = saltlen;
+    basil[3] = timeCost;
+    basil[4] = nRows;
+    basil[5] = nCols;
+
+    memset(ptrByte, 0, maxBlocks * BLOCK_LEN_BYTES);
+    memcpy(ptrByte, pwd, pwdlen);
+    ptrByte += pwdlen;
+    memcpy(ptrByte, salt, saltlen);
+    ptrByte += saltlen;
+    memcpy(ptrByte, basil, sizeof (basil));
+    ptrByte += sizeof (basil);
+    *ptrByte = 0x80;
+    ((byte*) input)[nBlocksInput * BLOCK_LEN_BYTES - 1] ^= 0x01;
+
+    return nBlocksInput;
+}
+
+/**
+ * Runs LYRA2 on exactly LYRA2_LANES passwords. See LYRA2_multi.
+ */
+static int lyra2Lanes(unsigned char * const *K, int kLen, const unsigned char * const *pwd, const int *pwdlen,
+        const unsigned char * const *salt, const int *saltlen, int timeCost, int nRows, int nCols,
+        uint64_t *matrix) {
+
+    //============================= Basic variables ============================//
+    int row = 2; //index of row to be processed
+    int prev = 1; //index of prev (last row ever computed/modified)
+    int rowa = 0; //index of row* (the same for all lanes during Setup)
+    int tau; //Time Loop iterator
+    int i, j, l; //auxiliary iteration counters
+    lane_t state[16];
+    lanes_t *stateLanes = (lanes_t *) state;
+    lanes_t rowaIndex; //row* of each lane during Wandering
+    lanes_t rowaOffset; //offset of the first word of each lane's row*
+    //==========================================================================/
+
+    //============= Getting the password + salt + basil padded with 10*1 ===============//
+    int maxBlocks = 0;
+    int nBlocksInput[LYRA2_LANES];
+    for (l = 0; l < LYRA2_LANES; l++) {
+        int n = ((saltlen[l] + pwdlen[l] + 6 * sizeof (int)) / BLOCK_LEN_BYTES) + 1;
+        if (n > maxBlocks) {
+            maxBlocks = n;
+        }
+    }
+    uint64_t *input = malloc((size_t) LYRA2_LANES * maxBlocks * BLOCK_LEN_BYTES);
+    if (input == NULL) {
+        return -1;
+    }
+    for (l = 0; l < LYRA2_LANES; l++) {
+        nBlocksInput[l] = padInput(input + (size_t) l * maxBlocks * BLOCK_LEN_INT64, maxBlocks, kLen,
+                pwd[l], pwdlen[l], salt[l], saltlen[l], timeCost, nRows, nCols);
+    }
+    //==========================================================================/
+
+    //======================= Initializing the Sponge State ====================//
+    for (i = 0; i < 16; i++) {
+        state[i] = LANE_SET1(i < 8 ? 0 : blake2b_IV_multi[i - 8]);
+    }
+    //==========================================================================/
+
+    //================================ Setup Phase =============================//
+    //Absorbing salt, password and basil; lanes with shorter inputs sit out the last blocks
+    for (i = 0; i < maxBlocks; i++) {
+        lanes_t block[BLOCK_LEN_INT64], mask;
+        for (l = 0; l < LYRA2_LANES; l++) {
+            const uint64_t *in = input + ((size_t) l * maxBlocks + i) * BLOCK_LEN_INT64;
+            for (j = 0; j < BLOCK_LEN_INT64; j++) {
+                block[j].w[l] = in[j];
+            }
+            mask.w[l] = i < nBlocksInput[l] ? ~(uint64_t) 0 : 0;
+        }
+        absorbBlockMasked(state, (lane_t *) block, mask.v);
+        memset(block, 0, sizeof (block));
+    }
+    memset(input, 0, (size_t) LYRA2_LANES * maxBlocks * BLOCK_LEN_BYTES);
+    free(input);
+
+    //Initializes M[0] and M[1]
+    reducedSqueezeRowLanes(state, ROW_LANES(matrix, 0, nCols), nCols);
+    reducedSqueezeRowLanes(state, ROW_LANES(matrix, 1, nCols), nCols);
+
+    do {
+        //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
+        reducedDuplexRowSetupLanes(state, ROW_LANES(matrix, prev, nCols),
+                ROW_LANES(matrix, rowa, nCols), ROW_LANES(matrix, row, nCols), nCols);
+
+        rowa--;
+        if (rowa < 0) {
+            rowa = prev;
+        }
+        prev = row;
+        row++;
+    } while (row < nRows);
+    //==========================================================================/
+
+    //============================ Wandering Phase =============================//
+    int maxIndex = nRows - 1;
+    for (l = 0; l < LYRA2_LANES; l++) {
+        rowaIndex.w[l] = rowa;
+    }
+    for (tau = 1; tau <= timeCost; tau++) {
+        //Odd iterations go from the last row down to 0, even ones from 0 up
+        int step = (tau & 1) ? -1 : 1;
+        row = (tau & 1) ? maxIndex : 0;
+        prev = (tau & 1) ? 0 : maxIndex;
+        do {
+            for (l = 0; l < LYRA2_LANES; l++) {
+                rowaIndex.w[l] = ((unsigned int) (stateLanes[0].w[l] ^ prev)) % nRows;
+                rowaOffset.w[l] = rowaIndex.w[l] * COL_WORDS * nCols + LANE_OFFSET(l);
+            }
+
+            reducedDuplexRowLanes(state, matrix, rowaOffset,
+                    ROW_LANES(matrix, prev, nCols), ROW_LANES(matrix, row, nCols), nCols);
+
+            prev = row;
+            row += step;
+        } while (row >= 0 && row <= maxIndex);
+    }
+    //==========================================================================/
+
+    //============================ Wrap-up Phase ===============================//
+    //Absorbs the last block of row* of each lane
+    {
+        lanes_t block[BLOCK_LEN_INT64], all;
+        for (l = 0; l < LYRA2_LANES; l++) {
+            const uint64_t *src = ROW_LANES(matrix, rowaIndex.w[l], nCols) + LANE_OFFSET(l);
+            for (j = 0; j < BLOCK_LEN_INT64; j++) {
+                block[j].w[l] = src[j * LANE_GROUP];
+            }
+            all.w[l] = ~(uint64_t) 0;
+        }
+        absorbBlockMasked(state, (lane_t *) block, all.v);
+    }
+
+    //Squeezes the keys
+    for (i = 0; i < kLen; i += BLOCK_LEN_BYTES) {
+        int len = kLen - i < BLOCK_LEN_BYTES ? kLen - i : BLOCK_LEN_BYTES;
+        for (l = 0; l < LYRA2_LANES; l++) {
+            uint64_t words[BLOCK_LEN_INT64];
+            for (j = 0; j < BLOCK_LEN_INT64; j++) {
+                words[j] = stateLanes[j].w[l];
+            }
+            memcpy(K[l] + i, words, len);
+        }
+        if (len == BLOCK_LEN_BYTES) {
+            blake2bLyraLanes(state);
+        }
+    }
+    //==========================================================================/
+
+    memset(state, 0, sizeof (state));
+    return 0;
+}
+
+/**
+ * Number of passwords LYRA2_multi hashes at once on this build.
+ */
+int LYRA2_multiLanes(void) {
+    return LYRA2_LANES;
+}
+
+/**
+ * Executes LYRA2 on count passwords, LYRA2_multiLanes() of them at a time in parallel SIMD
+ * lanes. K[i] receives the same key as LYRA2(K[i], kLen, pwd[i], pwdlen[i], salt[i],
+ * saltlen[i], timeCost, nRows, nCols). kLen, timeCost and nRows are shared by all passwords.
+ * Memory use is LYRA2_multiLanes() times that of LYRA2.
+ *
+ * @return 0 if the keys are generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+ */
+int LYRA2_multi(unsigned char * const *K, int kLen, const unsigned char * const *pwd, const int *pwdlen,
+        const unsigned char * const *salt, const int *saltlen, int timeCost, int nRows, int nCols, int count) {
+    unsigned char *laneK[LYRA2_LANES];
+    const unsigned char *lanePwd[LYRA2_LANES], *laneSalt[LYRA2_LANES];
+    int lanePwdlen[LYRA2_LANES], laneSaltlen[LYRA2_LANES];
+    unsigned char *spareK;
+    LYRA2_CTX ctx;
+    void *matrix;
+    int i, l, result = 0;
+
+    if (count <= 0) {
+        return 0;
+    }
+    if (nRows < 3 || nCols < 1 || kLen <= 0) {
+        return -1;
+    }
+    LYRA2_initCtx(&ctx, LYRA2_HUGEPAGES_TRANSPARENT);
+    matrix = LYRA2_reserve(&ctx, (size_t) nRows * BLOCK_LEN_BYTES * nCols * LYRA2_LANES);
+    if (matrix == NULL) {
+        return -1;
+    }
+    spareK = malloc(kLen);
+    if (spareK == NULL) {
+        LYRA2_freeCtx(&ctx);
+        return -1;
+    }
+
+    for (i = 0; i < count && result == 0; i += LYRA2_LANES) {
+        //A short last group repeats its first password in the unused lanes
+        for (l = 0; l < LYRA2_LANES; l++) {
+            int src = i + l < count ? i + l : i;
+            laneK[l] = i + l < count ? K[i + l] : spareK;
+            lanePwd[l] = pwd[src];
+            lanePwdlen[l] = pwdlen[src];
+            laneSalt[l] = salt[src];
+            laneSaltlen[l] = saltlen[src];
+        }
+        result = lyra2Lanes(laneK, kLen, lanePwd, lanePwdlen, laneSalt, laneSaltlen,
+                timeCost, nRows, nCols, matrix);
+    }
+
+    memset(spareK, 0, kLen);
+    free(spareK);
+    LYRA2_freeCtx(&ctx);
+    return result;
+}
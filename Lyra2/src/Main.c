@@ -17,12 +17,20 @@
  * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 #include "Lyra2.h"
 #include "Sponge.h"
 
@@ -31,8 +39,9 @@
  *
  * @param t Parameter to determine the processing time (T)
  * @param r  Memory cost parameter (defines the number of rows of the memory matrix, R)
+ * @param p  Number of parallel lanes (1 for the sequential LYRA2)
  */
-int testVectors(unsigned int  t, unsigned int  r) {
+int testVectors(unsigned int  t, unsigned int  r, int p) {
     //=================== Basic variables, with default values =======================//
     int kLen = 64;
     unsigned char *pwd;
@@ -46,7 +55,15 @@ int testVectors(unsigned int  t, unsigned int  r) {
     int indexSalt = 0;
     //==========================================================================/
 
-    unsigned char *K = malloc(kLen);
+    unsigned char *K;
+    LYRA2_CTX ctx;
+
+    if (p < 1 || r % p != 0 || r / p < 3) {
+        printf("The number of rows must be a multiple of p, with at least 3 rows per lane\n");
+        return 1;
+    }
+    K = malloc(kLen);
+    LYRA2_initCtx(&ctx, LYRA2_HUGEPAGES_TRANSPARENT);
 
     /* Generating vectors with the input size varying from 0 to 128 bytes,
      * and values varying from 0 to 127. The salt size is fixed in 16 bytes, 
@@ -68,11 +85,21 @@ int testVectors(unsigned int  t, unsigned int  r) {
         if (indexSalt == saltLen)
             indexSalt = 0;
 
-        PHS(K, kLen, pwd, pwdLen, salt, saltLen, t, r);
+        if (LYRA2_parallel(&ctx, K, kLen, pwd, pwdLen, salt, saltLen, t, r, N_COLS, p) != 0) {
+            fprintf(stderr, "LYRA2_parallel failed (inlen %d)\n", pwdLen);
+            free(pwd);
+            free(salt);
+            free(K);
+            LYRA2_freeCtx(&ctx);
+            return 1;
+        }
 
         printf("\ninlen: %d\n", pwdLen);
         printf("t_cost: %d\n", t);
         printf("m_cost: %d\n", r);
+        if (p > 1) {
+            printf("parallelism: %d\n", p);
+        }
         printf("outlen: %d\n", kLen);
 
         printf("In: ");
@@ -114,11 +141,21 @@ int testVectors(unsigned int  t, unsigned int  r) {
         if (indexSalt == saltLen)
             indexSalt = 0;
 
-        PHS(K, kLen, pwd, pwdLen, salt, saltLen, t, r);
+        if (LYRA2_parallel(&ctx, K, kLen, pwd, pwdLen, salt, saltLen, t, r, N_COLS, p) != 0) {
+            fprintf(stderr, "LYRA2_parallel failed (inlen %d)\n", pwdLen);
+            free(pwd);
+            free(salt);
+            free(K);
+            LYRA2_freeCtx(&ctx);
+            return 1;
+        }
 
         printf("\ninlen: %d\n", pwdLen);
         printf("t_cost: %d\n", t);
         printf("m_cost: %d\n", r);
+        if (p > 1) {
+            printf("parallelism: %d\n", p);
+        }
         printf("outlen: %d\n", kLen);
 
         printf("In: ");
@@ -139,6 +176,250 @@ int testVectors(unsigned int  t, unsigned int  r) {
         }
         printf("\n");
     }
+    LYRA2_freeCtx(&ctx);
+    return 0;
+}
+
+/**
+ * Checks LYRA2_multi against LYRA2 on a batch of passwords and compares their speed.
+ *
+ * @param t Parameter to determine the processing time (T)
+ * @param r  Memory cost parameter (defines the number of rows of the memory matrix, R)
+ * @param n  Number of passwords in the batch
+ */
+int testMulti(unsigned int t, unsigned int r, int n) {
+    int kLen = 64;
+    int saltLen = 16;
+    int i, j;
+    struct timeval start, end;
+    double single, multi;
+
+    unsigned char **pwd = malloc(n * sizeof (unsigned char*));
+    unsigned char **salt = malloc(n * sizeof (unsigned char*));
+    unsigned char **K = malloc(n * sizeof (unsigned char*));
+    int *pwdLen = malloc(n * sizeof (int));
+    int *saltLens = malloc(n * sizeof (int));
+    unsigned char *ref = malloc(kLen);
+
+    //Passwords of varying length, so that lanes absorb different numbers of blocks
+    for (i = 0; i < n; i++) {
+        pwdLen[i] = i % 129;
+        saltLens[i] = saltLen;
+        pwd[i] = malloc(pwdLen[i] + 1);
+        salt[i] = malloc(saltLen);
+        K[i] = malloc(kLen);
+        for (j = 0; j < pwdLen[i]; j++) {
+            pwd[i][j] = j + i;
+        }
+        for (j = 0; j < saltLen; j++) {
+            salt[i][j] = saltLen * (i % 16) + j;
+        }
+    }
+
+    gettimeofday(&start, NULL);
+    if (LYRA2_multi(K, kLen, (const unsigned char * const *) pwd, pwdLen, (const unsigned char * const *) salt,
+            saltLens, t, r, N_COLS, n) != 0) {
+        printf("LYRA2_multi failed\n");
+        return 1;
+    }
+    gettimeofday(&end, NULL);
+    multi = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        LYRA2(ref, kLen, pwd[i], pwdLen[i], salt[i], saltLen, t, r, N_COLS);
+        if (memcmp(ref, K[i], kLen) != 0) {
+            printf("Mismatch between LYRA2 and LYRA2_multi for password %d\n", i);
+            return 1;
+        }
+    }
+    gettimeofday(&end, NULL);
+    single = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    printf("Lanes: %d\n", LYRA2_multiLanes());
+    printf("LYRA2:       %.1f hashes/s\n", n / single);
+    printf("LYRA2_multi: %.1f hashes/s\n", n / multi);
+
+    for (i = 0; i < n; i++) {
+        free(pwd[i]);
+        free(salt[i]);
+        free(K[i]);
+    }
+    free(pwd);
+    free(salt);
+    free(K);
+    free(pwdLen);
+    free(saltLens);
+    free(ref);
+    return 0;
+}
+
+/**
+ * Measures the time per row of the Wandering phase, as the difference between runs with timeCost = t
+ * and timeCost = 0, divided by the number of rows visited.
+ */
+static double wanderingNsPerRow(unsigned int t, unsigned int r, int reps) {
+    unsigned char K[64];
+    struct timeval start, end;
+    double elapsed[2];
+    int pass, i;
+    LYRA2_CTX ctx;
+
+    //The matrix is allocated once, so that page faults do not add to the timings
+    LYRA2_initCtx(&ctx, LYRA2_HUGEPAGES_TRANSPARENT);
+    for (pass = 0; pass < 2; pass++) {
+        unsigned int tCost = pass == 0 ? t : 0;
+        gettimeofday(&start, NULL);
+        for (i = 0; i < reps; i++) {
+            LYRA2_ctx(&ctx, K, sizeof (K), (const unsigned char *) "Lyra sponge", 11, (const unsigned char *) "saltsaltsaltsalt", 16, tCost, r, N_COLS);
+        }
+        gettimeofday(&end, NULL);
+        elapsed[pass] = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_usec - start.tv_usec) * 1e3;
+    }
+    LYRA2_freeCtx(&ctx);
+    return (elapsed[0] - elapsed[1]) / ((double) reps * t * r);
+}
+
+/**
+ * Compares the Wandering phase for nRows = r, a power of 2 (row* picked with a mask), and for
+ * nRows = r + 1 (row* picked with a division). Build with -DLYRA2_NO_PREFETCH to see the effect of
+ * the prefetches alone.
+ *
+ * @param t Parameter to determine the processing time (T)
+ * @param r  Number of rows, a power of 2
+ */
+int benchWandering(unsigned int t, unsigned int r) {
+    int reps;
+    double pow2, generic;
+
+    if (t == 0 || r < 4 || (r & (r - 1)) != 0) {
+        printf("benchWandering needs tCost > 0 and nRows a power of 2, at least 4\n");
+        return 1;
+    }
+    //Roughly 2^26 row visits in total, whatever the parameters
+    reps = (int) ((1 << 26) / ((unsigned long) N_COLS * r * (t + 1))) + 1;
+
+    wanderingNsPerRow(t, r, 1);
+    pow2 = wanderingNsPerRow(t, r, reps);
+    generic = wanderingNsPerRow(t, r + 1, reps);
+
+    printf("Wandering phase, C = %d, T = %u, %d runs\n", N_COLS, t, reps);
+    printf("R = %u (mask):     %.1f ns/row\n", r, pow2);
+    printf("R = %u (division): %.1f ns/row\n", r + 1, generic);
+    printf("Gain: %.1f ns/row (%.1f%%)\n", generic - pow2, 100.0 * (generic - pow2) / generic);
+    return 0;
+}
+
+#if defined(__linux__)
+/**
+ * Opens a counter of the given hardware event for this process, or returns -1 if the kernel
+ * does not allow it (e.g., no PMU in a virtual machine, or perf_event_paranoid too high).
+ */
+static int openCounter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void startCounter(int fd) {
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static double stopCounter(int fd) {
+    uint64_t count = 0;
+    if (fd < 0) {
+        return -1;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof (count)) != sizeof (count)) {
+        return -1;
+    }
+    return (double) count;
+}
+#endif
+
+/**
+ * Runs Lyra2 with each of the usual column counts (16, 32, 64, 96 and 128) on a matrix of the same
+ * size, and reports the throughput and, where the kernel gives access to the hardware counters,
+ * the L1 data cache and last-level cache misses per row visited.
+ *
+ * @param t Parameter to determine the processing time (T)
+ * @param memKiB Size of the memory matrix, in KiB
+ */
+int sweepCols(unsigned int t, unsigned int memKiB) {
+    static const int cols[] = {16, 32, 64, 96, 128};
+    unsigned char K[64];
+    struct timeval start, end;
+    LYRA2_CTX ctx;
+    int c, i;
+    int l1 = -1, llc = -1;
+
+#if defined(__linux__)
+    l1 = openCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    llc = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+    if (l1 < 0 || llc < 0) {
+        printf("Hardware cache counters unavailable: miss rates are not reported\n");
+    }
+
+    LYRA2_initCtx(&ctx, LYRA2_HUGEPAGES_TRANSPARENT);
+    printf("T = %u, memory = %u KiB\n", t, memKiB);
+    printf("%6s %8s %12s %12s %14s %14s\n", "C", "R", "hashes/s", "MiB/s", "L1D miss/row", "LLC miss/row");
+    for (c = 0; c < (int) (sizeof (cols) / sizeof (cols[0])); c++) {
+        int nCols = cols[c];
+        int nRows = (int) (((uint64_t) memKiB * 1024) / ((uint64_t) nCols * BLOCK_LEN_BYTES));
+        int reps;
+        double elapsed, l1Misses = -1, llcMisses = -1;
+        double rowsVisited;
+
+        if (nRows < 3) {
+            continue;
+        }
+        //Roughly 2^26 blocks processed per column count
+        reps = (int) ((1 << 26) / ((uint64_t) nCols * nRows * (t + 1))) + 1;
+        rowsVisited = (double) reps * nRows * (t + 1);
+
+        LYRA2_ctx(&ctx, K, sizeof (K), (const unsigned char *) "Lyra sponge", 11, (const unsigned char *) "saltsaltsaltsalt", 16, t, nRows, nCols);
+#if defined(__linux__)
+        startCounter(l1);
+        startCounter(llc);
+#endif
+        gettimeofday(&start, NULL);
+        for (i = 0; i < reps; i++) {
+            LYRA2_ctx(&ctx, K, sizeof (K), (const unsigned char *) "Lyra sponge", 11, (const unsigned char *) "saltsaltsaltsalt", 16, t, nRows, nCols);
+        }
+        gettimeofday(&end, NULL);
+#if defined(__linux__)
+        l1Misses = stopCounter(l1);
+        llcMisses = stopCounter(llc);
+#endif
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+        printf("%6d %8d %12.1f %12.1f", nCols, nRows, reps / elapsed, reps * (t + 1) * (nRows * (double) nCols * BLOCK_LEN_BYTES) / (1 << 20) / elapsed);
+        if (l1Misses >= 0 && llcMisses >= 0) {
+            printf(" %14.1f %14.1f\n", l1Misses / rowsVisited, llcMisses / rowsVisited);
+        } else {
+            printf(" %14s %14s\n", "n/a", "n/a");
+        }
+    }
+    LYRA2_freeCtx(&ctx);
+#if defined(__linux__)
+    if (l1 >= 0) {
+        close(l1);
+    }
+    if (llc >= 0) {
+        close(llc);
+    }
+#endif
     return 0;
 }
 
@@ -166,7 +447,13 @@ int main(int argc, char *argv[]) {
                 printf(" - nRows: the number of rows parameter\n");
                 printf("\n");
                 printf("Or:\n");
-                printf("       Lyra2 tCost nRows --testVectors (to generate test vectors and test Lyra2 operation)\n\n");
+                printf("       Lyra2 tCost nRows --testVectors [p] (to generate test vectors and test Lyra2 operation, with p parallel lanes)\n\n");
+                printf("Or:\n");
+                printf("       Lyra2 tCost nRows --multi nPasswords (to check and time LYRA2_multi against LYRA2)\n\n");
+                printf("Or:\n");
+                printf("       Lyra2 tCost nRows --benchWandering (to time the Wandering phase per row, nRows a power of 2)\n\n");
+                printf("Or:\n");
+                printf("       Lyra2 tCost memKiB --sweepCols (to compare nCols = 16, 32, 64, 96 and 128 with the same memory)\n\n");
                 return 0;
             } else {
                 printf("Invalid options.\nFor more information, try \"Lyra2 --help\".\n");
@@ -186,8 +473,23 @@ int main(int argc, char *argv[]) {
             if (strcmp(argv[3], "--testVectors") == 0) {
                 t = atoi(argv[1]);
                 r = atoi(argv[2]);
-                testVectors(t, r);
+                return testVectors(t, r, 1);
+            } else if (strcmp(argv[3], "--benchWandering") == 0) {
+                return benchWandering(atoi(argv[1]), atoi(argv[2]));
+            } else if (strcmp(argv[3], "--sweepCols") == 0) {
+                return sweepCols(atoi(argv[1]), atoi(argv[2]));
+            } else {
+                printf("Invalid options.\nFor more information, try \"Lyra2 --help\".\n");
                 return 0;
+            }
+            break;
+        case 5:
+            if (strcmp(argv[3], "--testVectors") == 0) {
+                return testVectors(atoi(argv[1]), atoi(argv[2]), atoi(argv[4]));
+            } else if (strcmp(argv[3], "--multi") == 0) {
+                t = atoi(argv[1]);
+                r = atoi(argv[2]);
+                return testMulti(t, r, atoi(argv[4]));
             } else {
                 printf("Invalid options.\nFor more information, try \"Lyra2 --help\".\n");
                 return 0;
@@ -132,11 +132,12 @@ inline void absorbBlock(uint64_t *state, const uint64_t *in) {
  * 
  * @param state     The current state of the sponge 
  * @param row       Row to receive the data squeezed
+ * @param nCols     Number of columns of the memory matrix
  */
-inline void reducedSqueezeRow(uint64_t* state, uint64_t* row) {
+static ALWAYS_INLINE void reducedSqueezeRowCols(uint64_t* state, uint64_t* row, int nCols) {
     int i;
     //M[row][col] = H.reduced_squeeze()
-    for (i = 0; i < N_COLS; i++) {
+    for (i = 0; i < nCols; i++) {
         row[0] = state[0];
         row[1] = state[1];
         row[2] = state[2];
@@ -167,14 +168,15 @@ inline void reducedSqueezeRow(uint64_t* state, uint64_t* row) {
  * @param rowIn          Row used only as input
  * @param rowInOut       Row used as input and to receive output after rotation
  * @param rowOut         Row receiving the output
+ * @param nCols          Number of columns of the memory matrix
  *
  */
-inline void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut) {
+static ALWAYS_INLINE void reducedDuplexRowSetupCols(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols) {
     uint64_t* ptr64In = rowIn; 		//In Lyra2: pointer to prev
     uint64_t* ptr64InOut = rowInOut; 	//In Lyra2: pointer to row*
     uint64_t* ptr64Out = rowOut; 	//In Lyra2: pointer to row
     int i; 
-    for (i = 0; i < N_COLS; i++) {
+    for (i = 0; i < nCols; i++) {
         //Absorbing "M[rowInOut] XOR M[rowIn]"
         state[0] ^= ptr64InOut[0] ^ ptr64In[0];
         state[1] ^= ptr64InOut[1] ^ ptr64In[1];
@@ -237,14 +239,20 @@ inline void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *ro
  * @param rowIn          Row used only as input
  * @param rowInOut       Row used as input and to receive output after rotation
  * @param rowOut         Row receiving the output
+ * @param nCols          Number of columns of the memory matrix
  *
  */
-inline void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut) {
+static ALWAYS_INLINE void reducedDuplexRowCols(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols) {
     uint64_t* ptr64InOut = rowInOut; 	//In Lyra2: pointer to row*
     uint64_t* ptr64In = rowIn;          //In Lyra2: pointer to prev
     uint64_t* ptr64Out = rowOut; 	//In Lyra2: pointer to row
     int i;
-    for (i = 0; i < N_COLS; i++) {
+    for (i = 0; i < nCols; i++) {
+	//Prefetches row* a few blocks ahead: being picked at random, it is the row the hardware can not predict
+	if (i + PREFETCH_BLOCKS < nCols) {
+	    PREFETCH(ptr64InOut + PREFETCH_BLOCKS * BLOCK_LEN_INT64);
+	    PREFETCH(ptr64InOut + PREFETCH_BLOCKS * BLOCK_LEN_INT64 + 8);
+	}
 	
 	//Absorbing "M[rowInOut] XOR M[rowIn]"
         state[0] ^= ptr64InOut[0] ^ ptr64In[0];
@@ -298,6 +306,78 @@ inline void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOu
     }
 }
 
+/**
+ * Row operations for any number of columns, given at runtime.
+ */
+void reducedSqueezeRow(uint64_t* state, uint64_t* row, int nCols) {
+    reducedSqueezeRowCols(state, row, nCols);
+}
+
+void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols) {
+    reducedDuplexRowSetupCols(state, rowIn, rowInOut, rowOut, nCols);
+}
+
+void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols) {
+    reducedDuplexRowCols(state, rowIn, rowInOut, rowOut, nCols);
+}
+
+/*Row operations specialized for C columns: a row of nCols columns, a multiple of C, is processed C columns at a
+time, so that the compiler sees a constant column count*/
+#define SPONGE_KERNELS(C) \
+static void reducedSqueezeRow##C(uint64_t* state, uint64_t* row, int nCols) { \
+    int i; \
+    for (i = 0; i < nCols; i += C, row += C * BLOCK_LEN_INT64) { \
+        reducedSqueezeRowCols(state, row, C); \
+    } \
+} \
+static void reducedDuplexRowSetup##C(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols) { \
+    int i; \
+    for (i = 0; i < nCols; i += C, rowIn += C * BLOCK_LEN_INT64, rowInOut += C * BLOCK_LEN_INT64, rowOut += C * BLOCK_LEN_INT64) { \
+        reducedDuplexRowSetupCols(state, rowIn, rowInOut, rowOut, C); \
+    } \
+} \
+static void reducedDuplexRow##C(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols) { \
+    int i; \
+    for (i = 0; i < nCols; i += C, rowIn += C * BLOCK_LEN_INT64, rowInOut += C * BLOCK_LEN_INT64, rowOut += C * BLOCK_LEN_INT64) { \
+        reducedDuplexRowCols(state, rowIn, rowInOut, rowOut, C); \
+    } \
+}
+
+SPONGE_KERNELS(16)
+SPONGE_KERNELS(32)
+SPONGE_KERNELS(64)
+SPONGE_KERNELS(96)
+SPONGE_KERNELS(128)
+
+/*Largest column count first, so that a row is split into as few pieces as possible*/
+static const SpongeKernels spongeKernels[] = {
+    {128, reducedSqueezeRow128, reducedDuplexRowSetup128, reducedDuplexRow128},
+    {96, reducedSqueezeRow96, reducedDuplexRowSetup96, reducedDuplexRow96},
+    {64, reducedSqueezeRow64, reducedDuplexRowSetup64, reducedDuplexRow64},
+    {32, reducedSqueezeRow32, reducedDuplexRowSetup32, reducedDuplexRow32},
+    {16, reducedSqueezeRow16, reducedDuplexRowSetup16, reducedDuplexRow16},
+    {0, reducedSqueezeRow, reducedDuplexRowSetup, reducedDuplexRow}
+};
+
+/**
+ * Picks the row operations for a number of columns: a version specialized for 128, 96, 64, 32
+ * or 16 columns, the largest that divides nCols, and the generic one (which takes any nCols) if
+ * none does.
+ *
+ * @param nCols     Number of columns of the memory matrix
+ *
+ * @return The row operations to be used, with nCols as their last argument
+ */
+const SpongeKernels *getSpongeKernels(int nCols) {
+    int i;
+    for (i = 0; spongeKernels[i].nCols != 0; i++) {
+        if (nCols % spongeKernels[i].nCols == 0) {
+            break;
+        }
+    }
+    return &spongeKernels[i];
+}
+
 /**
  Prints an array of unsigned chars
  */
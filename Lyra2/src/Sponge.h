@@ -32,6 +32,23 @@
 #define ALIGN
 #endif
 
+/*Software prefetch of the cache line holding addr, for writing; define LYRA2_NO_PREFETCH to disable*/
+#if defined(__GNUC__) && !defined(LYRA2_NO_PREFETCH)
+#define PREFETCH(addr) __builtin_prefetch((addr), 1, 3)
+#else
+#define PREFETCH(addr)
+#endif
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__ ((always_inline))
+#elif defined(_MSC_VER)
+#define ALWAYS_INLINE __forceinline
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+#define PREFETCH_BLOCKS 2                               //How many blocks ahead of the current column row* is prefetched
+
 
 /*Blake2b IV Array*/
 static const uint64_t blake2b_IV[8] =
@@ -90,9 +107,19 @@ void initState(uint64_t state[/*16*/]);
 void squeeze(uint64_t *state, unsigned char *out, unsigned int len);
 void absorbBlock(uint64_t *state, const uint64_t *in);
 void squeezeBlock(uint64_t* state, uint64_t* block);
-void reducedSqueezeRow(uint64_t* state, uint64_t* row);
-void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut);
-void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut);
+void reducedSqueezeRow(uint64_t* state, uint64_t* row, int nCols);
+void reducedDuplexRowSetup(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols);
+void reducedDuplexRow(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols);
+
+/*The row operations of the Setup and Wandering phases, for a given number of columns*/
+typedef struct {
+    int nCols;                                          //nCols must be a multiple of this, 0 if any
+    void (*reducedSqueezeRow)(uint64_t* state, uint64_t* row, int nCols);
+    void (*reducedDuplexRowSetup)(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols);
+    void (*reducedDuplexRow)(uint64_t *state, uint64_t *rowIn, uint64_t *rowInOut, uint64_t *rowOut, int nCols);
+} SpongeKernels;
+
+const SpongeKernels *getSpongeKernels(int nCols);
 
 void printArray(unsigned char *array, unsigned int size, char *name);
 
@@ -20,10 +20,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <immintrin.h>
 #include "Lyra2.h"
 #include "Sponge.h"
 
+/*Address of row r of the memory matrix m, whose rows have c columns*/
+#define ROW(m, r, c) ((m) + (size_t) (r) * BLOCK_LEN_INT128 * (c))
+
 /**
 * Executes Lyra2 based on the G function from Blake2b. The number of columns of the memory matrix is set to nCols = 64.
 * This version supports salts and passwords whose combined length is smaller than the size of the memory matrix,
@@ -65,30 +69,153 @@ void print128(__m128i *v){
     printf("\n");
 }
 /**
-* Executes Lyra2 based on the G function from Blake2b. This version supports salts and passwords
-* whose combined length is smaller than the size of the memory matrix, (i.e., (nRows x nCols x b) bits,
-* where "b" is the underlying sponge's bitrate). In this implementation, the "basil" is composed by all 
- * integer parameters, in the order they are provided (i.e., basil = kLen || pwdlen || saltlen || timeCost || nRows || nCols).
-*
-* @param K The derived key to be output by the algorithm
-* @param kLen Desired key length
-* @param pwd User password
-* @param pwdlen Password length
-* @param salt Salt
-* @param saltlen Salt length
-* @param timeCost Parameter to determine the processing time (T)
-* @param nRows Number or rows of the memory matrix (R)
-* @param nCols Number of columns of the memory matrix (C)
-*
-* @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
-*/
-int LYRA2(unsigned char *K, int kLen, const unsigned char *pwd, int pwdlen, const unsigned char *salt, int saltlen, int timeCost, int nRows, int nCols) {
-    int rowLenBytes = BLOCK_LEN_INT64 * nCols * 8;
+ * Prefetches the first PREFETCH_BLOCKS blocks of a row; reducedDuplexRowSSE prefetches the rest as it goes.
+ */
+static inline void prefetchRow(__m128i *row) {
+    int i;
+    for (i = 0; i < PREFETCH_BLOCKS * BLOCK_LEN_INT128; i += 4) {
+        PREFETCH(row + i);
+    }
+}
+
+/**
+ * Performs one iteration of the Wandering phase of Lyra2: odd iterations visit the rows from the
+ * last one down to 0, even ones from 0 up. Called with pow2 = 1 when nRows is a power of 2, so that
+ * the compiler generates a copy that picks row* with a mask instead of a division. Before each
+ * duplexing, the start of row* and of the row visited next are prefetched.
+ *
+ * @param state The current state of the sponge
+ * @param memMatrix The memory matrix, one row every BLOCK_LEN_INT128 * nCols words
+ * @param tau The iteration of the Wandering phase, from 1 to timeCost
+ * @param nRows Number or rows of the memory matrix (R)
+ * @param nCols Number of columns of the memory matrix (C)
+ * @param rowa The last row* picked
+ * @param pow2 Whether nRows is a power of 2
+ *
+ * @return The last row* picked in this iteration
+ */
+static inline int wanderingPass(__m128i *state, __m128i *memMatrix, int tau, int nRows, int nCols, int rowa, const int pow2) {
+    int maxIndex = nRows - 1;
+    //Odd iterations go from the last row down to 0 (with prev = 0), even ones from 0 up (with prev = maxIndex)
+    int step = (tau & 1) ? -1 : 1;
+    int row = (tau & 1) ? maxIndex : 0;
+    int prev = (tau & 1) ? 0 : maxIndex;
+    do {
+    //Selects a pseudorandom index row*
+    if (pow2) {
+        rowa = ((unsigned int) (((unsigned int *) state)[0] ^ prev)) & maxIndex;
+    } else {
+        rowa = ((unsigned int) (((unsigned int *) state)[0] ^ prev)) % nRows;
+    }
+    prefetchRow(ROW(memMatrix, rowa, nCols));
+    if (row + step >= 0 && row + step <= maxIndex) {
+        prefetchRow(ROW(memMatrix, row + step, nCols));
+    }
+
+    //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
+    reducedDuplexRowSSE(state, ROW(memMatrix, prev, nCols), ROW(memMatrix, rowa, nCols), ROW(memMatrix, row, nCols), nCols);
+
+    //Goes to the next row
+    prev = row;
+    row += step;
+    } while (row >= 0 && row <= maxIndex);
+    return rowa;
+}
+
+/*A LYRA2 call, shared by the threads running its lanes*/
+typedef struct {
+    __m128i *memMatrix;                 //The whole memory matrix; lane i owns rows [i * laneRows, (i + 1) * laneRows)
+    unsigned char *K;
+    int kLen;
+    const unsigned char *pwd;
+    int pwdlen;
+    const unsigned char *salt;
+    int saltlen;
+    int timeCost;
+    int nRows;
+    int nCols;
+    int p;                              //Number of lanes
+    int laneRows;                       //Number of rows of each lane
+    uint64_t *published;                //Two blocks per lane, alternately written at the synchronization points
+
+    pthread_mutex_t mutex;              //Barrier used at the synchronization points
+    pthread_cond_t cond;
+    int waiting;
+    unsigned int generation;
+    int aborted;                        //Set if a thread could not be started: the lanes give up
+} Lyra2Job;
+
+/*Argument of the thread running one lane*/
+typedef struct {
+    Lyra2Job *job;
+    int lane;
+} Lyra2Lane;
+
+/**
+ * Waits until all lanes of a job reach this point.
+ *
+ * @return 0, or -1 if the job was aborted
+ */
+static int laneBarrier(Lyra2Job *job) {
+    int result;
+    pthread_mutex_lock(&job->mutex);
+    if (!job->aborted) {
+    unsigned int generation = job->generation;
+    if (++job->waiting == job->p) {
+        job->waiting = 0;
+        job->generation++;
+        pthread_cond_broadcast(&job->cond);
+    } else {
+        while (generation == job->generation && !job->aborted) {
+        pthread_cond_wait(&job->cond, &job->mutex);
+        }
+    }
+    }
+    result = job->aborted ? -1 : 0;
+    pthread_mutex_unlock(&job->mutex);
+    return result;
+}
 
-    //Checks whether or not the salt+password are within the accepted limits
-    if (pwdlen + saltlen > rowLenBytes) {
-        return -1;
+/**
+ * Synchronization point number "point" of a parallel LYRA2: every lane publishes the bitrate part
+ * of its sponge, waits for the others, and absorbs their blocks, starting with the next lane. Blocks
+ * are published in two alternating slots, so a slot is never rewritten before all lanes have read it.
+ *
+ * @return 0, or -1 if the job was aborted
+ */
+static int syncLanes(Lyra2Job *job, int lane, __m128i *state, int point) {
+    uint64_t *slots = job->published + (size_t) (point & 1) * job->p * BLOCK_LEN_INT64;
+    int i;
+    if (job->p == 1) {
+    return 0;
+    }
+    memcpy(slots + (size_t) lane * BLOCK_LEN_INT64, state, BLOCK_LEN_BYTES);
+    if (laneBarrier(job) != 0) {
+    return -1;
     }
+    for (i = 1; i < job->p; i++) {
+    absorbBlockSSE(state, (const __m128i *) (slots + (size_t) ((lane + i) % job->p) * BLOCK_LEN_INT64));
+    }
+    return 0;
+}
+
+/**
+ * Number of blocks taken by pad(pwd || salt || basil). The basil of a parallel LYRA2 also holds
+ * the number of lanes and the index of the lane.
+ */
+static int inputBlocks(int pwdlen, int saltlen, int p) {
+    int basilLen = (p == 1 ? 6 : 8) * sizeof(int);
+    return ((saltlen + pwdlen + basilLen) / BLOCK_LEN_BYTES) + 1;
+}
+
+/**
+ * Runs one lane of LYRA2 over its own rows. With a single lane, this is the whole of LYRA2.
+ * Otherwise, the lanes synchronize after the Setup phase and after each iteration of the
+ * Wandering phase, and lane 0 squeezes the key.
+ */
+static void *lyra2Lane(void *arg) {
+    Lyra2Job *job = ((Lyra2Lane *) arg)->job;
+    int lane = ((Lyra2Lane *) arg)->lane;
 
     //============================= Basic variables ============================//
     int row = 2; //index of row to be processed
@@ -96,159 +223,281 @@ int LYRA2(unsigned char *K, int kLen, const unsigned char *pwd, int pwdlen, cons
     int rowa = 0; //index of row* (a previous row, deterministically picked during Setup and randomly picked during Wandering)
     int tau; //Time Loop iterator
     int i; //auxiliary iteration counter
+    int nRows = job->laneRows; //Rows of this lane
+    int nCols = job->nCols;
+    __m128i *memMatrix = ROW(job->memMatrix, (size_t) lane * nRows, nCols);
+    __m128i *ptrWord;
     //==========================================================================/
 
-    //========== Initializing the Memory Matrix and pointers to it =============//
-    //Allocates enough space for the whole memory matrix
-    __m128i *wholeMatrix = malloc(nRows * rowLenBytes);
-    if (wholeMatrix == NULL) {
-        return -1;
-    }
-    //Allocates pointers to each row of the matrix
-    __m128i **memMatrix = malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-        return -1;
-    }
-    //Places the pointers in the correct positions
-    __m128i *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-        memMatrix[i] = ptrWord;
-        ptrWord += BLOCK_LEN_INT128 * nCols;
-    }
-    //==========================================================================/
-
-    //============== Initializing the Sponge State =============/
-    //Sponge state: 8 __m128i, BLOCK_LEN_INT128 words of them for the bitrate (b) and the remainder for the capacity (c)
-    __m128i *state = malloc(8 * sizeof (__m128i));
-    initStateSSE(state);
-    //========================================================//
-
     //============= Getting the password + salt + basil padded with 10*1 ===============//
 
     //OBS.:The memory matrix will temporarily hold the password: not for saving memory,
     //but this ensures that the password copied locally will be overwritten as soon as possible
 
     //First, we clean enough blocks for the password, salt, basil and padding
-    int nBlocksInput = ((saltlen + pwdlen + 6*sizeof(int)) / BLOCK_LEN_BYTES) + 1;
-    byte *ptrByte = (byte*) wholeMatrix;
+    int nBlocksInput = inputBlocks(job->pwdlen, job->saltlen, job->p);
+    byte *ptrByte = (byte*) memMatrix;
     memset(ptrByte, 0, nBlocksInput * BLOCK_LEN_BYTES);
 
     //Prepends the password
-    memcpy(ptrByte, pwd, pwdlen);
-    ptrByte += pwdlen;
+    memcpy(ptrByte, job->pwd, job->pwdlen);
+    ptrByte += job->pwdlen;
     
     //Concatenates the salt
-    memcpy(ptrByte, salt, saltlen);
-    ptrByte += saltlen;
+    memcpy(ptrByte, job->salt, job->saltlen);
+    ptrByte += job->saltlen;
     
     //Concatenates the basil: every integer passed as parameter, in the order they are provided by the interface
-    memcpy(ptrByte, &kLen, sizeof(int));
+    memcpy(ptrByte, &job->kLen, sizeof(int));
     ptrByte += sizeof(int);
-    memcpy(ptrByte, &pwdlen, sizeof(int));
+    memcpy(ptrByte, &job->pwdlen, sizeof(int));
     ptrByte += sizeof(int);
-    memcpy(ptrByte, &saltlen, sizeof(int));
+    memcpy(ptrByte, &job->saltlen, sizeof(int));
     ptrByte += sizeof(int);
-    memcpy(ptrByte, &timeCost, sizeof(int));
+    memcpy(ptrByte, &job->timeCost, sizeof(int));
     ptrByte += sizeof(int);
-    memcpy(ptrByte, &nRows, sizeof(int));
+    memcpy(ptrByte, &job->nRows, sizeof(int));
     ptrByte += sizeof(int);
     memcpy(ptrByte, &nCols, sizeof(int));
     ptrByte += sizeof(int);
-    
+    if (job->p > 1) {
+    memcpy(ptrByte, &job->p, sizeof(int));
+    ptrByte += sizeof(int);
+    memcpy(ptrByte, &lane, sizeof(int));
+    ptrByte += sizeof(int);
+    }
 
     //Now comes the padding
     *ptrByte = 0x80; //first byte of padding: right after the password
-    ptrByte = (byte*) wholeMatrix; //resets the pointer to the start of the memory matrix
+    ptrByte = (byte*) memMatrix; //resets the pointer to the start of the memory matrix
     ptrByte += nBlocksInput * BLOCK_LEN_BYTES - 1; //sets the pointer to the correct position: end of incomplete block
     *ptrByte ^= 0x01; //last byte of padding: at the end of the last incomplete block
 
     //==========================================================================/
 
-    //====================== Setup Phase =====================//
+    //======================= Initializing the Sponge State ====================//
+    //Sponge state: 8 __m128i, BLOCK_LEN_INT128 words of them for the bitrate (b) and the remainder for the capacity (c)
+    __m128i state[8];
+    initStateSSE(state);
+    //==========================================================================/
+
+    //================================ Setup Phase =============================//
 
-    //Absorbing salt and password
-    ptrWord = memMatrix[0];
+    //Absorbing salt, password and basil
+    ptrWord = memMatrix;
     for (i = 0; i < nBlocksInput; i++) {
-        absorbBlockSSE(state, ptrWord); //absorbs each block of pad(pwd || salt || basil)
-        ptrWord += BLOCK_LEN_INT128; //goes to next block of pad(pwd || salt || basil)
+    absorbBlockSSE(state, ptrWord); //absorbs each block of pad(pwd || salt || basil)
+    ptrWord += BLOCK_LEN_INT128; //goes to next block of pad(pwd || salt || basil)
     }
-    
-    reducedSqueezeRowSSE(state, memMatrix[0], nCols); //The locally copied password is overwritten here
-    reducedSqueezeRowSSE(state, memMatrix[1], nCols);
+
+    //Initializes M[0] and M[1]
+    reducedSqueezeRowSSE(state, ROW(memMatrix, 0, nCols), nCols); //The locally copied password is most likely overwritten here
+    reducedSqueezeRowSSE(state, ROW(memMatrix, 1, nCols), nCols);
 
     do {
-        //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
-        reducedDuplexRowSetupSSE(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+    //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
+    reducedDuplexRowSetupSSE(state, ROW(memMatrix, prev, nCols), ROW(memMatrix, rowa, nCols), ROW(memMatrix, row, nCols), nCols);
 
-        //updates the value of row* (deterministically picked during Setup))
-        rowa--;
-        if (rowa < 0) {
-            rowa = prev;
-        }
-        //update prev: it now points to the last row ever computed
-        prev = row;
-        //updates row: does to the next row to be computed
-        row++;
+    //updates the value of row* (deterministically picked during Setup))
+    rowa--;
+    if (rowa < 0) {
+        rowa = prev;
+    }
+    //update prev: it now points to the last row ever computed
+    prev = row;
+    //updates row: does to the next row to be computed
+    row++;
     } while (row < nRows);
-    //========================================================//
 
-    //================== Wandering Phase =====================//
-    int maxIndex = nRows - 1;
-    for (tau = 1; tau <= timeCost; tau++) {
-        //========= Iterations for an odd tau ==========
-        row = maxIndex; //Odd iterations of the Wandering phase start with the last row ever computed
-        prev = 0; //The companion "prev" is 0
-        do {
-            //Selects a pseudorandom index row*
-            //rowa = ((unsigned int) (((int *) state)[0] ^ prev)) & maxIndex; //(USE THIS IF nRows IS A POWER OF 2)
-            rowa = ((unsigned int) (((unsigned int *) state)[0] ^ prev)) % nRows; //(USE THIS FOR THE "GENERIC" CASE)
-
-            //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
-            reducedDuplexRowSSE(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
-
-            //Goes to the next row (inverse order)
-            prev = row;
-            row--;
-        } while (row >= 0);
-
-        if (++tau > timeCost) {
-            break; //end of the Wandering phase
-        }
+    if (syncLanes(job, lane, state, 0) != 0) {
+    return NULL;
+    }
+    //==========================================================================/
 
-        //========= Iterations for an even tau ==========
-        row = 0; //Even iterations of the Wandering phase start with row = 0
-        prev = maxIndex; //The companion "prev" is the last row in the memory matrix
-        do {
-            //rowa = ((unsigned int) (((int *) state)[0] ^ prev)) & maxIndex; //(USE THIS IF nRows IS A POWER OF 2)
-            rowa = ((unsigned int) (((unsigned int *) state)[0] ^ prev)) % nRows; //(USE THIS FOR THE "GENERIC" CASE)
+    //============================ Wandering Phase =============================//
+    for (tau = 1; tau <= job->timeCost; tau++) {
+    if ((nRows & (nRows - 1)) == 0) {
+        rowa = wanderingPass(state, memMatrix, tau, nRows, nCols, rowa, 1); //row* = (state[0] ^ prev) & (nRows - 1)
+    } else {
+        rowa = wanderingPass(state, memMatrix, tau, nRows, nCols, rowa, 0); //row* = (state[0] ^ prev) % nRows
+    }
+    if (syncLanes(job, lane, state, tau) != 0) {
+        return NULL;
+    }
+    }
+    //==========================================================================/
 
-            //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
-            reducedDuplexRowSSE(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+    //============================ Wrap-up Phase ===============================//
+    //Absorbs the last block of the memory matrix
+    absorbBlockSSE(state, ROW(memMatrix, rowa, nCols));
 
-            //Goes to the next row (direct order)
-            prev = row;
-            row++;
-        } while (row <= maxIndex);
+    //Squeezes the key, once every lane has been absorbed by lane 0
+    if (syncLanes(job, lane, state, job->timeCost + 1) == 0 && lane == 0) {
+    squeezeSSE(state, job->K, job->kLen);
     }
-    //========================================================//
+    //==========================================================================/
 
-    //==================== Wrap-up Phase =====================//
-    //Absorbs the last block of the memory matrix
-    absorbBlockSSE(state, memMatrix[rowa]);
+    //Wiping out the sponge's internal state; the matrix stays in the context for the next call
+    memset(state, 0, sizeof (state));
 
-    //Squeezes the key
-    squeezeSSE(state, K, kLen);
-    //========================================================//
-    
-    //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
-    
-    //Wiping out the sponge's internal state before freeing it
-    memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
+    return NULL;
+}
+
+/**
+* Executes Lyra2 based on the G function from Blake2b. This version supports salts and passwords
+* whose combined length is smaller than the size of the memory matrix, (i.e., (nRows x nCols x b) bits,
+* where "b" is the underlying sponge's bitrate). In this implementation, the "basil" is composed by all 
+ * integer parameters, in the order they are provided (i.e., basil = kLen || pwdlen || saltlen || timeCost || nRows || nCols).
+*
+* @param K The derived key to be output by the algorithm
+* @param kLen Desired key length
+* @param pwd User password
+* @param pwdlen Password length
+* @param salt Salt
+* @param saltlen Salt length
+* @param timeCost Parameter to determine the processing time (T)
+* @param nRows Number or rows of the memory matrix (R)
+* @param nCols Number of columns of the memory matrix (C)
+*
+* @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+*/
+int LYRA2(unsigned char *K, int kLen, const unsigned char *pwd, int pwdlen, const unsigned char *salt, int saltlen, int timeCost, int nRows, int nCols) {
+    LYRA2_CTX ctx;
+    int result;
+
+    LYRA2_initCtx(&ctx, LYRA2_HUGEPAGES_TRANSPARENT);
+    result = LYRA2_ctx(&ctx, K, kLen, pwd, pwdlen, salt, saltlen, timeCost, nRows, nCols);
+    LYRA2_freeCtx(&ctx);
+    return result;
+}
+
+/**
+* Executes Lyra2 like LYRA2, but keeps the memory matrix in a caller-owned context (see
+* LYRA2_initCtx). The matrix is only allocated again when a larger one is needed, so a series of
+* hashes pays for allocating and page-faulting it once. The context must not be shared between
+* threads running at the same time.
+*
+* @param ctx The context holding the memory matrix
+* @param K The derived key to be output by the algorithm
+* @param kLen Desired key length
+* @param pwd User password
+* @param pwdlen Password length
+* @param salt Salt
+* @param saltlen Salt length
+* @param timeCost Parameter to determine the processing time (T)
+* @param nRows Number or rows of the memory matrix (R)
+* @param nCols Number of columns of the memory matrix (C)
+*
+* @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+*/
+int LYRA2_ctx(LYRA2_CTX *ctx, unsigned char *K, int kLen, const unsigned char *pwd, int pwdlen, const unsigned char *salt, int saltlen, int timeCost, int nRows, int nCols) {
+    return LYRA2_parallel(ctx, K, kLen, pwd, pwdlen, salt, saltlen, timeCost, nRows, nCols, 1);
+}
+
+/**
+ * Executes Lyra2 with p lanes, each run by its own thread with its own sponge over nRows / p rows
+ * of the memory matrix. The lanes exchange the bitrate part of their sponges after the Setup phase
+ * and after each iteration of the Wandering phase, and lane 0 squeezes the key. The basil of each
+ * lane also holds p and the index of the lane. With p = 1, this is the same as LYRA2_ctx; other
+ * values of p give different keys.
+ *
+ * @param ctx The context holding the memory matrix
+ * @param K The derived key to be output by the algorithm
+ * @param kLen Desired key length
+ * @param pwd User password
+ * @param pwdlen Password length
+ * @param salt Salt
+ * @param saltlen Salt length
+ * @param timeCost Parameter to determine the processing time (T)
+ * @param nRows Number or rows of the memory matrix (R), a multiple of p with at least 3 rows per lane
+ * @param nCols Number of columns of the memory matrix (C)
+ * @param p Number of lanes (and threads)
+ *
+ * @return 0 if the key is generated correctly; -1 if there is an error (invalid parameters, lack of memory, or threads that could not be started)
+ */
+int LYRA2_parallel(LYRA2_CTX *ctx, unsigned char *K, int kLen, const unsigned char *pwd, int pwdlen, const unsigned char *salt, int saltlen, int timeCost, int nRows, int nCols, int p) {
+    Lyra2Job job;
+    Lyra2Lane *lanes;
+    pthread_t *threads;
+    int i, started, result = 0;
+
+    //The rows of each lane must hold its padded input and leave room for the Setup phase
+    size_t rowLenBytes = (size_t) BLOCK_LEN_BYTES * nCols;
+    if (p < 1 || nCols < 1 || nRows % p != 0 || nRows / p < 3
+        || (size_t) inputBlocks(pwdlen, saltlen, p) * BLOCK_LEN_BYTES > (size_t) (nRows / p) * rowLenBytes) {
+    return -1;
+    }
+
+    //======================= Initializing the Memory Matrix ===================//
+    //The whole matrix is a single region; row i starts BLOCK_LEN_INT128 * nCols words after row i-1
+    job.memMatrix = LYRA2_reserve(ctx, nRows * rowLenBytes);
+    if (job.memMatrix == NULL) {
+    return -1;
+    }
     //==========================================================================/
 
+    job.K = K;
+    job.kLen = kLen;
+    job.pwd = pwd;
+    job.pwdlen = pwdlen;
+    job.salt = salt;
+    job.saltlen = saltlen;
+    job.timeCost = timeCost;
+    job.nRows = nRows;
+    job.nCols = nCols;
+    job.p = p;
+    job.laneRows = nRows / p;
 
+    if (p == 1) {
+    Lyra2Lane lane = {&job, 0};
+    job.published = NULL;
+    lyra2Lane(&lane);
     return 0;
-}
\ No newline at end of file
+    }
+
+    job.published = malloc((size_t) 2 * p * BLOCK_LEN_BYTES);
+    lanes = malloc(p * sizeof (Lyra2Lane));
+    threads = malloc(p * sizeof (pthread_t));
+    if (job.published == NULL || lanes == NULL || threads == NULL) {
+    free(job.published);
+    free(lanes);
+    free(threads);
+    return -1;
+    }
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    job.waiting = 0;
+    job.generation = 0;
+    job.aborted = 0;
+
+    //Lanes 1 to p-1 get their own threads, lane 0 runs in the calling thread
+    for (started = 1; started < p; started++) {
+    lanes[started].job = &job;
+    lanes[started].lane = started;
+    if (pthread_create(&threads[started], NULL, lyra2Lane, &lanes[started]) != 0) {
+        break;
+    }
+    }
+    if (started < p) {
+    pthread_mutex_lock(&job.mutex);
+    job.aborted = 1;
+    pthread_cond_broadcast(&job.cond);
+    pthread_mutex_unlock(&job.mutex);
+    result = -1;
+    } else {
+    lanes[0].job = &job;
+    lanes[0].lane = 0;
+    lyra2Lane(&lanes[0]);
+    }
+    for (i = 1; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.mutex);
+    memset(job.published, 0, (size_t) 2 * p * BLOCK_LEN_BYTES);
+    free(job.published);
+    free(lanes);
+    free(threads);
+    return result;
+}
@@ -87,7 +87,7 @@ static inline void reducedBlake2bLyraSSE(__m128i *v){
  * @param len        The number of bytes to be squeezed into the "out" array
  */
 void squeezeSSE(__m128i *state, byte *out, unsigned int len) {
-    int fullBlocks = len / 64;
+    int fullBlocks = len / BLOCK_LEN_BYTES;
     byte *ptr = out;
     int i;
     //Squeezes full blocks
@@ -97,7 +97,7 @@ void squeezeSSE(__m128i *state, byte *out, unsigned int len) {
 
         ptr += BLOCK_LEN_BYTES;
     }
-    memcpy(ptr, state, (len % 64));
+    memcpy(ptr, state, (len % BLOCK_LEN_BYTES));
 }
 
 /**
@@ -239,6 +239,12 @@ void reducedDuplexRowSSE(__m128i *state, __m128i *rowIn, __m128i *rowInOut, __m1
     __m128i* ptr64Out = rowOut;         //pointer to row*
     int i;
     for (i = 0; i < nCols; i++) {
+        //Prefetches row* a few blocks ahead: being picked at random, it is the row the hardware can not predict
+        if (i + PREFETCH_BLOCKS < nCols) {
+            PREFETCH(ptr64InOut + PREFETCH_BLOCKS * BLOCK_LEN_INT128);
+            PREFETCH(ptr64InOut + PREFETCH_BLOCKS * BLOCK_LEN_INT128 + 4);
+        }
+
         //Absorbing "M[rowInOut] XOR M[rowIn]"
         state[0] = _mm_xor_si128(state[0], _mm_xor_si128(ptr64InOut[0], ptr64In[0]));
         state[1] = _mm_xor_si128(state[1], _mm_xor_si128(ptr64InOut[1], ptr64In[1]));
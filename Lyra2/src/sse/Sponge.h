@@ -34,6 +34,15 @@
 #define ALIGN
 #endif
 
+/*Software prefetch of the cache line holding addr, for writing; define LYRA2_NO_PREFETCH to disable*/
+#if defined(__GNUC__) && !defined(LYRA2_NO_PREFETCH)
+#define PREFETCH(addr) __builtin_prefetch((addr), 1, 3)
+#else
+#define PREFETCH(addr)
+#endif
+
+#define PREFETCH_BLOCKS 2                               //How many blocks ahead of the current column row* is prefetched
+
 /*Blake 2b IV Array*/
 static const uint64_t blake2b_IV[8] =
 {
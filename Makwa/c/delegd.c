@@ -0,0 +1,73 @@
+/*
+ * This command-line tool is a delegation server: it answers Makwa
+ * delegation requests sent over a Unix-domain socket (see delegnet.h
+ * for the protocol), with one worker thread per core by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "delegnet.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+"usage: delegd [ -threads n ] [ -maxwf workfactor ] socket\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char *path;
+	long threads;
+	unsigned long max_wf;
+	int i, fd, err;
+
+	/* Parse command-line arguments. */
+	path = NULL;
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1) {
+		threads = 1;
+	}
+	max_wf = 0;
+	for (i = 1; i < argc; i ++) {
+		char *a;
+
+		a = argv[i];
+		if (strcasecmp(a, "-threads") == 0) {
+			if (++ i == argc) {
+				usage();
+			}
+			threads = atol(argv[i]);
+			if (threads < 1 || threads > 4096) {
+				usage();
+			}
+		} else if (strcasecmp(a, "-maxwf") == 0) {
+			if (++ i == argc) {
+				usage();
+			}
+			max_wf = strtoul(argv[i], NULL, 0);
+		} else {
+			if (path != NULL) {
+				usage();
+			}
+			path = a;
+		}
+	}
+	if (path == NULL) {
+		usage();
+	}
+
+	fd = makwa_delegd_listen(path);
+	if (fd < 0) {
+		fprintf(stderr, "cannot listen on '%s' (error %d)\n", path, fd);
+		return EXIT_FAILURE;
+	}
+	err = makwa_delegd_serve(fd, (unsigned)threads, max_wf);
+	fprintf(stderr, "server failed (error %d)\n", err);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,772 @@
+/*
+ * Makwa delegation over a Unix-domain socket (see delegnet.h).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "delegnet.h"
+
+/*
+ * Frame header length: payload length and request identifier.
+ */
+#define HEADER_LEN   8
+
+/*
+ * Maximum number of requests read by the server and not yet taken by
+ * a worker thread; readers wait beyond that.
+ */
+#define QUEUE_MAX   1024
+
+/*
+ * Maximum number of requests of one connection read by the server and
+ * whose answers are not yet written; the reader of that connection
+ * waits beyond that. This keeps a client which does not read its
+ * answers from filling the queue.
+ */
+#define CONN_MAX_PENDING   (2 * MAKWA_DELEGD_WINDOW)
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS   MSG_NOSIGNAL
+#else
+#define SEND_FLAGS   0
+#endif
+
+static uint32_t
+decode_32(const unsigned char *buf)
+{
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16)
+		| ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+static void
+encode_32(unsigned char *buf, uint32_t x)
+{
+	buf[0] = (unsigned char)(x >> 24);
+	buf[1] = (unsigned char)(x >> 16);
+	buf[2] = (unsigned char)(x >> 8);
+	buf[3] = (unsigned char)x;
+}
+
+/*
+ * Read exactly 'len' bytes. Returned value is 1 on success, 0 on a clean
+ * end-of-stream before the first byte, -1 on error or truncation.
+ */
+static int
+read_full(int fd, void *buf, size_t len)
+{
+	unsigned char *b;
+	size_t off;
+
+	b = buf;
+	off = 0;
+	while (off < len) {
+		ssize_t r;
+
+		r = read(fd, b + off, len - off);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (r == 0) {
+			return off == 0 ? 0 : -1;
+		}
+		off += (size_t)r;
+	}
+	return 1;
+}
+
+/*
+ * Write exactly 'len' bytes. Returned value is 0 on success, -1 on
+ * error. A closed peer is an error, not a signal.
+ */
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+	const unsigned char *b;
+	size_t off;
+
+	b = buf;
+	off = 0;
+	while (off < len) {
+		ssize_t r;
+
+		r = send(fd, b + off, len - off, SEND_FLAGS);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		off += (size_t)r;
+	}
+	return 0;
+}
+
+/*
+ * Get the work factor named in an encoded delegation request: after
+ * the 4-byte header comes the modulus (2-byte length, then the value),
+ * then the work factor over 4 bytes. Returned value is 0 on success,
+ * -1 if the request is too short (makwa_delegation_answer() will then
+ * reject it).
+ */
+static int
+request_work_factor(const unsigned char *req, size_t len,
+	unsigned long *wf)
+{
+	size_t off;
+
+	if (len < 6) {
+		return -1;
+	}
+	off = 6 + (((size_t)req[4] << 8) | req[5]);
+	if (off + 4 > len) {
+		return -1;
+	}
+	*wf = decode_32(req + off);
+	return 0;
+}
+
+/* see delegnet.h */
+int
+makwa_delegd_listen(const char *path)
+{
+	struct sockaddr_un sa;
+	struct stat st;
+	int fd;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof sa.sun_path) {
+		return MAKWA_TOOLARGE;
+	}
+	strcpy(sa.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return MAKWA_IO_ERROR;
+	}
+
+	/* Only a stale socket is removed; bind() fails on anything else. */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	if (bind(fd, (struct sockaddr *)&sa, sizeof sa) < 0
+		|| listen(fd, SOMAXCONN) < 0)
+	{
+		close(fd);
+		return MAKWA_IO_ERROR;
+	}
+	return fd;
+}
+
+/* ====================================================================== */
+/*
+ * Server.
+ *
+ * The calling thread accepts connections; each connection gets a reader
+ * thread, which queues the requests it reads, and a writer thread.
+ * Worker threads take requests from the queue, compute the answers and
+ * queue them on their connection, for its writer. Workers thus never
+ * wait on a socket: a client which does not read its answers stalls
+ * only its own writer, then its own reader (see CONN_MAX_PENDING). A
+ * connection is closed when its reader has seen the end of the stream
+ * and all its requests have been answered.
+ */
+
+typedef struct delegd_answer_ {
+	struct delegd_answer_ *next;
+	size_t len;
+	unsigned char *frame;
+} delegd_answer;
+
+typedef struct {
+	int fd;
+
+	/* Protects the fields below. */
+	pthread_mutex_t lock;
+
+	/* Signalled when an answer is queued or written, and when the
+	   reader stops. */
+	pthread_cond_t cond;
+
+	/* Reader and writer threads. */
+	int refs;
+
+	/* Cleared when the reader stops. */
+	int reading;
+
+	/* Requests read and whose answers are not yet written. */
+	size_t pending;
+
+	/* Answers waiting for the writer. */
+	delegd_answer *head, *tail;
+
+	/* Set when a write fails; later answers are dropped. */
+	int broken;
+} delegd_conn;
+
+typedef struct delegd_job_ {
+	struct delegd_job_ *next;
+	delegd_conn *conn;
+	uint32_t id;
+	size_t len;
+	unsigned char *req;
+} delegd_job;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t nonempty, nonfull;
+	delegd_job *head, *tail;
+	size_t queued;
+	unsigned long max_work_factor;
+} delegd_server;
+
+typedef struct {
+	delegd_server *srv;
+	delegd_conn *conn;
+} delegd_reader_arg;
+
+static void
+conn_release(delegd_conn *c)
+{
+	int last;
+
+	pthread_mutex_lock(&c->lock);
+	last = (-- c->refs == 0);
+	pthread_mutex_unlock(&c->lock);
+	if (last) {
+		close(c->fd);
+		pthread_cond_destroy(&c->cond);
+		pthread_mutex_destroy(&c->lock);
+		free(c);
+	}
+}
+
+/*
+ * Mark a connection as broken (c->lock must be held): the client will
+ * not get all its answers, so it is told by closing the connection.
+ */
+static void
+conn_break(delegd_conn *c)
+{
+	if (!c->broken) {
+		c->broken = 1;
+		shutdown(c->fd, SHUT_RDWR);
+	}
+}
+
+static void *
+reader_thread(void *arg)
+{
+	delegd_reader_arg *ra;
+	delegd_server *srv;
+	delegd_conn *c;
+
+	ra = arg;
+	srv = ra->srv;
+	c = ra->conn;
+	free(ra);
+	for (;;) {
+		unsigned char hdr[HEADER_LEN];
+		delegd_job *job;
+		size_t len;
+
+		pthread_mutex_lock(&c->lock);
+		while (c->pending >= CONN_MAX_PENDING) {
+			pthread_cond_wait(&c->cond, &c->lock);
+		}
+		pthread_mutex_unlock(&c->lock);
+
+		if (read_full(c->fd, hdr, sizeof hdr) <= 0) {
+			break;
+		}
+		len = decode_32(hdr);
+		if (len > MAKWA_DELEGD_MAX_FRAME) {
+			break;
+		}
+		job = malloc(sizeof *job);
+		if (job == NULL) {
+			break;
+		}
+		job->req = malloc(len > 0 ? len : 1);
+		if (job->req == NULL) {
+			free(job);
+			break;
+		}
+		if (len > 0 && read_full(c->fd, job->req, len) <= 0) {
+			free(job->req);
+			free(job);
+			break;
+		}
+		job->next = NULL;
+		job->conn = c;
+		job->id = decode_32(hdr + 4);
+		job->len = len;
+		pthread_mutex_lock(&c->lock);
+		c->pending ++;
+		pthread_mutex_unlock(&c->lock);
+
+		pthread_mutex_lock(&srv->lock);
+		while (srv->queued >= QUEUE_MAX) {
+			pthread_cond_wait(&srv->nonfull, &srv->lock);
+		}
+		if (srv->tail == NULL) {
+			srv->head = job;
+		} else {
+			srv->tail->next = job;
+		}
+		srv->tail = job;
+		srv->queued ++;
+		pthread_cond_signal(&srv->nonempty);
+		pthread_mutex_unlock(&srv->lock);
+	}
+
+	/* No more requests; pending answers can still be written. */
+	shutdown(c->fd, SHUT_RD);
+	pthread_mutex_lock(&c->lock);
+	c->reading = 0;
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	conn_release(c);
+	return NULL;
+}
+
+static void *
+writer_thread(void *arg)
+{
+	delegd_conn *c;
+
+	c = arg;
+	pthread_mutex_lock(&c->lock);
+	for (;;) {
+		delegd_answer *a;
+		int broken, failed;
+
+		while (c->head == NULL && (c->reading || c->pending > 0)) {
+			pthread_cond_wait(&c->cond, &c->lock);
+		}
+		if (c->head == NULL) {
+			break;
+		}
+		a = c->head;
+		c->head = a->next;
+		if (c->head == NULL) {
+			c->tail = NULL;
+		}
+		broken = c->broken;
+		pthread_mutex_unlock(&c->lock);
+
+		/* The write may block for as long as the client does not
+		   read; only this connection waits. */
+		failed = !broken && write_full(c->fd, a->frame, a->len) < 0;
+		free(a);
+
+		pthread_mutex_lock(&c->lock);
+		if (failed) {
+			conn_break(c);
+		}
+		c->pending --;
+		pthread_cond_broadcast(&c->cond);
+	}
+	pthread_mutex_unlock(&c->lock);
+	conn_release(c);
+	return NULL;
+}
+
+static void *
+worker_thread(void *arg)
+{
+	delegd_server *srv;
+	unsigned char *frame;
+	unsigned char nomem_frame[HEADER_LEN + 4];
+
+	srv = arg;
+
+	/*
+	 * Without a frame buffer, the thread still takes jobs, but answers
+	 * each of them with MAKWA_NOMEM, so that no client waits forever.
+	 */
+	frame = malloc(HEADER_LEN + 4 + MAKWA_DELEGD_MAX_FRAME);
+	if (frame == NULL) {
+		frame = nomem_frame;
+	}
+	for (;;) {
+		delegd_job *job;
+		delegd_conn *c;
+		delegd_answer *a;
+		unsigned long wf;
+		size_t ans_len;
+		int status;
+
+		pthread_mutex_lock(&srv->lock);
+		while (srv->head == NULL) {
+			pthread_cond_wait(&srv->nonempty, &srv->lock);
+		}
+		job = srv->head;
+		srv->head = job->next;
+		if (srv->head == NULL) {
+			srv->tail = NULL;
+		}
+		srv->queued --;
+		pthread_cond_signal(&srv->nonfull);
+		pthread_mutex_unlock(&srv->lock);
+
+		ans_len = MAKWA_DELEGD_MAX_FRAME;
+		if (frame == nomem_frame) {
+			status = MAKWA_NOMEM;
+		} else if (srv->max_work_factor != 0
+			&& request_work_factor(job->req, job->len, &wf) == 0
+			&& wf > srv->max_work_factor)
+		{
+			status = MAKWA_TOOLARGE;
+		} else {
+			status = makwa_delegation_answer(job->req, job->len,
+				frame + HEADER_LEN + 4, &ans_len);
+		}
+		if (status < 0) {
+			ans_len = 0;
+		}
+		encode_32(frame, (uint32_t)(4 + ans_len));
+		encode_32(frame + 4, job->id);
+		encode_32(frame + HEADER_LEN, (uint32_t)status);
+
+		/* Hand the answer to the writer of the connection. */
+		c = job->conn;
+		a = malloc(sizeof *a + HEADER_LEN + 4 + ans_len);
+		if (a != NULL) {
+			a->next = NULL;
+			a->len = HEADER_LEN + 4 + ans_len;
+			a->frame = (unsigned char *)(a + 1);
+			memcpy(a->frame, frame, a->len);
+		}
+		pthread_mutex_lock(&c->lock);
+		if (a == NULL) {
+			conn_break(c);
+			c->pending --;
+		} else {
+			if (c->tail == NULL) {
+				c->head = a;
+			} else {
+				c->tail->next = a;
+			}
+			c->tail = a;
+		}
+		pthread_cond_broadcast(&c->cond);
+		pthread_mutex_unlock(&c->lock);
+		free(job->req);
+		free(job);
+	}
+	return NULL;
+}
+
+/* see delegnet.h */
+int
+makwa_delegd_serve(int fd, unsigned threads, unsigned long max_work_factor)
+{
+	delegd_server *srv;
+	pthread_t th;
+	pthread_attr_t attr;
+	unsigned u;
+
+	if (threads == 0) {
+		return MAKWA_BADPARAM;
+	}
+
+	/* The server state is never released: worker threads run until
+	   the process exits. */
+	srv = malloc(sizeof *srv);
+	if (srv == NULL) {
+		return MAKWA_NOMEM;
+	}
+	pthread_mutex_init(&srv->lock, NULL);
+	pthread_cond_init(&srv->nonempty, NULL);
+	pthread_cond_init(&srv->nonfull, NULL);
+	srv->head = NULL;
+	srv->tail = NULL;
+	srv->queued = 0;
+	srv->max_work_factor = max_work_factor;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (u = 0; u < threads; u ++) {
+		if (pthread_create(&th, &attr, worker_thread, srv) != 0) {
+			return MAKWA_NOMEM;
+		}
+	}
+
+	for (;;) {
+		delegd_reader_arg *ra;
+		delegd_conn *c;
+		int cfd;
+
+		cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			return MAKWA_IO_ERROR;
+		}
+		c = malloc(sizeof *c);
+		ra = malloc(sizeof *ra);
+		if (c == NULL || ra == NULL) {
+			free(c);
+			free(ra);
+			close(cfd);
+			continue;
+		}
+		c->fd = cfd;
+		pthread_mutex_init(&c->lock, NULL);
+		pthread_cond_init(&c->cond, NULL);
+		c->refs = 2;
+		c->reading = 1;
+		c->pending = 0;
+		c->head = NULL;
+		c->tail = NULL;
+		c->broken = 0;
+		ra->srv = srv;
+		ra->conn = c;
+		if (pthread_create(&th, &attr, writer_thread, c) != 0) {
+			free(ra);
+			c->refs = 1;
+			conn_release(c);
+			continue;
+		}
+		if (pthread_create(&th, &attr, reader_thread, ra) != 0) {
+			free(ra);
+			pthread_mutex_lock(&c->lock);
+			c->reading = 0;
+			pthread_cond_broadcast(&c->cond);
+			pthread_mutex_unlock(&c->lock);
+			conn_release(c);
+		}
+	}
+}
+
+/* ====================================================================== */
+/*
+ * Client.
+ */
+
+struct makwa_delegd_client_ {
+	int fd;
+
+	/* Identifier for the next request. */
+	uint32_t next_id;
+
+	/* Buffer for one frame (request or answer). */
+	unsigned char *buf;
+
+	/* Answer read but not yet returned by makwa_delegd_receive()
+	   (its payload is in buf). */
+	int pending;
+	uint32_t pending_id;
+	int pending_status;
+	size_t pending_len;
+};
+
+/* see delegnet.h */
+makwa_delegd_client *
+makwa_delegd_connect(const char *path)
+{
+	struct sockaddr_un sa;
+	makwa_delegd_client *dc;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof sa.sun_path) {
+		return NULL;
+	}
+	strcpy(sa.sun_path, path);
+	dc = malloc(sizeof *dc);
+	if (dc == NULL) {
+		return NULL;
+	}
+	dc->buf = malloc(HEADER_LEN + MAKWA_DELEGD_MAX_FRAME);
+	dc->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (dc->buf == NULL || dc->fd < 0
+		|| connect(dc->fd, (struct sockaddr *)&sa, sizeof sa) < 0)
+	{
+		if (dc->fd >= 0) {
+			close(dc->fd);
+		}
+		free(dc->buf);
+		free(dc);
+		return NULL;
+	}
+	dc->next_id = 0;
+	dc->pending = 0;
+	return dc;
+}
+
+/* see delegnet.h */
+void
+makwa_delegd_close(makwa_delegd_client *dc)
+{
+	if (dc == NULL) {
+		return;
+	}
+	close(dc->fd);
+	free(dc->buf);
+	free(dc);
+}
+
+/* see delegnet.h */
+int
+makwa_delegd_send(makwa_delegd_client *dc,
+	const makwa_delegation_context *mdc, unsigned long *id)
+{
+	size_t req_len;
+	int err;
+
+	if (dc->pending) {
+		/* buf holds an answer not yet returned */
+		return MAKWA_BADPARAM;
+	}
+	req_len = MAKWA_DELEGD_MAX_FRAME;
+	err = makwa_delegation_context_encode(mdc,
+		dc->buf + HEADER_LEN, &req_len);
+	if (err < 0) {
+		return err;
+	}
+	encode_32(dc->buf, (uint32_t)req_len);
+	encode_32(dc->buf + 4, dc->next_id);
+	if (write_full(dc->fd, dc->buf, HEADER_LEN + req_len) < 0) {
+		return MAKWA_IO_ERROR;
+	}
+	*id = dc->next_id ++;
+	return MAKWA_OK;
+}
+
+/* see delegnet.h */
+int
+makwa_delegd_receive(makwa_delegd_client *dc,
+	unsigned long *id, void *ans, size_t *ans_len)
+{
+	size_t len;
+
+	if (!dc->pending) {
+		unsigned char hdr[HEADER_LEN + 4];
+
+		if (read_full(dc->fd, hdr, sizeof hdr) <= 0) {
+			return MAKWA_IO_ERROR;
+		}
+		len = decode_32(hdr);
+		if (len < 4 || len > MAKWA_DELEGD_MAX_FRAME) {
+			return MAKWA_IO_ERROR;
+		}
+		len -= 4;
+		if (len > 0 && read_full(dc->fd, dc->buf, len) <= 0) {
+			return MAKWA_IO_ERROR;
+		}
+		dc->pending = 1;
+		dc->pending_id = decode_32(hdr + 4);
+		dc->pending_status = (int)(int32_t)decode_32(hdr + HEADER_LEN);
+		dc->pending_len = len;
+	}
+	*id = dc->pending_id;
+	if (dc->pending_status < 0) {
+		dc->pending = 0;
+		return dc->pending_status;
+	}
+	len = dc->pending_len;
+	if (ans_len != NULL) {
+		size_t pred;
+
+		pred = *ans_len;
+		*ans_len = len;
+		if (ans == NULL || pred < len) {
+			return MAKWA_BUFFER_TOO_SMALL;
+		}
+	} else if (ans == NULL) {
+		return MAKWA_BUFFER_TOO_SMALL;
+	}
+	memcpy(ans, dc->buf, len);
+	dc->pending = 0;
+	return MAKWA_OK;
+}
+
+/* see delegnet.h */
+int
+makwa_delegd_hash_many(makwa_delegd_client *dc, size_t num,
+	const makwa_delegation_context *const *mdc,
+	void *out, size_t out_len)
+{
+	unsigned char *ans, *answered;
+	size_t sent, done, u;
+	unsigned long base;
+	int err, first_err;
+
+	/*
+	 * 'answered' has one bit per request: the server might send an
+	 * identifier twice, and counting answers would then leave some
+	 * outputs unwritten.
+	 */
+	ans = malloc(MAKWA_DELEGD_MAX_FRAME);
+	answered = calloc((num + 7) >> 3, 1);
+	if (ans == NULL || answered == NULL) {
+		free(ans);
+		free(answered);
+		return MAKWA_NOMEM;
+	}
+	base = dc->next_id;
+	first_err = MAKWA_OK;
+	sent = 0;
+	done = 0;
+	while (done < num) {
+		unsigned long id;
+		size_t ans_len, len;
+
+		while (sent < num && sent - done < MAKWA_DELEGD_WINDOW) {
+			err = makwa_delegd_send(dc, mdc[sent], &id);
+			if (err < 0) {
+				goto exit_hash_many;
+			}
+			sent ++;
+		}
+		ans_len = MAKWA_DELEGD_MAX_FRAME;
+		err = makwa_delegd_receive(dc, &id, ans, &ans_len);
+		if (err == MAKWA_IO_ERROR) {
+			goto exit_hash_many;
+		}
+		u = (uint32_t)(id - base);
+		if (u >= sent || (answered[u >> 3] & (1 << (u & 7))) != 0) {
+			err = MAKWA_IO_ERROR;
+			goto exit_hash_many;
+		}
+		answered[u >> 3] |= 1 << (u & 7);
+		if (err == MAKWA_OK) {
+			len = out_len;
+			err = makwa_hash_delegate_end(mdc[u], ans, ans_len,
+				(unsigned char *)out + u * out_len, &len);
+			if (err == MAKWA_OK && len != out_len) {
+				err = MAKWA_BADPARAM;
+			}
+		}
+		if (err < 0 && first_err == MAKWA_OK) {
+			first_err = err;
+		}
+		done ++;
+	}
+	for (u = 0; u < num; u ++) {
+		if ((answered[u >> 3] & (1 << (u & 7))) == 0) {
+			err = MAKWA_IO_ERROR;
+			goto exit_hash_many;
+		}
+	}
+	err = first_err;
+
+exit_hash_many:
+	free(ans);
+	free(answered);
+	return err;
+}
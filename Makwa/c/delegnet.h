@@ -0,0 +1,138 @@
+#ifndef DELEGNET_H__
+#define DELEGNET_H__
+
+#include "makwa.h"
+
+/*
+ * Makwa delegation over a Unix-domain stream socket: the server loop
+ * run by the 'delegd' daemon, and a client library. The server answers
+ * delegation requests (see makwa_delegation_answer()) with several
+ * worker threads; the client pipelines many requests on one connection.
+ *
+ * WIRE PROTOCOL:
+ * --------------
+ *
+ * Both directions carry frames. A frame consists of a 32-bit payload
+ * length, a 32-bit request identifier, then the payload; integers are
+ * big-endian. The identifier is chosen by the client and copied into
+ * the answer; answers may come in any order.
+ *
+ * A request payload is an encoded delegation request, as produced by
+ * makwa_delegation_context_encode(). An answer payload is a 32-bit
+ * status (a MAKWA_* code, as a two's complement integer) followed, if
+ * the status is MAKWA_OK, by the encoded answer for
+ * makwa_hash_delegate_end().
+ *
+ * The server closes a connection which sends a frame larger than
+ * MAKWA_DELEGD_MAX_FRAME bytes. It answers all the requests it has read
+ * before the client closes its side. It stops reading requests from a
+ * connection which has 2*MAKWA_DELEGD_WINDOW requests pending (read,
+ * but whose answers are not written yet), until some answers can be
+ * written: a client which does not read its answers does not delay
+ * the other connections.
+ */
+
+#define MAKWA_DELEGD_MAX_FRAME   (1UL << 18)
+
+/*
+ * Maximum number of requests that makwa_delegd_hash_many() keeps in
+ * flight on a connection.
+ */
+#define MAKWA_DELEGD_WINDOW   64
+
+/* ====================================================================== */
+/*
+ * Server API.
+ */
+
+/*
+ * Create a listening socket bound to 'path'. An existing socket with
+ * that name is removed first; any other existing file makes the call
+ * fail. The socket descriptor is returned, or a
+ * negative error code (MAKWA_TOOLARGE if the path is too long,
+ * MAKWA_IO_ERROR otherwise).
+ */
+int makwa_delegd_listen(const char *path);
+
+/*
+ * Serve delegation requests on the listening socket 'fd', with 'threads'
+ * worker threads (at least 1). If 'max_work_factor' is not 0, then
+ * requests with a larger work factor are answered with MAKWA_TOOLARGE
+ * (a request names its own work factor, so this bounds the work that a
+ * client can ask for).
+ *
+ * This function returns only on error (MAKWA_IO_ERROR or MAKWA_NOMEM).
+ */
+int makwa_delegd_serve(int fd, unsigned threads,
+	unsigned long max_work_factor);
+
+/* ====================================================================== */
+/*
+ * Client API.
+ *
+ * A makwa_delegd_client instance is one connection to a server. It
+ * must not be used by several threads at the same time.
+ */
+
+typedef struct makwa_delegd_client_ makwa_delegd_client;
+
+/*
+ * Connect to the server listening on 'path'. NULL is returned on error.
+ */
+makwa_delegd_client *makwa_delegd_connect(const char *path);
+
+/*
+ * Close a connection and release the instance. If 'dc' is NULL, then
+ * this function does nothing.
+ */
+void makwa_delegd_close(makwa_delegd_client *dc);
+
+/*
+ * Send the delegation request for 'mdc'. The request identifier is
+ * written in '*id'. This function does not wait for the answer; up to
+ * about MAKWA_DELEGD_WINDOW requests can be sent before answers are
+ * read (more may block if the server answers faster than the client
+ * reads).
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+int makwa_delegd_send(makwa_delegd_client *dc,
+	const makwa_delegation_context *mdc, unsigned long *id);
+
+/*
+ * Receive the next answer, waiting for it if needed. The identifier of
+ * the request it answers is written in '*id'. The encoded answer is
+ * written in ans/ans_len, with the "output buffer semantics"; if the
+ * buffer is too small, then the answer is kept and returned again by
+ * the next call.
+ *
+ * If the server could not answer the request, then its status is
+ * returned ('*id' is still set). Other errors leave '*id' unspecified
+ * and the connection unusable.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+int makwa_delegd_receive(makwa_delegd_client *dc,
+	unsigned long *id, void *ans, size_t *ans_len);
+
+/*
+ * Complete the 'num' delegated hash computations mdc[0..num-1]
+ * (initialized with makwa_hash_delegate_begin()): the requests are sent
+ * in a pipeline, and each answer is processed with
+ * makwa_hash_delegate_end() as it comes. The outputs are written one
+ * after the other in 'out', 'out_len' bytes each; 'out_len' must be the
+ * output length of the computations (the modulus length, or the
+ * post-hashing length).
+ *
+ * All answers are read even if some computations fail; the first error
+ * is then returned. An answer with an unknown identifier, or with the
+ * identifier of a request already answered, is a protocol error
+ * (MAKWA_IO_ERROR), after which the connection is unusable.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+int makwa_delegd_hash_many(makwa_delegd_client *dc, size_t num,
+	const makwa_delegation_context *const *mdc,
+	void *out, size_t out_len);
+
+#endif
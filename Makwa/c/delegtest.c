@@ -0,0 +1,309 @@
+/*
+ * This file tests the delegation server and client (delegnet.c) on the
+ * local host: a server is started in a child process, on a socket in
+ * /tmp, and delegated hashes are compared with makwa_hash().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "delegnet.h"
+
+#define FAIL   do { \
+		fprintf(stderr, \
+			"FAIL: delegation test failed, line %ld\n", \
+			(long)__LINE__); \
+		abort(); \
+	} while (0)
+
+#define CHECK(x)   do { \
+		if (!(x)) { \
+			FAIL; \
+		} \
+	} while (0)
+
+#define CE(x, expected)   do { \
+		int error_code = (x); \
+		if (error_code != (expected)) { \
+			fprintf(stderr, "FAIL (line %ld): %s returned %d\n", \
+				(long)__LINE__, #x, error_code); \
+			abort(); \
+		} \
+	} while (0)
+
+#define CC(x)   CE(x, MAKWA_OK)
+
+#define NUM          256
+#define WORK_FACTOR  4096
+#define MAX_WF       8192
+
+/*
+ * Requests sent by a client which never reads its answers; their answers
+ * are well beyond what the socket buffers hold.
+ */
+#define NUM_STALLED  4096
+
+static void *
+xmalloc(size_t len)
+{
+	void *x;
+
+	x = malloc(len);
+	if (x == NULL) {
+		fprintf(stderr, "memory allocation failed (%lu bytes)\n",
+			(unsigned long)len);
+		abort();
+	}
+	return x;
+}
+
+/*
+ * Fake server: accept one connection, then answer request 0 twice (with
+ * an error status) and drain the connection.
+ */
+static void
+duplicate_answer_server(int fd)
+{
+	unsigned char frame[12];
+	int cfd, status;
+
+	cfd = accept(fd, NULL, NULL);
+	if (cfd < 0) {
+		_exit(EXIT_FAILURE);
+	}
+	status = MAKWA_TOOLARGE;
+	memset(frame, 0, sizeof frame);
+	frame[3] = 4;
+	frame[8] = (unsigned char)(status >> 24);
+	frame[9] = (unsigned char)(status >> 16);
+	frame[10] = (unsigned char)(status >> 8);
+	frame[11] = (unsigned char)status;
+	if (write(cfd, frame, sizeof frame) != sizeof frame
+		|| write(cfd, frame, sizeof frame) != sizeof frame)
+	{
+		_exit(EXIT_FAILURE);
+	}
+	while (read(cfd, frame, sizeof frame) > 0);
+	_exit(EXIT_SUCCESS);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/*
+ * Make delegation parameters for the given private key and work factor.
+ */
+static makwa_delegation_parameters *
+make_params(const void *priv, size_t priv_len, long work_factor)
+{
+	makwa_delegation_parameters *mdp;
+	unsigned char *buf;
+	size_t len;
+
+	CE(makwa_delegation_generate(priv, priv_len, work_factor, NULL, &len),
+		MAKWA_OK);
+	buf = xmalloc(len);
+	CC(makwa_delegation_generate(priv, priv_len, work_factor, buf, &len));
+	CHECK((mdp = makwa_delegation_new()) != NULL);
+	CC(makwa_delegation_init(mdp, buf, len));
+	free(buf);
+	return mdp;
+}
+
+int
+main(void)
+{
+	char path[64];
+	unsigned char *priv;
+	size_t priv_len, k;
+	makwa_context *mc;
+	makwa_delegation_parameters *mdp, *mdp_large;
+	makwa_delegation_context *mdc[NUM];
+	unsigned char salt[NUM][16];
+	char input[NUM][16];
+	unsigned char *out, *ref, *expected;
+	makwa_delegd_client *dc, *dc2;
+	pid_t pid, stalled;
+	double t0, t1, t2;
+	int i, fd, status;
+
+	printf("Key and parameters...\n");
+	CC(makwa_generate_key(2048, NULL, &priv_len));
+	priv = xmalloc(priv_len);
+	CC(makwa_generate_key(2048, priv, &priv_len));
+	CHECK((mc = makwa_new()) != NULL);
+	CC(makwa_init(mc, priv, priv_len, 0));
+	mdp = make_params(priv, priv_len, WORK_FACTOR);
+	mdp_large = make_params(priv, priv_len, 2 * MAX_WF);
+
+	/* Start the server. */
+	sprintf(path, "/tmp/delegtest.%ld.sock", (long)getpid());
+	pid = fork();
+	CHECK(pid >= 0);
+	if (pid == 0) {
+		fd = makwa_delegd_listen(path);
+		if (fd < 0) {
+			_exit(EXIT_FAILURE);
+		}
+		makwa_delegd_serve(fd, 4, MAX_WF);
+		_exit(EXIT_FAILURE);
+	}
+	dc = NULL;
+	for (i = 0; i < 200 && dc == NULL; i ++) {
+		dc = makwa_delegd_connect(path);
+		if (dc == NULL) {
+			usleep(10000);
+		}
+	}
+	CHECK(dc != NULL);
+
+	printf("Delegated hashes...\n");
+	k = 256;
+	out = xmalloc(NUM * k);
+	ref = xmalloc(k);
+	expected = xmalloc(NUM * k);
+	for (i = 0; i < NUM; i ++) {
+		sprintf(input[i], "password%d", i);
+		CC(makwa_make_new_salt(salt[i], sizeof salt[i]));
+		CHECK((mdc[i] = makwa_delegation_context_new()) != NULL);
+		CC(makwa_hash_delegate_begin(mc, mdp,
+			input[i], strlen(input[i]), salt[i], sizeof salt[i],
+			0, 0, mdc[i]));
+	}
+	t0 = now();
+	CC(makwa_delegd_hash_many(dc, NUM,
+		(const makwa_delegation_context *const *)mdc, out, k));
+	t1 = now();
+	for (i = 0; i < NUM; i ++) {
+		size_t len;
+
+		len = k;
+		CC(makwa_hash(mc, input[i], strlen(input[i]),
+			salt[i], sizeof salt[i], 0, 0, WORK_FACTOR, ref, &len));
+		CHECK(memcmp(ref, out + i * k, k) == 0);
+	}
+	memcpy(expected, out, NUM * k);
+
+	/* One request at a time, for comparison. */
+	t2 = now();
+	for (i = 0; i < NUM; i ++) {
+		CC(makwa_delegd_hash_many(dc, 1,
+			(const makwa_delegation_context *const *)&mdc[i],
+			out + i * k, k));
+	}
+	t2 = now() - t2;
+	printf("pipelined: %.2f hashes/s, one at a time: %.2f hashes/s\n",
+		NUM / (t1 - t0), NUM / t2);
+
+	printf("Work factor limit...\n");
+	CC(makwa_hash_delegate_begin(mc, mdp_large, "test", 4, salt[0], 16,
+		0, 0, mdc[0]));
+	CE(makwa_delegd_hash_many(dc, 1,
+		(const makwa_delegation_context *const *)mdc, out, k),
+		MAKWA_TOOLARGE);
+
+	/* The connection is still usable after an error. */
+	CC(makwa_hash_delegate_begin(mc, mdp, input[1], strlen(input[1]),
+		salt[1], sizeof salt[1], 0, 0, mdc[1]));
+	CC(makwa_delegd_hash_many(dc, 1,
+		(const makwa_delegation_context *const *)&mdc[1], out, k));
+	CC(makwa_hash(mc, input[1], strlen(input[1]),
+		salt[1], sizeof salt[1], 0, 0, WORK_FACTOR, ref, NULL));
+	CHECK(memcmp(ref, out, k) == 0);
+
+	printf("Client not reading its answers...\n");
+	stalled = fork();
+	CHECK(stalled >= 0);
+	if (stalled == 0) {
+		makwa_delegd_client *sdc;
+		unsigned long id;
+
+		sdc = makwa_delegd_connect(path);
+		if (sdc == NULL) {
+			_exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < NUM_STALLED; i ++) {
+			if (makwa_delegd_send(sdc, mdc[1], &id) != MAKWA_OK) {
+				_exit(EXIT_FAILURE);
+			}
+		}
+		pause();
+		_exit(EXIT_SUCCESS);
+	}
+
+	/* Other connections are still served; if they are not, then
+	   the alarm kills this test. */
+	CC(makwa_hash_delegate_begin(mc, mdp, input[0], strlen(input[0]),
+		salt[0], sizeof salt[0], 0, 0, mdc[0]));
+	usleep(200000);
+	alarm(60);
+	dc2 = makwa_delegd_connect(path);
+	CHECK(dc2 != NULL);
+	CC(makwa_delegd_hash_many(dc2, NUM,
+		(const makwa_delegation_context *const *)mdc, out, k));
+	CHECK(memcmp(expected, out, NUM * k) == 0);
+	memset(out, 0, NUM * k);
+	CC(makwa_delegd_hash_many(dc, NUM,
+		(const makwa_delegation_context *const *)mdc, out, k));
+	CHECK(memcmp(expected, out, NUM * k) == 0);
+	alarm(0);
+	makwa_delegd_close(dc2);
+	kill(stalled, SIGKILL);
+	waitpid(stalled, &status, 0);
+
+	makwa_delegd_close(dc);
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+	unlink(path);
+
+	printf("Duplicate answers...\n");
+	fd = makwa_delegd_listen(path);
+	CHECK(fd >= 0);
+	pid = fork();
+	CHECK(pid >= 0);
+	if (pid == 0) {
+		duplicate_answer_server(fd);
+	}
+	close(fd);
+	CHECK((dc = makwa_delegd_connect(path)) != NULL);
+	CE(makwa_delegd_hash_many(dc, 2,
+		(const makwa_delegation_context *const *)mdc, out, k),
+		MAKWA_IO_ERROR);
+	makwa_delegd_close(dc);
+	waitpid(pid, &status, 0);
+	unlink(path);
+
+	printf("Existing file at the socket path...\n");
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	CHECK(fd >= 0);
+	close(fd);
+	CE(makwa_delegd_listen(path), MAKWA_IO_ERROR);
+	CHECK(access(path, F_OK) == 0);
+	unlink(path);
+	for (i = 0; i < NUM; i ++) {
+		makwa_delegation_context_free(mdc[i]);
+	}
+	makwa_delegation_free(mdp);
+	makwa_delegation_free(mdp_large);
+	makwa_free(mc);
+	free(priv);
+	free(out);
+	free(ref);
+	free(expected);
+	printf("All tests OK.\n");
+	return 0;
+}
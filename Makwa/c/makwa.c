@@ -14,10 +14,13 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <limits.h>
+#include <time.h>
+#include <pthread.h>
 
 /*
  * We use SHA-256, SHA-512, HMAC and the big integer code from OpenSSL.
@@ -29,6 +32,48 @@
 
 #include "makwa.h"
 
+/*
+ * On x86-64, squarings modulo n (without the CRT) use the AVX-512 IFMA
+ * instructions (52-bit multiply-add) if the CPU has them: one value at
+ * a time for makwa_hash(), eight at once for makwa_hash_many(). This
+ * is checked at runtime, so the code is compiled in with the default
+ * compiler flags. Define MAKWA_NO_IFMA to leave it out.
+ */
+#if !defined(MAKWA_NO_IFMA) && defined(__x86_64__) \
+	&& ((defined(__GNUC__) && __GNUC__ >= 8) || defined(__clang__))
+#define MAKWA_IFMA   1
+#include <immintrin.h>
+#else
+#define MAKWA_IFMA   0
+#endif
+
+/*
+ * OpenSSL-1.1.0 made HMAC_CTX opaque, allocated with HMAC_CTX_new().
+ * Older versions only have the stack-allocated structure.
+ */
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static HMAC_CTX *
+HMAC_CTX_new(void)
+{
+	HMAC_CTX *hc;
+
+	hc = malloc(sizeof *hc);
+	if (hc != NULL) {
+		HMAC_CTX_init(hc);
+	}
+	return hc;
+}
+
+static void
+HMAC_CTX_free(HMAC_CTX *hc)
+{
+	if (hc != NULL) {
+		HMAC_CTX_cleanup(hc);
+		free(hc);
+	}
+}
+#endif
+
 /*
  * Each encoded format (modulus, private key, set of delegation
  * parameters, delegation request and delegation response) begins with a
@@ -47,13 +92,13 @@ makwa_kdf(int hash_function,
 	const void *src, size_t src_len,
 	void *dst, size_t dst_len)
 {
-	HMAC_CTX hc;
+	HMAC_CTX *hc;
 	const EVP_MD *mdf;
 	size_t r;
 	unsigned char K[64], V[64], b;
 	unsigned mlen;
+	int err;
 
-	HMAC_CTX_init(&hc);
 	switch (hash_function) {
 	case MAKWA_SHA256:
 		mdf = EVP_sha256();
@@ -66,6 +111,11 @@ makwa_kdf(int hash_function,
 	default:
 		return MAKWA_BADPARAM;
 	}
+	hc = HMAC_CTX_new();
+	if (hc == NULL) {
+		return MAKWA_NOMEM;
+	}
+	err = MAKWA_HMAC_ERROR;
 
 	/*
 	 * HMAC_Init_ex(), HMAC_Update() and HMAC_Final() return 'void'
@@ -82,52 +132,52 @@ makwa_kdf(int hash_function,
 	memset(K, 0x00, r);
 
 	/* 3. K <- HMAC_K(V || 0x00 || m) */
-	HMAC_Init_ex(&hc, K, r, mdf, NULL);
-	HMAC_Update(&hc, V, r);
+	HMAC_Init_ex(hc, K, r, mdf, NULL);
+	HMAC_Update(hc, V, r);
 	b = 0x00;
-	HMAC_Update(&hc, &b, 1);
-	HMAC_Update(&hc, src, src_len);
-	HMAC_Final(&hc, K, &mlen);
+	HMAC_Update(hc, &b, 1);
+	HMAC_Update(hc, src, src_len);
+	HMAC_Final(hc, K, &mlen);
 	if (mlen != r) {
-		return MAKWA_HMAC_ERROR;
+		goto kdf_exit;
 	}
 
 	/* 4. V <- HMAC_K(V) */
-	HMAC_Init_ex(&hc, K, r, NULL, NULL);
-	HMAC_Update(&hc, V, r);
-	HMAC_Final(&hc, V, &mlen);
+	HMAC_Init_ex(hc, K, r, NULL, NULL);
+	HMAC_Update(hc, V, r);
+	HMAC_Final(hc, V, &mlen);
 	if (mlen != r) {
-		return MAKWA_HMAC_ERROR;
+		goto kdf_exit;
 	}
 
 	/* 5. K <- HMAC_K(V || 0x01 || m) */
-	HMAC_Init_ex(&hc, K, r, NULL, NULL);
-	HMAC_Update(&hc, V, r);
+	HMAC_Init_ex(hc, K, r, NULL, NULL);
+	HMAC_Update(hc, V, r);
 	b = 0x01;
-	HMAC_Update(&hc, &b, 1);
-	HMAC_Update(&hc, src, src_len);
-	HMAC_Final(&hc, K, &mlen);
+	HMAC_Update(hc, &b, 1);
+	HMAC_Update(hc, src, src_len);
+	HMAC_Final(hc, K, &mlen);
 	if (mlen != r) {
-		return MAKWA_HMAC_ERROR;
+		goto kdf_exit;
 	}
 
 	/* 6. V <- HMAC_K(V) */
-	HMAC_Init_ex(&hc, K, r, NULL, NULL);
-	HMAC_Update(&hc, V, r);
-	HMAC_Final(&hc, V, &mlen);
+	HMAC_Init_ex(hc, K, r, NULL, NULL);
+	HMAC_Update(hc, V, r);
+	HMAC_Final(hc, V, &mlen);
 	if (mlen != r) {
-		return MAKWA_HMAC_ERROR;
+		goto kdf_exit;
 	}
 
 	/* 7. and 8. */
 	while (dst_len > 0) {
 		size_t clen;
 
-		HMAC_Init_ex(&hc, K, r, NULL, NULL);
-		HMAC_Update(&hc, V, r);
-		HMAC_Final(&hc, V, &mlen);
+		HMAC_Init_ex(hc, K, r, NULL, NULL);
+		HMAC_Update(hc, V, r);
+		HMAC_Final(hc, V, &mlen);
 		if (mlen != r) {
-			return MAKWA_HMAC_ERROR;
+			goto kdf_exit;
 		}
 		clen = dst_len;
 		if (clen > r) {
@@ -137,8 +187,11 @@ makwa_kdf(int hash_function,
 		dst = (unsigned char *)dst + clen;
 		dst_len -= clen;
 	}
-	HMAC_CTX_cleanup(&hc);
-	return MAKWA_OK;
+	err = MAKWA_OK;
+
+kdf_exit:
+	HMAC_CTX_free(hc);
+	return err;
 }
 
 /* see makwa.h */
@@ -471,6 +524,15 @@ FUNCTION_EXIT:
  * When using a private key, makwa_init_full() ensures that p is greater
  * than q (the factors are swapped if necessary).
  */
+typedef struct {
+	/* Square count; negative for a reversal (unescrow). */
+	long w;
+
+	/* Exponents modulo p-1 and q-1 that apply (or revert) w
+	   squarings modulo p and q. */
+	BIGNUM *ep, *eq;
+} makwa_crt_exp;
+
 struct makwa_context_ {
 	/* The modulus. */
 	BIGNUM *modulus;
@@ -478,9 +540,32 @@ struct makwa_context_ {
 	/* The private key parameters; NULL if no private key is set. */
 	BIGNUM *p, *q, *iq;
 
+	/* Montgomery contexts for p and q; NULL if no private key is set. */
+	BN_MONT_CTX *mont_p, *mont_q;
+
+	/* CRT exponents for the square counts cached with
+	   makwa_cache_work_factor() and makwa_cache_work_factor_change(). */
+	makwa_crt_exp *crt_exp;
+	size_t crt_exp_num;
+
 	/* The modulus length, in bytes. */
 	size_t mod_len;
 
+	/* Montgomery context for the modulus, computed once by
+	   makwa_init_full() and shared by all hashes on this context
+	   (OpenSSL only reads it). */
+	BN_MONT_CTX *mont;
+
+#if MAKWA_IFMA
+	/* Modulus in 52-bit limbs for the IFMA squarings (see
+	   ifma_init()), with -1/n mod 2^52, R = 2^(52*ifma_len) mod n and
+	   1/R mod n. ifma_len is 0 if that code is not used. */
+	size_t ifma_len;
+	uint64_t *ifma_n;
+	uint64_t ifma_k0;
+	BIGNUM *ifma_r, *ifma_ri;
+#endif
+
 	/* The modulus checksum, used for the first 11 characters of the
 	   string encoding of Makwa output. */
 	unsigned char modID[8];
@@ -498,6 +583,483 @@ struct makwa_context_ {
 	long default_work_factor;
 };
 
+/*
+ * Release the cached CRT exponents of a context.
+ */
+static void
+crt_exp_clear(makwa_context *ctx)
+{
+	size_t u;
+
+	for (u = 0; u < ctx->crt_exp_num; u ++) {
+		FREE_BN(ctx->crt_exp[u].ep);
+		FREE_BN(ctx->crt_exp[u].eq);
+	}
+	FREE(ctx->crt_exp);
+	ctx->crt_exp = NULL;
+	ctx->crt_exp_num = 0;
+}
+
+/*
+ * Compute the CRT exponents for 'w' squarings: 2^w mod p-1 and
+ * 2^w mod q-1. If 'w' is negative, then the exponents revert -w
+ * squarings instead: ((p+1)/4)^(-w) mod p-1 and ((q+1)/4)^(-w) mod q-1
+ * (this works because p and q are equal to 3 modulo 4). The context
+ * must contain a private key.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+static int
+crt_exp_compute(const makwa_context *ctx, long w, BIGNUM *ep, BIGNUM *eq)
+{
+	BN_CTX *bnctx;
+	BIGNUM *fm, *bw;
+	BIGNUM *f[2], *e[2];
+	int i, err;
+
+	bnctx = NULL;
+	fm = NULL;
+	bw = NULL;
+	CZ(fm = BN_new());
+	CZ(bw = BN_new());
+	CZ(bnctx = BN_CTX_new());
+	f[0] = ctx->p;
+	f[1] = ctx->q;
+	e[0] = ep;
+	e[1] = eq;
+	for (i = 0; i < 2; i ++) {
+		if (w >= 0) {
+			CZ(BN_set_word(bw, (unsigned long)w));
+			CZ(BN_set_word(e[i], 2));
+		} else {
+			CZ(BN_set_word(bw, -(unsigned long)w));
+			CZ(BN_copy(e[i], f[i]));
+			CZ(BN_add_word(e[i], 1));
+			CZ(BN_rshift(e[i], e[i], 2));
+		}
+		CZ(BN_copy(fm, f[i]));
+		CZ(BN_sub_word(fm, 1));
+		CZ(BN_mod_exp(e[i], e[i], bw, fm, bnctx));
+	}
+
+FUNCTION_EXIT:
+	FREE_BN(fm);
+	FREE_BN(bw);
+	FREE_BNCTX(bnctx);
+	return err;
+}
+
+/*
+ * Find the cached CRT exponents for 'w' squarings (see
+ * crt_exp_compute()); NULL is returned if they are not cached.
+ */
+static const makwa_crt_exp *
+crt_exp_find(const makwa_context *ctx, long w)
+{
+	size_t u;
+
+	for (u = 0; u < ctx->crt_exp_num; u ++) {
+		if (ctx->crt_exp[u].w == w) {
+			return &ctx->crt_exp[u];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Compute and cache the CRT exponents for 'w' squarings (see
+ * crt_exp_compute()), unless they are already cached. The context
+ * must contain a private key.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+static int
+crt_exp_add(makwa_context *ctx, long w)
+{
+	makwa_crt_exp *ce;
+	BIGNUM *ep, *eq;
+	int err;
+
+	ep = NULL;
+	eq = NULL;
+	if (crt_exp_find(ctx, w) != NULL) {
+		RETURN(MAKWA_OK);
+	}
+	CZ(ep = BN_new());
+	CZ(eq = BN_new());
+	CF(crt_exp_compute(ctx, w, ep, eq));
+	CZ(ce = realloc(ctx->crt_exp, (ctx->crt_exp_num + 1) * sizeof *ce));
+	ctx->crt_exp = ce;
+	ce += ctx->crt_exp_num ++;
+	ce->w = w;
+	ce->ep = ep;
+	ce->eq = eq;
+	ep = NULL;
+	eq = NULL;
+
+FUNCTION_EXIT:
+	FREE_BN(ep);
+	FREE_BN(eq);
+	return err;
+}
+
+#if MAKWA_IFMA
+
+/*
+ * IFMA squarings work on values split into 52-bit limbs (least
+ * significant first). Eight values are processed at once, one per
+ * 64-bit lane: limb j of the value in lane l is at index 8*j+l.
+ *
+ * The Montgomery squaring uses R = 2^(52*len), where len is the
+ * smallest limb count such that R > 4n. With that margin, a value lower
+ * than 2n squares to a value lower than 2n, and no final subtraction is
+ * needed between squarings. Products are accumulated in 64-bit lanes
+ * without carry propagation (there is room for more than 4*80 terms);
+ * carries are propagated once per squaring, after the reduction.
+ */
+#define IFMA_LANES       8
+#define IFMA_MAX_LIMBS   80
+#define IFMA_MASK        (((uint64_t)1 << 52) - 1)
+#define IFMA_VECS(len)   (((len) + IFMA_LANES - 1) / IFMA_LANES)
+
+/*
+ * Minimum square count for which multi_square() uses ifma_square1().
+ * Entering and leaving its Montgomery domain costs two modular
+ * multiplications; with a 2048-bit modulus, this is recouped after
+ * about 8 squarings.
+ */
+#define IFMA_SQUARE1_MIN   16
+
+/*
+ * Tell whether the CPU supports the AVX-512 IFMA instructions.
+ */
+static int
+ifma_supported(void)
+{
+	return __builtin_cpu_supports("avx512f")
+		&& __builtin_cpu_supports("avx512ifma");
+}
+
+/*
+ * Decode a big-endian integer of 'blen' bytes into 'len' 52-bit limbs,
+ * written at w[0], w[stride], w[2*stride]... The integer must fit.
+ */
+static void
+ifma_decode(const unsigned char *buf, size_t blen,
+	uint64_t *w, size_t stride, size_t len)
+{
+	uint64_t acc;
+	int acc_len;
+	size_t j;
+
+	acc = 0;
+	acc_len = 0;
+	j = 0;
+	while (blen -- > 0) {
+		acc |= (uint64_t)buf[blen] << acc_len;
+		acc_len += 8;
+		if (acc_len >= 52) {
+			w[stride * j ++] = acc & IFMA_MASK;
+			acc >>= 52;
+			acc_len -= 52;
+		}
+	}
+	while (j < len) {
+		w[stride * j ++] = acc;
+		acc = 0;
+	}
+}
+
+/*
+ * Encode 'len' 52-bit limbs read at w[0], w[stride], w[2*stride]...
+ * into a big-endian integer of 'blen' bytes. The integer must fit.
+ */
+static void
+ifma_encode(const uint64_t *w, size_t stride, size_t len,
+	unsigned char *buf, size_t blen)
+{
+	uint64_t acc;
+	int acc_len;
+	size_t j;
+
+	acc = 0;
+	acc_len = 0;
+	for (j = 0; j < len; j ++) {
+		acc |= w[stride * j] << acc_len;
+		acc_len += 52;
+		while (acc_len >= 8) {
+			if (blen > 0) {
+				buf[-- blen] = (unsigned char)acc;
+			}
+			acc >>= 8;
+			acc_len -= 8;
+		}
+	}
+	while (blen > 0) {
+		buf[-- blen] = (unsigned char)acc;
+		acc = 0;
+	}
+}
+
+/*
+ * Compute the IFMA parameters of the context modulus. If the CPU lacks
+ * IFMA, or the modulus is too large, then ifma_len is set to 0.
+ */
+static int
+ifma_init(makwa_context *ctx, BN_CTX *bnctx)
+{
+	unsigned char *buf;
+	size_t len;
+	uint64_t n0, x;
+	int i, err;
+
+	buf = NULL;
+	FREE(ctx->ifma_n);
+	ctx->ifma_n = NULL;
+	ctx->ifma_len = 0;
+	len = ((size_t)BN_num_bits(ctx->modulus) + 2 + 51) / 52;
+	if (len > IFMA_MAX_LIMBS || !ifma_supported()) {
+		RETURN(MAKWA_OK);
+	}
+	/* ifma_square1() loads the modulus eight limbs at a time; the
+	   extra limbs are zero. */
+	CZ(ctx->ifma_n = calloc(IFMA_VECS(len) * IFMA_LANES,
+		sizeof *ctx->ifma_n));
+	CZ(buf = malloc(ctx->mod_len));
+	BN_bn2bin(ctx->modulus, buf);
+	ifma_decode(buf, ctx->mod_len, ctx->ifma_n, 1, len);
+
+	/*
+	 * Inverse of the (odd) low limb with Newton's iteration; each
+	 * step doubles the number of correct low bits, starting at 3.
+	 */
+	n0 = ctx->ifma_n[0];
+	x = n0;
+	for (i = 0; i < 5; i ++) {
+		x *= 2 - n0 * x;
+	}
+	ctx->ifma_k0 = -x & IFMA_MASK;
+
+	if (ctx->ifma_r == NULL) {
+		CZ(ctx->ifma_r = BN_new());
+	}
+	if (ctx->ifma_ri == NULL) {
+		CZ(ctx->ifma_ri = BN_new());
+	}
+	CZ(BN_set_word(ctx->ifma_r, 1));
+	CZ(BN_lshift(ctx->ifma_r, ctx->ifma_r, (int)(52 * len)));
+	CZ(BN_mod(ctx->ifma_r, ctx->ifma_r, ctx->modulus, bnctx));
+	CZ(BN_mod_inverse(ctx->ifma_ri, ctx->ifma_r, ctx->modulus, bnctx));
+	ctx->ifma_len = len;
+
+FUNCTION_EXIT:
+	FREE(buf);
+	return err;
+}
+
+/*
+ * Apply 'w' Montgomery squarings to the eight values in 'a' (interleaved
+ * limbs, see above), modulo n (given as 'len' limbs) with k0 = -1/n mod
+ * 2^52. The values must be lower than 2n, and so are the results. The
+ * instruction sequence does not depend on the values.
+ */
+__attribute__((target("avx512f,avx512ifma")))
+static void
+ifma_square8(uint64_t *a, const uint64_t *n, uint64_t k0,
+	size_t len, unsigned long w)
+{
+	__m512i av[IFMA_MAX_LIMBS], nv[IFMA_MAX_LIMBS];
+	__m512i t[2 * IFMA_MAX_LIMBS];
+	__m512i mask, zero, kv, m, c, v;
+	size_t i, j;
+
+	mask = _mm512_set1_epi64((long long)IFMA_MASK);
+	zero = _mm512_setzero_si512();
+	kv = _mm512_set1_epi64((long long)k0);
+	for (i = 0; i < len; i ++) {
+		av[i] = _mm512_loadu_si512(a + IFMA_LANES * i);
+		nv[i] = _mm512_set1_epi64((long long)n[i]);
+	}
+	while (w -- > 0) {
+		/* Cross products a[i]*a[j] (i < j), doubled. */
+		for (i = 0; i < 2 * len; i ++) {
+			t[i] = zero;
+		}
+		for (i = 0; i < len; i ++) {
+			for (j = i + 1; j < len; j ++) {
+				t[i + j] = _mm512_madd52lo_epu64(
+					t[i + j], av[i], av[j]);
+				t[i + j + 1] = _mm512_madd52hi_epu64(
+					t[i + j + 1], av[i], av[j]);
+			}
+		}
+		for (i = 0; i < 2 * len; i ++) {
+			t[i] = _mm512_add_epi64(t[i], t[i]);
+		}
+
+		/* Squares a[i]*a[i]. */
+		for (i = 0; i < len; i ++) {
+			t[2 * i] = _mm512_madd52lo_epu64(
+				t[2 * i], av[i], av[i]);
+			t[2 * i + 1] = _mm512_madd52hi_epu64(
+				t[2 * i + 1], av[i], av[i]);
+		}
+
+		/* Reduction: clear one limb at a time, passing its carry
+		   to the next one. */
+		for (i = 0; i < len; i ++) {
+			m = _mm512_madd52lo_epu64(zero, t[i], kv);
+			for (j = 0; j < len; j ++) {
+				t[i + j] = _mm512_madd52lo_epu64(
+					t[i + j], m, nv[j]);
+				t[i + j + 1] = _mm512_madd52hi_epu64(
+					t[i + j + 1], m, nv[j]);
+			}
+			t[i + 1] = _mm512_add_epi64(t[i + 1],
+				_mm512_srli_epi64(t[i], 52));
+		}
+
+		/* Result is the upper half, with carries propagated. */
+		c = zero;
+		for (i = 0; i < len; i ++) {
+			v = _mm512_add_epi64(t[len + i], c);
+			av[i] = _mm512_and_si512(v, mask);
+			c = _mm512_srli_epi64(v, 52);
+		}
+	}
+	for (i = 0; i < len; i ++) {
+		_mm512_storeu_si512(a + IFMA_LANES * i, av[i]);
+	}
+}
+
+/*
+ * Apply 'w' Montgomery squarings to a single value, with the same
+ * modulus parameters and bounds as ifma_square8(). Here the limbs are
+ * consecutive, eight per register: 'a' has room for nr registers (the
+ * limbs beyond 'len' are zero) and so has 'n'.
+ *
+ * This is the operand-scanning method: for each limb a[i], the
+ * accumulator receives a*a[i] + y*n, with y chosen so that its low
+ * limb becomes zero, then is shifted down by one limb. Low and high
+ * halves of the products are added on each side of the shift. The low
+ * limb of the accumulator is followed in a scalar register, so that the
+ * next y is known without waiting for the vector shift; the vector copy
+ * of that limb is simply dropped at the next shift.
+ *
+ * This function is always inlined with a constant 'nr', so that the
+ * loops over registers are unrolled and the accumulators stay in
+ * registers; see ifma_square1().
+ */
+__attribute__((target("avx512f,avx512ifma"), always_inline))
+static inline void
+ifma_square1_inner(uint64_t *a, const uint64_t *n, uint64_t k0,
+	size_t len, unsigned long w, const size_t nr)
+{
+	__m512i av[IFMA_VECS(IFMA_MAX_LIMBS)], nv[IFMA_VECS(IFMA_MAX_LIMBS)];
+	__m512i ra[IFMA_VECS(IFMA_MAX_LIMBS)], rn[IFMA_VECS(IFMA_MAX_LIMBS)];
+	__m512i zero, bv, yv;
+	unsigned __int128 pa, pn;
+	uint64_t a0, a1, n0, n1, acc, bi, y, t, c;
+	size_t i, v;
+
+	zero = _mm512_setzero_si512();
+#pragma GCC unroll 10
+	for (v = 0; v < nr; v ++) {
+		nv[v] = _mm512_loadu_si512(n + IFMA_LANES * v);
+	}
+	n0 = n[0];
+	n1 = n[1];
+	while (w -- > 0) {
+#pragma GCC unroll 10
+		for (v = 0; v < nr; v ++) {
+			av[v] = _mm512_loadu_si512(a + IFMA_LANES * v);
+			ra[v] = zero;
+			rn[v] = zero;
+		}
+		a0 = a[0];
+		a1 = a[1];
+		acc = 0;
+		for (i = 0; i < len; i ++) {
+			bi = a[i];
+
+			/* Limb 1 of the accumulator, before this step. */
+			t = (uint64_t)_mm_cvtsi128_si64(_mm512_castsi512_si128(
+				_mm512_alignr_epi64(zero,
+				_mm512_add_epi64(ra[0], rn[0]), 1)));
+
+			/* Scalar side: y, and the low limb after the shift. */
+			pa = (unsigned __int128)a0 * bi;
+			c = acc + ((uint64_t)pa & IFMA_MASK);
+			y = (c * k0) & IFMA_MASK;
+			pn = (unsigned __int128)n0 * y;
+			c += (uint64_t)pn & IFMA_MASK;
+			acc = (c >> 52) + t
+				+ ((a1 * bi) & IFMA_MASK) + ((n1 * y) & IFMA_MASK)
+				+ (uint64_t)(pa >> 52) + (uint64_t)(pn >> 52);
+
+			/* Vector side. */
+			bv = _mm512_set1_epi64((long long)bi);
+			yv = _mm512_set1_epi64((long long)y);
+#pragma GCC unroll 10
+			for (v = 0; v < nr; v ++) {
+				ra[v] = _mm512_madd52lo_epu64(ra[v], av[v], bv);
+				rn[v] = _mm512_madd52lo_epu64(rn[v], nv[v], yv);
+			}
+#pragma GCC unroll 10
+			for (v = 0; v < nr; v ++) {
+				__m512i ha, hn;
+
+				ha = v + 1 < nr ? ra[v + 1] : zero;
+				hn = v + 1 < nr ? rn[v + 1] : zero;
+				ra[v] = _mm512_alignr_epi64(ha, ra[v], 1);
+				rn[v] = _mm512_alignr_epi64(hn, rn[v], 1);
+			}
+#pragma GCC unroll 10
+			for (v = 0; v < nr; v ++) {
+				ra[v] = _mm512_madd52hi_epu64(ra[v], av[v], bv);
+				rn[v] = _mm512_madd52hi_epu64(rn[v], nv[v], yv);
+			}
+		}
+
+		/* The low limb is the scalar one; propagate carries. */
+		ra[0] = _mm512_mask_mov_epi64(ra[0], 1,
+			_mm512_set1_epi64((long long)acc));
+		rn[0] = _mm512_maskz_mov_epi64(0xFE, rn[0]);
+#pragma GCC unroll 10
+		for (v = 0; v < nr; v ++) {
+			_mm512_storeu_si512(a + IFMA_LANES * v,
+				_mm512_add_epi64(ra[v], rn[v]));
+		}
+		c = 0;
+		for (i = 0; i < len; i ++) {
+			c += a[i];
+			a[i] = c & IFMA_MASK;
+			c >>= 52;
+		}
+	}
+}
+
+__attribute__((target("avx512f,avx512ifma")))
+static void
+ifma_square1(uint64_t *a, const uint64_t *n, uint64_t k0,
+	size_t len, unsigned long w)
+{
+	switch (IFMA_VECS(len)) {
+	case 1:  ifma_square1_inner(a, n, k0, len, w, 1);  break;
+	case 2:  ifma_square1_inner(a, n, k0, len, w, 2);  break;
+	case 3:  ifma_square1_inner(a, n, k0, len, w, 3);  break;
+	case 4:  ifma_square1_inner(a, n, k0, len, w, 4);  break;
+	case 5:  ifma_square1_inner(a, n, k0, len, w, 5);  break;
+	case 6:  ifma_square1_inner(a, n, k0, len, w, 6);  break;
+	case 7:  ifma_square1_inner(a, n, k0, len, w, 7);  break;
+	case 8:  ifma_square1_inner(a, n, k0, len, w, 8);  break;
+	case 9:  ifma_square1_inner(a, n, k0, len, w, 9);  break;
+	default: ifma_square1_inner(a, n, k0, len, w, 10); break;
+	}
+}
+
+#endif
+
 /* see makwa.h */
 makwa_context *
 makwa_new(void)
@@ -512,6 +1074,17 @@ makwa_new(void)
 	ctx->p = NULL;
 	ctx->q = NULL;
 	ctx->iq = NULL;
+	ctx->mont = NULL;
+	ctx->mont_p = NULL;
+	ctx->mont_q = NULL;
+	ctx->crt_exp = NULL;
+	ctx->crt_exp_num = 0;
+#if MAKWA_IFMA
+	ctx->ifma_len = 0;
+	ctx->ifma_n = NULL;
+	ctx->ifma_r = NULL;
+	ctx->ifma_ri = NULL;
+#endif
 	return ctx;
 }
 
@@ -534,6 +1107,15 @@ makwa_free(makwa_context *ctx)
 	if (ctx->iq != NULL) {
 		BN_clear_free(ctx->iq);
 	}
+	FREE_MCTX(ctx->mont);
+	FREE_MCTX(ctx->mont_p);
+	FREE_MCTX(ctx->mont_q);
+	crt_exp_clear(ctx);
+#if MAKWA_IFMA
+	FREE(ctx->ifma_n);
+	FREE_BN(ctx->ifma_r);
+	FREE_BN(ctx->ifma_ri);
+#endif
 	free(ctx);
 }
 
@@ -597,6 +1179,7 @@ makwa_init_full(makwa_context *ctx,
 
 	bnctx = NULL;
 	tmp_mod = NULL;
+	crt_exp_clear(ctx);
 	if (ctx->modulus == NULL) {
 		CZ(ctx->modulus = BN_new());
 	}
@@ -635,6 +1218,10 @@ makwa_init_full(makwa_context *ctx,
 		ctx->q = NULL;
 		FREE_BN(ctx->iq);
 		ctx->iq = NULL;
+		FREE_MCTX(ctx->mont_p);
+		ctx->mont_p = NULL;
+		FREE_MCTX(ctx->mont_q);
+		ctx->mont_q = NULL;
 		break;
 	case MAGIC_PRIVKEY:
 		/* Private key. */
@@ -675,6 +1262,14 @@ makwa_init_full(makwa_context *ctx,
 		CZ(BN_mul(ctx->modulus, ctx->p, ctx->q, bnctx));
 		CZX(BN_mod_inverse(ctx->iq, ctx->q, ctx->p, bnctx),
 			MAKWA_BADPARAM);
+		if (ctx->mont_p == NULL) {
+			CZ(ctx->mont_p = BN_MONT_CTX_new());
+		}
+		if (ctx->mont_q == NULL) {
+			CZ(ctx->mont_q = BN_MONT_CTX_new());
+		}
+		CZ(BN_MONT_CTX_set(ctx->mont_p, ctx->p, bnctx));
+		CZ(BN_MONT_CTX_set(ctx->mont_q, ctx->q, bnctx));
 		break;
 	default:
 		RETURN(MAKWA_BADPARAM);
@@ -684,6 +1279,21 @@ makwa_init_full(makwa_context *ctx,
 		RETURN(MAKWA_BADPARAM);
 	}
 
+	/*
+	 * Montgomery context for the modulus (reused if the context
+	 * is initialized again).
+	 */
+	if (bnctx == NULL) {
+		CZ(bnctx = BN_CTX_new());
+	}
+	if (ctx->mont == NULL) {
+		CZ(ctx->mont = BN_MONT_CTX_new());
+	}
+	CZ(BN_MONT_CTX_set(ctx->mont, ctx->modulus, bnctx));
+#if MAKWA_IFMA
+	CF(ifma_init(ctx, bnctx));
+#endif
+
 	/*
 	 * Set/check hash function.
 	 */
@@ -725,12 +1335,54 @@ makwa_init_full(makwa_context *ctx,
 	}
 	ctx->default_work_factor = default_work_factor;
 
+	/*
+	 * With a private key, cache the CRT exponents for the default
+	 * work factor (hashing and unescrow).
+	 */
+	if (ctx->p != NULL) {
+		CF(makwa_cache_work_factor(ctx, default_work_factor));
+	}
+
 FUNCTION_EXIT:
 	FREE_BNCTX(bnctx);
 	FREE(tmp_mod);
 	return err;
 }
 
+/* see makwa.h */
+int
+makwa_cache_work_factor(makwa_context *ctx, long work_factor)
+{
+	int err;
+
+	if (work_factor < 0 || work_factor == LONG_MAX) {
+		RETURN(MAKWA_BADPARAM);
+	}
+	if (ctx->p == NULL) {
+		RETURN(MAKWA_NO_PRIVATE_KEY);
+	}
+	CF(crt_exp_add(ctx, work_factor + 1));
+	CF(crt_exp_add(ctx, -(work_factor + 1)));
+
+FUNCTION_EXIT:
+	return err;
+}
+
+/* see makwa.h */
+int
+makwa_cache_work_factor_change(makwa_context *ctx, long diff_wf)
+{
+	int err;
+
+	if (ctx->p == NULL) {
+		RETURN(MAKWA_NO_PRIVATE_KEY);
+	}
+	CF(crt_exp_add(ctx, diff_wf));
+
+FUNCTION_EXIT:
+	return err;
+}
+
 /* see makwa.h */
 int
 makwa_export_public(const makwa_context *ctx, void *out, size_t *out_len)
@@ -815,6 +1467,45 @@ OS2IP(const makwa_context *ctx, const void *src, BIGNUM *v)
 	return MAKWA_OK;
 }
 
+/*
+ * Apply (if 'w' is positive) or revert (if 'w' is negative) a sequence
+ * of |w| squarings on an integer 'x', modulo p and modulo q. The results
+ * are written in xp and xq. The context must contain a private key. The
+ * CRT exponents are taken from the context cache if available.
+ */
+static int
+crt_exp_apply(const makwa_context *ctx, const BIGNUM *x, long w,
+	BIGNUM *xp, BIGNUM *xq)
+{
+	const makwa_crt_exp *ce;
+	BN_CTX *bnctx;
+	BIGNUM *ep, *eq;
+	int err;
+
+	bnctx = NULL;
+	ep = NULL;
+	eq = NULL;
+	CZ(bnctx = BN_CTX_new());
+	ce = crt_exp_find(ctx, w);
+	if (ce == NULL) {
+		CZ(ep = BN_new());
+		CZ(eq = BN_new());
+		CF(crt_exp_compute(ctx, w, ep, eq));
+	}
+	CZ(BN_mod(xp, x, ctx->p, bnctx));
+	CZ(BN_mod(xq, x, ctx->q, bnctx));
+	CZ(BN_mod_exp_mont(xp, xp, ce != NULL ? ce->ep : ep,
+		ctx->p, bnctx, ctx->mont_p));
+	CZ(BN_mod_exp_mont(xq, xq, ce != NULL ? ce->eq : eq,
+		ctx->q, bnctx, ctx->mont_q));
+
+FUNCTION_EXIT:
+	FREE_BN(ep);
+	FREE_BN(eq);
+	FREE_BNCTX(bnctx);
+	return err;
+}
+
 /*
  * Apply a sequence of squarings to a modular integer 'x'. The context
  * must contain a private key; the "fast path" is used. Beware that
@@ -824,50 +1515,28 @@ static int
 multi_square_CRT(const makwa_context *ctx, BIGNUM *x, long w)
 {
 	BN_CTX *bnctx;
-	BIGNUM *p, *q, *iq;
-	BIGNUM *xp, *xq, *ep, *eq, *b2, *bw;
-	BIGNUM *temps[6];
-	int i, err;
+	BIGNUM *xp, *xq, *t;
+	int err;
 
 	bnctx = NULL;
-	p = ctx->p;
-	q = ctx->q;
-	iq = ctx->iq;
-	for (i = 0; i < 6; i ++) {
-		temps[i] = NULL;
-	}
-	for (i = 0; i < 6; i ++) {
-		CZ(temps[i] = BN_new());
-	}
-	xp = temps[0];
-	xq = temps[1];
-	ep = temps[2];
-	eq = temps[3];
-	b2 = temps[4];
-	bw = temps[5];
+	xp = NULL;
+	xq = NULL;
+	t = NULL;
+	CZ(xp = BN_new());
+	CZ(xq = BN_new());
+	CZ(t = BN_new());
 	CZ(bnctx = BN_CTX_new());
 
-	CZ(BN_set_word(b2, 2));
-	CZ(BN_set_word(bw, w));
-	CZ(BN_copy(xp, p));
-	CZ(BN_sub_word(xp, 1));
-	CZ(BN_mod_exp(ep, b2, bw, xp, bnctx));
-	CZ(BN_copy(xq, q));
-	CZ(BN_sub_word(xq, 1));
-	CZ(BN_mod_exp(eq, b2, bw, xq, bnctx));
-	CZ(BN_mod(xp, x, p, bnctx));
-	CZ(BN_mod(xq, x, q, bnctx));
-	CZ(BN_mod_exp(xp, xp, ep, p, bnctx));
-	CZ(BN_mod_exp(xq, xq, eq, q, bnctx));
-	CZ(BN_mod_sub(b2, xp, xq, p, bnctx));
-	CZ(BN_mod_mul(b2, b2, iq, p, bnctx));
-	CZ(BN_mul(b2, b2, q, bnctx));
-	CZ(BN_add(x, xq, b2));
+	CF(crt_exp_apply(ctx, x, w, xp, xq));
+	CZ(BN_mod_sub(t, xp, xq, ctx->p, bnctx));
+	CZ(BN_mod_mul(t, t, ctx->iq, ctx->p, bnctx));
+	CZ(BN_mul(t, t, ctx->q, bnctx));
+	CZ(BN_add(x, xq, t));
 
 FUNCTION_EXIT:
-	for (i = 0; i < 6; i ++) {
-		FREE_BN(temps[i]);
-	}
+	FREE_BN(xp);
+	FREE_BN(xq);
+	FREE_BN(t);
 	FREE_BNCTX(bnctx);
 	return err;
 }
@@ -881,56 +1550,7 @@ static int
 revert_multi_square(const makwa_context *ctx,
 	BIGNUM *x, long nw, BIGNUM *xp, BIGNUM *xq)
 {
-	BN_CTX *bnctx;
-	BIGNUM *p, *q;
-	BIGNUM *ep, *eq, *bw;
-	BIGNUM *temps[3];
-	int i, err;
-
-	bnctx = NULL;
-	p = ctx->p;
-	q = ctx->q;
-	for (i = 0; i < 3; i ++) {
-		temps[i] = NULL;
-	}
-	for (i = 0; i < 3; i ++) {
-		CZ(temps[i] = BN_new());
-	}
-	ep = temps[0];
-	eq = temps[1];
-	bw = temps[2];
-	CZ(bnctx = BN_CTX_new());
-
-	CZ(BN_set_word(bw, nw));
-
-	/* Compute the e'_p exponent. */
-	CZ(BN_copy(ep, p));
-	CZ(BN_add_word(ep, 1));
-	CZ(BN_rshift(ep, ep, 2));
-	CZ(BN_copy(xp, p));
-	CZ(BN_sub_word(xp, 1));
-	CZ(BN_mod_exp(ep, ep, bw, xp, bnctx));
-
-	/* Compute the e'_q exponent. */
-	CZ(BN_copy(eq, q));
-	CZ(BN_add_word(eq, 1));
-	CZ(BN_rshift(eq, eq, 2));
-	CZ(BN_copy(xq, q));
-	CZ(BN_sub_word(xq, 1));
-	CZ(BN_mod_exp(eq, eq, bw, xq, bnctx));
-
-	/* Do the exponentiations. */
-	CZ(BN_mod(xp, x, p, bnctx));
-	CZ(BN_mod(xq, x, q, bnctx));
-	CZ(BN_mod_exp(xp, xp, ep, p, bnctx));
-	CZ(BN_mod_exp(xq, xq, eq, q, bnctx));
-
-FUNCTION_EXIT:
-	for (i = 0; i < 3; i ++) {
-		FREE_BN(temps[i]);
-	}
-	FREE_BNCTX(bnctx);
-	return err;
+	return crt_exp_apply(ctx, x, -nw, xp, xq);
 }
 
 /*
@@ -961,9 +1581,35 @@ FUNCTION_EXIT:
 	return err;
 }
 
+/*
+ * Apply a sequence of squarings to an integer 'x' (lower than the
+ * modulus) modulo the modulus of the Montgomery context 'mctx'.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+static int
+multi_square_mont(BN_MONT_CTX *mctx, BIGNUM *x, unsigned long w)
+{
+	BN_CTX *bnctx;
+	int err;
+
+	bnctx = NULL;
+	CZ(bnctx = BN_CTX_new());
+	CZ(BN_to_montgomery(x, x, mctx, bnctx));
+	while (w -- > 0) {
+		CZ(BN_mod_mul_montgomery(x, x, x, mctx, bnctx));
+	}
+	CZ(BN_from_montgomery(x, x, mctx, bnctx));
+
+FUNCTION_EXIT:
+	FREE_BNCTX(bnctx);
+	return err;
+}
+
 /*
  * Apply a sequence of squarings to an integer 'x' modulo 'n'. This
- * function is context-free.
+ * function is context-free: the Montgomery context is computed for
+ * this call only.
  *
  * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
  */
@@ -979,11 +1625,7 @@ multi_square_cf(BIGNUM *x, unsigned long w, BIGNUM *n)
 	CZ(bnctx = BN_CTX_new());
 	CZ(mctx = BN_MONT_CTX_new());
 	CZ(BN_MONT_CTX_set(mctx, n, bnctx));
-	CZ(BN_to_montgomery(x, x, mctx, bnctx));
-	while (w -- > 0) {
-		CZ(BN_mod_mul_montgomery(x, x, x, mctx, bnctx));
-	}
-	CZ(BN_from_montgomery(x, x, mctx, bnctx));
+	CF(multi_square_mont(mctx, x, w));
 
 FUNCTION_EXIT:
 	FREE_BNCTX(bnctx);
@@ -991,6 +1633,64 @@ FUNCTION_EXIT:
 	return err;
 }
 
+/*
+ * Tell whether 'w' squarings should use the "fast path": this is the
+ * case if there is a private key, and the square count is at least
+ * equal to about 34% of the modulus length (in bits).
+ */
+static int
+use_CRT(const makwa_context *ctx, long w)
+{
+	long thr;
+
+	if (ctx->p == NULL || ctx->q == NULL || ctx->iq == NULL) {
+		return 0;
+	}
+	thr = (((long)BN_num_bits(ctx->modulus) * 34) + 50) / 100;
+	return w > thr;
+}
+
+#if MAKWA_IFMA
+/*
+ * Apply a sequence of squarings to an integer 'x' (lower than the
+ * modulus) with ifma_square1(). The context must have IFMA parameters
+ * (ifma_len != 0).
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+static int
+multi_square_ifma(const makwa_context *ctx, BIGNUM *x, unsigned long w)
+{
+	BN_CTX *bnctx;
+	uint64_t *a;
+	unsigned char *buf;
+	size_t len, blen;
+	int err;
+
+	bnctx = NULL;
+	a = NULL;
+	buf = NULL;
+	len = ctx->ifma_len;
+	blen = (52 * len + 7) >> 3;
+	CZ(bnctx = BN_CTX_new());
+	CZ(a = calloc(IFMA_VECS(len) * IFMA_LANES, sizeof *a));
+	CZ(buf = malloc(blen));
+	CZ(BN_mod_mul(x, x, ctx->ifma_r, ctx->modulus, bnctx));
+	CF(I2OSP_ex(blen, x, buf));
+	ifma_decode(buf, blen, a, 1, len);
+	ifma_square1(a, ctx->ifma_n, ctx->ifma_k0, len, w);
+	ifma_encode(a, 1, len, buf, blen);
+	CZ(BN_bin2bn(buf, blen, x));
+	CZ(BN_mod_mul(x, x, ctx->ifma_ri, ctx->modulus, bnctx));
+
+FUNCTION_EXIT:
+	FREE_BNCTX(bnctx);
+	FREE(a);
+	FREE(buf);
+	return err;
+}
+#endif
+
 /*
  * Apply a sequence of squarings to a modular integer 'x'. If the context
  * contains a private key and the number of squarings is large enough to
@@ -1035,25 +1735,27 @@ multi_square(const makwa_context *ctx, BIGNUM *x, long w)
 	}
 
 	/*
-	 * If there is a private key, and the square count is at least
-	 * equal to about 34% of the modulus length (in bits), then it
-	 * is worthwhile to switch to the "fast path".
+	 * Use the "fast path" if it is worthwhile.
 	 */
-	if (has_private) {
-		long thr;
-
-		thr = (((long)BN_num_bits(ctx->modulus) * 34) + 50) / 100;
-		if (w > thr) {
-			CF(multi_square_CRT(ctx, x, w));
-			RETURN(MAKWA_OK);
-		}
+	if (use_CRT(ctx, w)) {
+		CF(multi_square_CRT(ctx, x, w));
+		RETURN(MAKWA_OK);
 	}
 
 	/*
 	 * Normal path. We convert the integer to Montgomery representation,
-	 * then square repeatedly with Montgomery multiplication.
+	 * then square repeatedly with Montgomery multiplication. The
+	 * Montgomery context was computed along with the modulus. Where
+	 * the CPU has IFMA, ifma_square1() is used instead, unless there
+	 * are too few squarings to pay for the conversions.
 	 */
-	CF(multi_square_cf(x, (unsigned long)w, ctx->modulus));
+#if MAKWA_IFMA
+	if (ctx->ifma_len != 0 && w >= IFMA_SQUARE1_MIN) {
+		CF(multi_square_ifma(ctx, x, (unsigned long)w));
+		RETURN(MAKWA_OK);
+	}
+#endif
+	CF(multi_square_mont(ctx->mont, x, (unsigned long)w));
 
 FUNCTION_EXIT:
 	FREE_BN(xp);
@@ -1061,39 +1763,98 @@ FUNCTION_EXIT:
 	return err;
 }
 
-/* see makwa.h */
-int
-makwa_hash(const makwa_context *ctx,
+/*
+ * Apply a sequence of squarings to the 'num' modular integers x[].
+ * Where available, the IFMA code squares them eight at a time;
+ * otherwise, and when the "fast path" applies, they are processed one
+ * by one with multi_square().
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+static int
+multi_square_many(const makwa_context *ctx,
+	BIGNUM *const *x, size_t num, long w)
+{
+	size_t u;
+	int err;
+#if MAKWA_IFMA
+	BN_CTX *bnctx;
+	uint64_t *a;
+	unsigned char *buf;
+	size_t len, blen, lane, cnt;
+
+	bnctx = NULL;
+	a = NULL;
+	buf = NULL;
+	len = ctx->ifma_len;
+	if (len != 0 && num > 1 && w >= 0 && !use_CRT(ctx, w)) {
+		blen = (52 * len + 7) >> 3;
+		CZ(bnctx = BN_CTX_new());
+		CZ(a = malloc(IFMA_LANES * len * sizeof *a));
+		CZ(buf = malloc(blen));
+		for (u = 0; u < num; u += cnt) {
+			cnt = num - u;
+			if (cnt > IFMA_LANES) {
+				cnt = IFMA_LANES;
+			}
+			/* Unused lanes square zero. */
+			memset(a, 0, IFMA_LANES * len * sizeof *a);
+			for (lane = 0; lane < cnt; lane ++) {
+				CZ(BN_mod_mul(x[u + lane], x[u + lane],
+					ctx->ifma_r, ctx->modulus, bnctx));
+				CF(I2OSP_ex(blen, x[u + lane], buf));
+				ifma_decode(buf, blen, a + lane,
+					IFMA_LANES, len);
+			}
+			ifma_square8(a, ctx->ifma_n, ctx->ifma_k0,
+				len, (unsigned long)w);
+			for (lane = 0; lane < cnt; lane ++) {
+				ifma_encode(a + lane, IFMA_LANES, len,
+					buf, blen);
+				CZ(BN_bin2bn(buf, blen, x[u + lane]));
+				CZ(BN_mod_mul(x[u + lane], x[u + lane],
+					ctx->ifma_ri, ctx->modulus, bnctx));
+			}
+		}
+		RETURN(MAKWA_OK);
+	}
+#endif
+	for (u = 0; u < num; u ++) {
+		CF(multi_square(ctx, x[u], w));
+	}
+
+FUNCTION_EXIT:
+#if MAKWA_IFMA
+	FREE_BNCTX(bnctx);
+	FREE(a);
+	FREE(buf);
+#endif
+	return err;
+}
+
+/*
+ * Compute the integer x which Makwa squares, from the input and salt
+ * (steps 3 to 6 of the Makwa specification: pre-hashing, padding and
+ * decoding). The caller checks the input length.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+static int
+hash_input(const makwa_context *ctx,
 	const void *input, size_t input_len,
 	const void *salt, size_t salt_len,
-	int pre_hash,
-	size_t post_hash_length,
-	long work_factor,
-	void *out, size_t *out_len)
+	int pre_hash, BIGNUM *x)
 {
 	const unsigned char *pi;
-	size_t k, u, blen;
+	size_t k, u;
 	unsigned char tmp_pi[64];
 	unsigned char *Xbuf, *tmp;
-	BIGNUM *x;
 	int err;
 
 	Xbuf = NULL;
 	tmp = NULL;
-	x = NULL;
-
-	/* 1. Filter out error conditions on input parameters. */
 	k = ctx->mod_len;
-	if (!pre_hash && (input_len > (k - 32) || input_len > 255)) {
-		RETURN(MAKWA_TOOLARGE);
-	}
-
-	/* 2. Check and/or return output buffer size. */
-	blen = (post_hash_length > 0) ? post_hash_length : k;
-	DO_BUFFER(out, out_len, blen);
 
-	/* 3. Output buffer is present and large enough; compute the
-	      hash value. */
 	/* Pre-hashing (if applicable). */
 	if (pre_hash) {
 		CF(makwa_kdf(ctx->hash_function,
@@ -1120,20 +1881,33 @@ makwa_hash(const makwa_context *ctx,
 	Xbuf[k - 1] = u;
 
 	/* Decode X[] into integer x. */
-	CZ(x = BN_new());
 	CF(OS2IP(ctx, Xbuf, x));
 
-	/* Compute all the squarings. There is a corner case in which
-	   the "+1" makes the work factor overflow; we handle that case
-	   by calling multi_square() twice in that case. */
-	if (work_factor == LONG_MAX) {
-		CF(multi_square(ctx, x, work_factor));
-		CF(multi_square(ctx, x, 1));
-	} else {
-		CF(multi_square(ctx, x, work_factor + 1));
-	}
+FUNCTION_EXIT:
+	FREE(Xbuf);
+	FREE(tmp);
+	return err;
+}
+
+/*
+ * Write the Makwa output for the squared integer x into 'out': the
+ * primary output, or its post-hash if 'post_hash_length' is not 0.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+static int
+hash_output(const makwa_context *ctx, BIGNUM *x,
+	size_t post_hash_length, void *out)
+{
+	size_t k;
+	unsigned char *Xbuf;
+	int err;
+
+	Xbuf = NULL;
+	k = ctx->mod_len;
 
-	/* Encode the result back into XBuf[]; this is the primary output. */
+	/* Encode the result into XBuf[]; this is the primary output. */
+	CZ(Xbuf = malloc(k));
 	CF(I2OSP(ctx, x, Xbuf));
 
 	/* Return the primary output, or apply post-hashing, depending on
@@ -1147,11 +1921,119 @@ makwa_hash(const makwa_context *ctx,
 
 FUNCTION_EXIT:
 	FREE(Xbuf);
-	FREE(tmp);
+	return err;
+}
+
+/* see makwa.h */
+int
+makwa_hash(const makwa_context *ctx,
+	const void *input, size_t input_len,
+	const void *salt, size_t salt_len,
+	int pre_hash,
+	size_t post_hash_length,
+	long work_factor,
+	void *out, size_t *out_len)
+{
+	size_t k, blen;
+	BIGNUM *x;
+	int err;
+
+	x = NULL;
+
+	/* 1. Filter out error conditions on input parameters. */
+	k = ctx->mod_len;
+	if (!pre_hash && (input_len > (k - 32) || input_len > 255)) {
+		RETURN(MAKWA_TOOLARGE);
+	}
+
+	/* 2. Check and/or return output buffer size. */
+	blen = (post_hash_length > 0) ? post_hash_length : k;
+	DO_BUFFER(out, out_len, blen);
+
+	/* 3. Output buffer is present and large enough; compute the
+	      hash value. */
+	CZ(x = BN_new());
+	CF(hash_input(ctx, input, input_len, salt, salt_len, pre_hash, x));
+
+	/* Compute all the squarings. There is a corner case in which
+	   the "+1" makes the work factor overflow; we handle that case
+	   by calling multi_square() twice in that case. */
+	if (work_factor == LONG_MAX) {
+		CF(multi_square(ctx, x, work_factor));
+		CF(multi_square(ctx, x, 1));
+	} else {
+		CF(multi_square(ctx, x, work_factor + 1));
+	}
+
+	CF(hash_output(ctx, x, post_hash_length, out));
+
+FUNCTION_EXIT:
 	FREE_BN(x);
 	return err;
 }
 
+/* see makwa.h */
+int
+makwa_hash_many(const makwa_context *ctx, size_t num,
+	const void *const *input, const size_t *input_len,
+	const void *const *salt, const size_t *salt_len,
+	int pre_hash,
+	size_t post_hash_length,
+	long work_factor,
+	void *out, size_t *out_len)
+{
+	size_t k, u, blen;
+	BIGNUM **x;
+	int err;
+
+	x = NULL;
+	k = ctx->mod_len;
+	for (u = 0; u < num; u ++) {
+		if (!pre_hash
+			&& (input_len[u] > (k - 32) || input_len[u] > 255))
+		{
+			RETURN(MAKWA_TOOLARGE);
+		}
+	}
+	blen = (post_hash_length > 0) ? post_hash_length : k;
+	if (num > ((size_t)-1) / blen) {
+		RETURN(MAKWA_TOOLARGE);
+	}
+	DO_BUFFER(out, out_len, num * blen);
+	if (num == 0) {
+		RETURN(MAKWA_OK);
+	}
+
+	CZ(x = malloc(num * sizeof *x));
+	for (u = 0; u < num; u ++) {
+		x[u] = NULL;
+	}
+	for (u = 0; u < num; u ++) {
+		CZ(x[u] = BN_new());
+		CF(hash_input(ctx, input[u], input_len[u],
+			salt[u], salt_len[u], pre_hash, x[u]));
+	}
+	if (work_factor == LONG_MAX) {
+		CF(multi_square_many(ctx, x, num, work_factor));
+		CF(multi_square_many(ctx, x, num, 1));
+	} else {
+		CF(multi_square_many(ctx, x, num, work_factor + 1));
+	}
+	for (u = 0; u < num; u ++) {
+		CF(hash_output(ctx, x[u], post_hash_length,
+			(unsigned char *)out + u * blen));
+	}
+
+FUNCTION_EXIT:
+	if (x != NULL) {
+		for (u = 0; u < num; u ++) {
+			FREE_BN(x[u]);
+		}
+		free(x);
+	}
+	return err;
+}
+
 /* see makwa.h */
 int
 makwa_change_work_factor(const makwa_context *ctx,
@@ -1962,12 +2844,16 @@ FUNCTION_EXIT:
 
 /* ====================================================================== */
 
+typedef struct mask_pool_ mask_pool;
+
 struct makwa_delegation_parameters_ {
 	BIGNUM *modulus;
 	long work_factor;
 	size_t num;
 	BIGNUM **alpha;
 	BIGNUM **beta;
+	BN_MONT_CTX *mont;
+	mask_pool *pool;
 };
 
 /* see makwa.h */
@@ -2055,12 +2941,17 @@ makwa_delegation_new(void)
 	mdp->num = 0;
 	mdp->alpha = NULL;
 	mdp->beta = NULL;
+	mdp->mont = NULL;
+	mdp->pool = NULL;
 	return mdp;
 }
 
 static void
 mdp_clear(makwa_delegation_parameters *mdp)
 {
+	makwa_delegation_pool_stop(mdp);
+	FREE_MCTX(mdp->mont);
+	mdp->mont = NULL;
 	FREE_BN(mdp->modulus);
 	mdp->modulus = NULL;
 	if (mdp->alpha != NULL) {
@@ -2166,6 +3057,10 @@ makwa_delegation_init(makwa_delegation_parameters *mdp,
 		CZ(BN_to_montgomery(mdp->beta[u], mdp->beta[u], mctx, bnctx));
 	}
 
+	/* The Montgomery context is kept for mask pair creation. */
+	mdp->mont = mctx;
+	mctx = NULL;
+
 FUNCTION_EXIT:
 	FREE_BNCTX(bnctx);
 	FREE_MCTX(mctx);
@@ -2183,31 +3078,25 @@ makwa_delegation_get_work_factor(const makwa_delegation_parameters *mdp)
 }
 
 /*
- * Using the delegation parameters, create a "mask pair". The caller must
- * put the value to mask in z. This function replaces z with the value to
- * send, and stores the "unmask" integer in 'unmask'.
+ * Using the delegation parameters, compute a random "mask pair": 'mask'
+ * receives the product of a random subset of the alpha values, and
+ * 'unmask' the product of the matching beta values. Neither depends on
+ * the value to mask, so pairs can be computed ahead of time.
  */
 static int
-create_mask_pair(const makwa_delegation_parameters *mdp,
-	BIGNUM *z, BIGNUM *unmask)
+mask_pair(const makwa_delegation_parameters *mdp, BN_CTX *bnctx,
+	BIGNUM *mask, BIGNUM *unmask)
 {
-	BN_CTX *bnctx;
-	BN_MONT_CTX *mctx;
 	unsigned char rnd[38];
 	int err;
 	size_t u, n;
 
-	bnctx = NULL;
-	mctx = NULL;
 	if (!RAND_bytes(rnd, sizeof rnd)) {
 		RETURN(MAKWA_RAND_ERROR);
 	}
-	CZ(bnctx = BN_CTX_new());
-	CZ(mctx = BN_MONT_CTX_new());
-	CZ(BN_MONT_CTX_set(mctx, mdp->modulus, bnctx));
-	CZ(BN_to_montgomery(z, z, mctx, bnctx));
-	CZ(BN_set_word(unmask, 1));
-	CZ(BN_to_montgomery(unmask, unmask, mctx, bnctx));
+	CZ(BN_one(mask));
+	CZ(BN_to_montgomery(mask, mask, mdp->mont, bnctx));
+	CZ(BN_copy(unmask, mask));
 	n = mdp->num;
 	if (n > 300) {
 		n = 300;
@@ -2217,16 +3106,319 @@ create_mask_pair(const makwa_delegation_parameters *mdp,
 			continue;
 		}
 		CZ(BN_mod_mul_montgomery(
-			z, z, mdp->alpha[u], mctx, bnctx));
+			mask, mask, mdp->alpha[u], mdp->mont, bnctx));
 		CZ(BN_mod_mul_montgomery(
-			unmask, unmask, mdp->beta[u], mctx, bnctx));
+			unmask, unmask, mdp->beta[u], mdp->mont, bnctx));
 	}
-	CZ(BN_from_montgomery(z, z, mctx, bnctx));
-	CZ(BN_from_montgomery(unmask, unmask, mctx, bnctx));
+	CZ(BN_from_montgomery(mask, mask, mdp->mont, bnctx));
+	CZ(BN_from_montgomery(unmask, unmask, mdp->mont, bnctx));
 
 FUNCTION_EXIT:
+	OPENSSL_cleanse(rnd, sizeof rnd);
+	return err;
+}
+
+/*
+ * Pool of precomputed mask pairs, refilled by a background thread.
+ *
+ * The pool is a bounded ring with one producer (the refill thread) and
+ * any number of consumers (makwa_hash_delegate_begin() callers). Each
+ * slot carries a sequence number, which tells whether the slot is full
+ * for a given position; consumers claim positions with a compare-and-swap
+ * on 'tail', so that taking a pair never blocks. Each slot holds the
+ * mask then the unmask value, both over 'k' bytes (unsigned big-endian).
+ *
+ * When the ring is full, the refill thread sleeps on 'wake'; consumers
+ * signal it when the depth falls to half the capacity. The signal is
+ * sent without holding the mutex, so a wakeup may be missed; the thread
+ * then sleeps at most POOL_NAP_MS before looking again.
+ */
+#define POOL_MAX      ((size_t)1 << 20)
+#define POOL_NAP_MS   10
+
+typedef struct {
+	size_t seq;
+	unsigned char *data;
+} mask_slot;
+
+struct mask_pool_ {
+	const makwa_delegation_parameters *mdp;
+	size_t k;
+	size_t cap;
+	mask_slot *slots;
+	unsigned char *data;
+	size_t head;
+	size_t tail;
+	int stop;
+	unsigned long long produced;
+	unsigned long long consumed;
+	unsigned long long misses;
+	unsigned long long busy_ns;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL
+		+ (unsigned long long)ts.tv_nsec;
+}
+
+static void *
+pool_refill(void *arg)
+{
+	mask_pool *mp;
+	BN_CTX *bnctx;
+	BIGNUM *mask, *unmask;
+	mask_slot *slot;
+	size_t pos;
+	unsigned long long t;
+
+	mp = arg;
+	bnctx = BN_CTX_new();
+	mask = BN_new();
+	unmask = BN_new();
+	if (bnctx == NULL || mask == NULL || unmask == NULL) {
+		goto exit;
+	}
+	pos = mp->head;
+	while (!__atomic_load_n(&mp->stop, __ATOMIC_ACQUIRE)) {
+		slot = &mp->slots[pos & (mp->cap - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos) {
+			struct timespec ts;
+
+			/* Full: wait for consumers to make room. */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += POOL_NAP_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec ++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_mutex_lock(&mp->lock);
+			if (!__atomic_load_n(&mp->stop, __ATOMIC_ACQUIRE)) {
+				pthread_cond_timedwait(&mp->wake, &mp->lock, &ts);
+			}
+			pthread_mutex_unlock(&mp->lock);
+			continue;
+		}
+		t = now_ns();
+		if (mask_pair(mp->mdp, bnctx, mask, unmask) != MAKWA_OK
+			|| I2OSP_ex(mp->k, mask, slot->data) != MAKWA_OK
+			|| I2OSP_ex(mp->k, unmask, slot->data + mp->k)
+			!= MAKWA_OK)
+		{
+			/* Consumers fall back to inline computation. */
+			break;
+		}
+		pos ++;
+		__atomic_store_n(&slot->seq, pos, __ATOMIC_RELEASE);
+		__atomic_store_n(&mp->head, pos, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&mp->produced, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&mp->busy_ns, now_ns() - t,
+			__ATOMIC_RELAXED);
+	}
+
+exit:
+	FREE_BN(mask);
+	FREE_BN(unmask);
+	FREE_BNCTX(bnctx);
+	return NULL;
+}
+
+/*
+ * Take one mask pair from the pool into 'dst' (2*k bytes). Returned
+ * value is 1 on success, 0 if the pool is empty.
+ */
+static int
+pool_pop(mask_pool *mp, unsigned char *dst)
+{
+	mask_slot *slot;
+	size_t pos, seq, depth;
+
+	pos = __atomic_load_n(&mp->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &mp->slots[pos & (mp->cap - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos + 1) {
+			if (__atomic_compare_exchange_n(&mp->tail, &pos,
+				pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				break;
+			}
+		} else if ((ptrdiff_t)(seq - (pos + 1)) < 0) {
+			__atomic_add_fetch(&mp->misses, 1, __ATOMIC_RELAXED);
+			return 0;
+		} else {
+			pos = __atomic_load_n(&mp->tail, __ATOMIC_RELAXED);
+		}
+	}
+	memcpy(dst, slot->data, 2 * mp->k);
+	OPENSSL_cleanse(slot->data, 2 * mp->k);
+	__atomic_store_n(&slot->seq, pos + mp->cap, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&mp->consumed, 1, __ATOMIC_RELAXED);
+	depth = __atomic_load_n(&mp->head, __ATOMIC_ACQUIRE) - (pos + 1);
+	if (depth <= mp->cap / 2) {
+		pthread_cond_signal(&mp->wake);
+	}
+	return 1;
+}
+
+static void
+pool_free(mask_pool *mp)
+{
+	if (mp->data != NULL) {
+		OPENSSL_cleanse(mp->data, mp->cap * 2 * mp->k);
+	}
+	FREE(mp->data);
+	FREE(mp->slots);
+	free(mp);
+}
+
+/* see makwa.h */
+int
+makwa_delegation_pool_start(makwa_delegation_parameters *mdp, size_t size)
+{
+	mask_pool *mp;
+	size_t u;
+	int err;
+
+	mp = NULL;
+	if (mdp->modulus == NULL || size == 0 || size > POOL_MAX) {
+		RETURN(MAKWA_BADPARAM);
+	}
+	makwa_delegation_pool_stop(mdp);
+	CZ(mp = malloc(sizeof *mp));
+	mp->mdp = mdp;
+	mp->k = BN_num_bytes(mdp->modulus);
+	for (mp->cap = 2; mp->cap < size; mp->cap <<= 1);
+	mp->data = NULL;
+	mp->slots = NULL;
+	mp->head = 0;
+	mp->tail = 0;
+	mp->stop = 0;
+	mp->produced = 0;
+	mp->consumed = 0;
+	mp->misses = 0;
+	mp->busy_ns = 0;
+	CZ(mp->slots = malloc(mp->cap * sizeof *mp->slots));
+	CZ(mp->data = malloc(mp->cap * 2 * mp->k));
+	for (u = 0; u < mp->cap; u ++) {
+		mp->slots[u].seq = u;
+		mp->slots[u].data = mp->data + u * 2 * mp->k;
+	}
+	CZ(pthread_mutex_init(&mp->lock, NULL) == 0);
+	if (pthread_cond_init(&mp->wake, NULL) != 0) {
+		pthread_mutex_destroy(&mp->lock);
+		RETURN(MAKWA_NOMEM);
+	}
+	if (pthread_create(&mp->thread, NULL, pool_refill, mp) != 0) {
+		pthread_cond_destroy(&mp->wake);
+		pthread_mutex_destroy(&mp->lock);
+		RETURN(MAKWA_NOMEM);
+	}
+	mdp->pool = mp;
+	mp = NULL;
+
+FUNCTION_EXIT:
+	if (mp != NULL) {
+		pool_free(mp);
+	}
+	return err;
+}
+
+/* see makwa.h */
+void
+makwa_delegation_pool_stop(makwa_delegation_parameters *mdp)
+{
+	mask_pool *mp;
+
+	mp = mdp->pool;
+	if (mp == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&mp->lock);
+	__atomic_store_n(&mp->stop, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&mp->wake);
+	pthread_mutex_unlock(&mp->lock);
+	pthread_join(mp->thread, NULL);
+	pthread_cond_destroy(&mp->wake);
+	pthread_mutex_destroy(&mp->lock);
+	pool_free(mp);
+	mdp->pool = NULL;
+}
+
+/* see makwa.h */
+void
+makwa_delegation_pool_get_stats(const makwa_delegation_parameters *mdp,
+	makwa_delegation_pool_stats *st)
+{
+	mask_pool *mp;
+	size_t head, tail;
+	unsigned long long busy;
+
+	memset(st, 0, sizeof *st);
+	mp = mdp->pool;
+	if (mp == NULL) {
+		return;
+	}
+	tail = __atomic_load_n(&mp->tail, __ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&mp->head, __ATOMIC_ACQUIRE);
+	st->capacity = mp->cap;
+	st->depth = head >= tail ? head - tail : 0;
+	st->produced = __atomic_load_n(&mp->produced, __ATOMIC_RELAXED);
+	st->consumed = __atomic_load_n(&mp->consumed, __ATOMIC_RELAXED);
+	st->misses = __atomic_load_n(&mp->misses, __ATOMIC_RELAXED);
+	busy = __atomic_load_n(&mp->busy_ns, __ATOMIC_RELAXED);
+	if (busy > 0) {
+		st->refill_rate = (double)st->produced * 1e9 / (double)busy;
+	}
+}
+
+/*
+ * Using the delegation parameters, mask the value in z: z is replaced
+ * with the value to send, and the "unmask" integer is stored in
+ * 'unmask'. The mask pair is taken from the pool if there is one and
+ * it is not empty; otherwise, it is computed here.
+ */
+static int
+create_mask_pair(const makwa_delegation_parameters *mdp,
+	BIGNUM *z, BIGNUM *unmask)
+{
+	BN_CTX *bnctx;
+	BIGNUM *mask;
+	unsigned char *buf;
+	size_t k;
+	int err;
+
+	bnctx = NULL;
+	mask = NULL;
+	buf = NULL;
+	k = BN_num_bytes(mdp->modulus);
+	CZ(bnctx = BN_CTX_new());
+	CZ(mask = BN_new());
+	if (mdp->pool != NULL) {
+		CZ(buf = malloc(2 * k));
+	}
+	if (buf != NULL && pool_pop(mdp->pool, buf)) {
+		CZ(BN_bin2bn(buf, k, mask));
+		CZ(BN_bin2bn(buf + k, k, unmask));
+	} else {
+		CF(mask_pair(mdp, bnctx, mask, unmask));
+	}
+	CZ(BN_mod_mul(z, z, mask, mdp->modulus, bnctx));
+
+FUNCTION_EXIT:
+	if (buf != NULL) {
+		OPENSSL_cleanse(buf, 2 * k);
+		free(buf);
+	}
+	FREE_BN(mask);
 	FREE_BNCTX(bnctx);
-	FREE_MCTX(mctx);
 	return err;
 }
 
@@ -2495,6 +3687,11 @@ makwa_delegation_answer(
 	encode_32(buf, MAGIC_DELEG_ANS);
 	buf_len = k + 2;
 	CF(encode_mpi(z, buf + 4, &buf_len));
+	/* The result may be shorter than the modulus; report the actual
+	   length, as documented. */
+	if (ans_len != NULL) {
+		*ans_len = 4 + buf_len;
+	}
 
 FUNCTION_EXIT:
 	FREE_BN(n);
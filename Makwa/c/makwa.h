@@ -152,6 +152,7 @@
 #define MAKWA_PRE_HASH          -10  /* cannot operate: pre-hashing applied */
 #define MAKWA_POST_HASH         -11  /* cannot operate: post-hashing applied */
 #define MAKWA_EMBEDDED_ZERO     -12  /* escrowed password contains a zero */
+#define MAKWA_IO_ERROR          -13  /* socket I/O failure (delegd) */
 
 /*
  * Run the Makwa internal KDF over the provided source and data bytes.
@@ -255,6 +256,31 @@ int makwa_init_full(makwa_context *ctx,
 	size_t default_post_hash_length,
 	long default_work_factor);
 
+/*
+ * Precompute, in a context initialized with a private key, the CRT
+ * exponents used by makwa_hash() (for large enough work factors) and
+ * makwa_unescrow() with the given work factor. makwa_init_full() already
+ * does this for the default work factor; this function is for
+ * applications which use other work factors, e.g. bulk unescrow. Without
+ * it, these exponents are recomputed on every call.
+ *
+ * Like makwa_init_full(), this function modifies the context: it must
+ * not be called while other threads use the same context.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+int makwa_cache_work_factor(makwa_context *ctx, long work_factor);
+
+/*
+ * Precompute, in a context initialized with a private key, the CRT
+ * exponents used by makwa_change_work_factor() with the given work
+ * factor difference (which may be negative). Same rules as
+ * makwa_cache_work_factor().
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+int makwa_cache_work_factor_change(makwa_context *ctx, long diff_wf);
+
 /*
  * Export the modulus that a provided initialized context uses. Note that
  * this always exports the modulus, not the private key, even if the
@@ -321,6 +347,31 @@ int makwa_hash(const makwa_context *ctx,
 	long work_factor,
 	void *out, size_t *out_len);
 
+/*
+ * Compute the Makwa outputs for 'num' inputs at once; the result is the
+ * same as calling makwa_hash() on each input and salt (input[i],
+ * input_len[i], salt[i], salt_len[i]) with the other parameters. The
+ * outputs, of the length which makwa_hash() would produce, are written
+ * one after the other in 'out'; the "output buffer semantics" apply to
+ * the whole buffer.
+ *
+ * This is meant for servers which verify many passwords. On CPUs with
+ * the AVX-512 IFMA instructions (x86-64), the squarings of up to eight
+ * inputs run together, which gives a higher total throughput than
+ * hashing them one by one. Otherwise, and when the context holds a
+ * private key and the work factor is large enough for the "fast path",
+ * the inputs are simply processed in turn.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+int makwa_hash_many(const makwa_context *ctx, size_t num,
+	const void *const *input, const size_t *input_len,
+	const void *const *salt, const size_t *salt_len,
+	int pre_hash,
+	size_t post_hash_length,
+	long work_factor,
+	void *out, size_t *out_len);
+
 /*
  * Change the work factor for a given Makwa output. The provided buffer
  * must contain a Makwa primary output (no post-hashing) matching the
@@ -446,6 +497,56 @@ int makwa_delegation_init(makwa_delegation_parameters *mdp,
  */
 long makwa_delegation_get_work_factor(const makwa_delegation_parameters *mdp);
 
+/*
+ * Start a pool of precomputed mask pairs for a set of delegation
+ * parameters. Masking is the costly part of makwa_hash_delegate_begin()
+ * (about 150 modular multiplications for each of the two values); with
+ * a pool, a background thread computes mask pairs ahead of time, and
+ * makwa_hash_delegate_begin() only takes one out of the pool and does a
+ * single modular multiplication. Taking a pair never blocks: if the pool
+ * is empty, the mask pair is computed inline, as without a pool.
+ *
+ * The pool holds up to 'size' pairs (rounded up to a power of two, at
+ * most 2^20). Each pair is used only once. The refill thread runs until
+ * makwa_delegation_pool_stop() is called, or 'mdp' is reinitialized or
+ * released. Starting a pool on an instance which already has one
+ * replaces the latter. This function, like makwa_delegation_pool_stop(),
+ * must not be called while 'mdp' is being used by other threads.
+ *
+ * Returned value is 0 (MAKWA_OK) on success, or a negative error code.
+ */
+int makwa_delegation_pool_start(makwa_delegation_parameters *mdp,
+	size_t size);
+
+/*
+ * Stop the refill thread of the mask pair pool of 'mdp', and release
+ * the pool. This function does nothing if 'mdp' has no pool.
+ */
+void makwa_delegation_pool_stop(makwa_delegation_parameters *mdp);
+
+/*
+ * Mask pair pool metrics, as returned by
+ * makwa_delegation_pool_get_stats().
+ */
+typedef struct {
+	size_t capacity;              /* pool size, in mask pairs */
+	size_t depth;                 /* mask pairs currently available */
+	unsigned long long produced;  /* pairs computed by the refill thread */
+	unsigned long long consumed;  /* pairs taken from the pool */
+	unsigned long long misses;    /* begin calls that found it empty */
+	double refill_rate;           /* pairs per second of refill work */
+} makwa_delegation_pool_stats;
+
+/*
+ * Get the current metrics of the mask pair pool of 'mdp'. The counters
+ * are cumulative since the pool was started. If 'mdp' has no pool,
+ * then all fields are set to zero. This function may be called while
+ * other threads use 'mdp'; the values are then a consistent but
+ * possibly slightly stale snapshot for each field.
+ */
+void makwa_delegation_pool_get_stats(const makwa_delegation_parameters *mdp,
+	makwa_delegation_pool_stats *st);
+
 /*
  * A makwa_delegation_context instance maintains the running state of a
  * delegated hash computation. It is allocated with
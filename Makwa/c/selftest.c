@@ -23,6 +23,8 @@
 #include <string.h>
 #include <time.h>
 
+#include <openssl/bn.h>
+
 #include "makwa.h"
 
 static const unsigned char PUB2048[] = {
@@ -238,12 +240,56 @@ check_work_factor_change()
 	CC(makwa_simple_reset_work_factor(mpriv_large, hl, 384));
 	CC(makwa_simple_hash_verify(mpub_small, "test1", hl));
 
+	/* Same changes, with cached CRT exponents. */
+	CE(makwa_cache_work_factor_change(mpub_small, 4096 - 384),
+		MAKWA_NO_PRIVATE_KEY);
+	CC(makwa_cache_work_factor_change(mpriv_small, 4096 - 384));
+	CC(makwa_cache_work_factor_change(mpriv_large, 384 - 4096));
+	CC(makwa_simple_hash_new(mpub_small, "test2", hs, NULL));
+	strcpy(hl, hs);
+	CC(makwa_simple_reset_work_factor(mpriv_small, hl, 4096));
+	CC(makwa_simple_hash_verify(mpub_large, "test2", hl));
+	CC(makwa_simple_reset_work_factor(mpriv_large, hl, 384));
+	CHECK(strcmp(hl, hs) == 0);
+
 	makwa_free(mpub_small);
 	makwa_free(mpub_large);
 	makwa_free(mpriv_small);
 	makwa_free(mpriv_large);
 }
 
+static void
+check_hash_many(const void *param, size_t param_len,
+	size_t num, long work_factor)
+{
+	makwa_context *mc;
+	const void *input[20], *salt[20];
+	size_t input_len[20], salt_len[20];
+	char name[20][8];
+	unsigned char out[20 * 256], ref[256];
+	size_t len, u;
+
+	CZ(mc = makwa_new());
+	CC(makwa_init(mc, param, param_len, 0));
+	for (u = 0; u < num; u ++) {
+		sprintf(name[u], "test%u", (unsigned)u);
+		input[u] = name[u];
+		input_len[u] = strlen(name[u]);
+		salt[u] = "salt";
+		salt_len[u] = 4 - (u & 1);
+	}
+	len = sizeof out;
+	CC(makwa_hash_many(mc, num, input, input_len, salt, salt_len,
+		0, 0, work_factor, out, &len));
+	CHECK(len == num * 256);
+	for (u = 0; u < num; u ++) {
+		CC(makwa_hash(mc, input[u], input_len[u], salt[u], salt_len[u],
+			0, 0, work_factor, ref, NULL));
+		CHECK(memcmp(ref, out + u * 256, 256) == 0);
+	}
+	makwa_free(mc);
+}
+
 static void
 check_unescrow()
 {
@@ -271,6 +317,8 @@ check_delegation()
 	makwa_context *mpub, *mpriv;
 	makwa_delegation_parameters *mdp;
 	makwa_delegation_context *mdc;
+	makwa_delegation_pool_stats st;
+	int u;
 
 	/*
 	 * Generate some delegation parameters for work factor 16384. We
@@ -344,10 +392,56 @@ check_delegation()
 	 * Finalize the verification process.
 	 */
 	CC(makwa_simple_hash_verify_delegate_end(mdc, ans, ans_len));
-
 	xfree(req);
 	xfree(ans);
 	xfree(str_out);
+
+	/*
+	 * Same again with a mask pair pool: once the refill thread has
+	 * filled it, the first hashes take their pair from the pool, and
+	 * the next ones compute it inline if the pool runs dry.
+	 */
+	CC(makwa_delegation_pool_start(mdp, 3));
+	for (;;) {
+		struct timespec ts;
+
+		makwa_delegation_pool_get_stats(mdp, &st);
+		if (st.depth == st.capacity) {
+			break;
+		}
+		ts.tv_sec = 0;
+		ts.tv_nsec = 1000000;
+		nanosleep(&ts, NULL);
+	}
+	CHECK(st.capacity == 4);
+	CHECK(st.produced == 4);
+	CHECK(st.refill_rate > 0.0);
+	for (u = 0; u < 6; u ++) {
+		CC(makwa_simple_hash_new_delegate_begin(
+			mpub, mdp, "test2", mdc));
+		CC(makwa_delegation_context_encode(mdc, NULL, &req_len));
+		req = xmalloc(req_len);
+		CC(makwa_delegation_context_encode(mdc, req, &req_len));
+		CC(makwa_delegation_answer(req, req_len, NULL, &ans_len));
+		ans = xmalloc(ans_len);
+		CC(makwa_delegation_answer(req, req_len, ans, &ans_len));
+		CC(makwa_simple_hash_delegate_end(mdc,
+			ans, ans_len, NULL, &str_out_len));
+		str_out = xmalloc(str_out_len);
+		CC(makwa_simple_hash_delegate_end(mdc,
+			ans, ans_len, str_out, &str_out_len));
+		CC(makwa_simple_hash_verify(mpriv, "test2", str_out));
+		xfree(req);
+		xfree(ans);
+		xfree(str_out);
+	}
+	makwa_delegation_pool_get_stats(mdp, &st);
+	CHECK(st.consumed >= 4);
+	CHECK(st.consumed + st.misses == 6);
+	makwa_delegation_pool_stop(mdp);
+	makwa_delegation_pool_get_stats(mdp, &st);
+	CHECK(st.capacity == 0);
+
 	makwa_free(mpub);
 	makwa_free(mpriv);
 	makwa_delegation_free(mdp);
@@ -371,6 +465,80 @@ check_PHC(void)
 	printf("\n");
 }
 
+/*
+ * Time 'cc' hashes of work factor 'w', either through makwa_hash() or
+ * as a bare OpenSSL loop (Montgomery context setup, conversions and
+ * squarings, as each hash did before the context was cached).
+ */
+static double
+time_hashes(makwa_context *mc, const BIGNUM *n, long w, long cc)
+{
+	BN_CTX *bnctx;
+	BN_MONT_CTX *mctx;
+	BIGNUM *x;
+	clock_t begin, end;
+	unsigned char out[16];
+	unsigned char salt[16];
+	long m, u;
+
+	CZ(bnctx = BN_CTX_new());
+	CZ(x = BN_new());
+	CC(makwa_make_new_salt(salt, sizeof salt));
+	begin = clock();
+	for (m = 0; m < cc; m ++) {
+		if (mc != NULL) {
+			CC(makwa_hash(mc, "speedtest", 9, salt, sizeof salt,
+				0, 16, w, out, NULL));
+			continue;
+		}
+		CZ(BN_rand_range(x, n));
+		CZ(mctx = BN_MONT_CTX_new());
+		CZ(BN_MONT_CTX_set(mctx, n, bnctx));
+		CZ(BN_to_montgomery(x, x, mctx, bnctx));
+		for (u = 0; u <= w; u ++) {
+			CZ(BN_mod_mul_montgomery(x, x, x, mctx, bnctx));
+		}
+		CZ(BN_from_montgomery(x, x, mctx, bnctx));
+		BN_MONT_CTX_free(mctx);
+	}
+	end = clock();
+	BN_free(x);
+	BN_CTX_free(bnctx);
+	return (double)(end - begin) / CLOCKS_PER_SEC;
+}
+
+/*
+ * Compare hashes per second through makwa_hash() with the bare OpenSSL
+ * loop, for work factors 4096 to 65536 with the 2048-bit modulus.
+ */
+static void
+speed_test_wf(void)
+{
+	makwa_context *mc;
+	BIGNUM *n;
+	long w;
+
+	CZ(mc = makwa_new());
+	CC(makwa_init(mc, PUB2048, sizeof PUB2048, 0));
+	CZ(n = BN_bin2bn(PUB2048 + 6, sizeof PUB2048 - 6, NULL));
+	for (w = 4096; w <= 65536; w <<= 1) {
+		double tm, tb;
+		long cc;
+
+		for (cc = 1;; cc <<= 1) {
+			tm = time_hashes(mc, n, w, cc);
+			if (tm > 1.0) {
+				break;
+			}
+		}
+		tb = time_hashes(NULL, n, w, cc);
+		printf("wf = %6ld: makwa %8.2f h/s, bn %8.2f h/s (x%.3f)\n",
+			w, (double)cc / tm, (double)cc / tb, tb / tm);
+	}
+	BN_free(n);
+	makwa_free(mc);
+}
+
 /*
  * Run a speed test. We want two measures: the number of squarings per
  * second, and the number of private key operations per second. The latter
@@ -412,6 +580,41 @@ speed_test(void)
 		w <<= 1;
 	}
 
+	/* Batch mode: eight hashes per call. */
+	wprev = 1;
+	w = 2;
+	ttprev = 0.0;
+	for (;;) {
+		clock_t begin, end;
+		double tt;
+		const void *input[8], *salt[8];
+		size_t input_len[8], salt_len[8];
+		unsigned char out[8 * 16];
+		unsigned char salts[8][16];
+		int i;
+
+		begin = clock();
+		for (i = 0; i < 8; i ++) {
+			CC(makwa_make_new_salt(salts[i], sizeof salts[i]));
+			input[i] = "speedtest";
+			input_len[i] = 9;
+			salt[i] = salts[i];
+			salt_len[i] = sizeof salts[i];
+		}
+		CC(makwa_hash_many(mc, 8, input, input_len, salt, salt_len,
+			1, 16, w, out, NULL));
+		end = clock();
+		tt = (double)(end - begin) / CLOCKS_PER_SEC;
+		if (tt > 4.0) {
+			printf("batch wf/s = %.2f (8 hashes per call)\n",
+				8.0 * (double)(w - wprev) / (tt - ttprev));
+			break;
+		}
+		ttprev = tt;
+		wprev = w;
+		w <<= 1;
+	}
+
 	CC(makwa_init_full(mc, PRIV2048, sizeof PRIV2048, 0, 1, 16, 65536));
 	CC(makwa_simple_hash_new(mc, "speedtest", str, NULL));
 	cc = 2;
@@ -436,6 +639,73 @@ speed_test(void)
 	makwa_free(mc);
 }
 
+/*
+ * Time makwa_hash_delegate_begin(), first computing each mask pair
+ * inline, then taking them from a full pool. Wall-clock time is used,
+ * since the refill thread also uses CPU; only half the pool is drained,
+ * so that the refill thread stays mostly idle while we measure.
+ */
+static double
+time_delegate_begin(const makwa_context *mc,
+	const makwa_delegation_parameters *mdp, long cc)
+{
+	makwa_delegation_context *mdc;
+	struct timespec begin, end;
+	long m;
+
+	CZ(mdc = makwa_delegation_context_new());
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (m = 0; m < cc; m ++) {
+		CC(makwa_hash_delegate_begin(mc, mdp, "speedtest", 9,
+			"salt", 4, 0, 0, mdc));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	makwa_delegation_context_free(mdc);
+	return (double)cc / ((double)(end.tv_sec - begin.tv_sec)
+		+ (double)(end.tv_nsec - begin.tv_nsec) / 1e9);
+}
+
+static void
+speed_test_delegation(void)
+{
+	void *param;
+	size_t param_len;
+	makwa_context *mc;
+	makwa_delegation_parameters *mdp;
+	makwa_delegation_pool_stats st;
+	double inl, pool;
+
+	CC(makwa_delegation_generate(PRIV2048, sizeof PRIV2048,
+		4096, NULL, &param_len));
+	param = xmalloc(param_len);
+	CC(makwa_delegation_generate(PRIV2048, sizeof PRIV2048,
+		4096, param, &param_len));
+	CZ(mdp = makwa_delegation_new());
+	CC(makwa_delegation_init(mdp, param, param_len));
+	CZ(mc = makwa_new());
+	CC(makwa_init(mc, PUB2048, sizeof PUB2048, 0));
+
+	inl = time_delegate_begin(mc, mdp, 1000);
+	CC(makwa_delegation_pool_start(mdp, 2048));
+	do {
+		struct timespec ts;
+
+		ts.tv_sec = 0;
+		ts.tv_nsec = 10000000;
+		nanosleep(&ts, NULL);
+		makwa_delegation_pool_get_stats(mdp, &st);
+	} while (st.depth < st.capacity);
+	pool = time_delegate_begin(mc, mdp, 1000);
+	makwa_delegation_pool_get_stats(mdp, &st);
+	printf("deleg begin/s = %.2f inline, %.2f from pool (x%.2f),"
+		" refill %.2f pairs/s, %llu misses\n",
+		inl, pool, pool / inl, st.refill_rate, st.misses);
+
+	makwa_free(mc);
+	makwa_delegation_free(mdp);
+	xfree(param);
+}
+
 int
 main(void)
 {
@@ -452,6 +722,13 @@ main(void)
 	printf("Work factor change...\n");
 	check_work_factor_change();
 
+	printf("Batch hashing...\n");
+	check_hash_many(PUB2048, sizeof PUB2048, 1, 384);
+	check_hash_many(PUB2048, sizeof PUB2048, 8, 384);
+	check_hash_many(PUB2048, sizeof PUB2048, 19, 384);
+	check_hash_many(PRIV2048, sizeof PRIV2048, 11, 384);
+	check_hash_many(PRIV2048, sizeof PRIV2048, 3, 4096);
+
 	printf("Unescrow...\n");
 	check_unescrow();
 
@@ -465,6 +742,8 @@ main(void)
 
 	printf("Speed test...\n");
 	speed_test();
+	speed_test_delegation();
+	speed_test_wf();
 
 	return 0;
 }
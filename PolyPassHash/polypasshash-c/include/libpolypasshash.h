@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
 // constants declaration
@@ -47,6 +48,49 @@
 // the maximum number of shares to use in this framework.
 #define MAX_NUMBER_OF_SHARES 255
 
+// the username index starts with this many slots, and doubles whenever it
+// would get more than three quarters full.
+#define ACCOUNT_INDEX_INITIAL_SIZE 64
+#define ACCOUNT_INDEX_KEY_LENGTH 16
+
+// Stores are written by pph_store_context in a flat, versioned format that 
+// pph_map_context can use in place. All integers are little-endian, and 
+// every section starts at a multiple of 8 bytes:
+//
+//   header (PPH_STORE_HEADER_LENGTH bytes):
+//     0   "PPHSTORE"
+//     8   uint32 version (PPH_STORE_VERSION)
+//     12  uint32 header length
+//     16  uint8 threshold, partial_bytes, next_entry, available_shares
+//     20  uint32 reserved (0)
+//     24  uint64 number of accounts
+//     32  uint64 end of the valid data, where the next append goes
+//     40  uint64 offset of the index
+//     48  uint64 number of index slots, a power of two
+//     56  the key of the username hash (ACCOUNT_INDEX_KEY_LENGTH bytes)
+//
+//   account record, one per account:
+//     0   uint8 username length, uint8 number of entries, 6 bytes reserved
+//     8   the username, padded with zeros to a multiple of 8
+//     ..  the entries (PPH_STORE_ENTRY_LENGTH bytes each): uint8 share 
+//         number, uint8 salt length, uint8 password length, 1 byte
+//         reserved, the salt (MAX_SALT_LENGTH bytes), the polyhashed value
+//         (DIGEST_LENGTH bytes) and 4 bytes reserved
+//
+//   index (PPH_STORE_SLOT_LENGTH bytes per slot):
+//     0   uint64 username hash (as the in-memory index, under the file key)
+//     8   uint64 offset of the account record, 0 for an empty slot
+//
+// pph_append_context writes new records at the end of the valid data, fills
+// their slots (or writes a larger index after them) and only then updates
+// the header, so a crash in between leaves the previous state of the store.
+// It holds an exclusive flock() on the file meanwhile, so appends from 
+// several processes take turns.
+#define PPH_STORE_VERSION 1
+#define PPH_STORE_HEADER_LENGTH 72
+#define PPH_STORE_ENTRY_LENGTH 56
+#define PPH_STORE_SLOT_LENGTH 16
+
 // these constants are set to meet the password hashing competition guidelines
 #define MAX_USERNAME_LENGTH 128            
 #define MAX_SALT_LENGTH 16                  
@@ -141,6 +185,18 @@ typedef struct _pph_account_node{
 
 
 
+// a slot of the username index. Empty slots have node set to NULL, the hash
+// of the username is kept next to the pointer so that probing seldom needs
+// to touch the account itself.
+typedef struct _pph_index_slot{
+
+  uint64_t hash;
+  pph_account_node *node;
+
+} pph_index_slot;
+
+
+
 // The context structure defines all of what's needed to handle a polypasshash
 // store.
 typedef struct _pph_context{
@@ -169,6 +225,29 @@ typedef struct _pph_context{
   // this points to the account nodes currently available.  
   pph_account_node* account_data;
 
+  // open-addressing (linear probing) index over account_data, keyed by a 
+  // SipHash of the username under a random per-context key, so that logins 
+  // and duplicate checks do not walk the account list. index_size is a 
+  // power of two, or 0 before the first account is created.
+  pph_index_slot *account_index;
+  unsigned int index_size;
+  unsigned int account_count;
+  uint8 index_key[ACCOUNT_INDEX_KEY_LENGTH];
+
+  // if the context was opened with pph_map_context, this is the store file,
+  // mapped read-only: its accounts are looked up in place. Accounts created
+  // afterwards are kept in account_data until pph_append_context writes 
+  // them to the file. store_fd is -1 and store_map NULL otherwise.
+  int store_fd;
+  const uint8 *store_map;
+  size_t store_size;
+
+  // a copy of the header of the store file, taken when it was mapped. 
+  // Lookups go by this copy and not by the mapped header: when another 
+  // process appends to the file, that one may describe an index past the 
+  // end of our mapping. The data the copy points to is never overwritten.
+  uint8 store_header[PPH_STORE_HEADER_LENGTH];
+
 } pph_context;
 
 
@@ -194,6 +273,14 @@ typedef struct _pph_context{
 *                     uint8 *secret;                  = generated secret
 *                     uint8 partial_bytes;            = partial_bytes
 *                     pph_account_node* account_data; = NULL
+*                     pph_index_slot *account_index;  = NULL
+*                     unsigned int index_size;        = 0
+*                     unsigned int account_count;     = 0
+*                     uint8 index_key[];              = random key
+*                     int store_fd;                   = -1
+*                     const uint8 *store_map;         = NULL
+*                     size_t store_size;              = 0
+*                     uint8 store_header[];           = 
 *                   } pph_context;
 *                
 *
@@ -259,6 +346,14 @@ pph_context* pph_init_context(uint8 threshold, uint8 partial_bytes);
 *                     uint8 *secret;                  = needs freeing
 *                     uint8 partial_bytes;            = 
 *                     pph_account_node* account_data; = needs freeing
+*                     pph_index_slot *account_index;  = needs freeing
+*                     unsigned int index_size;        = 
+*                     unsigned int account_count;     = 
+*                     uint8 index_key[];              = 
+*                     int store_fd;                   = needs closing
+*                     const uint8 *store_map;         = needs unmapping
+*                     size_t store_size;              = 
+*                     uint8 store_header[];           = 
 *                   } pph_context;
 
 *
@@ -506,6 +601,12 @@ PPH_ERROR pph_unlock_password_data(pph_context *ctx,unsigned int username_count,
 *
 * DESCRIPTION :   store the information of the working context into a file. 
 *                 Elements as the secret and the share context are not stored.
+*                 The file uses the flat format described at the top of this
+*                 file, with a prebuilt username index, so that it can be 
+*                 opened in place with pph_map_context. It is written under a
+*                 temporary name and then renamed, so an existing store is 
+*                 replaced atomically (a context mapping the old file keeps
+*                 using it).
 *                 
 *
 * INPUTS :
@@ -532,16 +633,19 @@ PPH_ERROR pph_unlock_password_data(pph_context *ctx,unsigned int username_count,
 *           PPH_FILE_ERR                      when the file selected is non-
 *                                             writable. 
 *
+*           PPH_NO_MEM                        If malloc, calloc fails.
+*
 *           PPH_ERROR_UNKNOWN                 any time else
 *           
 * PROCESS :
-*     * Sanitize the data (unset flags, point secret to NULL)
-*     * open the selected file.
-*     * traverse the dynamic linked lists storing everything
-*     * close the file, return appropriate error
+*     * Sanitize the data
+*     * open a temporary file next to the selected one.
+*     * write an account record for every account, mapped or in memory
+*     * write the username index and the header
+*     * close the file, rename it, return appropriate error
 *
 * CHANGES :
-*     None as of this version
+*     (17/10/2026): flat, versioned format with a username index.
 */
 
 PPH_ERROR pph_store_context(pph_context *ctx, const unsigned char *filename);
@@ -579,13 +683,12 @@ PPH_ERROR pph_store_context(pph_context *ctx, const unsigned char *filename);
 *            A valid pointer                  if everything went fine
 * 
 * PROCESS :
-*     * Sanitize the data (check the string is a good string) 
-*     * open the selected file.
-*     * Build a dynamic list by traversing the file's contents
-*     * close the file, return appropriate structure
+*     * Map the file with pph_map_context
+*     * Build a dynamic list and the username index out of its accounts
+*     * unmap the file, return appropriate structure
 *
 * CHANGES :
-*     None as of this version
+*     (17/10/2026): reads the flat format written by pph_store_context.
 */
 
 pph_context *pph_reload_context(const unsigned char *filename);
@@ -594,6 +697,112 @@ pph_context *pph_reload_context(const unsigned char *filename);
 
 
 
+/*******************************************************************
+* NAME :          pph_map_context
+*
+* DESCRIPTION :   Open a pph_context stored in a file without loading its 
+*                 accounts: the file is mapped read-only and logins are 
+*                 checked against it in place, through the username index
+*                 stored with it. Opening takes the same time whatever the
+*                 number of accounts. As with pph_reload_context, the context
+*                 is locked until pph_unlock_password_data succeeds.
+*
+*                 Accounts created in a mapped context are kept in memory 
+*                 until pph_append_context adds them to the file.
+*
+* INPUTS :
+*   PARAMETERS:
+*     const unsigned char* filename: The filename of the datastore to use
+*
+* OUTPUTS :
+*   PARAMETERS:
+*     None
+*     
+*   GLOBALS :
+*     None
+*   
+*   RETURN :
+*     Type: pph_context * 
+*
+*           Values:                         When:
+*            NULL                             The file is not loadable
+*                                             or data looks corrupted
+*           
+*            A valid pointer                  if everything went fine
+* 
+* PROCESS :
+*     * open the selected file, read-write if possible
+*     * map it and check its header
+*     * initialize a locked context with the stored parameters
+*
+* CHANGES :
+*     None as of this version
+*/
+
+pph_context *pph_map_context(const unsigned char *filename);
+ 
+
+
+
+
+/*******************************************************************
+* NAME :          pph_append_context
+*
+* DESCRIPTION :   Add the accounts created in a mapped context to its file, 
+*                 without rewriting the accounts already there. The new 
+*                 accounts are then looked up in the file, like the others.
+*                 
+*                 Other contexts mapping the same file keep working with the
+*                 accounts they mapped, and see the new ones once they map 
+*                 it again. If another context appended to the file since 
+*                 this one mapped it, the file is mapped again first.
+*
+*                 Several processes may append to the same file: each 
+*                 append holds an exclusive flock() on it, from reading 
+*                 the header to writing the new one.
+*
+* INPUTS :
+*   PARAMETERS:
+*     pph_context *ctx:              A context opened with pph_map_context
+*
+* OUTPUTS :
+*   PARAMETERS:
+*     None
+*     
+*   GLOBALS :
+*     None
+*   
+*   RETURN :
+*     Type: int PPH_ERROR     
+*           Values:                         When:
+*           PPH_ERROR_OK                      When the accounts were added 
+*
+*           PPH_BAD_PTR                       When the context is NULL or was
+*                                             not opened with pph_map_context
+*           
+*           PPH_FILE_ERR                      when the file could not be 
+*                                             written (e.g., it was opened
+*                                             read-only)
+*
+*           PPH_NO_MEM                        If malloc, calloc fails.
+*           
+* PROCESS :
+*     * lock the file, and map it again if its header changed
+*     * write the records of the new accounts at the end of the valid data
+*     * add them to the index in place, or write a larger index after them
+*     * update the header, syncing the file before and after
+*     * map the file again, drop the accounts from memory and unlock it
+*
+* CHANGES :
+*     None as of this version
+*/
+
+PPH_ERROR pph_append_context(pph_context *ctx);
+ 
+
+
+
+
 /*******************************************************************
 * NAME :          PHS 
 *
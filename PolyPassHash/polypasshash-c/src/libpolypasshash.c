@@ -26,6 +26,66 @@
 #include "config.h"
 #include "libgfshare.h"
 #include "libpolypasshash.h"
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+// private helpers for the username index, defined at the end of this file.
+static uint64_t _hash_username(const uint8 *key, const uint8 *username,
+    unsigned int username_length);
+static pph_account_node *_find_account(pph_context *ctx,
+    const uint8 *username, unsigned int username_length);
+static PPH_ERROR _reserve_index(pph_context *ctx, unsigned int count);
+static void _insert_index(pph_context *ctx, pph_account_node *node);
+
+// private helpers for the flat store, also at the end of this file.
+static uint32_t _load32_le(const uint8 *p);
+static uint64_t _load64_le(const uint8 *p);
+static void _store32_le(uint8 *p, uint32_t v);
+static void _store64_le(uint8 *p, uint64_t v);
+static PPH_ERROR _map_store(pph_context *ctx);
+static void _unmap_store(pph_context *ctx);
+static uint64_t _store_end(pph_context *ctx);
+static PPH_ERROR _append_store(pph_context *ctx);
+static const uint8 *_store_index(pph_context *ctx, uint64_t *slots);
+static const uint8 *_store_record(pph_context *ctx, uint64_t offset);
+static const uint8 *_find_record(pph_context *ctx, const uint8 *username,
+    unsigned int username_length);
+static unsigned int _find_entries(pph_context *ctx, const uint8 *username,
+    unsigned int username_length, pph_entry *entries,
+    unsigned int max_entries);
+static size_t _record_length(const uint8 *record);
+static size_t _encode_record(uint8 *dest, const pph_account *account);
+static void _decode_entry(pph_entry *entry, const uint8 *entry_data);
+static void _encode_header(uint8 *dest, const pph_context *ctx,
+    uint64_t account_count, uint64_t file_end, uint64_t index_offset,
+    uint64_t index_slots, const uint8 *key);
+static void _index_slot_put(uint8 *index, uint64_t slots, uint64_t hash,
+    uint64_t offset);
+static void _destroy_account_list(pph_context *ctx);
+
+// offsets of the header fields of a store, see libpolypasshash.h
+#define STORE_MAGIC "PPHSTORE"
+#define STORE_VERSION_OFFSET 8
+#define STORE_HEADER_LENGTH_OFFSET 12
+#define STORE_THRESHOLD_OFFSET 16
+#define STORE_PARTIAL_BYTES_OFFSET 17
+#define STORE_NEXT_ENTRY_OFFSET 18
+#define STORE_AVAILABLE_SHARES_OFFSET 19
+#define STORE_ACCOUNT_COUNT_OFFSET 24
+#define STORE_FILE_END_OFFSET 32
+#define STORE_INDEX_OFFSET_OFFSET 40
+#define STORE_INDEX_SLOTS_OFFSET 48
+#define STORE_KEY_OFFSET 56
+
+// the largest account record, with a full username and all of the shares
+#define STORE_MAX_RECORD_LENGTH (8 + MAX_USERNAME_LENGTH + \
+    MAX_NUMBER_OF_SHARES * PPH_STORE_ENTRY_LENGTH)
 
 
 
@@ -48,6 +108,14 @@
 *                     uint8 *secret;                  = generated secret
 *                     uint8 partial_bytes;            = partial_bytes
 *                     pph_account_node* account_data; = NULL
+*                     pph_index_slot *account_index;  = NULL
+*                     unsigned int index_size;        = 0
+*                     unsigned int account_count;     = 0
+*                     uint8 index_key[];              = random key
+*                     int store_fd;                   = -1
+*                     const uint8 *store_map;         = NULL
+*                     size_t store_size;              = 0
+*                     uint8 store_header[];           = 
 *                   } pph_context;
 *                
 *
@@ -160,6 +228,17 @@ pph_context* pph_init_context(uint8 threshold, uint8 partial_bytes) {
   context->next_entry=1;
   context->account_data=NULL;
 
+  // the username index is allocated along with the first account.
+  context->account_index = NULL;
+  context->index_size = 0;
+  context->account_count = 0;
+  get_random_bytes(ACCOUNT_INDEX_KEY_LENGTH, context->index_key);
+
+  // this context is not backed by a store file.
+  context->store_fd = -1;
+  context->store_map = NULL;
+  context->store_size = 0;
+
 
 
   // 5) Initialize share context
@@ -213,6 +292,14 @@ pph_context* pph_init_context(uint8 threshold, uint8 partial_bytes) {
 *                     uint8 *secret;                  = needs freeing
 *                     uint8 partial_bytes;            = 
 *                     pph_account_node* account_data; = needs freeing
+*                     pph_index_slot *account_index;  = needs freeing
+*                     unsigned int index_size;        = 
+*                     unsigned int account_count;     = 
+*                     uint8 index_key[];              = 
+*                     int store_fd;                   = needs closing
+*                     const uint8 *store_map;         = needs unmapping
+*                     size_t store_size;              = 
+*                     uint8 store_header[];           = 
 *                   } pph_context;
 *
 *
@@ -245,9 +332,6 @@ pph_context* pph_init_context(uint8 threshold, uint8 partial_bytes) {
 PPH_ERROR pph_destroy_context(pph_context *context){
 
 
-  pph_account_node *current,*next;
-
-
   // check that we are given a valid pointer
   if(context == NULL){
     
@@ -261,16 +345,13 @@ PPH_ERROR pph_destroy_context(pph_context *context){
     free(context->secret);
   }
 
+  // free the accounts and their index
+  _destroy_account_list(context);
 
-  if(context->account_data != NULL){
-    next = context->account_data;
-    while(next!=NULL){
-      current=next;
-      next=next->next;
-      // free their entry list
-      _destroy_entry_list(current->account.entries);
-      free(current); 
-    }
+  // and release the store file, if any
+  _unmap_store(context);
+  if(context->store_fd != -1){
+    close(context->store_fd);
   }
 
 
@@ -364,7 +445,7 @@ PPH_ERROR pph_create_account(pph_context *ctx, const uint8 *username,
                         const unsigned int password_length, uint8 shares){
 
 
-  pph_account_node *node,*next;
+  pph_account_node *node;
   unsigned int length;
   unsigned int i;
   pph_entry *entry_node,*last_entry;
@@ -412,19 +493,21 @@ PPH_ERROR pph_create_account(pph_context *ctx, const uint8 *username,
     
   }
 
-  // This while loop will traverse our accounts and check if the username is 
-  // already taken.
-  next = ctx->account_data;
-  while(next!=NULL){
-    node=next;
-    next=next->next;
-    // only compare them if their lengths match
-    if(username_length==node->account.username_length && 
-        !memcmp(node->account.username,username,username_length)){
+  // look the username up in the index to check if it is already taken, and
+  // in the store file if the context is mapped.
+  if(_find_account(ctx, username, username_length) != NULL ||
+      _find_record(ctx, username, username_length) != NULL){
     
-      return PPH_ACCOUNT_EXISTS; 
+    return PPH_ACCOUNT_EXISTS; 
+    
+  }
+
+  // make room in the index now, so that nothing can fail once the entries
+  // are generated.
+  if(_reserve_index(ctx, ctx->account_count + 1) != PPH_ERROR_OK){
+    
+    return PPH_NO_MEM;
     
-    }
   }
 
 
@@ -509,9 +592,10 @@ PPH_ERROR pph_create_account(pph_context *ctx, const uint8 *username,
   node->account.entries = entry_node;
 
   // 5) add the resulting account to the current context.
-  // append it to the context list, with the rest of thee users
+  // append it to the context list, with the rest of thee users, and index it
   node->next = ctx->account_data;
   ctx->account_data = node;
+  _insert_index(ctx, node);
 
   // 6) return.
   // everything is set!
@@ -580,9 +664,6 @@ PPH_ERROR pph_check_login(pph_context *ctx, const char *username,
                           unsigned int password_length){
  
 
-  // this will be used to iterate all the users 
-  pph_account_node *search;
-  pph_account_node *target = NULL; 
   
   // we will store the current share in this buffer for xor'ing   
   uint8 share_data[SHARE_LENGTH];  
@@ -595,6 +676,7 @@ PPH_ERROR pph_check_login(pph_context *ctx, const char *username,
 
   // these are value holders to improve readability
   uint8 sharenumber;
+  pph_entry entry;
   pph_entry *current_entry;
   unsigned int i;
 
@@ -645,21 +727,11 @@ PPH_ERROR pph_check_login(pph_context *ctx, const char *username,
   }
 
 
-  // 2) Try to find the user in our context.
-  // search for our user, we search the entries with the same username length 
-  // first, and then we check if the contents are the same. 
-  search = ctx->account_data;
-  while(search!=NULL){
-    // we check lengths first and then compare what's in it. 
-    if(username_length == search->account.username_length && 
-        !memcmp(search->account.username,username,username_length)){
-      target = search;
-    }
-    search=search->next;
-  } 
-
+  // 2) Try to find the user in our context, through the username index
+  // (in memory or in the store file), we only need his first entry.
   //i.e. we found no one
-  if(target == NULL){ 
+  if(_find_entries(ctx, (const uint8 *)username, username_length, &entry, 1)
+      == 0){ 
     
     return PPH_ACCOUNT_IS_INVALID;
     
@@ -673,18 +745,9 @@ PPH_ERROR pph_check_login(pph_context *ctx, const char *username,
   // 3) Try to verify the proper password for him.
   // first, check what type of account is this
   
-  // this probably happens if data is inconsistent, but let's avoid
-  // segmentation faults. 
-  if(target->account.entries == NULL){
-    
-    return PPH_ERROR_UNKNOWN; 
-    
-  }
-
-
-  // we get the first entry to check if this is a valid login, we could be 
+  // we got the first entry to check if this is a valid login, we could be 
   // thorough and check for each, but it looks like an overkill
-  current_entry = target->account.entries;
+  current_entry = &entry;
   sharenumber = current_entry->share_number;
   partial_bytes_offset = DIGEST_LENGTH - ctx->partial_bytes;
   
@@ -704,7 +767,7 @@ PPH_ERROR pph_check_login(pph_context *ctx, const char *username,
     // only compare the bytes that are not obscured by either AES or the 
     // share, we start from share_length-partial_bytes to share_length. 
     if(memcmp(resulting_hash+partial_bytes_offset,
-          target->account.entries->polyhashed_value+partial_bytes_offset,
+          current_entry->polyhashed_value+partial_bytes_offset,
           ctx->partial_bytes)){
     
       return PPH_ACCOUNT_IS_INVALID;
@@ -774,7 +837,7 @@ PPH_ERROR pph_check_login(pph_context *ctx, const char *username,
       
       // add the partial bytes to the end of the digest.
       for(i=DIGEST_LENGTH-ctx->partial_bytes;i<DIGEST_LENGTH;i++){
-        xored_hash[i] = target->account.entries->polyhashed_value[i];
+        xored_hash[i] = current_entry->polyhashed_value[i];
       }
       
       // compare both.
@@ -845,7 +908,8 @@ PPH_ERROR pph_check_login(pph_context *ctx, const char *username,
 *           
 * PROCESS :
 *     1) Verify input sanity
-*     2) traverse user accounts searching for proposed username
+*     2) look each proposed username up in the username index, in memory
+*        or in the store file
 *     3) produce shares out of the password digest
 *     4) give shares to the recombination context
 *     5) attempt recombination
@@ -870,8 +934,9 @@ PPH_ERROR pph_unlock_password_data(pph_context *ctx,unsigned int username_count,
   uint8 salted_password[MAX_USERNAME_LENGTH+MAX_SALT_LENGTH];
   uint8 estimated_digest[DIGEST_LENGTH];
   uint8 estimated_share[SHARE_LENGTH];
+  pph_entry entries[MAX_NUMBER_OF_SHARES];
   pph_entry *entry; 
-  pph_account_node *current_user;
+  unsigned int entry_count, j;
   
 
   //sanitize the data.
@@ -899,52 +964,42 @@ PPH_ERROR pph_unlock_password_data(pph_context *ctx,unsigned int username_count,
      SHARE_LENGTH-ctx->partial_bytes);
 
 
-  // traverse our possible users
-  current_user=ctx->account_data;
-  while(current_user!=NULL){
-    // check if each of the provided users is inside the context. We traverse
-    // our user list inside the while, and compare against the provided users 
-    // inside this for loop.
-    for(i = 0; i<username_count;i++){
+  // look each of the provided users up in the context
+  for(i = 0; i<username_count;i++){
 
-      //compare the proposed against existing users.
-      if(username_lengths[i] == current_user->account.username_length &&
-          (!memcmp(usernames[i],current_user->account.username,
-            current_user->account.username_length))){
+    entry_count = _find_entries(ctx, usernames[i], username_lengths[i],
+        entries, MAX_NUMBER_OF_SHARES);
+    if(entry_count == 0){
+      continue;
+    }
 
-        // this is an existing user
-        entry = current_user->account.entries;
-        
-        // check if he is a threshold account.
-        if(entry->share_number != 0){
-        
-          // if he is a threshold account, we must attempt to reconstruct the
-          // shares using their information, traverse his entries
-          while(entry!=NULL){
-
-            // calulate the digest given the password.
-            memcpy(salted_password,entry->salt,entry->salt_length);
-            memcpy(salted_password+entry->salt_length, passwords[i],
-                entry->password_length);
-            _calculate_digest(estimated_digest,salted_password,
-             MAX_SALT_LENGTH + current_user->account.entries->password_length);
-
-            // xor the obtained digest with the polyhashed value to obtain
-            // our share.
-            _xor_share_with_digest(estimated_share,entry->polyhashed_value,
-                estimated_digest,SHARE_LENGTH-ctx->partial_bytes);
-         
-            // give share to the recombinator. 
-            share_numbers[entry->share_number] = entry->share_number+1;
-            gfshare_ctx_dec_giveshare(G, entry->share_number,estimated_share);
-
-            // move to the next entry.
-            entry = entry->next;
-          }
-        } 
+    // this is an existing user
+    
+    // check if he is a threshold account.
+    if(entries[0].share_number != 0){
+    
+      // if he is a threshold account, we must attempt to reconstruct the
+      // shares using their information, traverse his entries
+      for(j = 0; j < entry_count; j++){
+        entry = &entries[j];
+
+        // calulate the digest given the password.
+        memcpy(salted_password,entry->salt,entry->salt_length);
+        memcpy(salted_password+entry->salt_length, passwords[i],
+            entry->password_length);
+        _calculate_digest(estimated_digest,salted_password,
+         MAX_SALT_LENGTH + entries[0].password_length);
+
+        // xor the obtained digest with the polyhashed value to obtain
+        // our share.
+        _xor_share_with_digest(estimated_share,entry->polyhashed_value,
+            estimated_digest,SHARE_LENGTH-ctx->partial_bytes);
+     
+        // give share to the recombinator. 
+        share_numbers[entry->share_number] = entry->share_number+1;
+        gfshare_ctx_dec_giveshare(G, entry->share_number,estimated_share);
       }
     } 
-    current_user = current_user->next;
   }
 
 
@@ -999,6 +1054,12 @@ PPH_ERROR pph_unlock_password_data(pph_context *ctx,unsigned int username_count,
 *
 * DESCRIPTION :   store the information of the working context into a file. 
 *                 Elements as the secret and the share context are not stored.
+*                 The file uses the flat format described in 
+*                 libpolypasshash.h, with a prebuilt username index, so that 
+*                 it can be opened in place with pph_map_context. It is 
+*                 written under a temporary name and then renamed, so an 
+*                 existing store is replaced atomically (a context mapping the
+*                 old file keeps using it).
 *                 
 *
 * INPUTS :
@@ -1025,13 +1086,16 @@ PPH_ERROR pph_unlock_password_data(pph_context *ctx,unsigned int username_count,
 *           PPH_FILE_ERR                      when the file selected is non-
 *                                             writable. 
 *
+*           PPH_NO_MEM                        If malloc, calloc fails.
+*
 *           PPH_ERROR_UNKNOWN                 any time else
 *           
 * PROCESS :
-*     * Sanitize the data (unset flags, point secret to NULL)
-*     * open the selected file.
-*     * traverse the dynamic linked lists storing everything
-*     * close the file, return appropriate error
+*     * Sanitize the data
+*     * open a temporary file next to the selected one.
+*     * write an account record for every account, mapped or in memory
+*     * write the username index and the header
+*     * close the file, rename it, return appropriate error
 *
 * CHANGES :
 *     None as of this version
@@ -1041,13 +1105,16 @@ PPH_ERROR pph_store_context(pph_context *ctx, const unsigned char *filename){
   
   
   FILE *fp;
+  char *temporary_name;
   pph_account_node *current_node;
-
-  // we use a hard copy so we can mess with it without damaging the one from the
-  // user, he might want to keep using it and we need to set some values before
-  // writing. 
-  pph_context context_to_store; 
-  pph_entry *current_entry;  
+  const uint8 *store_index, *record;
+  uint8 header[PPH_STORE_HEADER_LENGTH];
+  uint8 record_buffer[STORE_MAX_RECORD_LENGTH];
+  uint8 key[ACCOUNT_INDEX_KEY_LENGTH];
+  uint8 *index;
+  uint64_t account_count, store_slots, slots, offset, i;
+  size_t length;
+  int error;
 
 
   // 1) sanitize the data
@@ -1058,51 +1125,104 @@ PPH_ERROR pph_store_context(pph_context *ctx, const unsigned char *filename){
   }
  
 
-  // we backup the context so we can mess with it without breaking anything. 
-  memcpy(&context_to_store,ctx,sizeof(*ctx));
+  // count the accounts to store: those in memory, and those of the store 
+  // file if the context is mapped.
+  account_count = ctx->account_count;
+  store_index = _store_index(ctx, &store_slots);
+  for(i = 0; store_index != NULL && i < store_slots; i++){
+    if(_store_record(ctx, _load64_le(store_index + i * PPH_STORE_SLOT_LENGTH
+            + 8)) != NULL){
+      account_count++;
+    }
+  }
 
-  // NULL out the pointers, we won't store that, not even where it used to point
-  context_to_store.share_context = NULL;
-  context_to_store.AES_key = NULL;
-  context_to_store.secret = NULL;
-  context_to_store.account_data = NULL;
+  // the stored index is at most three quarters full, like the one in 
+  // memory, and its hashes use a new key.
+  slots = ACCOUNT_INDEX_INITIAL_SIZE;
+  while(account_count * 4 > slots * 3){
+    slots *= 2;
+  }
+  index = calloc(slots, PPH_STORE_SLOT_LENGTH);
+  if(index == NULL){
+    
+    return PPH_NO_MEM;
+    
+  }
+  get_random_bytes(ACCOUNT_INDEX_KEY_LENGTH, key);
 
-  // set this context's information to locked.
-  context_to_store.is_unlocked = false; 
 
+  // 2) open a temporary file next to the selected one
+  temporary_name = malloc(strlen((const char *)filename) + sizeof(".tmp"));
+  if(temporary_name == NULL){
+    free(index);
+    
+    return PPH_NO_MEM;
+    
+  }
+  sprintf(temporary_name, "%s.tmp", filename);
 
-  // 2) open selected file
-  fp=fopen(filename,"wb");
+  fp=fopen(temporary_name,"wb");
   if(fp==NULL){
+    free(temporary_name);
+    free(index);
     
     return PPH_FILE_ERR;
     
   }
 
 
-  // 3) write the context
-  fwrite(&context_to_store,sizeof(context_to_store),1,fp); 
+  // 3) write the account records, after room for the header. 
+  memset(header, 0, sizeof(header));
+  error = fwrite(header, sizeof(header), 1, fp) != 1;
+  offset = PPH_STORE_HEADER_LENGTH;
+
+  // the accounts of the store file are copied as they are...
+  for(i = 0; store_index != NULL && i < store_slots; i++){
+    record = _store_record(ctx, _load64_le(store_index + 
+          i * PPH_STORE_SLOT_LENGTH + 8));
+    if(record == NULL){
+      continue;
+    }
+    length = _record_length(record);
+    _index_slot_put(index, slots, _hash_username(key, record + 8, record[0]),
+        offset);
+    error |= fwrite(record, length, 1, fp) != 1;
+    offset += length;
+  }
 
-  // traverse the list and write it too.
+  // ...and those in memory are encoded.
   current_node = ctx->account_data;
   while(current_node!=NULL){
-    
-    // write current node...
-    fwrite(current_node,sizeof(*current_node),1,fp);
-    
-    current_entry = current_node->account.entries;
-    while(current_entry != NULL){
-      
-      // write its entries
-      fwrite(current_entry,sizeof(*current_entry),1,fp);
-      current_entry = current_entry->next;
-    }
+    length = _encode_record(record_buffer, &current_node->account);
+    _index_slot_put(index, slots, _hash_username(key,
+          current_node->account.username,
+          current_node->account.username_length), offset);
+    error |= fwrite(record_buffer, length, 1, fp) != 1;
+    offset += length;
     current_node = current_node->next;
   }
 
 
-  // 4) close the file, return appropriate error
-  fclose(fp);
+  // 4) write the index, and go back to write the header. 
+  error |= fwrite(index, PPH_STORE_SLOT_LENGTH, slots, fp) != slots;
+  _encode_header(header, ctx, account_count, 
+      offset + slots * PPH_STORE_SLOT_LENGTH, offset, slots, key);
+  error |= fseek(fp, 0, SEEK_SET) != 0;
+  error |= fwrite(header, sizeof(header), 1, fp) != 1;
+  error |= fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+  free(index);
+
+
+  // 5) close the file, rename it, return appropriate error
+  error |= fclose(fp) != 0;
+  if(error || rename(temporary_name, (const char *)filename) != 0){
+    unlink(temporary_name);
+    free(temporary_name);
+    
+    return PPH_FILE_ERR;
+    
+  }
+  free(temporary_name);
     
   return PPH_ERROR_OK;
     
@@ -1141,10 +1261,9 @@ PPH_ERROR pph_store_context(pph_context *ctx, const unsigned char *filename){
 *            A valid pointer                  if everything went fine
 * 
 * PROCESS :
-*     * Sanitize the data (check the string is a good string) 
-*     * open the selected file.
-*     * Build a dynamic list by traversing the file's contents
-*     * close the file, return appropriate structure
+*     * Map the file with pph_map_context
+*     * Build a dynamic list and the username index out of its accounts
+*     * unmap the file, return appropriate structure
 *
 * CHANGES :
 *     None as of this version
@@ -1153,11 +1272,138 @@ PPH_ERROR pph_store_context(pph_context *ctx, const unsigned char *filename){
 pph_context *pph_reload_context(const unsigned char *filename){
 
 
-  FILE *fp;
   pph_context *loaded_context;
-  pph_account_node *accounts,*last,account_buffer;
-  pph_entry *entries, *last_entry, entry_buffer;
-  unsigned int i;
+  pph_account_node *account;
+  pph_entry *entry, *last_entry;
+  const uint8 *store_index, *record, *entry_data;
+  uint64_t slots, i;
+  unsigned int j;
+
+
+  // 1) map the selected file, this checks its header
+  loaded_context = pph_map_context(filename);
+  if(loaded_context == NULL){
+    
+    return NULL;
+    
+  }
+  
+
+  // 2) build the account and entry list out of the records in the file, and
+  // index them under the context's own key.
+  store_index = _store_index(loaded_context, &slots);
+  for(i = 0; i < slots; i++){
+    record = _store_record(loaded_context, _load64_le(store_index + 
+          i * PPH_STORE_SLOT_LENGTH + 8));
+    if(record == NULL){
+      continue;
+    }
+
+    if(_reserve_index(loaded_context, loaded_context->account_count + 1)
+        != PPH_ERROR_OK){
+      pph_destroy_context(loaded_context);
+
+      return NULL;
+
+    }
+    account = malloc(sizeof(*account));
+    if(account == NULL){
+      pph_destroy_context(loaded_context);
+
+      return NULL;
+
+    }
+
+    // read an account
+    memcpy(account->account.username, record + 8, record[0]);
+    account->account.username_length = record[0];
+    account->account.number_of_entries = record[1];
+    account->account.entries = NULL;
+    account->next = loaded_context->account_data;
+    loaded_context->account_data = account;
+    _insert_index(loaded_context, account);
+
+    // and its entries, in the order they were stored.
+    entry_data = record + 8 + ((record[0] + 7) & ~7);
+    last_entry = NULL;
+    for(j = 0; j < record[1]; j++){
+      entry = malloc(sizeof(*entry));
+      if(entry == NULL){
+        pph_destroy_context(loaded_context);
+
+        return NULL;
+
+      }
+      _decode_entry(entry, entry_data + j * PPH_STORE_ENTRY_LENGTH);
+      if(last_entry == NULL){
+        account->account.entries = entry;
+      }else{
+        last_entry->next = entry;
+      }
+      last_entry = entry;
+    }
+  }
+  
+
+  // 3) unmap and close the file.
+  _unmap_store(loaded_context);
+  close(loaded_context->store_fd);
+  loaded_context->store_fd = -1;
+    
+  return loaded_context;
+    
+}
+
+
+
+
+
+/*******************************************************************
+* NAME :          pph_map_context
+*
+* DESCRIPTION :   Open a pph_context stored in a file without loading its 
+*                 accounts: the file is mapped read-only and logins are 
+*                 checked against it in place, through the username index
+*                 stored with it. Opening takes the same time whatever the
+*                 number of accounts. As with pph_reload_context, the context
+*                 is locked until pph_unlock_password_data succeeds.
+*
+*                 Accounts created in a mapped context are kept in memory 
+*                 until pph_append_context adds them to the file.
+*
+* INPUTS :
+*   PARAMETERS:
+*     const unsigned char* filename: The filename of the datastore to use
+*
+* OUTPUTS :
+*   PARAMETERS:
+*     None
+*     
+*   GLOBALS :
+*     None
+*   
+*   RETURN :
+*     Type: pph_context * 
+*
+*           Values:                         When:
+*            NULL                             The file is not loadable
+*                                             or data looks corrupted
+*           
+*            A valid pointer                  if everything went fine
+* 
+* PROCESS :
+*     * open the selected file, read-write if possible
+*     * map it and check its header
+*     * initialize a locked context with the stored parameters
+*
+* CHANGES :
+*     None as of this version
+*/
+
+pph_context *pph_map_context(const unsigned char *filename){
+
+
+  pph_context *context;
 
 
   // 1) sanitize data
@@ -1167,54 +1413,153 @@ pph_context *pph_reload_context(const unsigned char *filename){
     
   }
 
+  context = malloc(sizeof(*context));
+  if(context == NULL){
+    
+    return NULL;
+    
+  }
+
+  // the context is locked, there is no secret nor share context until it
+  // is unlocked.
+  context->share_context = NULL;
+  context->is_unlocked = false;
+  context->AES_key = NULL;
+  context->secret = NULL;
+  context->account_data = NULL;
+  context->account_index = NULL;
+  context->index_size = 0;
+  context->account_count = 0;
+  get_random_bytes(ACCOUNT_INDEX_KEY_LENGTH, context->index_key);
+  context->store_map = NULL;
+  context->store_size = 0;
+
+
+  // 2) open the selected file, we only need to write to it to append 
+  // accounts.
+  context->store_fd = open((const char *)filename, O_RDWR);
+  if(context->store_fd == -1){
+    context->store_fd = open((const char *)filename, O_RDONLY);
+  }
+  if(context->store_fd == -1){
+    free(context);
+    
+    return NULL;
+    
+  }
+
 
-  // 2) open selected file
-  fp= fopen(filename,"rb");
-  if(fp == NULL){
+  // 3) map it, and load the parameters of the context from its header.
+  if(_map_store(context) != PPH_ERROR_OK){
+    pph_destroy_context(context);
     
     return NULL;
     
   }
-  
+  context->threshold = context->store_header[STORE_THRESHOLD_OFFSET];
+  context->partial_bytes = context->store_header[STORE_PARTIAL_BYTES_OFFSET];
+  context->next_entry = context->store_header[STORE_NEXT_ENTRY_OFFSET];
+  context->available_shares = 
+      context->store_header[STORE_AVAILABLE_SHARES_OFFSET];
 
-  // 3) load the context structure from the file. 
-  loaded_context = malloc(sizeof(*loaded_context));
-  if(loaded_context == NULL){
+  if(context->threshold == 0 || context->partial_bytes > DIGEST_LENGTH ||
+      context->next_entry == 0 || 
+      context->next_entry >= MAX_NUMBER_OF_SHARES){
+    pph_destroy_context(context);
     
     return NULL;
     
   }
+    
+  return context;
+    
+}
 
-  fread(loaded_context,sizeof(*loaded_context),1,fp);
-  
-  // build the account and entry list out of the information from the file. 
-  accounts = NULL;
-  while(fread(&account_buffer,sizeof(account_buffer),1,fp) != 0){
+
+
+
+
+/*******************************************************************
+* NAME :          pph_append_context
+*
+* DESCRIPTION :   Add the accounts created in a mapped context to its file, 
+*                 without rewriting the accounts already there. The new 
+*                 accounts are then looked up in the file, like the others.
+*                 
+*                 Other contexts mapping the same file keep working with the
+*                 accounts they mapped, and see the new ones once they map 
+*                 it again. If another context appended to the file since 
+*                 this one mapped it, the file is mapped again first.
+*
+*                 Several processes may append to the same file: each 
+*                 append holds an exclusive flock() on it, from reading 
+*                 the header to writing the new one.
+*
+* INPUTS :
+*   PARAMETERS:
+*     pph_context *ctx:              A context opened with pph_map_context
+*
+* OUTPUTS :
+*   PARAMETERS:
+*     None
+*     
+*   GLOBALS :
+*     None
+*   
+*   RETURN :
+*     Type: int PPH_ERROR     
+*           Values:                         When:
+*           PPH_ERROR_OK                      When the accounts were added 
+*
+*           PPH_BAD_PTR                       When the context is NULL or was
+*                                             not opened with pph_map_context
+*           
+*           PPH_FILE_ERR                      when the file could not be 
+*                                             written (e.g., it was opened
+*                                             read-only)
+*
+*           PPH_NO_MEM                        If malloc, calloc fails.
+*           
+* PROCESS :
+*     * lock the file, and map it again if its header changed
+*     * write the records of the new accounts at the end of the valid data
+*     * add them to the index in place, or write a larger index after them
+*     * update the header, syncing the file before and after
+*     * map the file again, drop the accounts from memory and unlock it
+*
+* CHANGES :
+*     None as of this version
+*/
+
+PPH_ERROR pph_append_context(pph_context *ctx){
+
+
+  PPH_ERROR error;
+
+
+  // 1) sanitize data
+  if(ctx == NULL || ctx->store_map == NULL){
+    
+    return PPH_BAD_PTR;
+    
+  }
+  if(ctx->account_data == NULL){
+    
+    return PPH_ERROR_OK;
     
-    // read an account
-    last = accounts;
-    accounts = malloc(sizeof(account_buffer));
-    memcpy(accounts,&account_buffer,sizeof(account_buffer));
-    last_entry = NULL;
-    for(i=0;i<account_buffer.account.number_of_entries;i++){
-      
-      // allocate the entry list for this account
-      entries = malloc(sizeof(*entries));
-      fread(entries,sizeof(*entries),1,fp);
-      entries->next = last_entry;
-      last_entry = entries;
-    }
-    accounts->account.entries = entries;
-    accounts->next = last;
-    last = accounts; 
   }
-  loaded_context->account_data = accounts;
-  
 
-  // 4) close the file.
-  fclose(fp);
+  // appends from other processes wait for this one: they would write at 
+  // the same file_end, and over the same index slots.
+  if(flock(ctx->store_fd, LOCK_EX) != 0){
     
-  return loaded_context;
+    return PPH_FILE_ERR;
+    
+  }
+  error = _append_store(ctx);
+  flock(ctx->store_fd, LOCK_UN);
+    
+  return error;
     
 }
 
@@ -1586,6 +1931,7 @@ pph_entry *create_thresholdless_entry(uint8 *password, unsigned int
   // copy the salt into the pph_entry
   memcpy(entry_node->salt, salt, salt_length);
   entry_node->salt_length = salt_length;
+  entry_node->password_length = password_length;
   
   // prepend the salt to the password and generate a digest
   memcpy(salted_password,entry_node->salt,salt_length);
@@ -1635,3 +1981,818 @@ void get_random_bytes(unsigned int length, uint8 *dest){
 }
 
 
+
+
+
+
+
+// SipHash-2-4 of the username under the context's index key. A keyed hash
+// keeps whoever picks the usernames from forcing them all into one probe
+// sequence.
+
+#define _ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define _SIPROUND(v0, v1, v2, v3) do { \
+    v0 += v1; v1 = _ROTL64(v1, 13); v1 ^= v0; v0 = _ROTL64(v0, 32); \
+    v2 += v3; v3 = _ROTL64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = _ROTL64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = _ROTL64(v1, 17); v1 ^= v2; v2 = _ROTL64(v2, 32); \
+  } while(0)
+
+static uint64_t _load64_le(const uint8 *p){
+
+  return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+      (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+      (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+
+}
+
+static uint64_t _hash_username(const uint8 *key, const uint8 *username,
+    unsigned int username_length){
+
+
+  uint64_t k0 = _load64_le(key);
+  uint64_t k1 = _load64_le(key + 8);
+  uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+  uint64_t m;
+  unsigned int i, left;
+
+  // compress the whole 8-byte words
+  for(i = 0; i + 8 <= username_length; i += 8){
+    m = _load64_le(username + i);
+    v3 ^= m;
+    _SIPROUND(v0, v1, v2, v3);
+    _SIPROUND(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+
+  // the last word holds the remaining bytes and the length
+  m = (uint64_t)username_length << 56;
+  left = username_length - i;
+  while(left > 0){
+    left--;
+    m |= (uint64_t)username[i + left] << (8 * left);
+  }
+  v3 ^= m;
+  _SIPROUND(v0, v1, v2, v3);
+  _SIPROUND(v0, v1, v2, v3);
+  v0 ^= m;
+
+  // finalize
+  v2 ^= 0xff;
+  _SIPROUND(v0, v1, v2, v3);
+  _SIPROUND(v0, v1, v2, v3);
+  _SIPROUND(v0, v1, v2, v3);
+  _SIPROUND(v0, v1, v2, v3);
+
+  return v0 ^ v1 ^ v2 ^ v3;
+
+}
+
+
+
+
+
+// this looks a username up in the index, it returns the account node or NULL
+// if there is no such user.
+
+static pph_account_node *_find_account(pph_context *ctx,
+    const uint8 *username, unsigned int username_length){
+
+
+  uint64_t hash;
+  unsigned int mask, i;
+  pph_index_slot *slot;
+
+  if(ctx->index_size == 0){
+    
+    return NULL;
+    
+  }
+
+  hash = _hash_username(ctx->index_key, username, username_length);
+  mask = ctx->index_size - 1;
+
+  // probe linearly until we find the user or an empty slot, accounts are
+  // never removed so an empty slot ends the search.
+  for(i = hash & mask; ; i = (i + 1) & mask){
+    slot = &ctx->account_index[i];
+    if(slot->node == NULL){
+      
+      return NULL;
+      
+    }
+    if(slot->hash == hash &&
+        slot->node->account.username_length == username_length &&
+        !memcmp(slot->node->account.username, username, username_length)){
+      
+      return slot->node;
+      
+    }
+  }
+
+}
+
+
+
+
+
+// this makes sure that the index can hold count accounts while staying at
+// most three quarters full, doubling it as needed.
+
+static PPH_ERROR _reserve_index(pph_context *ctx, unsigned int count){
+
+
+  pph_index_slot *old_index, *slot;
+  unsigned int old_size, size, mask, i, j;
+
+  size = ctx->index_size;
+  if(size == 0){
+    size = ACCOUNT_INDEX_INITIAL_SIZE;
+  }
+  while((uint64_t)count * 4 > (uint64_t)size * 3){
+    if(size > UINT_MAX / 2){
+      
+      return PPH_NO_MEM;
+      
+    }
+    size *= 2;
+  }
+  if(size == ctx->index_size){
+    
+    return PPH_ERROR_OK;
+    
+  }
+
+  old_index = ctx->account_index;
+  old_size = ctx->index_size;
+  ctx->account_index = calloc(size, sizeof(*ctx->account_index));
+  if(ctx->account_index == NULL){
+    ctx->account_index = old_index;
+    
+    return PPH_NO_MEM;
+    
+  }
+  ctx->index_size = size;
+
+  // move the existing slots over, their hashes are kept so we don't need to
+  // hash the usernames again.
+  mask = size - 1;
+  for(i = 0; i < old_size; i++){
+    if(old_index[i].node == NULL){
+      continue;
+    }
+    for(j = old_index[i].hash & mask; ctx->account_index[j].node != NULL;
+        j = (j + 1) & mask);
+    slot = &ctx->account_index[j];
+    slot->hash = old_index[i].hash;
+    slot->node = old_index[i].node;
+  }
+  if(old_index != NULL){
+    free(old_index);
+  }
+
+  return PPH_ERROR_OK;
+    
+}
+
+
+
+
+
+// this adds an account node to the index, _reserve_index must have been
+// called first so that there is room for it.
+
+static void _insert_index(pph_context *ctx, pph_account_node *node){
+
+
+  uint64_t hash;
+  unsigned int mask, i;
+
+  hash = _hash_username(ctx->index_key, node->account.username,
+      node->account.username_length);
+  mask = ctx->index_size - 1;
+  for(i = hash & mask; ctx->account_index[i].node != NULL;
+      i = (i + 1) & mask);
+  ctx->account_index[i].hash = hash;
+  ctx->account_index[i].node = node;
+  ctx->account_count++;
+
+}
+
+
+
+
+
+// little-endian stores, for the header and the index of the store file. 
+
+static uint32_t _load32_le(const uint8 *p){
+
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+      (uint32_t)p[3] << 24;
+
+}
+
+static void _store32_le(uint8 *p, uint32_t v){
+
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+
+}
+
+static void _store64_le(uint8 *p, uint64_t v){
+
+  _store32_le(p, (uint32_t)v);
+  _store32_le(p + 4, (uint32_t)(v >> 32));
+
+}
+
+
+
+
+
+// this maps the file of a context read-only and checks its header, see 
+// libpolypasshash.h for the format.
+
+static PPH_ERROR _map_store(pph_context *ctx){
+
+
+  struct stat st;
+  void *map;
+  uint64_t file_end, slots;
+
+  if(fstat(ctx->store_fd, &st) != 0 || st.st_size < PPH_STORE_HEADER_LENGTH){
+    
+    return PPH_FILE_ERR;
+    
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, ctx->store_fd, 0);
+  if(map == MAP_FAILED){
+    
+    return PPH_FILE_ERR;
+    
+  }
+  ctx->store_map = map;
+  ctx->store_size = st.st_size;
+  memcpy(ctx->store_header, ctx->store_map, PPH_STORE_HEADER_LENGTH);
+
+  // the header should be ours, and describe data that is in the file.
+  file_end = _load64_le(ctx->store_header + STORE_FILE_END_OFFSET);
+  if(memcmp(ctx->store_header, STORE_MAGIC, 8) ||
+      _load32_le(ctx->store_header + STORE_VERSION_OFFSET) != 
+        PPH_STORE_VERSION ||
+      _load32_le(ctx->store_header + STORE_HEADER_LENGTH_OFFSET) != 
+        PPH_STORE_HEADER_LENGTH ||
+      file_end < PPH_STORE_HEADER_LENGTH || file_end > ctx->store_size ||
+      _store_index(ctx, &slots) == NULL){
+    _unmap_store(ctx);
+    
+    return PPH_FILE_ERR;
+    
+  }
+
+  // lookups land anywhere in the file, there is no point in reading ahead.
+#ifdef MADV_RANDOM
+  madvise(map, ctx->store_size, MADV_RANDOM);
+#endif
+
+  return PPH_ERROR_OK;
+
+}
+
+static void _unmap_store(pph_context *ctx){
+
+  if(ctx->store_map != NULL){
+    munmap((void *)ctx->store_map, ctx->store_size);
+  }
+  ctx->store_map = NULL;
+  ctx->store_size = 0;
+
+}
+
+
+
+
+
+// the end of the valid data of the store file, as it was when we mapped it
+// (_map_store checked that it is within the mapping). Anything past it is 
+// either not mapped or belongs to an append we don't know about.
+
+static uint64_t _store_end(pph_context *ctx){
+
+  return _load64_le(ctx->store_header + STORE_FILE_END_OFFSET);
+
+}
+
+
+
+
+
+// this does the work of pph_append_context, with the file locked.
+
+static PPH_ERROR _append_store(pph_context *ctx){
+
+
+  struct stat st;
+  pph_account_node *current_node;
+  const uint8 *store_index, *record;
+  uint8 header[PPH_STORE_HEADER_LENGTH];
+  uint8 record_buffer[STORE_MAX_RECORD_LENGTH];
+  uint8 slot[PPH_STORE_SLOT_LENGTH];
+  uint8 *index;
+  uint64_t *hashes, *offsets;
+  uint64_t account_count, file_end, index_offset, slots, new_slots, offset;
+  uint64_t mask, probes, i, j;
+  unsigned int count;
+  size_t length;
+  bool rebuild;
+
+
+  // if another context appended to the file since we mapped it, our copy 
+  // of the header is stale: map the file again before writing past its end.
+  if(pread(ctx->store_fd, header, sizeof(header), 0) != sizeof(header)){
+    
+    return PPH_FILE_ERR;
+    
+  }
+  if(_load64_le(header + STORE_FILE_END_OFFSET) != _store_end(ctx)){
+    _unmap_store(ctx);
+    if(_map_store(ctx) != PPH_ERROR_OK){
+      
+      return PPH_FILE_ERR;
+      
+    }
+  }
+
+  store_index = _store_index(ctx, &slots);
+  if(store_index == NULL){
+    
+    return PPH_FILE_ERR;
+    
+  }
+  account_count = _load64_le(ctx->store_header + STORE_ACCOUNT_COUNT_OFFSET);
+  file_end = _load64_le(ctx->store_header + STORE_FILE_END_OFFSET);
+  index_offset = store_index - ctx->store_map;
+
+  // anything past the valid data was left by an append that didn't finish,
+  // including perhaps slots of the index pointing there: drop it, and 
+  // write a new index.
+  if(fstat(ctx->store_fd, &st) != 0){
+    
+    return PPH_FILE_ERR;
+    
+  }
+  rebuild = (uint64_t)st.st_size != file_end;
+  if(rebuild && ftruncate(ctx->store_fd, file_end) != 0){
+    
+    return PPH_FILE_ERR;
+    
+  }
+
+  hashes = malloc(ctx->account_count * sizeof(*hashes));
+  offsets = malloc(ctx->account_count * sizeof(*offsets));
+  if(hashes == NULL || offsets == NULL){
+    free(hashes);
+    free(offsets);
+    
+    return PPH_NO_MEM;
+    
+  }
+
+
+  // 2) write the new records at the end of the valid data, the header 
+  // still says they aren't there.
+  offset = file_end;
+  count = 0;
+  for(current_node = ctx->account_data; current_node != NULL;
+      current_node = current_node->next){
+    length = _encode_record(record_buffer, &current_node->account);
+    if(pwrite(ctx->store_fd, record_buffer, length, offset) != 
+        (ssize_t)length){
+      free(hashes);
+      free(offsets);
+      
+      return PPH_FILE_ERR;
+      
+    }
+    hashes[count] = _hash_username(ctx->store_header + STORE_KEY_OFFSET,
+        current_node->account.username, 
+        current_node->account.username_length);
+    offsets[count] = offset;
+    count++;
+    offset += length;
+  }
+  if(fsync(ctx->store_fd) != 0){
+    free(hashes);
+    free(offsets);
+    
+    return PPH_FILE_ERR;
+    
+  }
+
+
+  // 3) add them to the index. If it has room, the slots are filled in 
+  // place: readers skip slots pointing past the valid data.
+  if(!rebuild && (account_count + count) * 4 <= slots * 3){
+    mask = slots - 1;
+    for(j = 0; j < count; j++){
+
+      // find a free slot, there should be one unless the header lies about
+      // the number of accounts.
+      for(i = hashes[j] & mask, probes = 0; probes < slots; 
+          i = (i + 1) & mask, probes++){
+        if(pread(ctx->store_fd, slot, sizeof(slot), index_offset + 
+              i * PPH_STORE_SLOT_LENGTH) != sizeof(slot)){
+          probes = slots;
+          break;
+        }
+        if(_load64_le(slot + 8) == 0){
+          break;
+        }
+      }
+      _store64_le(slot, hashes[j]);
+      _store64_le(slot + 8, offsets[j]);
+      if(probes == slots || pwrite(ctx->store_fd, slot, sizeof(slot), 
+            index_offset + i * PPH_STORE_SLOT_LENGTH) != sizeof(slot)){
+        free(hashes);
+        free(offsets);
+        
+        return PPH_FILE_ERR;
+        
+      }
+    }
+    account_count += count;
+  }
+
+  // otherwise, a larger index goes after the new records. The slots of the
+  // old index keep their hashes, so we don't need to read the usernames.
+  else{
+    account_count = count;
+    for(i = 0; i < slots; i++){
+      if(_store_record(ctx, _load64_le(store_index + 
+              i * PPH_STORE_SLOT_LENGTH + 8)) != NULL){
+        account_count++;
+      }
+    }
+    new_slots = slots;
+    while(account_count * 4 > new_slots * 3){
+      new_slots *= 2;
+    }
+    index = calloc(new_slots, PPH_STORE_SLOT_LENGTH);
+    if(index == NULL){
+      free(hashes);
+      free(offsets);
+      
+      return PPH_NO_MEM;
+      
+    }
+    for(i = 0; i < slots; i++){
+      record = store_index + i * PPH_STORE_SLOT_LENGTH;
+      if(_store_record(ctx, _load64_le(record + 8)) != NULL){
+        _index_slot_put(index, new_slots, _load64_le(record),
+            _load64_le(record + 8));
+      }
+    }
+    for(j = 0; j < count; j++){
+      _index_slot_put(index, new_slots, hashes[j], offsets[j]);
+    }
+    length = new_slots * PPH_STORE_SLOT_LENGTH;
+    if(pwrite(ctx->store_fd, index, length, offset) != (ssize_t)length){
+      free(index);
+      free(hashes);
+      free(offsets);
+      
+      return PPH_FILE_ERR;
+      
+    }
+    free(index);
+    index_offset = offset;
+    offset += length;
+    slots = new_slots;
+  }
+  free(hashes);
+  free(offsets);
+
+
+  // 4) once all of that is on disk, the header makes it valid.
+  _encode_header(header, ctx, account_count, offset, index_offset, slots,
+      ctx->store_header + STORE_KEY_OFFSET);
+  if(fsync(ctx->store_fd) != 0 || pwrite(ctx->store_fd, header, 
+        sizeof(header), 0) != sizeof(header) || fsync(ctx->store_fd) != 0){
+    
+    return PPH_FILE_ERR;
+    
+  }
+
+
+  // 5) map the file again, the new accounts are looked up there from now on
+  _unmap_store(ctx);
+  if(_map_store(ctx) != PPH_ERROR_OK){
+    
+    return PPH_FILE_ERR;
+    
+  }
+  _destroy_account_list(ctx);
+    
+  return PPH_ERROR_OK;
+    
+}
+
+
+
+// this returns the index of the store file and its number of slots, or NULL
+// if the context isn't mapped or the index doesn't fit in the valid data.
+
+static const uint8 *_store_index(pph_context *ctx, uint64_t *slots){
+
+
+  uint64_t offset, end;
+
+  if(ctx->store_map == NULL){
+    
+    return NULL;
+    
+  }
+
+  offset = _load64_le(ctx->store_header + STORE_INDEX_OFFSET_OFFSET);
+  *slots = _load64_le(ctx->store_header + STORE_INDEX_SLOTS_OFFSET);
+  end = _store_end(ctx);
+  if(*slots == 0 || (*slots & (*slots - 1)) != 0 || offset % 8 != 0 ||
+      offset < PPH_STORE_HEADER_LENGTH || offset > end ||
+      *slots > (end - offset) / PPH_STORE_SLOT_LENGTH){
+    
+    return NULL;
+    
+  }
+
+  return ctx->store_map + offset;
+
+}
+
+
+
+// this returns the account record at the given offset of the store file, or
+// NULL if there is none: we never trust an offset or a length before 
+// checking it, so a damaged file can't make us read out of the mapping.
+
+static const uint8 *_store_record(pph_context *ctx, uint64_t offset){
+
+
+  const uint8 *record, *entry_data;
+  uint64_t end;
+  unsigned int i;
+
+  end = _store_end(ctx);
+  if(offset < PPH_STORE_HEADER_LENGTH || offset % 8 != 0 || end < 8 ||
+      offset > end - 8){
+    
+    return NULL;
+    
+  }
+  record = ctx->store_map + offset;
+  if(record[0] >= MAX_USERNAME_LENGTH || record[1] == 0 ||
+      _record_length(record) > end - offset){
+    
+    return NULL;
+    
+  }
+
+  entry_data = record + 8 + ((record[0] + 7) & ~7);
+  for(i = 0; i < record[1]; i++, entry_data += PPH_STORE_ENTRY_LENGTH){
+    if(entry_data[1] > MAX_SALT_LENGTH || 
+        entry_data[2] > MAX_PASSWORD_LENGTH){
+      
+      return NULL;
+      
+    }
+  }
+
+  return record;
+
+}
+
+
+
+// this looks a username up in the index of the store file, it returns the
+// account record or NULL if there is no such user (or no store file).
+
+static const uint8 *_find_record(pph_context *ctx, const uint8 *username,
+    unsigned int username_length){
+
+
+  const uint8 *store_index, *slot, *record;
+  uint64_t hash, slots, offset, mask, probes, i;
+
+  store_index = _store_index(ctx, &slots);
+  if(store_index == NULL){
+    
+    return NULL;
+    
+  }
+
+  hash = _hash_username(ctx->store_header + STORE_KEY_OFFSET, username,
+      username_length);
+  mask = slots - 1;
+
+  // as in memory, an empty slot ends the search. Slots pointing past the 
+  // valid data belong to an append that isn't done, we skip them.
+  for(i = hash & mask, probes = 0; probes < slots; 
+      i = (i + 1) & mask, probes++){
+    slot = store_index + i * PPH_STORE_SLOT_LENGTH;
+    offset = _load64_le(slot + 8);
+    if(offset == 0){
+      
+      return NULL;
+      
+    }
+    if(_load64_le(slot) != hash){
+      continue;
+    }
+    record = _store_record(ctx, offset);
+    if(record != NULL && record[0] == username_length &&
+        !memcmp(record + 8, username, username_length)){
+      
+      return record;
+      
+    }
+  }
+
+  return NULL;
+
+}
+
+
+
+// this copies the entries of a user, from memory or from the store file, 
+// into entries. It returns how many were copied, 0 if there is no such user.
+
+static unsigned int _find_entries(pph_context *ctx, const uint8 *username,
+    unsigned int username_length, pph_entry *entries,
+    unsigned int max_entries){
+
+
+  pph_account_node *node;
+  pph_entry *entry;
+  const uint8 *record, *entry_data;
+  unsigned int count;
+
+  node = _find_account(ctx, username, username_length);
+  if(node != NULL){
+    count = 0;
+    for(entry = node->account.entries; entry != NULL && count < max_entries;
+        entry = entry->next){
+      memcpy(&entries[count++], entry, sizeof(*entry));
+    }
+    
+    return count;
+    
+  }
+
+  record = _find_record(ctx, username, username_length);
+  if(record == NULL){
+    
+    return 0;
+    
+  }
+  entry_data = record + 8 + ((record[0] + 7) & ~7);
+  for(count = 0; count < record[1] && count < max_entries; count++){
+    _decode_entry(&entries[count], entry_data);
+    entry_data += PPH_STORE_ENTRY_LENGTH;
+  }
+
+  return count;
+
+}
+
+
+
+
+
+// the length of an account record, including its entries.
+
+static size_t _record_length(const uint8 *record){
+
+  return 8 + ((record[0] + 7) & ~7) + 
+      (size_t)record[1] * PPH_STORE_ENTRY_LENGTH;
+
+}
+
+
+
+// this writes the record of an account to dest, which should hold 
+// STORE_MAX_RECORD_LENGTH bytes, and returns its length.
+
+static size_t _encode_record(uint8 *dest, const pph_account *account){
+
+
+  pph_entry *entry;
+  uint8 *entry_data;
+  unsigned int count;
+
+  memset(dest, 0, 8 + ((account->username_length + 7) & ~7));
+  dest[0] = account->username_length;
+  memcpy(dest + 8, account->username, account->username_length);
+
+  entry_data = dest + 8 + ((account->username_length + 7) & ~7);
+  count = 0;
+  for(entry = account->entries; entry != NULL && count < MAX_NUMBER_OF_SHARES;
+      entry = entry->next){
+    memset(entry_data, 0, PPH_STORE_ENTRY_LENGTH);
+    entry_data[0] = entry->share_number;
+    entry_data[1] = entry->salt_length;
+    entry_data[2] = entry->password_length;
+    memcpy(entry_data + 4, entry->salt, MAX_SALT_LENGTH);
+    memcpy(entry_data + 4 + MAX_SALT_LENGTH, entry->polyhashed_value,
+        DIGEST_LENGTH);
+    entry_data += PPH_STORE_ENTRY_LENGTH;
+    count++;
+  }
+  dest[1] = count;
+
+  return entry_data - dest;
+
+}
+
+static void _decode_entry(pph_entry *entry, const uint8 *entry_data){
+
+  entry->share_number = entry_data[0];
+  entry->salt_length = entry_data[1];
+  entry->password_length = entry_data[2];
+  memcpy(entry->salt, entry_data + 4, MAX_SALT_LENGTH);
+  memcpy(entry->polyhashed_value, entry_data + 4 + MAX_SALT_LENGTH,
+      DIGEST_LENGTH);
+  entry->next = NULL;
+
+}
+
+
+
+// this writes the header of a store file to dest.
+
+static void _encode_header(uint8 *dest, const pph_context *ctx,
+    uint64_t account_count, uint64_t file_end, uint64_t index_offset,
+    uint64_t index_slots, const uint8 *key){
+
+  memset(dest, 0, PPH_STORE_HEADER_LENGTH);
+  memcpy(dest, STORE_MAGIC, 8);
+  _store32_le(dest + STORE_VERSION_OFFSET, PPH_STORE_VERSION);
+  _store32_le(dest + STORE_HEADER_LENGTH_OFFSET, PPH_STORE_HEADER_LENGTH);
+  dest[STORE_THRESHOLD_OFFSET] = ctx->threshold;
+  dest[STORE_PARTIAL_BYTES_OFFSET] = ctx->partial_bytes;
+  dest[STORE_NEXT_ENTRY_OFFSET] = ctx->next_entry;
+  dest[STORE_AVAILABLE_SHARES_OFFSET] = ctx->available_shares;
+  _store64_le(dest + STORE_ACCOUNT_COUNT_OFFSET, account_count);
+  _store64_le(dest + STORE_FILE_END_OFFSET, file_end);
+  _store64_le(dest + STORE_INDEX_OFFSET_OFFSET, index_offset);
+  _store64_le(dest + STORE_INDEX_SLOTS_OFFSET, index_slots);
+  memcpy(dest + STORE_KEY_OFFSET, key, ACCOUNT_INDEX_KEY_LENGTH);
+
+}
+
+
+
+// this puts a record in an index being built, which has a free slot for it.
+
+static void _index_slot_put(uint8 *index, uint64_t slots, uint64_t hash,
+    uint64_t offset){
+
+
+  uint64_t mask, i;
+
+  mask = slots - 1;
+  for(i = hash & mask; _load64_le(index + i * PPH_STORE_SLOT_LENGTH + 8) != 0;
+      i = (i + 1) & mask);
+  _store64_le(index + i * PPH_STORE_SLOT_LENGTH, hash);
+  _store64_le(index + i * PPH_STORE_SLOT_LENGTH + 8, offset);
+
+}
+
+
+
+// this frees the accounts held in memory, and their index.
+
+static void _destroy_account_list(pph_context *ctx){
+
+
+  pph_account_node *current,*next;
+
+  next = ctx->account_data;
+  while(next!=NULL){
+    current=next;
+    next=next->next;
+    // free their entry list
+    _destroy_entry_list(current->account.entries);
+    free(current); 
+  }
+  ctx->account_data = NULL;
+
+  if(ctx->account_index != NULL){
+    free(ctx->account_index);
+  }
+  ctx->account_index = NULL;
+  ctx->index_size = 0;
+  ctx->account_count = 0;
+
+}
@@ -0,0 +1,152 @@
+/* Benchmark of account creation and login checks against the number of
+ * accounts in a context.
+ *
+ * For 10^3, 10^4, ... accounts up to the given maximum (10^6 by default),
+ * this creates the accounts in a fresh context, then times logins to
+ * existing accounts and lookups of unknown users. With the username index,
+ * the rates should not depend on the number of accounts.
+ *
+ * It then stores the context and times opening the store, both by reloading
+ * it and by mapping it: mapping reads neither the accounts nor the index, 
+ * so it should take the same time whatever their number.
+ *
+ * usage: pph_bench [max_accounts]
+ *
+ * @license MIT
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#include "libpolypasshash.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// logins and failed lookups timed for each size
+#define LOOKUPS 100000
+
+// where the context is stored, in the current directory
+#define STORE_FILE "pph_bench.db"
+
+
+static double now(void){
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+
+}
+
+
+
+int main(int argc, char *argv[]){
+
+  pph_context *context;
+  uint8 username[32];
+  uint8 password[32];
+  unsigned long max_accounts = 1000000;
+  unsigned long accounts, i, j;
+  double start, create_time, login_time, miss_time;
+  double store_time, reload_time, map_time;
+
+
+  if(argc > 1){
+    max_accounts = strtoul(argv[1], NULL, 10);
+  }
+  if(argc > 2 || max_accounts < 1000 || max_accounts > 100000000){
+    fprintf(stderr, "usage: %s [max_accounts]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%10s %12s %12s %12s %12s %10s %10s %10s\n", "accounts", 
+      "creates/s", "logins/s", "misses/s", "index slots", "store ms",
+      "reload ms", "map ms");
+
+  for(accounts = 1000; accounts <= max_accounts; accounts *= 10){
+
+    context = pph_init_context(2, 0);
+    if(context == NULL){
+      fprintf(stderr, "couldn't initialize a context\n");
+      return EXIT_FAILURE;
+    }
+
+    // create the accounts, all of them threshold accounts with one share.
+    start = now();
+    for(i = 0; i < accounts; i++){
+      sprintf(username, "user%lu", i);
+      sprintf(password, "password%lu", i);
+      if(pph_create_account(context, username, strlen(username), password,
+            strlen(password), 1) != PPH_ERROR_OK){
+        fprintf(stderr, "couldn't create account %lu\n", i);
+        return EXIT_FAILURE;
+      }
+    }
+    create_time = now() - start;
+
+    // log into accounts spread over the whole store.
+    start = now();
+    for(j = 0; j < LOOKUPS; j++){
+      i = (j * 2654435761UL) % accounts;
+      sprintf(username, "user%lu", i);
+      sprintf(password, "password%lu", i);
+      if(pph_check_login(context, username, strlen(username), password,
+            strlen(password)) != PPH_ERROR_OK){
+        fprintf(stderr, "couldn't log into account %lu\n", i);
+        return EXIT_FAILURE;
+      }
+    }
+    login_time = now() - start;
+
+    // and look up users that don't exist.
+    start = now();
+    for(j = 0; j < LOOKUPS; j++){
+      sprintf(username, "nobody%lu", j);
+      if(pph_check_login(context, username, strlen(username), "password",
+            strlen("password")) != PPH_ACCOUNT_IS_INVALID){
+        fprintf(stderr, "found user nobody%lu\n", j);
+        return EXIT_FAILURE;
+      }
+    }
+    miss_time = now() - start;
+
+    // store the context, and open it again both ways.
+    start = now();
+    if(pph_store_context(context, STORE_FILE) != PPH_ERROR_OK){
+      fprintf(stderr, "couldn't store the context\n");
+      return EXIT_FAILURE;
+    }
+    store_time = now() - start;
+
+    printf("%10lu %12.0f %12.0f %12.0f %12u", accounts,
+        accounts / create_time, LOOKUPS / login_time, LOOKUPS / miss_time,
+        context->index_size);
+    pph_destroy_context(context);
+
+    start = now();
+    context = pph_reload_context(STORE_FILE);
+    reload_time = now() - start;
+    if(context == NULL){
+      fprintf(stderr, "couldn't reload the context\n");
+      return EXIT_FAILURE;
+    }
+    pph_destroy_context(context);
+
+    start = now();
+    context = pph_map_context(STORE_FILE);
+    map_time = now() - start;
+    if(context == NULL){
+      fprintf(stderr, "couldn't map the context\n");
+      return EXIT_FAILURE;
+    }
+    pph_destroy_context(context);
+
+    printf(" %10.2f %10.2f %10.3f\n", store_time * 1e3, reload_time * 1e3,
+        map_time * 1e3);
+    fflush(stdout);
+  }
+  unlink(STORE_FILE);
+
+  return EXIT_SUCCESS;
+
+}
@@ -12,8 +12,11 @@
 #include<check.h>
 #include"libgfshare.h"
 #include"libpolypasshash.h"
+#include<stdio.h>
 #include<stdlib.h>
 #include<strings.h>
+#include<unistd.h>
+#include<sys/wait.h>
 
 
 
@@ -702,6 +705,63 @@ START_TEST(test_pph_create_and_check_login_full_range) {
 }END_TEST
 
 
+// this test creates enough accounts to grow the username index several
+// times, and checks that every one of them can still be found, that
+// duplicates are refused and that unknown users are not found.
+START_TEST(test_pph_account_index_many_accounts) {
+
+
+  pph_context *context;
+  uint8 username[32];
+  uint8 password[32];
+  unsigned int i;
+  unsigned int account_count = 5000;
+  uint8 threshold = 2;
+  uint8 partial_bytes = 0;
+  PPH_ERROR error;
+
+
+  context = pph_init_context(threshold, partial_bytes);
+  ck_assert(context != NULL);
+
+  for(i = 0; i < account_count; i++){
+    sprintf(username, "user%u", i);
+    sprintf(password, "password%u", i);
+    error = pph_create_account(context, username, strlen(username), password,
+        strlen(password), 1);
+    ck_assert(error == PPH_ERROR_OK);
+  }
+  ck_assert(context->account_count == account_count);
+  ck_assert(context->account_count * 4 <= context->index_size * 3);
+
+  // every account should be there, exactly once.
+  for(i = 0; i < account_count; i++){
+    sprintf(username, "user%u", i);
+    sprintf(password, "password%u", i);
+    error = pph_check_login(context, username, strlen(username), password,
+        strlen(password));
+    ck_assert(error == PPH_ERROR_OK);
+    error = pph_create_account(context, username, strlen(username), password,
+        strlen(password), 1);
+    ck_assert(error == PPH_ACCOUNT_EXISTS);
+  }
+
+  // prefixes and extensions of existing usernames are different users.
+  error = pph_check_login(context, "user", strlen("user"), "password",
+      strlen("password"));
+  ck_assert(error == PPH_ACCOUNT_IS_INVALID);
+  sprintf(username, "user%u", account_count);
+  error = pph_check_login(context, username, strlen(username), "password",
+      strlen("password"));
+  ck_assert(error == PPH_ACCOUNT_IS_INVALID);
+
+  pph_destroy_context(context);
+
+}END_TEST
+
+
+
+
 ////////// shamir recombination and persistent storage test cases. //////////
 
 // this checks that the unlock password data correctly parses input.
@@ -1057,6 +1117,348 @@ START_TEST(test_pph_store_and_reload_with_users) {
     ck_assert(secret[i]==context->secret[i]);
   }
 
+  // the username index is rebuilt upon reloading, so every user can log in.
+  for(i=0;i<username_count;i++) {
+    error = pph_check_login(context, usernames[i], strlen(usernames[i]),
+        passwords[i], strlen(passwords[i]));
+    ck_assert(error == PPH_ERROR_OK);
+  }
+
+  pph_destroy_context(context);
+}
+END_TEST
+
+
+
+
+
+// open a stored context in place, log in against the file, then create 
+// accounts and append them to it, enough of them to outgrow its index.
+START_TEST(test_pph_map_and_append_context) {
+  
+  
+  PPH_ERROR error;
+  pph_context *context;
+  uint8 threshold = 2; 
+  uint8 partial_bytes = 2;
+  uint8 username[32];
+  uint8 password[32];
+  unsigned int i;
+  unsigned int username_count=4;
+  const uint8 *usernames[] = {"username1",
+                              "username12",
+                              "username1231",
+                              "username26",
+                            };
+  const uint8 *passwords[] = {"password1",
+                              "password12",
+                              "password1231",
+                              "password26",
+                              };
+  unsigned int username_lengths[] = { strlen("username1"),
+                                      strlen("username12"),
+                                      strlen("username1231"),
+                                      strlen("username26"),
+                                  };
+
+  // setup the context, with a thresholdless account too.
+  context = pph_init_context(threshold, partial_bytes);
+  ck_assert_msg(context != NULL,
+      "this was a good initialization, go tell someone");
+  for(i=0;i<username_count;i++) {
+    pph_create_account(context,usernames[i], strlen(usernames[i]),passwords[i],
+          strlen(passwords[i]),1);
+  }
+  pph_create_account(context, "admin", strlen("admin"), "adminpassword",
+      strlen("adminpassword"), 0);
+  error = pph_store_context(context,"pph_map.db");
+  ck_assert_msg(error == PPH_ERROR_OK, " couldn't store a context with users");
+  pph_destroy_context(context); 
+
+
+  // check for wrong arguments
+  ck_assert(pph_map_context(NULL) == NULL);
+  ck_assert(pph_map_context("nonexistent_file") == NULL);
+  ck_assert(pph_append_context(NULL) == PPH_BAD_PTR);
+
+
+  // map it, the context is locked but provides partial verification.
+  context = pph_map_context("pph_map.db");
+  ck_assert_msg(context != NULL, " Didn't get a valid structure from disk");
+  ck_assert_msg(context->threshold == 2, " threshold didn't match the one set");
+  ck_assert_msg(context->partial_bytes == 2, "partial bytes don't match");
+  ck_assert_msg(context->is_unlocked == false, " mapped an unlocked context");
+  ck_assert_msg(context->account_data == NULL, " loaded accounts in memory");
+  for(i=0;i<username_count;i++) {
+    error = pph_check_login(context, usernames[i], strlen(usernames[i]),
+        passwords[i], strlen(passwords[i]));
+    ck_assert(error == PPH_ERROR_OK);
+  }
+  error = pph_check_login(context, "username1", strlen("username1"), 
+      "password12", strlen("password12"));
+  ck_assert(error == PPH_ACCOUNT_IS_INVALID);
+  error = pph_check_login(context, "nobody", strlen("nobody"), 
+      "password1", strlen("password1"));
+  ck_assert(error == PPH_ACCOUNT_IS_INVALID);
+  error = pph_check_login(context, "admin", strlen("admin"), "adminpassword",
+      strlen("adminpassword"));
+  ck_assert(error == PPH_ERROR_OK);
+
+  // there is nothing to append yet, and we can't create accounts.
+  ck_assert(pph_append_context(context) == PPH_ERROR_OK);
+  error = pph_create_account(context, "user0", strlen("user0"), "password0",
+      strlen("password0"), 1);
+  ck_assert(error == PPH_CONTEXT_IS_LOCKED);
+
+
+  // unlock it with the shares in the file, then create accounts.
+  error = pph_unlock_password_data(context, username_count, usernames,
+      username_lengths, passwords);
+  ck_assert_msg(error == PPH_ERROR_OK, " couldn't unlock a mapped context");
+  error = pph_create_account(context, "username26", strlen("username26"),
+      "password26", strlen("password26"), 1);
+  ck_assert(error == PPH_ACCOUNT_EXISTS);
+
+  // one account fits in the stored index...
+  error = pph_create_account(context, "user0", strlen("user0"), "password0",
+      strlen("password0"), 1);
+  ck_assert(error == PPH_ERROR_OK);
+  ck_assert(pph_append_context(context) == PPH_ERROR_OK);
+  ck_assert(context->account_data == NULL);
+
+  // ...and a hundred more don't.
+  for(i=1;i<=100;i++) {
+    sprintf(username, "user%u", i);
+    sprintf(password, "password%u", i);
+    error = pph_create_account(context, username, strlen(username), password,
+        strlen(password), 1);
+    ck_assert(error == PPH_ERROR_OK);
+  }
+  ck_assert(pph_append_context(context) == PPH_ERROR_OK);
+  pph_destroy_context(context);
+
+
+  // map the file again, every account is there.
+  context = pph_map_context("pph_map.db");
+  ck_assert_msg(context != NULL, " Didn't get a valid structure from disk");
+  error = pph_check_login(context, "admin", strlen("admin"), "adminpassword",
+      strlen("adminpassword"));
+  ck_assert(error == PPH_ERROR_OK);
+  error = pph_unlock_password_data(context, 2, usernames, username_lengths,
+      passwords);
+  ck_assert_msg(error == PPH_ERROR_OK, " couldn't unlock a mapped context");
+  for(i=0;i<=100;i++) {
+    sprintf(username, "user%u", i);
+    sprintf(password, "password%u", i);
+    error = pph_check_login(context, username, strlen(username), password,
+        strlen(password));
+    ck_assert(error == PPH_ERROR_OK);
+  }
+  pph_destroy_context(context);
+
+
+  // and so does reloading it, but a reloaded context has no file to append 
+  // to.
+  context = pph_reload_context("pph_map.db");
+  ck_assert_msg(context != NULL, " Didn't get a valid structure from disk");
+  ck_assert(context->account_count == 106);
+  error = pph_unlock_password_data(context, 2, usernames, username_lengths,
+      passwords);
+  ck_assert_msg(error == PPH_ERROR_OK, " couldn't unlock a reloaded context");
+  error = pph_check_login(context, "user100", strlen("user100"), 
+      "password100", strlen("password100"));
+  ck_assert(error == PPH_ERROR_OK);
+  ck_assert(pph_append_context(context) == PPH_BAD_PTR);
+  pph_destroy_context(context);
+}
+END_TEST
+
+
+
+
+
+// two contexts map the same file, one of them appends enough accounts to 
+// outgrow the index. The other one should keep serving its accounts, and 
+// append its own without overwriting the first one's.
+START_TEST(test_pph_map_shared_across_append) {
+  
+  
+  PPH_ERROR error;
+  pph_context *context, *mapped_a, *mapped_b;
+  uint8 username[32];
+  uint8 password[32];
+  unsigned int i;
+  unsigned int username_count=4;
+  const uint8 *usernames[] = {"username1",
+                              "username12",
+                              "username1231",
+                              "username26",
+                            };
+  const uint8 *passwords[] = {"password1",
+                              "password12",
+                              "password1231",
+                              "password26",
+                              };
+  unsigned int username_lengths[] = { strlen("username1"),
+                                      strlen("username12"),
+                                      strlen("username1231"),
+                                      strlen("username26"),
+                                  };
+
+  // setup the store, and map it twice.
+  context = pph_init_context(2, 2);
+  ck_assert_msg(context != NULL,
+      "this was a good initialization, go tell someone");
+  for(i=0;i<username_count;i++) {
+    pph_create_account(context,usernames[i], strlen(usernames[i]),passwords[i],
+          strlen(passwords[i]),1);
+  }
+  error = pph_store_context(context,"pph_shared.db");
+  ck_assert_msg(error == PPH_ERROR_OK, " couldn't store a context with users");
+  pph_destroy_context(context); 
+
+  mapped_a = pph_map_context("pph_shared.db");
+  mapped_b = pph_map_context("pph_shared.db");
+  ck_assert(mapped_a != NULL && mapped_b != NULL);
+
+
+  // b appends a hundred accounts, that don't fit in the stored index.
+  error = pph_unlock_password_data(mapped_b, username_count, usernames,
+      username_lengths, passwords);
+  ck_assert_msg(error == PPH_ERROR_OK, " couldn't unlock a mapped context");
+  for(i=0;i<100;i++) {
+    sprintf(username, "user%u", i);
+    sprintf(password, "password%u", i);
+    error = pph_create_account(mapped_b, username, strlen(username), password,
+        strlen(password), 1);
+    ck_assert(error == PPH_ERROR_OK);
+  }
+  ck_assert(pph_append_context(mapped_b) == PPH_ERROR_OK);
+
+  // a still knows the accounts it mapped, but not the new ones.
+  for(i=0;i<username_count;i++) {
+    error = pph_check_login(mapped_a, usernames[i], strlen(usernames[i]),
+        passwords[i], strlen(passwords[i]));
+    ck_assert(error == PPH_ERROR_OK);
+  }
+  error = pph_check_login(mapped_a, "user0", strlen("user0"), "password0",
+      strlen("password0"));
+  ck_assert(error == PPH_ACCOUNT_IS_INVALID);
+
+  // a appends an account of its own, after those of b.
+  error = pph_unlock_password_data(mapped_a, username_count, usernames,
+      username_lengths, passwords);
+  ck_assert_msg(error == PPH_ERROR_OK, " couldn't unlock a mapped context");
+  error = pph_create_account(mapped_a, "latecomer", strlen("latecomer"),
+      "latepassword", strlen("latepassword"), 1);
+  ck_assert(error == PPH_ERROR_OK);
+  ck_assert(pph_append_context(mapped_a) == PPH_ERROR_OK);
+  error = pph_check_login(mapped_a, "user99", strlen("user99"), "password99",
+      strlen("password99"));
+  ck_assert(error == PPH_ERROR_OK);
+  pph_destroy_context(mapped_a);
+  pph_destroy_context(mapped_b);
+
+
+  // a new mapping has every account.
+  context = pph_map_context("pph_shared.db");
+  ck_assert_msg(context != NULL, " Didn't get a valid structure from disk");
+  for(i=0;i<username_count;i++) {
+    error = pph_check_login(context, usernames[i], strlen(usernames[i]),
+        passwords[i], strlen(passwords[i]));
+    ck_assert(error == PPH_ERROR_OK);
+  }
+  for(i=0;i<100;i++) {
+    sprintf(username, "user%u", i);
+    sprintf(password, "password%u", i);
+    error = pph_check_login(context, username, strlen(username), password,
+        strlen(password));
+    ck_assert(error == PPH_ERROR_OK);
+  }
+  error = pph_check_login(context, "latecomer", strlen("latecomer"),
+      "latepassword", strlen("latepassword"));
+  ck_assert(error == PPH_ERROR_OK);
+  pph_destroy_context(context);
+}
+END_TEST
+
+
+
+
+
+
+// several processes append to the same file at once. Each append should 
+// wait for the others, and the file should end up with every account.
+START_TEST(test_pph_append_concurrent_processes) {
+  
+  
+  PPH_ERROR error;
+  pph_context *context;
+  uint8 username[32];
+  uint8 password[32];
+  unsigned int i, j;
+  unsigned int process_count=4;
+  unsigned int account_count=50;
+  int status;
+  pid_t pid;
+  const uint8 *usernames[] = {"username1",
+                              "username12",
+                              };
+  const uint8 *passwords[] = {"password1",
+                              "password12",
+                              };
+  unsigned int username_lengths[] = { strlen("username1"),
+                                      strlen("username12"),
+                                  };
+
+  context = pph_init_context(2, 2);
+  ck_assert_msg(context != NULL,
+      "this was a good initialization, go tell someone");
+  for(i=0;i<2;i++) {
+    pph_create_account(context,usernames[i], strlen(usernames[i]),passwords[i],
+          strlen(passwords[i]),1);
+  }
+  error = pph_store_context(context,"pph_concurrent.db");
+  ck_assert_msg(error == PPH_ERROR_OK, " couldn't store a context with users");
+  pph_destroy_context(context); 
+
+  // every process maps the file before any of them appends.
+  for(j=0;j<process_count;j++) {
+    pid = fork();
+    ck_assert(pid >= 0);
+    if(pid == 0){
+      context = pph_map_context("pph_concurrent.db");
+      if(context == NULL || pph_unlock_password_data(context, 2, usernames,
+            username_lengths, passwords) != PPH_ERROR_OK){
+        _exit(1);
+      }
+      for(i=0;i<account_count;i++) {
+        sprintf(username, "p%uuser%u", j, i);
+        sprintf(password, "p%upassword%u", j, i);
+        if(pph_create_account(context, username, strlen(username), password,
+              strlen(password), 1) != PPH_ERROR_OK){
+          _exit(1);
+        }
+      }
+      _exit(pph_append_context(context) == PPH_ERROR_OK ? 0 : 1);
+    }
+  }
+  for(j=0;j<process_count;j++) {
+    ck_assert(wait(&status) > 0);
+    ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  context = pph_map_context("pph_concurrent.db");
+  ck_assert_msg(context != NULL, " Didn't get a valid structure from disk");
+  for(j=0;j<process_count;j++) {
+    for(i=0;i<account_count;i++) {
+      sprintf(username, "p%uuser%u", j, i);
+      sprintf(password, "p%upassword%u", j, i);
+      error = pph_check_login(context, username, strlen(username), password,
+          strlen(password));
+      ck_assert(error == PPH_ERROR_OK);
+    }
+  }
   pph_destroy_context(context);
 }
 END_TEST
@@ -1183,6 +1585,7 @@ Suite * polypasshash_suite(void)
   tcase_add_test (tc_non_partial,test_check_login_wrong_password);
   tcase_add_test (tc_non_partial,test_check_login_proper_data);
   tcase_add_test (tc_non_partial,test_pph_create_and_check_login_full_range);
+  tcase_add_test (tc_non_partial,test_pph_account_index_many_accounts);
   suite_add_tcase (s, tc_non_partial);
 
   /* vault unlocking (for both cases) */
@@ -1198,6 +1601,9 @@ Suite * polypasshash_suite(void)
   tcase_add_test( tc_store_context, test_pph_store_context_input_sanity);
   tcase_add_test( tc_store_context, test_pph_reload_context_input_sanity);
   tcase_add_test( tc_store_context, test_pph_store_and_reload_with_users);
+  tcase_add_test( tc_store_context, test_pph_map_and_append_context);
+  tcase_add_test( tc_store_context, test_pph_map_shared_across_append);
+  tcase_add_test( tc_store_context, test_pph_append_concurrent_processes);
   suite_add_tcase (s, tc_store_context);
 
   return s;
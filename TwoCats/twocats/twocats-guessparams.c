@@ -0,0 +1,99 @@
+/*
+   TwoCats parameter tuning tool.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include "twocats.h"
+
+static void usage(char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, (char *)format, ap);
+    va_end(ap);
+    fprintf(stderr, "\nUsage: twocats-guessparams [OPTIONS] [hashType]\n"
+        "    -t milliseconds  -- Target median latency per hash, default 1000\n"
+        "    -r throughput    -- Minimum hashes per second under load, default 0\n"
+        "    -c concurrency   -- Number of hashes run at once, default 1\n"
+        "    -m maxMem        -- Maximum memory per hash in KiB, default 2^20\n"
+        "    -P parallelism   -- Maximum threads per hash, default %u\n"
+        "    -n samples       -- Runs per measurement, default 3\n"
+        "The parameter profile is written to stdout as a line of JSON.\n"
+        "Hash types are", TWOCATS_PARALLELISM);
+    for(uint32_t i = 0; i < TWOCATS_NONE; i++) {
+        fprintf(stderr, " %s", TwoCats_GetHashTypeName(i));
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static uint32_t readuint32_t(char flag, char *arg) {
+    char *endPtr;
+    char *p = arg;
+    uint32_t value = strtol(p, &endPtr, 0);
+    if(*p == '\0' || *endPtr != '\0') {
+        usage("Invalid integer for parameter -%c", flag);
+    }
+    return value;
+}
+
+int main(int argc, char **argv) {
+    uint32_t milliseconds = 1000;
+    double minThroughput = 0.0;
+    uint32_t concurrency = 1;
+    uint32_t maxMem = 1 << 20;
+    uint32_t maxParallelism = TWOCATS_PARALLELISM;
+    uint32_t samples = 3;
+    TwoCats_HashType hashType = TWOCATS_HASHTYPE;
+
+    int c;
+    while((c = getopt(argc, argv, "t:r:c:m:P:n:")) != -1) {
+        switch (c) {
+        case 't':
+            milliseconds = readuint32_t(c, optarg);
+            break;
+        case 'r':
+            minThroughput = readuint32_t(c, optarg);
+            break;
+        case 'c':
+            concurrency = readuint32_t(c, optarg);
+            break;
+        case 'm':
+            maxMem = readuint32_t(c, optarg);
+            break;
+        case 'P':
+            maxParallelism = readuint32_t(c, optarg);
+            if(maxParallelism == 0 || maxParallelism > 255) {
+                usage("parallelism must be from 1 to 255");
+            }
+            break;
+        case 'n':
+            samples = readuint32_t(c, optarg);
+            break;
+        default:
+            usage("Invalid argument");
+        }
+    }
+    if(optind + 1 == argc) {
+        hashType = TwoCats_FindHashType(argv[optind]);
+        if(hashType == TWOCATS_NONE) {
+            usage("Invalid hash type %s", argv[optind]);
+        }
+    } else if(optind != argc) {
+        usage("Extra parameters not recognised");
+    }
+
+    TwoCats_CostProfile profile;
+    bool found = TwoCats_TuneCostParameters(hashType, milliseconds, minThroughput,
+        concurrency, maxMem, maxParallelism, samples, &profile);
+    char line[512];
+    TwoCats_FormatCostProfile(line, sizeof(line), &profile);
+    printf("%s\n", line);
+    if(!found) {
+        fprintf(stderr, "No parameters meet the requested latency and throughput\n");
+        return 1;
+    }
+    return 0;
+}
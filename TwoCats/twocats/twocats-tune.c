@@ -0,0 +1,315 @@
+/*
+   TwoCats parameter tuning.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "twocats-internal.h"
+
+// Extra cost is considered free if it slows hashing down by less than this.
+#define TWOCATS_FREECOST 1.05
+
+// The memCost used when comparing lane counts: 4 MiB, or maxMem if smaller.
+#define TWOCATS_LANESMEMCOST 12
+
+// Milliseconds on the monotonic clock.  clock() measures CPU time summed over all
+// threads, which overstates the runtime of multi-threaded hashing.
+static double nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+// Pick blockSize and subBlockSize the way TwoCats_HashPasswordFull does, so that each
+// thread has at least TWOCATS_MINBLOCKS blocks.  Return false if memCost is too small
+// for this many threads.
+static bool setBlockSizes(TwoCats_CostProfile *p) {
+    uint64_t memSize = (uint64_t)1024 << p->memCost;
+    p->blockSize = TWOCATS_BLOCKSIZE;
+    while(p->blockSize > 32 && memSize/((uint64_t)p->parallelism*p->blockSize) < TWOCATS_MINBLOCKS) {
+        p->blockSize >>= 1;
+    }
+    p->subBlockSize = TWOCATS_SUBBLOCKSIZE;
+    if(p->subBlockSize > p->blockSize) {
+        p->subBlockSize = p->blockSize;
+    }
+    return p->parallelism == 1 ||
+        memSize/((uint64_t)p->parallelism*p->blockSize) >= TWOCATS_MINBLOCKS;
+}
+
+static bool hashOnce(const TwoCats_CostProfile *p) {
+    uint8_t buf[TwoCats_GetHashTypeSize(p->hashType)];
+    return TwoCats_HashPasswordExtended(p->hashType, buf, NULL, 0, NULL, 0, NULL, 0,
+        p->memCost, p->memCost, p->timeCost, p->multiplies, p->lanes, p->parallelism,
+        p->blockSize, p->subBlockSize, 0, false, false);
+}
+
+typedef struct {
+    const TwoCats_CostProfile *profile;
+    uint32_t samples;
+    double *latencies;
+    bool ok;
+} TwoCats_TuneWorker;
+
+static void *tuneWorker(void *arg) {
+    TwoCats_TuneWorker *w = arg;
+    w->ok = true;
+    for(uint32_t i = 0; i < w->samples && w->ok; i++) {
+        double start = nowMs();
+        w->ok = hashOnce(w->profile);
+        w->latencies[i] = nowMs() - start;
+    }
+    return NULL;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Fill in latencyMs and throughput for p.  After one warm-up hash, p->concurrency
+// threads each run samples hashes back to back.  Return false if hashing fails.
+static bool measure(TwoCats_CostProfile *p, uint32_t samples) {
+    if(!hashOnce(p)) {
+        fprintf(stderr, "Memory hashing failed\n");
+        return false;
+    }
+    uint32_t concurrency = p->concurrency;
+    double *latencies = malloc((size_t)concurrency*samples*sizeof(double));
+    TwoCats_TuneWorker *workers = malloc(concurrency*sizeof(TwoCats_TuneWorker));
+    pthread_t *threads = malloc(concurrency*sizeof(pthread_t));
+    if(latencies == NULL || workers == NULL || threads == NULL) {
+        free(latencies);
+        free(workers);
+        free(threads);
+        return false;
+    }
+    uint32_t started = 0;
+    double start = nowMs();
+    for(uint32_t i = 0; i < concurrency; i++) {
+        workers[i].profile = p;
+        workers[i].samples = samples;
+        workers[i].latencies = latencies + (size_t)i*samples;
+        workers[i].ok = false;
+        if(i == concurrency - 1) {
+            // The calling thread is the last client
+            tuneWorker(&workers[i]);
+        } else if(pthread_create(&threads[i], NULL, tuneWorker, &workers[i]) == 0) {
+            started++;
+        } else {
+            break;
+        }
+    }
+    bool ok = started == concurrency - 1;
+    for(uint32_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = nowMs() - start;
+    for(uint32_t i = 0; i < concurrency && ok; i++) {
+        ok = workers[i].ok;
+    }
+    if(ok) {
+        uint32_t total = concurrency*samples;
+        qsort(latencies, total, sizeof(double), compareDoubles);
+        p->latencyMs = total & 1? latencies[total/2] :
+            (latencies[total/2 - 1] + latencies[total/2])/2.0;
+        p->throughput = elapsed > 0.0? total*1000.0/elapsed : 0.0;
+    } else {
+        fprintf(stderr, "Memory hashing failed\n");
+    }
+    free(latencies);
+    free(workers);
+    free(threads);
+    return ok;
+}
+
+static bool meetsTargets(const TwoCats_CostProfile *p, uint32_t milliseconds,
+        double minThroughput) {
+    return p->latencyMs <= milliseconds && p->throughput >= minThroughput;
+}
+
+// Find the largest number of SIMD lanes that runs about as fast as the fastest.
+static bool findLanes(TwoCats_CostProfile *p, uint32_t maxMem, uint32_t samples) {
+    TwoCats_CostProfile trial = *p;
+    trial.memCost = TWOCATS_LANESMEMCOST;
+    while(trial.memCost > 0 && ((uint32_t)1 << trial.memCost) > maxMem) {
+        trial.memCost--;
+    }
+    trial.timeCost = 0;
+    trial.multiplies = 0;
+    trial.parallelism = 1;
+    trial.concurrency = 1;
+    setBlockSizes(&trial);
+    uint8_t maxLanes = TwoCats_GetHashTypeSize(p->hashType)/4;
+    double fastest = 0.0;
+    double runtimes[maxLanes + 1];
+    for(uint8_t lanes = 1; lanes <= maxLanes; lanes <<= 1) {
+        trial.lanes = lanes;
+        if(!measure(&trial, samples)) {
+            return false;
+        }
+        runtimes[lanes] = trial.latencyMs;
+        if(lanes == 1 || trial.latencyMs < fastest) {
+            fastest = trial.latencyMs;
+        }
+    }
+    p->lanes = 1;
+    for(uint8_t lanes = 1; lanes <= maxLanes; lanes <<= 1) {
+        if(runtimes[lanes] <= TWOCATS_FREECOST*fastest) {
+            p->lanes = lanes;
+        }
+    }
+    return true;
+}
+
+// Increase the uint8_t cost at offset field in p up to maxCost while p still meets the
+// targets and runs no more than limit ms.  p is left measured at the final setting.
+static bool raiseCost(TwoCats_CostProfile *p, size_t field, uint8_t maxCost,
+        double limit, uint32_t milliseconds, double minThroughput, uint32_t samples) {
+    while(((uint8_t *)p)[field] < maxCost) {
+        TwoCats_CostProfile trial = *p;
+        ((uint8_t *)&trial)[field]++;
+        if(!measure(&trial, samples)) {
+            return false;
+        }
+        if(!meetsTargets(&trial, milliseconds, minThroughput) || trial.latencyMs > limit) {
+            break;
+        }
+        *p = trial;
+    }
+    return true;
+}
+
+// Tune memCost, multiplies, and timeCost for a fixed lanes and parallelism.  Return
+// false if nothing meets the targets.  *failed is set if hashing itself failed.
+static bool tuneForParallelism(TwoCats_CostProfile *p, uint32_t milliseconds,
+        double minThroughput, uint32_t maxMem, uint32_t samples, bool *failed) {
+    TwoCats_CostProfile trial = *p;
+    bool found = false;
+    trial.timeCost = 0;
+    trial.multiplies = 0;
+    // Memory dominates the cost, so first find the most of it we can afford
+    for(trial.memCost = 0; trial.memCost <= 30 && ((uint64_t)1 << trial.memCost) <= maxMem;
+            trial.memCost++) {
+        if(!setBlockSizes(&trial)) {
+            continue;
+        }
+        if(!measure(&trial, samples)) {
+            *failed = true;
+            return false;
+        }
+        if(!meetsTargets(&trial, milliseconds, minThroughput)) {
+            break;
+        }
+        *p = trial;
+        found = true;
+    }
+    if(!found) {
+        return false;
+    }
+    // Multiplies and then timeCost are added only while they are nearly free
+    double limit = TWOCATS_FREECOST*p->latencyMs;
+    if(!raiseCost(p, offsetof(TwoCats_CostProfile, multiplies), 8, limit, milliseconds, minThroughput, samples)) {
+        *failed = true;
+        return false;
+    }
+    limit = TWOCATS_FREECOST*p->latencyMs;
+    if(!raiseCost(p, offsetof(TwoCats_CostProfile, timeCost), 30, limit, milliseconds, minThroughput, samples)) {
+        *failed = true;
+        return false;
+    }
+    // If memory was capped by maxMem rather than time, spend the rest of the time budget
+    if((p->memCost == 30 || ((uint64_t)1 << (p->memCost + 1)) > maxMem) &&
+            !raiseCost(p, offsetof(TwoCats_CostProfile, timeCost), 30, milliseconds,
+                milliseconds, minThroughput, samples)) {
+        *failed = true;
+        return false;
+    }
+    return true;
+}
+
+// Joint search over all the cost parameters.
+bool TwoCats_TuneCostParameters(TwoCats_HashType hashType, uint32_t milliseconds,
+        double minThroughput, uint32_t concurrency, uint32_t maxMem, uint8_t maxParallelism,
+        uint32_t samples, TwoCats_CostProfile *profile) {
+    TwoCats_CostProfile p;
+    memset(&p, 0, sizeof(p));
+    p.hashType = hashType;
+    p.parallelism = 1;
+    p.lanes = 1;
+    p.concurrency = concurrency == 0? 1 : concurrency;
+    setBlockSizes(&p);
+    *profile = p;
+    if(TwoCats_GetHashTypeSize(hashType) == 0) {
+        fprintf(stderr, "Invalid hash type\n");
+        return false;
+    }
+    if(samples == 0) {
+        samples = 1;
+    }
+    if(maxParallelism == 0) {
+        maxParallelism = 1;
+    }
+    if(!findLanes(&p, maxMem, samples)) {
+        return false;
+    }
+    *profile = p;
+    bool found = false;
+    for(uint8_t parallelism = 1; parallelism <= maxParallelism; parallelism++) {
+        TwoCats_CostProfile trial = p;
+        bool failed = false;
+        trial.parallelism = parallelism;
+        if(!tuneForParallelism(&trial, milliseconds, minThroughput, maxMem, samples, &failed)) {
+            if(failed) {
+                return false;
+            }
+            continue;
+        }
+        if(found && trial.memCost < profile->memCost) {
+            // More threads no longer help, most likely because memory bandwidth is used up
+            break;
+        }
+        if(!found || trial.memCost > profile->memCost ||
+                (trial.memCost == profile->memCost && trial.latencyMs < profile->latencyMs)) {
+            *profile = trial;
+            found = true;
+        }
+    }
+    return found;
+}
+
+int TwoCats_FormatCostProfile(char *buf, size_t len, const TwoCats_CostProfile *p) {
+    return snprintf(buf, len, "{\"hashType\":\"%s\",\"memCost\":%u,\"timeCost\":%u,"
+        "\"multiplies\":%u,\"lanes\":%u,\"parallelism\":%u,\"blockSize\":%u,"
+        "\"subBlockSize\":%u,\"concurrency\":%u,\"latencyMs\":%.3f,\"throughput\":%.3f}",
+        TwoCats_GetHashTypeName(p->hashType), p->memCost, p->timeCost, p->multiplies,
+        p->lanes, p->parallelism, p->blockSize, p->subBlockSize, p->concurrency,
+        p->latencyMs, p->throughput);
+}
+
+// Find parameter settings on this machine for a given desired runtime and maximum memory
+// usage.  maxMem is in KiB.  Memory will be <= maxMem.
+void TwoCats_FindCostParameters(TwoCats_HashType hashType, uint32_t milliseconds, uint32_t
+        maxMem, uint8_t *memCost, uint8_t *timeCost, uint8_t *multiplies, uint8_t *lanes) {
+    // Callers hash with TWOCATS_PARALLELISM threads, so only the other costs are tuned
+    TwoCats_CostProfile p;
+    memset(&p, 0, sizeof(p));
+    p.hashType = hashType;
+    p.lanes = 1;
+    p.parallelism = TWOCATS_PARALLELISM;
+    p.concurrency = 1;
+    bool failed = false;
+    if(findLanes(&p, maxMem, 3)) {
+        tuneForParallelism(&p, milliseconds, 0.0, maxMem, 3, &failed);
+    }
+    *memCost = p.memCost;
+    *timeCost = p.timeCost;
+    *multiplies = p.multiplies;
+    *lanes = p.lanes;
+}
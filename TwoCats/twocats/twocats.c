@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <byteswap.h>
 #include "twocats-internal.h"
 
@@ -81,6 +82,131 @@ struct TwoCatsContextStruct {
     uint32_t p; // This is the memory-thread number
 };
 
+// A unit of work for the worker pool: one memory-thread's share of one slice.
+struct TwoCatsTaskStruct {
+    void *(*func)(void *);
+    void *arg;
+    uint32_t *pending; // Decremented when done, owned by the submitting call
+    struct TwoCatsTaskStruct *next;
+};
+
+// The worker pool is created on first use and shared by all concurrent
+// TwoCats calls.  It has one thread per online CPU, so many concurrent hashes
+// with parallelism > 1 queue up for the cores rather than oversubscribing
+// them.  Tasks of one slice never depend on each other, so they complete even
+// when parallelism exceeds the number of workers.  A forked child has none of
+// the workers, so the child side of fork resets the pool, and the child starts
+// its own on first use.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    struct TwoCatsTaskStruct *head, *tail;
+    uint32_t numThreads;
+    bool started;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, NULL, NULL, 0, false};
+
+// Holding the lock across fork leaves the queue in a consistent state.
+static void poolPrepareFork(void) {
+    pthread_mutex_lock(&pool.lock);
+}
+
+static void poolParentFork(void) {
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Tasks queued in the parent belong to parent threads, which wait for the
+// parent's workers: drop them along with the workers.
+static void poolChildFork(void) {
+    pool.head = NULL;
+    pool.tail = NULL;
+    pool.numThreads = 0;
+    pool.started = false;
+    pthread_cond_init(&pool.work, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void *poolWorker(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&pool.lock);
+    while(true) {
+        while(pool.head == NULL) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        struct TwoCatsTaskStruct *task = pool.head;
+        pool.head = task->next;
+        if(pool.head == NULL) {
+            pool.tail = NULL;
+        }
+        pthread_mutex_unlock(&pool.lock);
+        task->func(task->arg);
+        pthread_mutex_lock(&pool.lock);
+        if(--*task->pending == 0) {
+            pthread_cond_broadcast(&pool.done);
+        }
+    }
+    return NULL;
+}
+
+// Called with the lock held.
+static void startPool(void) {
+    // The handlers are inherited by children, which must not add them again
+    static bool forkHandlers = false;
+    if(!forkHandlers) {
+        if(pthread_atfork(poolPrepareFork, poolParentFork, poolChildFork)) {
+            return;
+        }
+        forkHandlers = true;
+    }
+    long numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    if(numCPUs < 1) {
+        numCPUs = 1;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for(long i = 0; i < numCPUs; i++) {
+        pthread_t thread;
+        if(pthread_create(&thread, &attr, poolWorker, NULL)) {
+            break;
+        }
+        pool.numThreads++;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// Run all the tasks on the worker pool and wait for them to finish.  Return
+// false if the pool could not be started.
+static bool runTasks(struct TwoCatsTaskStruct *tasks, uint32_t numTasks) {
+    pthread_mutex_lock(&pool.lock);
+    if(!pool.started) {
+        pool.started = true;
+        startPool();
+    }
+    if(pool.numThreads == 0) {
+        pthread_mutex_unlock(&pool.lock);
+        return false;
+    }
+    uint32_t pending = numTasks;
+    for(uint32_t i = 0; i < numTasks; i++) {
+        tasks[i].pending = &pending;
+        tasks[i].next = NULL;
+        if(pool.tail == NULL) {
+            pool.head = tasks + i;
+        } else {
+            pool.tail->next = tasks + i;
+        }
+        pool.tail = tasks + i;
+    }
+    pthread_cond_broadcast(&pool.work);
+    while(pending != 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return true;
+}
+
 // Add the last hashed data into the result.
 static void addIntoHash(TwoCats_H *H, uint32_t *hash32, uint32_t parallelism, uint32_t *states) {
     for(uint32_t p = 0; p < parallelism; p++) {
@@ -510,7 +636,7 @@ static void *hashWithoutPassword(void *contextPtr) {
         hashBlocks(H, state, mem, blocklen, blocklen, fromAddr, prevAddr, toAddr,
             multiplies, repetitions, lanes);
     }
-    pthread_exit(NULL);
+    return NULL;
 }
 
 // Hash memory with password dependent addressing.
@@ -557,7 +683,7 @@ static void *hashWithPassword(void *contextPtr) {
         hashBlocks(H, state, mem, blocklen, subBlocklen, fromAddr, prevAddr, toAddr,
             multiplies, repetitions, lanes);
     }
-    pthread_exit(NULL);
+    return NULL;
 }
 
 // Hash memory for one level of garlic.
@@ -573,7 +699,7 @@ static bool hashMemory(TwoCats_H *H, uint32_t *hash32, uint32_t *mem, uint8_t me
 
 
     // Fill out the common constant data used in all threads
-    pthread_t memThreads[parallelism];
+    struct TwoCatsTaskStruct tasks[parallelism];
     struct TwoCatsContextStruct c[parallelism];
     struct TwoCatsCommonDataStruct common;
     common.multiplies = multiplies;
@@ -599,19 +725,15 @@ static bool hashMemory(TwoCats_H *H, uint32_t *hash32, uint32_t *mem, uint8_t me
     for(uint32_t slice = 0; slice < TWOCATS_SLICES; slice++) {
         common.completedBlocks = slice*blocksPerThread/TWOCATS_SLICES;
         for(uint32_t p = 0; p < parallelism; p++) {
-            int rc;
-            if(slice < resistantSlices) {
-                rc = pthread_create(&memThreads[p], NULL, hashWithoutPassword, (void *)(c + p));
-            } else {
-                rc = pthread_create(&memThreads[p], NULL, hashWithPassword, (void *)(c + p));
-            }
-            if(rc) {
-                fprintf(stderr, "Unable to start threads\n");
-                return false;
-            }
+            tasks[p].func = slice < resistantSlices ? hashWithoutPassword : hashWithPassword;
+            tasks[p].arg = c + p;
         }
-        for(uint32_t p = 0; p < parallelism; p++) {
-            (void)pthread_join(memThreads[p], NULL);
+        if(parallelism == 1) {
+            // Not worth a round trip through the pool
+            tasks[0].func(tasks[0].arg);
+        } else if(!runTasks(tasks, parallelism)) {
+            fprintf(stderr, "Unable to start threads\n");
+            return false;
         }
     }
 
@@ -182,10 +182,41 @@ bool TwoCats_ClientHashPassword(TwoCats_HashType hashType, uint8_t *hash, uint8_
 bool TwoCats_ServerHashPassword(TwoCats_HashType hashType, uint8_t *hash);
 
 // Find parameter settings on this machine for a given desired runtime and maximum memory
-// usage.  maxMem is in KiB.  Runtime with be typically +/- 50% and memory will be <= maxMem.
+// usage.  maxMem is in KiB.  Memory will be <= maxMem.  This is a wrapper around
+// TwoCats_TuneCostParameters for a single request at a time with TWOCATS_PARALLELISM
+// threads.
 void TwoCats_FindCostParameters(TwoCats_HashType hashType, uint32_t milliSeconds, uint32_t maxMem,
     uint8_t *memCost, uint8_t *timeCost, uint8_t *multplies, uint8_t *lanes);
 
+// A tuned set of parameters, along with what was measured for them.  latencyMs is the
+// median wall-clock time of one hash while concurrency hashes are run at once, and
+// throughput is the total hashes per second completed under that load.
+typedef struct {
+    TwoCats_HashType hashType;
+    uint8_t memCost, timeCost, multiplies, lanes, parallelism;
+    uint32_t blockSize, subBlockSize;
+    uint32_t concurrency;
+    double latencyMs, throughput;
+} TwoCats_CostProfile;
+
+/*
+   Search memCost, timeCost, multiplies, lanes and parallelism jointly for the most memory
+   hashed per password such that, with concurrency requests in flight, the median latency
+   is <= milliseconds and at least minThroughput hashes per second complete.  Set
+   minThroughput to 0 to only bound latency.  maxMem is in KiB per request, and
+   parallelism is tried from 1 through maxParallelism.  Every measurement is taken on a
+   monotonic clock after a warm-up hash, and is the median of samples runs.  Hashing is
+   run many times over, so the search takes much longer than milliseconds.  Returns false
+   if no setting meets the targets.
+*/
+bool TwoCats_TuneCostParameters(TwoCats_HashType hashType, uint32_t milliseconds,
+    double minThroughput, uint32_t concurrency, uint32_t maxMem, uint8_t maxParallelism,
+    uint32_t samples, TwoCats_CostProfile *profile);
+
+// Write a profile as a single line of JSON into buf, returning the length it needs like
+// snprintf.
+int TwoCats_FormatCostProfile(char *buf, size_t len, const TwoCats_CostProfile *profile);
+
 // This is the prototype required for the password hashing competition.  It uses Blake2s.
 int PHS(void *out, size_t outlen, const void *in, size_t inlen, const void *salt, size_t saltlen,
     unsigned int t_cost, unsigned int m_cost);
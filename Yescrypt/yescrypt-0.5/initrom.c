@@ -20,6 +20,9 @@
 
 #define YESCRYPT_FLAGS (YESCRYPT_RW | YESCRYPT_PWXFORM)
 
+#define YESCRYPT_MASK_SHM		1
+#define YESCRYPT_MASK_FILE		0xe
+
 #define ROM_SHM_KEY			0x524f4d0a
 #define ROM_LOCAL_PARAM			"change this before use"
 
@@ -57,6 +60,8 @@ int main(int argc, const char * const *argv)
 	uint8_t digest[4];
 	const char * rom_filename = NULL;
 	int rom_fd;
+	uint8_t * rom_file = NULL;
+	uint64_t rom_file_bytes = 0;
 
 	if (argc > 1)
 		rom_bytes = atoi(argv[1]) * (1024ULL*1024*1024);
@@ -104,7 +109,8 @@ int main(int argc, const char * const *argv)
 			perror("open");
 			return 1;
 		}
-		if (ftruncate(rom_fd, rom_bytes)) {
+		rom_file_bytes = YESCRYPT_ROM_HEADER_SIZE + rom_bytes;
+		if (ftruncate(rom_fd, rom_file_bytes)) {
 			perror("ftruncate");
 			close(rom_fd);
 			unlink(rom_filename);
@@ -119,11 +125,11 @@ int main(int argc, const char * const *argv)
 		    MAP_HUGETLB |
 #endif
 		    MAP_SHARED;
-		void * p = mmap(NULL, rom_bytes, PROT_READ | PROT_WRITE,
+		void * p = mmap(NULL, rom_file_bytes, PROT_READ | PROT_WRITE,
 		    flags, rom_fd, 0);
 #if defined(MAP_HUGETLB) && defined(USE_HUGEPAGE)
 		if (p == MAP_FAILED)
-			p = mmap(NULL, rom_bytes, PROT_READ | PROT_WRITE,
+			p = mmap(NULL, rom_file_bytes, PROT_READ | PROT_WRITE,
 			    flags & ~MAP_HUGETLB, rom_fd, 0);
 #endif
 		if (p == MAP_FAILED) {
@@ -133,7 +139,10 @@ int main(int argc, const char * const *argv)
 			return 1;
 		}
 		close(rom_fd);
-		shared.shared1.base = shared.shared1.aligned = p;
+/* The ROM is computed in place, right after the file header */
+		rom_file = p;
+		shared.shared1.base = shared.shared1.aligned =
+		    rom_file + YESCRYPT_ROM_HEADER_SIZE;
 	} else {
 		shmid = shmget(ROM_SHM_KEY, shared.shared1.aligned_size,
 #ifdef SHM_HUGETLB
@@ -170,7 +179,8 @@ int main(int argc, const char * const *argv)
 	    (uint8_t *)ROM_LOCAL_PARAM, strlen(ROM_LOCAL_PARAM),
 	    (uint64_t)1 << NROM_log2, r,
 	    rom_filename ? YESCRYPT_PROM_FILE : YESCRYPT_PROM_SHM,
-	    YESCRYPT_SHARED_PREALLOCATED, 1,
+	    YESCRYPT_SHARED_PREALLOCATED,
+	    rom_filename ? YESCRYPT_MASK_FILE : YESCRYPT_MASK_SHM,
 	    digest, sizeof(digest))) {
 		puts(" FAILED");
 		if (rom_filename)
@@ -180,6 +190,20 @@ int main(int argc, const char * const *argv)
 	printf(" DONE (%02x%02x%02x%02x)\n",
 	    digest[0], digest[1], digest[2], digest[3]);
 
+	if (rom_file) {
+		printf("Writing ROM file header ...");
+		fflush(stdout);
+		if (yescrypt_encode_rom_header(&shared,
+		    (uint64_t)1 << NROM_log2, r, YESCRYPT_PROM_FILE,
+		    rom_file) ||
+		    msync(rom_file, rom_file_bytes, MS_SYNC)) {
+			puts(" FAILED");
+			unlink(rom_filename);
+			return 1;
+		}
+		puts(" DONE");
+	}
+
 	{
 		yescrypt_local_t local;
 		const uint8_t *setting;
@@ -199,7 +223,7 @@ int main(int argc, const char * const *argv)
 		    hash, sizeof(hash)));
 	}
 
-	if (rom_filename && munmap(shared.shared1.base, rom_bytes)) {
+	if (rom_file && munmap(rom_file, rom_file_bytes)) {
 		perror("munmap");
 		return 1;
 	}
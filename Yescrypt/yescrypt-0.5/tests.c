@@ -37,11 +37,17 @@
 #define TEST_YESCRYPT_ENCODING
 #define TEST_ROM
 #define TEST_ROM_PREALLOC
+#define TEST_BATCH
+#define TEST_ROM_FILE
 
 #ifdef TEST_ROM_PREALLOC
 #include <stdlib.h> /* for malloc() */
 #endif
 
+#ifdef TEST_ROM_FILE
+#include <unistd.h> /* for unlink() */
+#endif
+
 #ifdef TEST_PBKDF2_SHA256
 #include <assert.h>
 
@@ -264,6 +270,86 @@ main(int argc, char *argv[])
 		printf("'%s'\n", (char *)yescrypt_r(&shared, &local,
 		    (const uint8_t *)"pleaseletmeIn", 13, setting,
 		    hash, sizeof(hash)));
+
+#ifdef TEST_BATCH
+		{
+			uint8_t settings[2][64];
+			const uint8_t * passwds[4], * settingps[4];
+			size_t passwdlens[4];
+			uint8_t hashes[4][128], * results[4];
+			yescrypt_batch_t * batch;
+			int i;
+
+/* setting points to yescrypt_gensalt()'s static buffer, so copy it first */
+			snprintf((char *)settings[1], sizeof(settings[1]),
+			    "%s", (char *)setting);
+			snprintf((char *)settings[0], sizeof(settings[0]),
+			    "%s", (char *)yescrypt_gensalt(
+			    N_log2, r, YESCRYPT_P, YESCRYPT_FLAGS,
+			    (const uint8_t *)"binary data", 12));
+
+			for (i = 0; i < 4; i++) {
+				passwds[i] = (const uint8_t *)((i & 1) ?
+				    "pleaseletmeIn" : "pleaseletmein");
+				passwdlens[i] = 13;
+				settingps[i] = settings[i >> 1];
+			}
+
+			batch = yescrypt_init_batch(&shared, 2);
+			if (!batch || yescrypt_r_batch(batch,
+			    passwds, passwdlens, settingps,
+			    &hashes[0][0], sizeof(hashes[0]), results, 4)) {
+				puts("yescrypt_r_batch() FAILED");
+				return 1;
+			}
+			for (i = 0; i < 4; i++)
+				printf("'%s'\n", (char *)results[i]);
+			yescrypt_free_batch(batch);
+		}
+#endif
+
+#ifdef TEST_ROM_FILE
+		{
+			const char * rom_filename = "TESTS-ROM";
+			yescrypt_shared_t small, loaded;
+
+			if (yescrypt_init_shared(&small,
+			    (uint8_t *)"local param", 12, 1024, 8, 1,
+			    YESCRYPT_SHARED_DEFAULTS, 1, NULL, 0)) {
+				puts("yescrypt_init_shared() FAILED");
+				return 1;
+			}
+
+			unlink(rom_filename);
+			printf("Saving and loading ROM file ...");
+			fflush(stdout);
+			if (yescrypt_save_shared(&small, 1024, 8, 1,
+			    rom_filename) ||
+			    yescrypt_load_shared(&loaded, rom_filename,
+			    1024, 8, 1, YESCRYPT_SHARED_VERIFY)) {
+				puts(" FAILED");
+				unlink(rom_filename);
+				return 1;
+			}
+			unlink(rom_filename);
+			puts(" DONE");
+
+			setting = yescrypt_gensalt(
+			    4, 8, 1, YESCRYPT_RW | YESCRYPT_PWXFORM,
+			    (const uint8_t *)"binary data", 12);
+
+			printf("'%s'\n", (char *)yescrypt_r(&small, &local,
+			    (const uint8_t *)"pleaseletmein", 13, setting,
+			    hash, sizeof(hash)));
+
+			printf("'%s'\n", (char *)yescrypt_r(&loaded, &local,
+			    (const uint8_t *)"pleaseletmein", 13, setting,
+			    hash, sizeof(hash)));
+
+			yescrypt_unload_shared(&loaded);
+			yescrypt_free_shared(&small);
+		}
+#endif
 #endif
 	}
 #endif
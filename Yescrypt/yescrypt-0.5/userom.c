@@ -23,7 +23,6 @@
 //#define YESCRYPT_FLAGS YESCRYPT_WORM
 
 #define YESCRYPT_MASK_SHM		1
-#define YESCRYPT_MASK_FILE		0xe
 
 #define ROM_SHM_KEY			0x524f4d0a
 
@@ -64,7 +63,6 @@ int main(int argc, const char * const *argv)
 	int shmid;
 #endif
 	const char * rom_filename = NULL;
-	int rom_fd;
 
 	if (argc > 1)
 		rom_bytes = atoi(argv[1]) * (1024ULL*1024*1024);
@@ -113,36 +111,20 @@ int main(int argc, const char * const *argv)
 
 #ifndef DISABLE_ROM
 	if (rom_filename) {
-		rom_fd = open(rom_filename, O_RDONLY);
-		if (rom_fd < 0) {
-			perror("open");
+/*
+ * initrom may have used a larger r for the ROM than we use for the RAM, so
+ * only check that the ROM size is as expected.
+ */
+		if (yescrypt_load_shared(&shared, rom_filename, 0, 0, 0,
+		    YESCRYPT_SHARED_MAP_HUGETLB)) {
+			perror("yescrypt_load_shared");
 			return 1;
 		}
-
-		int flags =
-#ifdef MAP_NOCORE
-		    MAP_NOCORE |
-#endif
-#ifdef MAP_HUGETLB
-		    MAP_HUGETLB |
-#endif
-		    MAP_SHARED;
-		void * p = mmap(NULL, rom_bytes, PROT_READ, flags, rom_fd, 0);
-#ifdef MAP_HUGETLB
-		if (p == MAP_FAILED)
-			p = mmap(NULL, rom_bytes, PROT_READ,
-			    flags & ~MAP_HUGETLB, rom_fd, 0);
-#endif
-		if (p == MAP_FAILED) {
-			perror("mmap");
-			close(rom_fd);
+		if (shared.shared1.aligned_size != rom_bytes) {
+			puts("ROM file size mismatch");
+			yescrypt_unload_shared(&shared);
 			return 1;
 		}
-		close(rom_fd);
-
-		shared.shared1.base = shared.shared1.aligned = p;
-		shared.shared1.aligned_size = rom_bytes;
-		shared.mask1 = YESCRYPT_MASK_FILE;
 	} else if (rom_bytes) {
 		shared.shared1.aligned_size = rom_bytes;
 		shmid = shmget(ROM_SHM_KEY, shared.shared1.aligned_size, 0);
@@ -326,8 +308,8 @@ int main(int argc, const char * const *argv)
 #endif
 	}
 
-	if (rom_filename && munmap(shared.shared1.base, rom_bytes)) {
-		perror("munmap");
+	if (rom_filename && yescrypt_unload_shared(&shared)) {
+		perror("yescrypt_unload_shared");
 		return 1;
 	}
 
@@ -0,0 +1,205 @@
+/*
+ * Batch hashing for yescrypt_r_batch(): a pool of worker threads, each with
+ * its own yescrypt_local_t, computing independent hashes from a shared queue.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "yescrypt.h"
+
+typedef struct {
+	yescrypt_batch_t * batch;
+	yescrypt_local_t local;
+	pthread_t thread;
+} yescrypt_batch_worker_t;
+
+struct yescrypt_batch {
+	const yescrypt_shared_t * shared;
+	yescrypt_batch_worker_t * workers;
+	unsigned int nthreads;
+
+/* Only one batch may be in flight at a time */
+	pthread_mutex_t serialize;
+
+/* Everything below is protected by lock */
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned long generation;
+	unsigned int running;
+	int quit;
+
+	const uint8_t * const * passwd;
+	const size_t * passwdlen;
+	const uint8_t * const * setting;
+	uint8_t * buf;
+	size_t buflen;
+	uint8_t ** hashes;
+	size_t count, next;
+	int failed;
+};
+
+static void *
+batch_worker(void * arg)
+{
+	yescrypt_batch_worker_t * worker = arg;
+	yescrypt_batch_t * batch = worker->batch;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&batch->lock);
+	for (;;) {
+		while (batch->generation == seen && !batch->quit)
+			pthread_cond_wait(&batch->start, &batch->lock);
+		if (batch->quit)
+			break;
+		seen = batch->generation;
+
+		while (batch->next < batch->count) {
+			size_t i = batch->next++;
+			uint8_t * hash;
+
+			pthread_mutex_unlock(&batch->lock);
+			hash = yescrypt_r(batch->shared, &worker->local,
+			    batch->passwd[i], batch->passwdlen[i],
+			    batch->setting[i],
+			    batch->buf + i * batch->buflen, batch->buflen);
+			pthread_mutex_lock(&batch->lock);
+
+			batch->hashes[i] = hash;
+			if (!hash)
+				batch->failed = 1;
+		}
+
+		if (--batch->running == 0)
+			pthread_cond_signal(&batch->done);
+	}
+	pthread_mutex_unlock(&batch->lock);
+
+	return NULL;
+}
+
+static void
+stop_workers(yescrypt_batch_t * batch, unsigned int nstarted)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&batch->lock);
+	batch->quit = 1;
+	pthread_cond_broadcast(&batch->start);
+	pthread_mutex_unlock(&batch->lock);
+
+	for (i = 0; i < nstarted; i++) {
+		pthread_join(batch->workers[i].thread, NULL);
+		yescrypt_free_local(&batch->workers[i].local);
+	}
+}
+
+yescrypt_batch_t *
+yescrypt_init_batch(const yescrypt_shared_t * shared, unsigned int nthreads)
+{
+	yescrypt_batch_t * batch;
+	unsigned int i;
+
+	if (!nthreads) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = (n > 0) ? n : 1;
+	}
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+	batch->workers = calloc(nthreads, sizeof(*batch->workers));
+	if (!batch->workers) {
+		free(batch);
+		return NULL;
+	}
+	batch->shared = shared;
+	batch->nthreads = nthreads;
+
+	pthread_mutex_init(&batch->serialize, NULL);
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->start, NULL);
+	pthread_cond_init(&batch->done, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		yescrypt_batch_worker_t * worker = &batch->workers[i];
+		worker->batch = batch;
+		if (yescrypt_init_local(&worker->local))
+			break;
+		if ((errno = pthread_create(&worker->thread, NULL,
+		    batch_worker, worker)) != 0) {
+			yescrypt_free_local(&worker->local);
+			break;
+		}
+	}
+
+	if (i < nthreads) {
+		stop_workers(batch, i);
+		batch->nthreads = 0;
+		yescrypt_free_batch(batch);
+		return NULL;
+	}
+
+	return batch;
+}
+
+int
+yescrypt_free_batch(yescrypt_batch_t * batch)
+{
+	if (!batch)
+		return 0;
+
+	stop_workers(batch, batch->nthreads);
+
+	pthread_cond_destroy(&batch->done);
+	pthread_cond_destroy(&batch->start);
+	pthread_mutex_destroy(&batch->lock);
+	pthread_mutex_destroy(&batch->serialize);
+	free(batch->workers);
+	free(batch);
+
+	return 0;
+}
+
+int
+yescrypt_r_batch(yescrypt_batch_t * batch,
+    const uint8_t * const * passwd, const size_t * passwdlen,
+    const uint8_t * const * setting,
+    uint8_t * buf, size_t buflen,
+    uint8_t ** hashes, size_t count)
+{
+	int failed;
+
+	if (!count)
+		return 0;
+	if (!buflen || count > SIZE_MAX / buflen)
+		return -1;
+
+	pthread_mutex_lock(&batch->serialize);
+	pthread_mutex_lock(&batch->lock);
+
+	batch->passwd = passwd;
+	batch->passwdlen = passwdlen;
+	batch->setting = setting;
+	batch->buf = buf;
+	batch->buflen = buflen;
+	batch->hashes = hashes;
+	batch->count = count;
+	batch->next = 0;
+	batch->failed = 0;
+	batch->running = batch->nthreads;
+	batch->generation++;
+	pthread_cond_broadcast(&batch->start);
+
+	while (batch->running)
+		pthread_cond_wait(&batch->done, &batch->lock);
+	failed = batch->failed;
+
+	pthread_mutex_unlock(&batch->lock);
+	pthread_mutex_unlock(&batch->serialize);
+
+	return failed ? -1 : 0;
+}
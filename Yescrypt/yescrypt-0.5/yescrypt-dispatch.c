@@ -0,0 +1,120 @@
+/*
+ * Runtime selection between builds of yescrypt-simd.c for different x86-64
+ * instruction set extensions.  Each variant is compiled from the same source
+ * with different compiler flags and with yescrypt_kdf() renamed (see the
+ * Makefile), and this file provides yescrypt_kdf() itself along with the rest
+ * of the interface normally provided by yescrypt-platform.c.
+ *
+ * The choice may be overridden by setting the YESCRYPT_SIMD environment
+ * variable to one of the variant names below, which is mostly useful for
+ * testing.  Requesting a variant the CPU does not support is ignored.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "yescrypt.h"
+
+/* Only the variants allocate memory for yescrypt_kdf() */
+#define YESCRYPT_PLATFORM_NO_ALLOC
+#include "yescrypt-platform.c"
+
+typedef int (*yescrypt_kdf_t)(const yescrypt_shared_t * shared,
+    yescrypt_local_t * local,
+    const uint8_t * passwd, size_t passwdlen,
+    const uint8_t * salt, size_t saltlen,
+    uint64_t N, uint32_t r, uint32_t p, uint32_t t,
+    yescrypt_flags_t flags,
+    uint8_t * buf, size_t buflen);
+
+#define DECLARE_KDF(name) \
+	extern int name(const yescrypt_shared_t * shared, \
+	    yescrypt_local_t * local, \
+	    const uint8_t * passwd, size_t passwdlen, \
+	    const uint8_t * salt, size_t saltlen, \
+	    uint64_t N, uint32_t r, uint32_t p, uint32_t t, \
+	    yescrypt_flags_t flags, \
+	    uint8_t * buf, size_t buflen);
+
+DECLARE_KDF(yescrypt_kdf_sse2)
+DECLARE_KDF(yescrypt_kdf_sse41)
+DECLARE_KDF(yescrypt_kdf_avx)
+DECLARE_KDF(yescrypt_kdf_xop)
+DECLARE_KDF(yescrypt_kdf_avx2)
+DECLARE_KDF(yescrypt_kdf_avx512)
+
+/* In order of preference */
+static const struct {
+	const char * name;
+	yescrypt_kdf_t kdf;
+} variants[] = {
+	{"avx512", yescrypt_kdf_avx512},
+	{"avx2", yescrypt_kdf_avx2},
+	{"xop", yescrypt_kdf_xop},
+	{"avx", yescrypt_kdf_avx},
+	{"sse41", yescrypt_kdf_sse41},
+	{"sse2", yescrypt_kdf_sse2}
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+static int
+variant_supported(const char * name)
+{
+	if (!strcmp(name, "avx512"))
+		return __builtin_cpu_supports("avx512f") &&
+		    __builtin_cpu_supports("avx512vl");
+	if (!strcmp(name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(name, "xop"))
+		return __builtin_cpu_supports("xop");
+	if (!strcmp(name, "avx"))
+		return __builtin_cpu_supports("avx");
+	if (!strcmp(name, "sse41"))
+		return __builtin_cpu_supports("sse4.1");
+	return 1;
+}
+
+static yescrypt_kdf_t
+select_kdf(void)
+{
+	const char * want = getenv("YESCRYPT_SIMD");
+	size_t i;
+
+	__builtin_cpu_init();
+
+	if (want) {
+		for (i = 0; i < NVARIANTS; i++)
+			if (!strcmp(want, variants[i].name) &&
+			    variant_supported(variants[i].name))
+				return variants[i].kdf;
+	}
+
+	for (i = 0; i < NVARIANTS; i++)
+		if (variant_supported(variants[i].name))
+			return variants[i].kdf;
+
+	return yescrypt_kdf_sse2;
+}
+
+int
+yescrypt_kdf(const yescrypt_shared_t * shared, yescrypt_local_t * local,
+    const uint8_t * passwd, size_t passwdlen,
+    const uint8_t * salt, size_t saltlen,
+    uint64_t N, uint32_t r, uint32_t p, uint32_t t, yescrypt_flags_t flags,
+    uint8_t * buf, size_t buflen)
+{
+	static yescrypt_kdf_t kdf;
+	yescrypt_kdf_t k = __atomic_load_n(&kdf, __ATOMIC_ACQUIRE);
+
+/* Concurrent first calls may each select, but they all pick the same one */
+	if (!k) {
+		k = select_kdf();
+		__atomic_store_n(&kdf, k, __ATOMIC_RELEASE);
+	}
+
+	return k(shared, local, passwd, passwdlen, salt, saltlen,
+	    N, r, p, t, flags, buf, buflen);
+}
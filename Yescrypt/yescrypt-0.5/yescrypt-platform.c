@@ -28,6 +28,7 @@
 #undef HUGEPAGE_SIZE
 #endif
 
+#ifndef YESCRYPT_PLATFORM_NO_ALLOC
 static void *
 alloc_region(yescrypt_region_t * region, size_t size)
 {
@@ -86,6 +87,8 @@ alloc_region(yescrypt_region_t * region, size_t size)
 	return aligned;
 }
 
+#endif
+
 static inline void
 init_region(yescrypt_region_t * region)
 {
@@ -108,6 +111,7 @@ free_region(yescrypt_region_t * region)
 	return 0;
 }
 
+#ifndef YESCRYPT_PLATFORM_KDF_ONLY
 int
 yescrypt_init_shared(yescrypt_shared_t * shared,
     const uint8_t * param, size_t paramlen,
@@ -189,3 +193,4 @@ yescrypt_free_local(yescrypt_local_t * local)
 {
 	return free_region(local);
 }
+#endif /* !YESCRYPT_PLATFORM_KDF_ONLY */
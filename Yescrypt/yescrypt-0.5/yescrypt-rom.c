@@ -0,0 +1,246 @@
+/*
+ * ROM file format.  All integers are little-endian.
+ *
+ *	offset	size	contents
+ *	0	8	magic, "yescROM1"
+ *	8	4	header size (YESCRYPT_ROM_HEADER_SIZE)
+ *	12	4	mask
+ *	16	8	N
+ *	24	4	r
+ *	28	4	p
+ *	32	8	ROM size in bytes (N * r * 128)
+ *	40	32	SHA-256 of the ROM contents
+ *	72	32	SHA-256 of bytes 0 to 71 of the header
+ *	104	...	zero padding up to the header size
+ *
+ * The ROM contents follow the header.  The header size is a multiple of the
+ * page size, so that the ROM itself starts page-aligned in the mapping.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sha256.h"
+#include "sysendian.h"
+
+#include "yescrypt.h"
+
+#define ROM_MAGIC			"yescROM1"
+#define ROM_HEADER_USED			104
+
+int
+yescrypt_encode_rom_header(const yescrypt_shared_t * shared,
+    uint64_t N, uint32_t r, uint32_t p, uint8_t * header)
+{
+	const yescrypt_shared1_t * shared1 = &shared->shared1;
+	SHA256_CTX ctx;
+
+	if (!shared1->aligned || (uint64_t)shared1->aligned_size !=
+	    N * r * 128 || !N || !r) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(header, 0, YESCRYPT_ROM_HEADER_SIZE);
+	memcpy(header, ROM_MAGIC, 8);
+	le32enc(&header[8], YESCRYPT_ROM_HEADER_SIZE);
+	le32enc(&header[12], shared->mask1);
+	le64enc(&header[16], N);
+	le32enc(&header[24], r);
+	le32enc(&header[28], p);
+	le64enc(&header[32], shared1->aligned_size);
+
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, shared1->aligned, shared1->aligned_size);
+	SHA256_Final(&header[40], &ctx);
+
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, header, 72);
+	SHA256_Final(&header[72], &ctx);
+
+	return 0;
+}
+
+static int
+write_all(int fd, const uint8_t * buf, size_t size)
+{
+	while (size) {
+		ssize_t n = write(fd, buf, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		size -= n;
+	}
+	return 0;
+}
+
+int
+yescrypt_save_shared(const yescrypt_shared_t * shared,
+    uint64_t N, uint32_t r, uint32_t p, const char * filename)
+{
+	uint8_t header[YESCRYPT_ROM_HEADER_SIZE];
+	int fd, save_errno;
+
+	if (yescrypt_encode_rom_header(shared, N, r, p, header))
+		return -1;
+
+	fd = open(filename, O_CREAT | O_EXCL | O_WRONLY,
+	    S_IRUSR | S_IRGRP | S_IWUSR);
+	if (fd < 0)
+		return -1;
+
+	if (write_all(fd, header, sizeof(header)) ||
+	    write_all(fd, shared->shared1.aligned,
+	    shared->shared1.aligned_size) ||
+	    fsync(fd))
+		goto fail;
+
+	if (close(fd)) {
+		fd = -1;
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	save_errno = errno;
+	if (fd >= 0)
+		close(fd);
+	unlink(filename);
+	errno = save_errno;
+	return -1;
+}
+
+static int
+decode_rom_header(const uint8_t * header, uint32_t * mask,
+    uint64_t * N, uint32_t * r, uint32_t * p, uint64_t * rom_size)
+{
+	uint8_t digest[32];
+	SHA256_CTX ctx;
+	size_t i;
+
+	if (memcmp(header, ROM_MAGIC, 8) ||
+	    le32dec(&header[8]) != YESCRYPT_ROM_HEADER_SIZE)
+		return -1;
+
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, header, 72);
+	SHA256_Final(digest, &ctx);
+	if (memcmp(digest, &header[72], sizeof(digest)))
+		return -1;
+
+	for (i = ROM_HEADER_USED; i < YESCRYPT_ROM_HEADER_SIZE; i++)
+		if (header[i])
+			return -1;
+
+	*mask = le32dec(&header[12]);
+	*N = le64dec(&header[16]);
+	*r = le32dec(&header[24]);
+	*p = le32dec(&header[28]);
+	*rom_size = le64dec(&header[32]);
+
+	if (!*N || (*N & (*N - 1)) || !*r ||
+	    *N > UINT64_MAX / 128 / *r || *rom_size != *N * *r * 128 ||
+	    *rom_size > SIZE_MAX - YESCRYPT_ROM_HEADER_SIZE)
+		return -1;
+
+	return 0;
+}
+
+int
+yescrypt_load_shared(yescrypt_shared_t * shared, const char * filename,
+    uint64_t N, uint32_t r, uint32_t p,
+    yescrypt_init_shared_flags_t flags)
+{
+	uint8_t header[YESCRYPT_ROM_HEADER_SIZE];
+	uint64_t file_N, rom_size;
+	uint32_t file_mask, file_r, file_p;
+	struct stat st;
+	size_t map_size;
+	uint8_t * base;
+	int fd, map_flags;
+	ssize_t n;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	do {
+		n = pread(fd, header, sizeof(header), 0);
+	} while (n < 0 && errno == EINTR);
+	if (n != (ssize_t)sizeof(header) ||
+	    decode_rom_header(header, &file_mask, &file_N, &file_r, &file_p,
+	    &rom_size) ||
+	    (N && N != file_N) || (r && r != file_r) || (p && p != file_p) ||
+	    fstat(fd, &st) ||
+	    (uint64_t)st.st_size != YESCRYPT_ROM_HEADER_SIZE + rom_size) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	map_size = YESCRYPT_ROM_HEADER_SIZE + rom_size;
+	map_flags =
+#ifdef MAP_NOCORE
+	    MAP_NOCORE |
+#endif
+#ifdef MAP_POPULATE
+	    ((flags & YESCRYPT_SHARED_MAP_POPULATE) ? MAP_POPULATE : 0) |
+#endif
+	    MAP_SHARED;
+	base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+/* This only succeeds for files residing on a hugetlbfs */
+	if (flags & YESCRYPT_SHARED_MAP_HUGETLB)
+		base = mmap(NULL, map_size, PROT_READ,
+		    map_flags | MAP_HUGETLB, fd, 0);
+#endif
+	if (base == MAP_FAILED)
+		base = mmap(NULL, map_size, PROT_READ, map_flags, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+
+	if (flags & YESCRYPT_SHARED_VERIFY) {
+		uint8_t digest[32];
+		SHA256_CTX ctx;
+
+		SHA256_Init(&ctx);
+		SHA256_Update(&ctx, base + YESCRYPT_ROM_HEADER_SIZE, rom_size);
+		SHA256_Final(digest, &ctx);
+		if (memcmp(digest, &header[40], sizeof(digest))) {
+			munmap(base, map_size);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	shared->shared1.base = base;
+	shared->shared1.base_size = map_size;
+	shared->shared1.aligned = base + YESCRYPT_ROM_HEADER_SIZE;
+	shared->shared1.aligned_size = rom_size;
+	shared->mask1 = file_mask;
+
+	return 0;
+}
+
+int
+yescrypt_unload_shared(yescrypt_shared_t * shared)
+{
+	yescrypt_shared1_t * shared1 = &shared->shared1;
+
+	if (shared1->base && munmap(shared1->base, shared1->base_size))
+		return -1;
+
+	shared1->base = shared1->aligned = NULL;
+	shared1->base_size = shared1->aligned_size = 0;
+	return 0;
+}
@@ -32,8 +32,11 @@
  * On 64-bit, enabling SSE4.1 helps our pwxform code indirectly, via avoiding
  * gcc bug 54349 (fixed for gcc 4.9+).  On 32-bit, it's of direct help.  AVX
  * and XOP are of further help either way.
+ *
+ * A build for yescrypt-dispatch.c (YESCRYPT_KDF defined, see below) without
+ * SSE4.1 is the one meant for CPUs that lack it, so there's nothing to say.
  */
-#ifndef __SSE4_1__
+#if !defined(__SSE4_1__) && !defined(YESCRYPT_KDF)
 #warning "Consider enabling SSE4.1, AVX, or XOP in the C compiler for significantly better performance"
 #endif
 
@@ -41,6 +44,9 @@
 #ifdef __XOP__
 #include <x86intrin.h>
 #endif
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 #include <errno.h>
 #include <stdint.h>
@@ -52,6 +58,16 @@
 
 #include "yescrypt.h"
 
+/*
+ * When building one of several variants of this file for runtime selection
+ * by yescrypt-dispatch.c, YESCRYPT_KDF is the name to give yescrypt_kdf(),
+ * and the rest of the public interface is provided by the dispatcher.
+ */
+#ifdef YESCRYPT_KDF
+#define yescrypt_kdf YESCRYPT_KDF
+#define YESCRYPT_PLATFORM_KDF_ONLY
+#endif
+
 #include "yescrypt-platform.c"
 
 #if __STDC_VERSION__ >= 199901L
@@ -68,6 +84,9 @@
 #ifdef __XOP__
 #define ARX(out, in1, in2, s) \
 	out = _mm_xor_si128(out, _mm_roti_epi32(_mm_add_epi32(in1, in2), s));
+#elif defined(__AVX512VL__)
+#define ARX(out, in1, in2, s) \
+	out = _mm_xor_si128(out, _mm_rol_epi32(_mm_add_epi32(in1, in2), s));
 #else
 #define ARX(out, in1, in2, s) \
 	{ \
@@ -294,6 +313,92 @@ blockmix_salsa8(const salsa20_blk_t *restrict Bin,
 	PWXFORM_SIMD(X2, x2, s20, s21) \
 	PWXFORM_SIMD(X3, x3, s30, s31)
 
+/*
+ * pwxform's critical path is the chain of S-box lookups, which are scalar
+ * loads in all versions of the code below.  Packing the lanes into 256- or
+ * 512-bit registers saves multiply, add, and XOR instructions, but the extra
+ * lane inserts and extracts lie on that same critical path, and on the CPUs
+ * we tested this made the wide versions slower than the 128-bit one.  They
+ * are therefore only used when YESCRYPT_WIDE_PWXFORM is defined.
+ */
+#if defined(YESCRYPT_WIDE_PWXFORM) && defined(__x86_64__) && \
+    defined(__AVX512F__)
+/*
+ * Keep all four pwxform lanes in one 512-bit register.
+ */
+#define PWXFORM_LOAD512(Sx, x0, x1, x2, x3, out) \
+	out = _mm512_castsi128_si512(*(const __m128i *)(Sx + (x0))); \
+	out = _mm512_inserti32x4(out, *(const __m128i *)(Sx + (x1)), 1); \
+	out = _mm512_inserti32x4(out, *(const __m128i *)(Sx + (x2)), 2); \
+	out = _mm512_inserti32x4(out, *(const __m128i *)(Sx + (x3)), 3);
+
+#define PWXFORM_ROUND512 \
+	x0 = EXTRACT64(_mm512_castsi512_si128(Z)) & S_MASK2; \
+	x1 = EXTRACT64(_mm512_extracti32x4_epi32(Z, 1)) & S_MASK2; \
+	x2 = EXTRACT64(_mm512_extracti32x4_epi32(Z, 2)) & S_MASK2; \
+	x3 = EXTRACT64(_mm512_extracti32x4_epi32(Z, 3)) & S_MASK2; \
+	PWXFORM_LOAD512(S0, (uint32_t)x0, (uint32_t)x1, \
+	    (uint32_t)x2, (uint32_t)x3, s0) \
+	PWXFORM_LOAD512(S1, x0 >> 32, x1 >> 32, x2 >> 32, x3 >> 32, s1) \
+	Z = _mm512_mul_epu32(_mm512_shuffle_epi32(Z, _MM_PERM_CDAB), Z); \
+	Z = _mm512_add_epi64(Z, s0); \
+	Z = _mm512_xor_si512(Z, s1);
+
+#define PWXFORM \
+	{ \
+		uint64_t x0, x1, x2, x3; \
+		__m512i Z, s0, s1; \
+		Z = _mm512_castsi128_si512(X0); \
+		Z = _mm512_inserti32x4(Z, X1, 1); \
+		Z = _mm512_inserti32x4(Z, X2, 2); \
+		Z = _mm512_inserti32x4(Z, X3, 3); \
+		PWXFORM_ROUND512 PWXFORM_ROUND512 \
+		PWXFORM_ROUND512 PWXFORM_ROUND512 \
+		PWXFORM_ROUND512 PWXFORM_ROUND512 \
+		X0 = _mm512_castsi512_si128(Z); \
+		X1 = _mm512_extracti32x4_epi32(Z, 1); \
+		X2 = _mm512_extracti32x4_epi32(Z, 2); \
+		X3 = _mm512_extracti32x4_epi32(Z, 3); \
+	}
+#elif defined(YESCRYPT_WIDE_PWXFORM) && defined(__x86_64__) && \
+    defined(__AVX2__)
+/*
+ * Same for AVX2, with two pwxform lanes per 256-bit register.
+ */
+#define PWXFORM_LOAD256(Sx, xa, xb, out) \
+	out = _mm256_castsi128_si256(*(const __m128i *)(Sx + (xa))); \
+	out = _mm256_inserti128_si256(out, *(const __m128i *)(Sx + (xb)), 1);
+
+#define PWXFORM_SIMD256(Y, xa, xb, s0, s1) \
+	xa = EXTRACT64(_mm256_castsi256_si128(Y)) & S_MASK2; \
+	xb = (uint64_t)_mm256_extract_epi64(Y, 2) & S_MASK2; \
+	PWXFORM_LOAD256(S0, (uint32_t)xa, (uint32_t)xb, s0) \
+	PWXFORM_LOAD256(S1, xa >> 32, xb >> 32, s1) \
+	Y = _mm256_mul_epu32(_mm256_shuffle_epi32(Y, 0xb1), Y); \
+	Y = _mm256_add_epi64(Y, s0); \
+	Y = _mm256_xor_si256(Y, s1);
+
+#define PWXFORM_ROUND256 \
+	PWXFORM_SIMD256(Y01, x0, x1, s00, s01) \
+	PWXFORM_SIMD256(Y23, x2, x3, s20, s21)
+
+#define PWXFORM \
+	{ \
+		uint64_t x0, x1, x2, x3; \
+		__m256i Y01, Y23, s00, s01, s20, s21; \
+		Y01 = _mm256_inserti128_si256(_mm256_castsi128_si256(X0), \
+		    X1, 1); \
+		Y23 = _mm256_inserti128_si256(_mm256_castsi128_si256(X2), \
+		    X3, 1); \
+		PWXFORM_ROUND256 PWXFORM_ROUND256 \
+		PWXFORM_ROUND256 PWXFORM_ROUND256 \
+		PWXFORM_ROUND256 PWXFORM_ROUND256 \
+		X0 = _mm256_castsi256_si128(Y01); \
+		X1 = _mm256_extracti128_si256(Y01, 1); \
+		X2 = _mm256_castsi256_si128(Y23); \
+		X3 = _mm256_extracti128_si256(Y23, 1); \
+	}
+#else
 #define PWXFORM \
 	{ \
 		PWXFORM_X_T x0, x1, x2, x3; \
@@ -302,6 +407,7 @@ blockmix_salsa8(const salsa20_blk_t *restrict Bin,
 		PWXFORM_ROUND PWXFORM_ROUND \
 		PWXFORM_ROUND PWXFORM_ROUND \
 	}
+#endif
 
 #define XOR4(in) \
 	X0 = _mm_xor_si128(X0, (in)[0]); \
@@ -644,6 +750,11 @@ blockmix_xor_save(const salsa20_blk_t *restrict Bin1,
 #undef PWXFORM_SIMD_1
 #undef PWXFORM_SIMD_2
 #undef PWXFORM_ROUND
+#undef PWXFORM_LOAD512
+#undef PWXFORM_ROUND512
+#undef PWXFORM_LOAD256
+#undef PWXFORM_SIMD256
+#undef PWXFORM_ROUND256
 #undef PWXFORM
 #undef OUT
 #undef XOR4
@@ -74,7 +74,10 @@ typedef yescrypt_region_t yescrypt_local_t;
  */
 typedef enum {
 	YESCRYPT_SHARED_DEFAULTS = 0,
-	YESCRYPT_SHARED_PREALLOCATED = 0x100
+	YESCRYPT_SHARED_PREALLOCATED = 0x100,
+	YESCRYPT_SHARED_MAP_POPULATE = 0x200,
+	YESCRYPT_SHARED_MAP_HUGETLB = 0x400,
+	YESCRYPT_SHARED_VERIFY = 0x800
 } yescrypt_init_shared_flags_t;
 
 /**
@@ -161,6 +164,79 @@ extern int yescrypt_init_shared(yescrypt_shared_t * __shared,
  */
 extern int yescrypt_free_shared(yescrypt_shared_t * __shared);
 
+/**
+ * Size of the header that precedes the ROM contents in a ROM file.
+ */
+#define YESCRYPT_ROM_HEADER_SIZE 4096
+
+/**
+ * yescrypt_encode_rom_header(shared, N, r, p, header):
+ * Fill in the YESCRYPT_ROM_HEADER_SIZE bytes at header with a ROM file header
+ * describing the initialized shared structure.  N, r, and p must be the
+ * values that were passed to yescrypt_init_shared().  The header records
+ * them along with shared->mask1 and a SHA-256 digest of the ROM contents.
+ *
+ * This may be used to produce a ROM file in place, by initializing the ROM
+ * (with YESCRYPT_SHARED_PREALLOCATED) right after the header in a writable
+ * shared mapping of the file and then writing the header to its beginning.
+ *
+ * Return 0 on success; or -1 on error.
+ *
+ * MT-safe as long as header is local to the thread.
+ */
+extern int yescrypt_encode_rom_header(const yescrypt_shared_t * __shared,
+    uint64_t __N, uint32_t __r, uint32_t __p, uint8_t * __header);
+
+/**
+ * yescrypt_save_shared(shared, N, r, p, filename):
+ * Create a new ROM file named filename holding a header (as produced by
+ * yescrypt_encode_rom_header()) followed by the ROM contents.  The file must
+ * not already exist.
+ *
+ * Return 0 on success; or -1 on error.
+ *
+ * MT-safe.
+ */
+extern int yescrypt_save_shared(const yescrypt_shared_t * __shared,
+    uint64_t __N, uint32_t __r, uint32_t __p, const char * __filename);
+
+/**
+ * yescrypt_load_shared(shared, filename, N, r, p, flags):
+ * Map a ROM file previously produced with yescrypt_save_shared() read-only
+ * into memory and set up shared to use it, including the mask recorded in
+ * the file.  The header is always checked for consistency, and the file's
+ * N, r, and p must match the values passed in unless those are 0.  Since the
+ * mapping is shared, any number of processes loading the same file use a
+ * single copy of the ROM in the page cache.
+ *
+ * The following flags are recognized:
+ * YESCRYPT_SHARED_MAP_POPULATE - prefault the whole ROM at load time;
+ * YESCRYPT_SHARED_MAP_HUGETLB - try to use huge pages, which only works for
+ * files on a hugetlbfs (falls back to regular pages otherwise);
+ * YESCRYPT_SHARED_VERIFY - check the ROM contents against the digest stored
+ * in the header, which requires reading the entire ROM.
+ *
+ * The ROM must be released with yescrypt_unload_shared(), not with
+ * yescrypt_free_shared().
+ *
+ * Return 0 on success; or -1 on error.
+ *
+ * MT-safe as long as shared is local to the thread.
+ */
+extern int yescrypt_load_shared(yescrypt_shared_t * __shared,
+    const char * __filename, uint64_t __N, uint32_t __r, uint32_t __p,
+    yescrypt_init_shared_flags_t __flags);
+
+/**
+ * yescrypt_unload_shared(shared):
+ * Unmap a ROM that had been mapped with yescrypt_load_shared().
+ *
+ * Return 0 on success; or -1 on error.
+ *
+ * MT-safe as long as shared is local to the thread.
+ */
+extern int yescrypt_unload_shared(yescrypt_shared_t * __shared);
+
 /**
  * yescrypt_init_local(local):
  * Initialize the thread-local (RAM) data structure.  Actual memory allocation
@@ -307,6 +383,52 @@ extern uint8_t * yescrypt_r(const yescrypt_shared_t * __shared,
     const uint8_t * __setting,
     uint8_t * __buf, size_t __buflen);
 
+/**
+ * Opaque type for a pool of worker threads used by yescrypt_r_batch().
+ */
+typedef struct yescrypt_batch yescrypt_batch_t;
+
+/**
+ * yescrypt_init_batch(shared, nthreads):
+ * Start a pool of nthreads worker threads for use with yescrypt_r_batch().
+ * If nthreads is 0, one thread per online CPU is started.  Each worker owns a
+ * thread-local (RAM) data structure for its whole lifetime, so that the
+ * memory allocation is reused across all hashes the worker computes.  shared
+ * must have been initialized as described above for yescrypt_kdf(), and must
+ * remain valid until yescrypt_free_batch() is called.
+ *
+ * Return the pool on success; or NULL on error.
+ */
+extern yescrypt_batch_t * yescrypt_init_batch(
+    const yescrypt_shared_t * __shared, unsigned int __nthreads);
+
+/**
+ * yescrypt_free_batch(batch):
+ * Stop the worker threads and free all memory associated with batch.
+ *
+ * Return 0 on success; or -1 on error.
+ */
+extern int yescrypt_free_batch(yescrypt_batch_t * __batch);
+
+/**
+ * yescrypt_r_batch(batch, passwd, passwdlen, setting, buf, buflen,
+ *     hashes, count):
+ * Compute count encoded hashes as if with yescrypt_r(), spreading the work
+ * across the worker threads of batch.  The i'th hash is computed for
+ * passwd[i] (of passwdlen[i] bytes) and setting[i], and is written into
+ * buf[i * buflen .. (i + 1) * buflen - 1].  hashes[i] is set to point to the
+ * encoded hash string, or to NULL if that computation failed.
+ *
+ * Return 0 if all hashes were computed; or -1 if any of them failed.
+ *
+ * MT-safe.  Concurrent calls on the same batch are serialized.
+ */
+extern int yescrypt_r_batch(yescrypt_batch_t * __batch,
+    const uint8_t * const * __passwd, const size_t * __passwdlen,
+    const uint8_t * const * __setting,
+    uint8_t * __buf, size_t __buflen,
+    uint8_t ** __hashes, size_t __count);
+
 /**
  * yescrypt(passwd, setting):
  * Compute and encode an scrypt or enhanced scrypt hash of passwd given the